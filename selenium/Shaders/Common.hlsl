@@ -62,6 +62,29 @@ cbuffer cbPerObject : register(b0)
 	uint gObjPad2;
 };
 
+#ifdef INSTANCED
+// The object constants of every item at its constant buffer slot, for
+// instanced draws.  gInstanceIndices lists the items of each draw, starting
+// at gFirstInstance.
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint     MaterialIndex;
+	uint     InstPad0;
+	uint     InstPad1;
+	uint     InstPad2;
+};
+
+StructuredBuffer<InstanceData> gInstanceData : register(t1, space1);
+StructuredBuffer<uint> gInstanceIndices : register(t2, space1);
+
+cbuffer cbInstances : register(b3)
+{
+	uint gFirstInstance;
+};
+#endif
+
 cbuffer cbSkinned : register(b1)
 {
     float4x4 gBoneTransforms[96];
@@ -95,6 +118,46 @@ cbuffer cbPass : register(b2)
     Light gLights[MaxLights];
 };
 
+//---------------------------------------------------------------------------------------
+// Transforms and material of the object drawn: the per-object constants, or
+// the instance's entry of gInstanceData for instanced draws.
+//---------------------------------------------------------------------------------------
+struct ObjectData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint     MaterialIndex;
+};
+
+ObjectData GetObjectData(uint instanceID)
+{
+	ObjectData obj;
+#ifdef INSTANCED
+	InstanceData inst = gInstanceData[gInstanceIndices[gFirstInstance + instanceID]];
+	obj.World = inst.World;
+	obj.TexTransform = inst.TexTransform;
+	obj.MaterialIndex = inst.MaterialIndex;
+#else
+	obj.World = gWorld;
+	obj.TexTransform = gTexTransform;
+	obj.MaterialIndex = gMaterialIndex;
+#endif
+	return obj;
+}
+
+//---------------------------------------------------------------------------------------
+// Decodes an octahedral encoded unit vector (see vertex_packing.h).
+//---------------------------------------------------------------------------------------
+float3 OctDecode(float2 e)
+{
+	float3 v = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	float t = saturate(-v.z);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+
+	return normalize(v);
+}
+
 //---------------------------------------------------------------------------------------
 // Transforms a normal map sample to world space.
 //---------------------------------------------------------------------------------------
@@ -21,9 +21,9 @@
 struct VertexIn
 {
 	float3 PosL    : POSITION;
-    float3 NormalL : NORMAL;
+    float2 NormalL : NORMAL;
 	float2 TexC    : TEXCOORD;
-	float3 TangentL : TANGENT;
+	float2 TangentL : TANGENT;
 #ifdef SKINNED
     float3 BoneWeights : WEIGHTS;
     uint4 BoneIndices  : BONEINDICES;
@@ -36,14 +36,22 @@ struct VertexOut
     float3 NormalW  : NORMAL;
 	float3 TangentW : TANGENT;
 	float2 TexC     : TEXCOORD;
+	nointerpolation uint MaterialIndex : MATERIAL;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout = (VertexOut)0.0f;
 
+	ObjectData obj = GetObjectData(instanceID);
+	vout.MaterialIndex = obj.MaterialIndex;
+
 	// Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
+	MaterialData matData = gMaterialData[obj.MaterialIndex];
+
+	// Normals and tangents are octahedral encoded.
+	float3 normalL = OctDecode(vin.NormalL);
+	float3 tangentL = OctDecode(vin.TangentL);
 	
 #ifdef SKINNED
     float weights[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -53,33 +61,33 @@ VertexOut VS(VertexIn vin)
     weights[3] = 1.0f - weights[0] - weights[1] - weights[2];
 
     float3 posL = float3(0.0f, 0.0f, 0.0f);
-    float3 normalL = float3(0.0f, 0.0f, 0.0f);
-    float3 tangentL = float3(0.0f, 0.0f, 0.0f);
+    float3 skinnedNormalL = float3(0.0f, 0.0f, 0.0f);
+    float3 skinnedTangentL = float3(0.0f, 0.0f, 0.0f);
     for(int i = 0; i < 4; ++i)
     {
         // Assume no nonuniform scaling when transforming normals, so 
         // that we do not have to use the inverse-transpose.
 
         posL += weights[i] * mul(float4(vin.PosL, 1.0f), gBoneTransforms[vin.BoneIndices[i]]).xyz;
-        normalL += weights[i] * mul(vin.NormalL, (float3x3)gBoneTransforms[vin.BoneIndices[i]]);
-        tangentL += weights[i] * mul(vin.TangentL.xyz, (float3x3)gBoneTransforms[vin.BoneIndices[i]]);
+        skinnedNormalL += weights[i] * mul(normalL, (float3x3)gBoneTransforms[vin.BoneIndices[i]]);
+        skinnedTangentL += weights[i] * mul(tangentL, (float3x3)gBoneTransforms[vin.BoneIndices[i]]);
     }
 
     vin.PosL = posL;
-    vin.NormalL = normalL;
-    vin.TangentL.xyz = tangentL;
+    normalL = skinnedNormalL;
+    tangentL = skinnedTangentL;
 #endif
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
-	vout.TangentW = mul(vin.TangentL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)obj.World);
+	vout.TangentW = mul(tangentL, (float3x3)obj.World);
 
     // Transform to homogeneous clip space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(vin.PosL, 1.0f), obj.World);
     vout.PosH = mul(posW, gViewProj);
 	
 	// Output vertex attributes for interpolation across triangle.
-	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), obj.TexTransform);
 	vout.TexC = mul(texC, matData.MatTransform).xy;
 	
     return vout;
@@ -88,7 +96,7 @@ VertexOut VS(VertexIn vin)
 float4 PS(VertexOut pin) : SV_Target
 {
 	// Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
+	MaterialData matData = gMaterialData[pin.MaterialIndex];
 	float4 diffuseAlbedo = matData.DiffuseAlbedo;
 	uint diffuseMapIndex = matData.DiffuseMapIndex;
 	uint normalMapIndex = matData.NormalMapIndex;
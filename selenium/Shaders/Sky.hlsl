@@ -8,7 +8,7 @@
 struct VertexIn
 {
 	float3 PosL    : POSITION;
-	float3 NormalL : NORMAL;
+	float2 NormalL : NORMAL;
 	float2 TexC    : TEXCOORD;
 };
 
@@ -0,0 +1,89 @@
+#include "animation_batch.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace DirectX;
+
+UINT AnimationBatch::Add(SkinnedController* controller)
+{
+	assert(controller->Data->BoneCount() <= SkinnedConstants::MaxBones);
+
+	mControllers.push_back(controller);
+	return (UINT)mControllers.size() - 1;
+}
+
+void AnimationBatch::Clear()
+{
+	mControllers.clear();
+}
+
+UINT AnimationBatch::Size()const
+{
+	return (UINT)mControllers.size();
+}
+
+void AnimationBatch::Update(JobSystem& jobs, float dt, UploadBuffer<SkinnedConstants>& skinnedCB)
+{
+	Update(jobs, dt, [&](UINT i) { return skinnedCB.MappedElement(i)->BoneTransforms; });
+}
+
+void AnimationBatch::Update(JobSystem& jobs, float dt, SkinnedConstants* skinned)
+{
+	Update(jobs, dt, [=](UINT i) { return skinned[i].BoneTransforms; });
+}
+
+void AnimationBatch::Update(JobSystem& jobs, float dt, const std::function<XMFLOAT4X4*(UINT)>& palette)
+{
+	// Aim for several chunks per thread so stealing can even out the load
+	// when controllers have different bone counts.  Chunks are whole lane
+	// groups so the SIMD hierarchy pass runs full.
+	UINT count = (UINT)mControllers.size();
+	UINT grainSize = std::max<UINT>(1, count / (jobs.ThreadCount() * 8));
+	grainSize = (grainSize + SkeletonLaneCount - 1) / SkeletonLaneCount * SkeletonLaneCount;
+
+	jobs.ParallelFor(count, grainSize, [&](UINT begin, UINT end)
+	{
+		thread_local SkeletonLaneWorkspace laneWorkspace;
+
+		// Controllers of the same skeleton waiting for the lane pass.
+		const SkinnedData* laneData = nullptr;
+		SkinnedController* laneControllers[SkeletonLaneCount];
+		XMFLOAT4X4* slots[SkeletonLaneCount];
+		const XMFLOAT4X4* toParent[SkeletonLaneCount];
+		XMFLOAT4X4* finalTransforms[SkeletonLaneCount];
+		UINT laneCount = 0;
+
+		auto flush = [&]()
+		{
+			if (laneCount > 0)
+				laneData->ConcatenateHierarchyLanes(toParent, finalTransforms, laneCount, laneWorkspace);
+			for (UINT j = 0; j < laneCount; ++j)
+				laneControllers[j]->EndUpdate(slots[j]);
+			laneCount = 0;
+		};
+
+		for (UINT i = begin; i < end; ++i)
+		{
+			SkinnedController* controller = mControllers[i];
+			XMFLOAT4X4* slot = palette(i);
+
+			if (!controller->BeginUpdate(dt, slot))
+				continue;
+
+			if (controller->Data != laneData)
+			{
+				flush();
+				laneData = controller->Data;
+			}
+
+			laneControllers[laneCount] = controller;
+			slots[laneCount] = slot;
+			toParent[laneCount] = controller->Workspace.ToParentTransforms.data();
+			finalTransforms[laneCount] = controller->BatchOutput(slot);
+			if (++laneCount == SkeletonLaneCount)
+				flush();
+		}
+
+		flush();
+	});
+}
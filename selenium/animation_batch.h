@@ -0,0 +1,37 @@
+#pragma once
+#include <Windows.h>
+#include <functional>
+#include <vector>
+#include "frame_resource.h"
+#include "job_system.h"
+#include "skinned_controller.h"
+
+// Animates a set of SkinnedControllers in parallel.  Each controller owns one
+// slot of the per-frame SkinnedCB (the index returned by Add), and its bone
+// palette is evaluated straight into that slot, so no intermediate copy of the
+// palette is made.  Controllers playing a single clip of the same skeleton
+// have their hierarchy concatenated SkeletonLaneCount at a time in SIMD lanes;
+// that includes PoseCache misses, which are copied to the slot and the cache
+// afterwards.
+class AnimationBatch
+{
+public:
+	// Returns the SkinnedCB slot of the controller.
+	UINT Add(SkinnedController* controller);
+	void Clear();
+
+	UINT Size()const;
+
+	void Update(JobSystem& jobs, float dt, UploadBuffer<SkinnedConstants>& skinnedCB);
+
+	// Same as above, but writes controller i's palette to skinned[i], e.g.
+	// plain memory when benchmarking without a device.
+	void Update(JobSystem& jobs, float dt, SkinnedConstants* skinned);
+
+private:
+	// palette(i) returns where controller i's bone transforms go.
+	void Update(JobSystem& jobs, float dt, const std::function<DirectX::XMFLOAT4X4*(UINT)>& palette);
+
+private:
+	std::vector<SkinnedController*> mControllers;
+};
@@ -0,0 +1,404 @@
+#include "skinned_data.h"
+#include "math_helper.h"
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	enum ChannelType
+	{
+		TranslationChannel,
+		ScaleChannel,
+		RotationChannel
+	};
+
+	const float QuatComponentMax = 0.70710678f;
+
+	// Average number of keys per CompressedChannel bucket.  At two bytes per
+	// bucket that adds half a byte to every eight byte key.
+	const UINT KeysPerBucket = 4;
+
+	UINT ChannelBucket(const CompressedChannel& channel, float firstKeyTime, float keyTime)
+	{
+		UINT bucket = (UINT)((keyTime - firstKeyTime) * channel.BucketsPerKeyTime);
+		return MathHelper::Min(bucket, channel.BucketCount - 1);
+	}
+
+	// Smallest-three: drop the largest component (recovered from unit length),
+	// flip the sign so it is positive, and store the other three in 15 bits
+	// each.  Together with the 2-bit index that is 47 of the 48 bits.  The
+	// scale is 32766 rather than 32767 so zero is exactly representable.
+	void PackQuaternion(XMFLOAT4 q, UINT16* out)
+	{
+		float c[4] = { q.x, q.y, q.z, q.w };
+
+		UINT largest = 0;
+		for (UINT i = 1; i < 4; ++i)
+		{
+			if (std::fabs(c[i]) > std::fabs(c[largest]))
+				largest = i;
+		}
+
+		float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+		UINT64 bits = largest;
+		for (UINT i = 0; i < 4; ++i)
+		{
+			if (i == largest)
+				continue;
+
+			float v = MathHelper::Clamp(c[i] * sign / QuatComponentMax, -1.0f, 1.0f);
+			UINT64 qv = (UINT64)((v * 0.5f + 0.5f) * 32766.0f + 0.5f);
+			bits = (bits << 15) | qv;
+		}
+
+		out[0] = (UINT16)(bits >> 32);
+		out[1] = (UINT16)(bits >> 16);
+		out[2] = (UINT16)bits;
+	}
+
+	XMVECTOR UnpackQuaternion(const UINT16* in)
+	{
+		UINT64 bits = ((UINT64)in[0] << 32) | ((UINT64)in[1] << 16) | in[2];
+		UINT largest = (UINT)(bits >> 45) & 3;
+
+		float c[4];
+		float sumSq = 0.0f;
+		for (int i = 3; i >= 0; --i)
+		{
+			if ((UINT)i == largest)
+				continue;
+
+			float v = (bits & 0x7fff) / 32766.0f;
+			bits >>= 15;
+			c[i] = (v * 2.0f - 1.0f) * QuatComponentMax;
+			sumSq += c[i] * c[i];
+		}
+		c[largest] = std::sqrt(MathHelper::Max(0.0f, 1.0f - sumSq));
+
+		return XMVectorSet(c[0], c[1], c[2], c[3]);
+	}
+
+	XMFLOAT4 ChannelValue(const Keyframe& key, ChannelType type)
+	{
+		switch (type)
+		{
+		case TranslationChannel: return XMFLOAT4(key.Translation.x, key.Translation.y, key.Translation.z, 0.0f);
+		case ScaleChannel: return XMFLOAT4(key.Scale.x, key.Scale.y, key.Scale.z, 0.0f);
+		default: return key.RotationQuat;
+		}
+	}
+
+	XMVECTOR LoadChannelValue(const Keyframe& key, ChannelType type)
+	{
+		XMFLOAT4 v = ChannelValue(key, type);
+		return XMLoadFloat4(&v);
+	}
+
+	// Angle between two rotations, or the distance used for translation
+	// (length) and scale (largest component).
+	float ChannelError(FXMVECTOR a, FXMVECTOR b, ChannelType type)
+	{
+		switch (type)
+		{
+		case TranslationChannel:
+			return XMVectorGetX(XMVector3Length(XMVectorSubtract(a, b)));
+		case ScaleChannel:
+		{
+			XMFLOAT3 d;
+			XMStoreFloat3(&d, XMVectorAbs(XMVectorSubtract(a, b)));
+			return MathHelper::Max(d.x, MathHelper::Max(d.y, d.z));
+		}
+		default:
+		{
+			// Slerp of nearly equal keys is a plain lerp, so the inputs are
+			// not quite unit length.
+			float dot = std::fabs(XMVectorGetX(XMQuaternionDot(XMQuaternionNormalize(a), XMQuaternionNormalize(b))));
+			return 2.0f * std::acos(MathHelper::Min(dot, 1.0f));
+		}
+		}
+	}
+
+	XMVECTOR ChannelLerp(FXMVECTOR a, FXMVECTOR b, float t, ChannelType type)
+	{
+		return type == RotationChannel ? XMQuaternionSlerp(a, b, t) : XMVectorLerp(a, b, t);
+	}
+
+	// Greedy key reduction: starting from a kept key, extend the segment for as
+	// long as interpolating its end points reproduces every key inside it.
+	void ReduceKeys(const std::vector<Keyframe>& keys, ChannelType type, float tolerance,
+		std::vector<UINT>& keptKeys)
+	{
+		keptKeys.clear();
+
+		UINT count = (UINT)keys.size();
+		if (count == 0)
+			return;
+
+		keptKeys.push_back(0);
+
+		// Constant channel.
+		XMVECTOR first = LoadChannelValue(keys[0], type);
+		bool constant = true;
+		for (UINT k = 1; k < count && constant; ++k)
+		{
+			XMVECTOR v = LoadChannelValue(keys[k], type);
+			constant = ChannelError(first, v, type) <= tolerance;
+		}
+		if (constant)
+			return;
+
+		UINT anchor = 0;
+		while (anchor + 1 < count)
+		{
+			XMVECTOR a = LoadChannelValue(keys[anchor], type);
+
+			UINT end = anchor + 1;
+			while (end + 1 < count)
+			{
+				UINT candidate = end + 1;
+				XMVECTOR b = LoadChannelValue(keys[candidate], type);
+				float t0 = keys[anchor].TimePos;
+				float span = keys[candidate].TimePos - t0;
+
+				bool fits = true;
+				for (UINT k = anchor + 1; k < candidate && fits; ++k)
+				{
+					float t = span > 0.0f ? (keys[k].TimePos - t0) / span : 0.0f;
+					XMVECTOR v = LoadChannelValue(keys[k], type);
+					fits = ChannelError(ChannelLerp(a, b, t, type), v, type) <= tolerance;
+				}
+
+				if (!fits)
+					break;
+				end = candidate;
+			}
+
+			keptKeys.push_back(end);
+			anchor = end;
+		}
+	}
+}
+
+void AnimationCompressionStats::Merge(const AnimationCompressionStats& rhs)
+{
+	SourceBytes += rhs.SourceBytes;
+	CompressedBytes += rhs.CompressedBytes;
+	SourceKeys += rhs.SourceKeys;
+	CompressedKeys += rhs.CompressedKeys;
+	ConstantChannels += rhs.ConstantChannels;
+	MaxTranslationError = MathHelper::Max(MaxTranslationError, rhs.MaxTranslationError);
+	MaxRotationError = MathHelper::Max(MaxRotationError, rhs.MaxRotationError);
+	MaxScaleError = MathHelper::Max(MaxScaleError, rhs.MaxScaleError);
+}
+
+bool AnimationClip::IsCompressed()const
+{
+	return !mChannels.empty();
+}
+
+void AnimationClip::Compress(const AnimationCompressionSettings& settings, AnimationCompressionStats* stats)
+{
+	if (IsCompressed() || BoneAnimations.empty())
+		return;
+
+	if (!IsCompiled())
+		Compile();
+
+	AnimationCompressionStats clipStats;
+
+	UINT numBones = (UINT)BoneAnimations.size();
+	mChannels.resize(numBones * 3);
+	mPackedTimes.clear();
+	mPackedValues.clear();
+	mChannelBucketKeys.clear();
+	mKeyTimeScale = mEndTime > 0.0f ? 65535.0f / mEndTime : 0.0f;
+
+	const float tolerances[3] = { settings.TranslationTolerance, settings.ScaleTolerance, settings.RotationTolerance };
+
+	std::vector<UINT> keptKeys;
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		const std::vector<Keyframe>& keys = BoneAnimations[i].Keyframes;
+		clipStats.SourceKeys += (UINT)keys.size();
+		clipStats.SourceBytes += keys.size() * sizeof(Keyframe);
+
+		for (UINT c = 0; c < 3; ++c)
+		{
+			ChannelType type = (ChannelType)c;
+			CompressedChannel& channel = mChannels[i * 3 + c];
+
+			ReduceKeys(keys, type, tolerances[c], keptKeys);
+
+			channel.FirstKey = (UINT)mPackedTimes.size();
+			channel.KeyCount = (UINT)keptKeys.size();
+
+			if (channel.KeyCount == 1)
+				++clipStats.ConstantChannels;
+
+			if (type != RotationChannel && channel.KeyCount > 0)
+			{
+				XMVECTOR vMin = XMVectorReplicate(FLT_MAX);
+				XMVECTOR vMax = XMVectorReplicate(-FLT_MAX);
+				for (UINT k : keptKeys)
+				{
+					XMVECTOR v = LoadChannelValue(keys[k], type);
+					vMin = XMVectorMin(vMin, v);
+					vMax = XMVectorMax(vMax, v);
+				}
+				XMStoreFloat3(&channel.RangeMin, vMin);
+				XMStoreFloat3(&channel.RangeExtent, XMVectorSubtract(vMax, vMin));
+			}
+
+			for (UINT k : keptKeys)
+			{
+				float t = MathHelper::Max(keys[k].TimePos, 0.0f) * mKeyTimeScale;
+				mPackedTimes.push_back((UINT16)MathHelper::Min(t + 0.5f, 65535.0f));
+
+				XMFLOAT4 value = ChannelValue(keys[k], type);
+				UINT16 packed[3];
+				if (type == RotationChannel)
+				{
+					PackQuaternion(value, packed);
+				}
+				else
+				{
+					const float* v = &value.x;
+					const float* lo = &channel.RangeMin.x;
+					const float* extent = &channel.RangeExtent.x;
+					for (UINT j = 0; j < 3; ++j)
+					{
+						float n = extent[j] > 0.0f ? (v[j] - lo[j]) / extent[j] : 0.0f;
+						packed[j] = (UINT16)(MathHelper::Clamp(n, 0.0f, 1.0f) * 65535.0f + 0.5f);
+					}
+				}
+				mPackedValues.insert(mPackedValues.end(), packed, packed + 3);
+			}
+
+			channel.FirstBucket = (UINT)mChannelBucketKeys.size();
+			const UINT16* times = &mPackedTimes[channel.FirstKey];
+			if (channel.KeyCount > 1 && times[channel.KeyCount - 1] > times[0])
+			{
+				channel.BucketCount = (channel.KeyCount + KeysPerBucket - 1) / KeysPerBucket;
+				channel.BucketsPerKeyTime = channel.BucketCount / (float)(times[channel.KeyCount - 1] - times[0]);
+
+				// Only keys of earlier buckets are named, so the key of the
+				// bucket a time falls in never starts after that time.
+				UINT k = 0;
+				for (UINT b = 0; b < channel.BucketCount; ++b)
+				{
+					while (k + 1 < channel.KeyCount && ChannelBucket(channel, times[0], times[k + 1]) < b)
+						++k;
+					mChannelBucketKeys.push_back((UINT16)k);
+				}
+			}
+
+			clipStats.CompressedKeys += channel.KeyCount;
+		}
+	}
+
+	// Measure against the float tracks before they are released, at every
+	// source key and halfway to the next one.
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		const std::vector<Keyframe>& keys = BoneAnimations[i].Keyframes;
+		for (UINT k = 0; k < keys.size(); ++k)
+		{
+			for (UINT half = 0; half < 2; ++half)
+			{
+				if (half == 1 && k + 1 == keys.size())
+					break;
+
+				float t = half == 0 ? keys[k].TimePos : 0.5f * (keys[k].TimePos + keys[k + 1].TimePos);
+
+				XMVECTOR s0, q0, p0, s1, q1, p1;
+				SampleBoneTracks(i, t, s0, q0, p0);
+				SampleBoneCompressed(i, t, s1, q1, p1);
+
+				clipStats.MaxTranslationError = MathHelper::Max(clipStats.MaxTranslationError, ChannelError(p0, p1, TranslationChannel));
+				clipStats.MaxScaleError = MathHelper::Max(clipStats.MaxScaleError, ChannelError(s0, s1, ScaleChannel));
+				clipStats.MaxRotationError = MathHelper::Max(clipStats.MaxRotationError, ChannelError(q0, q1, RotationChannel));
+			}
+		}
+	}
+
+	clipStats.CompressedBytes = mChannels.size() * sizeof(CompressedChannel) +
+		(mPackedTimes.size() + mPackedValues.size() + mChannelBucketKeys.size()) * sizeof(UINT16);
+
+	// Release the source keys and the float tracks.
+	std::vector<BoneAnimation>().swap(BoneAnimations);
+	std::vector<BoneTrack>().swap(mTracks);
+	std::vector<float>().swap(mKeyTimes);
+	std::vector<XMFLOAT4A>().swap(mKeyTranslations);
+	std::vector<XMFLOAT4A>().swap(mKeyScales);
+	std::vector<XMFLOAT4A>().swap(mKeyRotations);
+	std::vector<UINT>().swap(mBucketKeys);
+	mPackedTimes.shrink_to_fit();
+	mPackedValues.shrink_to_fit();
+	mChannelBucketKeys.shrink_to_fit();
+
+	if (stats != nullptr)
+		stats->Merge(clipStats);
+}
+
+void AnimationClip::SampleBoneCompressed(UINT boneIndex, float timePos, XMVECTOR& S, XMVECTOR& Q, XMVECTOR& P)const
+{
+	float keyTime = MathHelper::Max(timePos, 0.0f) * mKeyTimeScale;
+
+	const CompressedChannel* channels = &mChannels[boneIndex * 3];
+	if (channels[TranslationChannel].KeyCount == 0)
+	{
+		S = XMVectorSplatOne();
+		Q = XMQuaternionIdentity();
+		P = XMVectorZero();
+		return;
+	}
+
+	P = SampleChannel(channels[TranslationChannel], false, keyTime);
+	S = SampleChannel(channels[ScaleChannel], false, keyTime);
+	Q = SampleChannel(channels[RotationChannel], true, keyTime);
+}
+
+XMVECTOR AnimationClip::SampleChannel(const CompressedChannel& channel, bool rotation, float keyTime)const
+{
+	const UINT16* times = &mPackedTimes[channel.FirstKey];
+	const UINT16* values = &mPackedValues[channel.FirstKey * 3];
+
+	auto decode = [&](UINT k)
+	{
+		const UINT16* v = values + k * 3;
+		if (rotation)
+			return UnpackQuaternion(v);
+
+		XMVECTOR n = XMVectorSet(v[0], v[1], v[2], 0.0f);
+		n = XMVectorScale(n, 1.0f / 65535.0f);
+		return XMVectorMultiplyAdd(n, XMLoadFloat3(&channel.RangeExtent), XMLoadFloat3(&channel.RangeMin));
+	};
+
+	UINT last = channel.KeyCount - 1;
+	if (channel.KeyCount == 1 || keyTime <= times[0])
+		return decode(0);
+	if (keyTime >= times[last])
+		return decode(last);
+
+	// Last key at or before keyTime; keyTime lies within the channel, so this
+	// stops before the last key.
+	UINT prev = mChannelBucketKeys[channel.FirstBucket + ChannelBucket(channel, times[0], keyTime)];
+	while (times[prev + 1] <= keyTime)
+		++prev;
+	UINT next = prev + 1;
+
+	float lerpPercent = (keyTime - times[prev]) / (float)(times[next] - times[prev]);
+
+	XMVECTOR a = decode(prev);
+	XMVECTOR b = decode(next);
+	return rotation ? XMQuaternionSlerp(a, b, lerpPercent) : XMVectorLerp(a, b, lerpPercent);
+}
+
+void SkinnedData::CompressClips(const AnimationCompressionSettings& settings, AnimationCompressionStats* stats)
+{
+	for (auto& clip : mAnimationClips)
+		clip.second.Compress(settings, stats);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+
+// Error tolerances used by AnimationClip::Compress.  Keys that can be
+// reproduced by interpolating their neighbours within these tolerances are
+// removed, and a channel whose keys all lie within them of the first key is
+// stored as a single constant key.
+struct AnimationCompressionSettings
+{
+	// Model units.
+	float TranslationTolerance = 1e-3f;
+
+	// Radians.
+	float RotationTolerance = 1e-3f;
+
+	// Absolute difference of each scale component.
+	float ScaleTolerance = 1e-3f;
+};
+
+// Size and accuracy of a compressed clip.  The errors are measured against
+// the uncompressed sampler at every source key and halfway between keys.
+struct AnimationCompressionStats
+{
+	UINT64 SourceBytes = 0;
+	UINT64 CompressedBytes = 0;
+
+	UINT SourceKeys = 0;
+	UINT CompressedKeys = 0;
+	UINT ConstantChannels = 0;
+
+	float MaxTranslationError = 0.0f;
+	float MaxRotationError = 0.0f;
+	float MaxScaleError = 0.0f;
+
+	float Ratio()const
+	{
+		return CompressedBytes > 0 ? (float)SourceBytes / (float)CompressedBytes : 0.0f;
+	}
+
+	// Accumulates the stats of another clip.
+	void Merge(const AnimationCompressionStats& rhs);
+};
+
+// One translation, scale or rotation channel of a compressed bone.  Every
+// key is a 16-bit time, normalized over the clip, plus three 16-bit words:
+// range-quantized x, y, z for translation and scale, or a smallest-three
+// 48-bit quaternion for rotation.  Constant channels have a single key.
+//
+// Like BoneTrack, the key times of a channel are split into uniform buckets
+// that remember the last key starting before them, so sampling steps forward
+// from a table lookup instead of searching the keys.
+struct CompressedChannel
+{
+	UINT FirstKey = 0;
+	UINT KeyCount = 0;
+	UINT FirstBucket = 0;
+	UINT BucketCount = 0;
+	float BucketsPerKeyTime = 0.0f;
+
+	// Dequantized value = RangeMin + q / 65535 * RangeExtent (translation and
+	// scale only).
+	DirectX::XMFLOAT3 RangeMin = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 RangeExtent = { 0.0f, 0.0f, 0.0f };
+};
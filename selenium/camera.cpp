@@ -19,7 +19,60 @@ void Camera::SetLens(float fovY, float aspect, float zn, float zf) {
 	mFarWindowHeight = 2.0f * mFarZ * tanf(0.5f*mFovY);
 
 	XMMATRIX P = XMMatrixPerspectiveFovLH(mFovY, mAspect, mNearZ, mFarZ);
-	XMStoreFloat4x4(&mProj, P);
+	XMStoreFloat4x4(&mCullProj, P);
+	BoundingFrustum::CreateFromMatrix(mViewFrustum, P);
+
+	UpdateProjMatrix();
+}
+
+void Camera::SetInfiniteReverseZ(bool enable)
+{
+	mInfiniteReverseZ = enable;
+	UpdateProjMatrix();
+}
+
+void Camera::SetJitter(float pixelX, float pixelY, UINT width, UINT height)
+{
+	// NDC y points up, pixel rows go down.
+	mJitter = XMFLOAT2(2.0f * pixelX / width, -2.0f * pixelY / height);
+	UpdateProjMatrix();
+}
+
+XMFLOAT2 Camera::HaltonJitter(UINT frameIndex, UINT sampleCount)
+{
+	// Index 0 is (0, 0) in every base, start at 1.
+	UINT index = frameIndex % sampleCount + 1;
+	return XMFLOAT2(MathHelper::Halton(index, 2) - 0.5f, MathHelper::Halton(index, 3) - 0.5f);
+}
+
+void Camera::UpdateProjMatrix()
+{
+	if (mInfiniteReverseZ)
+	{
+		// z' = zn and w' = z, so depth = zn / z: 1 at the near plane and 0 at
+		// infinity.
+		float yScale = 1.0f / tanf(0.5f*mFovY);
+		float xScale = yScale / mAspect;
+		mUnjitteredProj = XMFLOAT4X4(
+			xScale, 0.0f, 0.0f, 0.0f,
+			0.0f, yScale, 0.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f,
+			0.0f, 0.0f, mNearZ, 0.0f);
+	}
+	else
+	{
+		mUnjitteredProj = mCullProj;
+	}
+
+	// w' = z, so adding jitter * z to x' and y' moves the NDC position by the
+	// jitter at every depth.
+	mProj = mUnjitteredProj;
+	mProj(2, 0) += mJitter.x;
+	mProj(2, 1) += mJitter.y;
+
+	if (!mViewDirty)
+		UpdateFrustum();
+	++mVersion;
 }
 
 XMFLOAT3 Camera::GetPosition3f()const
@@ -124,6 +177,9 @@ void Camera::UpdateViewMatrix()
 		mView(3, 3) = 1.0f;
 
 		mViewDirty = false;
+
+		UpdateFrustum();
+		++mVersion;
 	}
 }
 
@@ -138,3 +194,57 @@ XMMATRIX Camera::GetProj()const
 	return XMLoadFloat4x4(&mProj);
 }
 
+XMMATRIX Camera::GetUnjitteredProj()const
+{
+	return XMLoadFloat4x4(&mUnjitteredProj);
+}
+
+const BoundingFrustum& Camera::GetViewFrustum()const
+{
+	return mViewFrustum;
+}
+
+const BoundingFrustum& Camera::GetFrustum()const
+{
+	assert(!mViewDirty);
+	return mFrustum;
+}
+
+void Camera::GetFrustumPlanes(XMFLOAT4 planes[6])const
+{
+	assert(!mViewDirty);
+	for (int i = 0; i < 6; ++i)
+		planes[i] = mFrustumPlanes[i];
+}
+
+void Camera::UpdateFrustum()
+{
+	// The rows of the inverse view matrix are the camera axes and position.
+	XMMATRIX invView(
+		mRight.x, mRight.y, mRight.z, 0.0f,
+		mUp.x, mUp.y, mUp.z, 0.0f,
+		mLook.x, mLook.y, mLook.z, 0.0f,
+		mPosition.x, mPosition.y, mPosition.z, 1.0f);
+	mViewFrustum.Transform(mFrustum, invView);
+
+	// A point p is inside when 0 <= z' <= w', -w' <= x' <= w' and
+	// -w' <= y' <= w' for (x', y', z', w') = p * view * proj, so every plane
+	// is a sum or difference of two columns of view * proj.
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, XMMatrixMultiply(XMLoadFloat4x4(&mView), XMLoadFloat4x4(&mCullProj)));
+
+	XMFLOAT4* planes = mFrustumPlanes;
+	float* plane[6] = { &planes[0].x, &planes[1].x, &planes[2].x, &planes[3].x, &planes[4].x, &planes[5].x };
+	for (int i = 0; i < 4; ++i)
+	{
+		plane[0][i] = m(i, 3) + m(i, 0);
+		plane[1][i] = m(i, 3) - m(i, 0);
+		plane[2][i] = m(i, 3) + m(i, 1);
+		plane[3][i] = m(i, 3) - m(i, 1);
+		plane[4][i] = m(i, 2);
+		plane[5][i] = m(i, 3) - m(i, 2);
+	}
+
+	for (int i = 0; i < 6; ++i)
+		XMStoreFloat4(&planes[i], XMPlaneNormalize(XMLoadFloat4(&planes[i])));
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <DirectXCollision.h>
 #include "math_helper.h"
 
 class Camera {
@@ -11,6 +12,22 @@ public:
 	// Set frustum.
 	void SetLens(float fovY, float aspect, float zn, float zf);
 
+	// Makes GetProj map the near plane to depth 1 and infinity to depth 0,
+	// which spreads float depth precision evenly over the view distance.
+	// Draw with a GREATER depth test and clear depth to 0.  Culling still
+	// stops at the far plane passed to SetLens.
+	void SetInfiniteReverseZ(bool enable);
+	bool GetInfiniteReverseZ()const { return mInfiniteReverseZ; }
+
+	// Shifts GetProj by a fraction of a pixel, for temporal techniques.
+	// Positive x moves the image right and positive y moves it down; the
+	// frustum and GetUnjitteredProj are not affected.
+	void SetJitter(float pixelX, float pixelY, UINT width, UINT height);
+
+	// Offset of frame frameIndex, in pixels in [-0.5, 0.5), from a Halton
+	// (2, 3) sequence that repeats every sampleCount frames.
+	static DirectX::XMFLOAT2 HaltonJitter(UINT frameIndex, UINT sampleCount = 8);
+
 	// Rotate the camera.
 	void Pitch(float angle);
 	void RotateY(float angle);
@@ -25,6 +42,26 @@ public:
 	// Get View/Proj matrices.
 	DirectX::XMMATRIX GetView()const;
 	DirectX::XMMATRIX GetProj()const;
+	DirectX::XMMATRIX GetUnjitteredProj()const;
+
+	// The frustum in view space and in world space, rebuilt with the view
+	// and projection matrices.
+	const DirectX::BoundingFrustum& GetViewFrustum()const;
+	const DirectX::BoundingFrustum& GetFrustum()const;
+
+	// World space frustum planes with unit normals pointing inwards, in the
+	// order left, right, bottom, top, near, far.
+	void GetFrustumPlanes(DirectX::XMFLOAT4 planes[6])const;
+
+	// Changes whenever the view or projection matrix does, so callers can skip
+	// work that depends only on the camera.
+	UINT64 GetVersion()const { return mVersion; }
+
+private:
+	void UpdateProjMatrix();
+
+	// Rebuilds the world space frustum and planes from the view matrix.
+	void UpdateFrustum();
 
 private:
 	// Camera coordinate system with coordinates relative to world space.
@@ -41,9 +78,23 @@ private:
 	float mNearWindowHeight = 0.0f;
 	float mFarWindowHeight = 0.0f;
 
+	bool mInfiniteReverseZ = false;
+
+	// Jitter in NDC units.
+	DirectX::XMFLOAT2 mJitter = { 0.0f, 0.0f };
+
 	bool mViewDirty = true;
+	UINT64 mVersion = 0;
 
 	// Cache View/Proj matrices.
 	DirectX::XMFLOAT4X4 mView = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 mProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mUnjitteredProj = MathHelper::Identity4x4();
+
+	// Cache frustum and planes.  The culling projection is the finite one
+	// SetLens describes, whatever GetProj returns.
+	DirectX::XMFLOAT4X4 mCullProj = MathHelper::Identity4x4();
+	DirectX::BoundingFrustum mViewFrustum;
+	DirectX::BoundingFrustum mFrustum;
+	DirectX::XMFLOAT4 mFrustumPlanes[6];
 };
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "command_recorder.h"
+#include "job_system.h"
+
+void ParallelRecording::Execute(CommandRecorder& recorder, JobSystem* jobs)const
+{
+	UINT listCount = ListCount();
+
+	auto recordList = [&](UINT list)
+	{
+		ID3D12GraphicsCommandList* cmdList = recorder.BeginList(list);
+		mLists[list](cmdList);
+		recorder.EndList(list);
+	};
+
+	if (jobs == nullptr || listCount < 2)
+	{
+		for (UINT list = 0; list < listCount; ++list)
+			recordList(list);
+	}
+	else
+	{
+		jobs->ParallelFor(listCount, 1, [&](UINT begin, UINT end)
+		{
+			for (UINT list = begin; list < end; ++list)
+				recordList(list);
+		});
+	}
+
+	recorder.Submit(listCount);
+}
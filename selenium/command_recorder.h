@@ -0,0 +1,46 @@
+#pragma once
+#include <Windows.h>
+#include <d3d12.h>
+#include <functional>
+#include <vector>
+
+class JobSystem;
+
+// Hands out the command lists a frame is recorded into and submits them.
+// Lists are named by index, and lists with different indices may be begun
+// and ended on different threads at once.  FrameCommandRecorder records into
+// the lists of a frame resource; anything that only cares about the calls,
+// like a mock that logs them, can stand in for it without a device.
+class CommandRecorder
+{
+public:
+	virtual ~CommandRecorder() = default;
+
+	// Readies list for recording; the pointer is valid until EndList.
+	virtual ID3D12GraphicsCommandList* BeginList(UINT list) = 0;
+	virtual void EndList(UINT list) = 0;
+
+	// Submits lists [0, listCount) in index order, with one call.
+	virtual void Submit(UINT listCount) = 0;
+};
+
+// The command lists of a frame, each filled by its own function.  The
+// functions may run at the same time on different threads, so they should
+// only read shared state; the lists are submitted in the order they were
+// added whatever order they were recorded in.
+class ParallelRecording
+{
+public:
+	typedef std::function<void(ID3D12GraphicsCommandList*)> RecordFunc;
+
+	void Clear() { mLists.clear(); }
+	void Add(RecordFunc record) { mLists.push_back(std::move(record)); }
+	UINT ListCount()const { return (UINT)mLists.size(); }
+
+	// Records every list, one job per list if jobs is set, and submits them
+	// once all are recorded.
+	void Execute(CommandRecorder& recorder, JobSystem* jobs)const;
+
+private:
+	std::vector<RecordFunc> mLists;
+};
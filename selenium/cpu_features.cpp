@@ -0,0 +1,32 @@
+#include "cpu_features.h"
+#include <intrin.h>
+
+namespace
+{
+	bool DetectAvx2()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		// FMA3, OSXSAVE and AVX in leaf 1.
+		const int leaf1Bits = (1 << 12) | (1 << 27) | (1 << 28);
+		__cpuid(info, 1);
+		if ((info[2] & leaf1Bits) != leaf1Bits)
+			return false;
+
+		// The OS must save the SSE and AVX state on a context switch.
+		if ((_xgetbv(0) & 0x6) != 0x6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	}
+}
+
+bool CpuHasAvx2()
+{
+	static const bool hasAvx2 = DetectAvx2();
+	return hasAvx2;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Whether the CPU has AVX2 and FMA3 and the OS saves the 256-bit registers.
+// Kernels compiled with /arch:AVX2 in files of their own are only called
+// when this is true; the rest of the app runs on any x64 CPU.
+bool CpuHasAvx2();
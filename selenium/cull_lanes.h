@@ -0,0 +1,81 @@
+#pragma once
+#include <Windows.h>
+#include <cstdint>
+
+// A frustum plane in the grid of FrustumCuller, as 16-bit coefficients in
+// pairs matching the bounds: a box is outside if
+// x * X + y * Y + z * Z + ex * |X| + ey * |Y| + ez * |Z| + Offset < 0 for its
+// center (x, y, z) and half sizes (ex, ey, ez) in grid steps.  The |X|, |Y|
+// and |Z| stored are rounded up, so the box is never made smaller.
+struct CullPlane
+{
+	// X in the low 16 bits, Y in the high 16 bits.
+	std::uint32_t CenterXY;
+
+	// Z in the low 16 bits, |X| in the high 16 bits.
+	std::uint32_t CenterZExtentX;
+
+	// |Y| in the low 16 bits, |Z| in the high 16 bits.
+	std::uint32_t ExtentYZ;
+
+	std::int32_t Offset;
+};
+
+// The plane test of FrustumCuller::CullRange for one lane width.  Lanes
+// supplies an integer vector of Lanes::Count 32-bit lanes and its
+// operations.  frustum_culler.cpp instantiates it for SSE2 and
+// frustum_culler_avx2.cpp for AVX2, each with a Lanes type of its own in an
+// anonymous namespace, so the two instantiations never merge at link time.
+//
+// centerXY, centerZExtentX and extentYZ hold two values per item; writes
+// first + lane for the visible items of [begin, end) to out and returns how
+// many there are.
+template<class Lanes>
+UINT CullLanes(const std::int16_t* centerXY, const std::int16_t* centerZExtentX, const std::int16_t* extentYZ,
+	const CullPlane planes[6], UINT begin, UINT end, UINT* out)
+{
+	typedef typename Lanes::Vector LaneVector;
+
+	LaneVector xyCoefficients[6];
+	LaneVector zxCoefficients[6];
+	LaneVector yzCoefficients[6];
+	LaneVector offsets[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		xyCoefficients[p] = Lanes::Splat(planes[p].CenterXY);
+		zxCoefficients[p] = Lanes::Splat(planes[p].CenterZExtentX);
+		yzCoefficients[p] = Lanes::Splat(planes[p].ExtentYZ);
+		offsets[p] = Lanes::Splat((std::uint32_t)planes[p].Offset);
+	}
+
+	UINT count = 0;
+	for (UINT i = begin; i < end; i += Lanes::Count)
+	{
+		LaneVector xy = Lanes::Load(centerXY + 2 * i);
+		LaneVector zx = Lanes::Load(centerZExtentX + 2 * i);
+		LaneVector yz = Lanes::Load(extentYZ + 2 * i);
+
+		auto distance = [&](int p)
+		{
+			return Lanes::Add(Lanes::Add(Lanes::Dot(xy, xyCoefficients[p]), Lanes::Dot(zx, zxCoefficients[p])),
+				Lanes::Add(Lanes::Dot(yz, yzCoefficients[p]), offsets[p]));
+		};
+
+		// Each lane gets the sign bit of a plane it is outside of.  Written
+		// out rather than looped so the planes stay in registers and run
+		// side by side.
+		LaneVector outside = Lanes::Or(Lanes::Or(Lanes::Or(distance(0), distance(1)), Lanes::Or(distance(2), distance(3))),
+			Lanes::Or(distance(4), distance(5)));
+
+		// count <= i - begin, so the full-width store stays inside this
+		// range's part of out; the lanes past count are overwritten next.
+		count += Lanes::StoreVisible(outside, i, out + count);
+	}
+
+	return count;
+}
+
+// The AVX2 instantiation, in frustum_culler_avx2.cpp.  Only call it when
+// CpuHasAvx2() is true.
+UINT CullLanesAvx2(const std::int16_t* centerXY, const std::int16_t* centerZExtentX, const std::int16_t* extentYZ,
+	const CullPlane planes[6], UINT begin, UINT end, UINT* out);
@@ -0,0 +1,62 @@
+#include "dirty_tracker.h"
+#include <cassert>
+
+DirtyTracker::DirtyTracker()
+{
+	mLists.resize(1);
+}
+
+void DirtyTracker::SetFrameResourceCount(int count)
+{
+	assert(count > 0 && count <= 32);
+
+	mLists.clear();
+	mLists.resize(count);
+	mDirtyMask.assign(mDirtyMask.size(), 0);
+}
+
+void DirtyTracker::Resize(UINT count)
+{
+	mDirtyMask.resize(count, 0);
+}
+
+void DirtyTracker::MarkDirty(UINT index)
+{
+	UINT& mask = mDirtyMask[index];
+	for (UINT frame = 0; frame < (UINT)mLists.size(); ++frame)
+	{
+		UINT bit = 1u << frame;
+		if ((mask & bit) == 0)
+		{
+			mask |= bit;
+			mLists[frame].push_back(index);
+		}
+	}
+}
+
+void DirtyTracker::MarkAllDirty()
+{
+	for (UINT i = 0; i < Count(); ++i)
+		MarkDirty(i);
+}
+
+const std::vector<UINT>& DirtyTracker::TakeDirty(int frameResource)
+{
+	std::vector<UINT>& list = mLists[frameResource];
+	UINT bit = 1u << frameResource;
+
+	// Entries removed by Resize may still be listed, and an entry that was
+	// dropped and added again may be listed twice; the mask sorts them out.
+	mTaken.clear();
+	for (UINT index : list)
+	{
+		if (index < Count() && (mDirtyMask[index] & bit) != 0)
+		{
+			mDirtyMask[index] &= ~bit;
+			mTaken.push_back(index);
+		}
+	}
+	list.clear();
+
+	return mTaken;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Tracks which entries of an indexed array changed since their copy in each
+// frame resource was last written.  MarkDirty queues the entry once per
+// frame resource, so writing the copies costs one step per change rather
+// than one per entry.
+class DirtyTracker
+{
+public:
+	// Starts with one frame resource.
+	DirtyTracker();
+
+	// At most 32 frame resources.  Clears the lists; call before MarkDirty.
+	void SetFrameResourceCount(int count);
+	int FrameResourceCount()const { return (int)mLists.size(); }
+
+	// Sets the entry count.  Queued entries at or past count are dropped when
+	// taken, new entries start clean.
+	void Resize(UINT count);
+	UINT Count()const { return (UINT)mDirtyMask.size(); }
+
+	// Queues the entry for every frame resource it is not queued for yet.
+	void MarkDirty(UINT index);
+	void MarkAllDirty();
+
+	// Entries changed since the last call for frameResource, each listed once,
+	// and clears them for it.  Valid until the next call.
+	const std::vector<UINT>& TakeDirty(int frameResource);
+
+private:
+	// Bit f is set while the entry is queued for frame resource f.
+	std::vector<UINT> mDirtyMask;
+	std::vector<std::vector<UINT>> mLists;
+	std::vector<UINT> mTaken;
+};
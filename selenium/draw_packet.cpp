@@ -0,0 +1,230 @@
+#include "draw_packet.h"
+#include <algorithm>
+#include "math_helper.h"
+
+namespace
+{
+	const UINT DrawKeyDepthShift = 0;
+	const UINT DrawKeyMaterialShift = DrawKeyDepthShift + DrawKeyDepthBits;
+	const UINT DrawKeyGeometryShift = DrawKeyMaterialShift + DrawKeyMaterialBits;
+	const UINT DrawKeyPsoShift = DrawKeyGeometryShift + DrawKeyGeometryBits;
+	const UINT DrawKeyLayerShift = DrawKeyPsoShift + DrawKeyPsoBits;
+
+	// Most bits sorted per radix sort pass, so the counts of a pass stay in
+	// the L1 cache.
+	const UINT MaxRadixBits = 11;
+
+	static_assert(DrawKeyLayerShift + DrawKeyLayerBits <= 64, "Draw key fields must fit in 64 bits.");
+
+	inline UINT64 KeyField(UINT value, UINT bits, UINT shift)
+	{
+		return ((UINT64)value & ((1ull << bits) - 1)) << shift;
+	}
+
+	inline UINT GetKeyField(UINT64 key, UINT bits, UINT shift)
+	{
+		return (UINT)((key >> shift) & ((1ull << bits) - 1));
+	}
+
+	// A run of key bits that differ between packets, and where it goes in
+	// the packed key: (key >> Shift) & Mask.
+	struct BitRun
+	{
+		UINT Shift;
+		UINT64 Mask;
+	};
+}
+
+UINT64 MakeDrawKey(UINT layer, UINT pso, UINT geometry, UINT material, UINT depth)
+{
+	return KeyField(layer, DrawKeyLayerBits, DrawKeyLayerShift) |
+		KeyField(pso, DrawKeyPsoBits, DrawKeyPsoShift) |
+		KeyField(geometry, DrawKeyGeometryBits, DrawKeyGeometryShift) |
+		KeyField(material, DrawKeyMaterialBits, DrawKeyMaterialShift) |
+		KeyField(depth, DrawKeyDepthBits, DrawKeyDepthShift);
+}
+
+UINT DrawKeyLayer(UINT64 key)
+{
+	return GetKeyField(key, DrawKeyLayerBits, DrawKeyLayerShift);
+}
+
+UINT DrawKeyPso(UINT64 key)
+{
+	return GetKeyField(key, DrawKeyPsoBits, DrawKeyPsoShift);
+}
+
+UINT DrawKeyGeometry(UINT64 key)
+{
+	return GetKeyField(key, DrawKeyGeometryBits, DrawKeyGeometryShift);
+}
+
+UINT DrawKeyDepth(float depth, float maxDepth)
+{
+	const UINT maxBucket = (1u << DrawKeyDepthBits) - 1;
+	float t = MathHelper::Clamp(depth / maxDepth, 0.0f, 1.0f);
+	return (UINT)(t * maxBucket);
+}
+
+void DrawPacketList::Add(UINT64 key, UINT item)
+{
+	DrawPacket packet;
+	packet.Key = key;
+	packet.Item = item;
+	mPackets.push_back(packet);
+}
+
+void DrawPacketList::Sort()
+{
+	const UINT n = (UINT)mPackets.size();
+	if (n < 2)
+		return;
+
+	// Bits that are the same in every key cannot change the order, so only
+	// the runs of bits that differ are sorted on.
+	UINT64 firstKey = mPackets[0].Key;
+	UINT64 differ = 0;
+	for (const DrawPacket& packet : mPackets)
+		differ |= packet.Key ^ firstKey;
+	if (differ == 0)
+		return;
+
+	BitRun runs[32];
+	UINT runCount = 0;
+	UINT keyBits = 0;
+	for (UINT bit = 0; bit < 64; ++bit)
+	{
+		if (((differ >> bit) & 1) == 0)
+			continue;
+
+		UINT first = bit;
+		while (bit < 64 && ((differ >> bit) & 1) != 0)
+			++bit;
+
+		// A run of all 64 bits cannot shift 1 into a mask.
+		UINT bits = bit - first;
+		UINT64 runMask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+
+		BitRun& run = runs[runCount++];
+		run.Shift = first - keyBits;
+		run.Mask = runMask << keyBits;
+		keyBits += bits;
+	}
+
+	UINT indexBits = 1;
+	while ((1ull << indexBits) < n)
+		++indexBits;
+
+	if (keyBits + indexBits > 64)
+	{
+		// Too many bits to pack with an index.
+		std::stable_sort(mPackets.begin(), mPackets.end(),
+			[](const DrawPacket& a, const DrawPacket& b) { return a.Key < b.Key; });
+		return;
+	}
+
+	// The fewest passes of at most MaxRadixBits that cover the differing
+	// bits, with the bits spread evenly over them.
+	UINT passCount = (keyBits + MaxRadixBits - 1) / MaxRadixBits;
+	UINT radixBits = (keyBits + passCount - 1) / passCount;
+	UINT radixSize = 1u << radixBits;
+	UINT64 radixMask = radixSize - 1;
+
+	// Pack the differing bits above the packet index and count the digits
+	// of every pass in the same scan.
+	mRadixCounts.assign(passCount * radixSize, 0);
+	UINT* counts = mRadixCounts.data();
+	mSortValues.resize(n);
+	mSortScratch.resize(n);
+	UINT64* values = mSortValues.data();
+	const DrawPacket* packets = mPackets.data();
+	for (UINT i = 0; i < n; ++i)
+	{
+		UINT64 key = packets[i].Key;
+		UINT64 packed = 0;
+		for (UINT r = 0; r < runCount; ++r)
+			packed |= (key >> runs[r].Shift) & runs[r].Mask;
+
+		values[i] = (packed << indexBits) | i;
+		for (UINT pass = 0; pass < passCount; ++pass)
+			++counts[pass * radixSize + ((packed >> (pass * radixBits)) & radixMask)];
+	}
+
+	for (UINT pass = 0; pass < passCount; ++pass)
+	{
+		UINT* passCounts = counts + pass * radixSize;
+		UINT offset = 0;
+		for (UINT digit = 0; digit < radixSize; ++digit)
+		{
+			UINT c = passCounts[digit];
+			passCounts[digit] = offset;
+			offset += c;
+		}
+
+		UINT shift = indexBits + pass * radixBits;
+		const UINT64* src = mSortValues.data();
+		UINT64* dst = mSortScratch.data();
+		for (UINT i = 0; i < n; ++i)
+		{
+			UINT64 value = src[i];
+			dst[passCounts[(value >> shift) & radixMask]++] = value;
+		}
+
+		mSortValues.swap(mSortScratch);
+	}
+
+	// Each pass is stable and the values started out in packet order, so
+	// packets with equal keys keep their order.
+	const UINT64 indexMask = (1ull << indexBits) - 1;
+	mScratch.resize(n);
+	for (UINT i = 0; i < n; ++i)
+		mScratch[i] = mPackets[(UINT)(mSortValues[i] & indexMask)];
+	mPackets.swap(mScratch);
+}
+
+void DrawPacketList::LayerRange(UINT firstLayer, UINT lastLayer, UINT& begin, UINT& end)const
+{
+	auto first = std::partition_point(mPackets.begin(), mPackets.end(),
+		[&](const DrawPacket& p) { return DrawKeyLayer(p.Key) < firstLayer; });
+	auto last = std::partition_point(first, mPackets.end(),
+		[&](const DrawPacket& p) { return DrawKeyLayer(p.Key) <= lastLayer; });
+
+	begin = (UINT)(first - mPackets.begin());
+	end = (UINT)(last - mPackets.begin());
+}
+
+bool DrawStateCache::SetPso(ID3D12PipelineState* pso)
+{
+	if (pso == mPso)
+		return false;
+	mPso = pso;
+	++mStats.PsoChanges;
+	return true;
+}
+
+bool DrawStateCache::SetGeometry(const MeshGeometry* geo)
+{
+	if (geo == mGeo)
+		return false;
+	mGeo = geo;
+	++mStats.GeometryChanges;
+	return true;
+}
+
+bool DrawStateCache::SetTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+{
+	if (topology == mTopology)
+		return false;
+	mTopology = topology;
+	++mStats.TopologyChanges;
+	return true;
+}
+
+bool DrawStateCache::SetSkinnedCB(UINT skinnedCBIndex)
+{
+	if (skinnedCBIndex == mSkinnedCBIndex)
+		return false;
+	mSkinnedCBIndex = skinnedCBIndex;
+	++mStats.SkinnedCBChanges;
+	return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <Windows.h>
+#include <d3d12.h>
+#include <vector>
+
+struct MeshGeometry;
+
+// A draw of a render item, with the key it is sorted by.
+struct DrawPacket
+{
+	UINT64 Key = 0;
+	UINT Item = 0;
+};
+
+// Bit widths of the sort key fields, most significant first.  Sorting by the
+// key groups the draws by layer, then by pipeline state, geometry and
+// material, and orders the draws that share all of those by depth.  A
+// thousand depth buckets are plenty to draw a state group front to back, and
+// every byte of key the draws differ in costs the sort a pass; the top bits
+// are left unused.
+const UINT DrawKeyLayerBits = 4;
+const UINT DrawKeyPsoBits = 8;
+const UINT DrawKeyGeometryBits = 12;
+const UINT DrawKeyMaterialBits = 16;
+const UINT DrawKeyDepthBits = 10;
+
+// Packs the fields of a sort key; each is cut to its width.  pso indexes the
+// pipeline states of the pass that draws the packets.
+UINT64 MakeDrawKey(UINT layer, UINT pso, UINT geometry, UINT material, UINT depth);
+UINT DrawKeyLayer(UINT64 key);
+UINT DrawKeyPso(UINT64 key);
+UINT DrawKeyGeometry(UINT64 key);
+
+// Quantizes a view space depth in [0, maxDepth] for the key, nearer first.
+UINT DrawKeyDepth(float depth, float maxDepth);
+
+class DrawPacketList
+{
+public:
+	void Clear() { mPackets.clear(); }
+	void Add(UINT64 key, UINT item);
+
+	// Least significant digit radix sort of 8-byte values: the key bits that
+	// differ between packets packed above the packet index.  Fields that are
+	// the same throughout, like the layer of a single layer list, cost
+	// nothing, and the digits of up to 11 bits are all counted in one scan.
+	// Packets with equal keys keep their order.
+	void Sort();
+
+	const std::vector<DrawPacket>& Packets()const { return mPackets; }
+
+	// Packets of layers [firstLayer, lastLayer] of the sorted list, as
+	// [begin, end).
+	void LayerRange(UINT firstLayer, UINT lastLayer, UINT& begin, UINT& end)const;
+
+private:
+	std::vector<DrawPacket> mPackets;
+	std::vector<DrawPacket> mScratch;
+
+	// The packed values Sort orders and the digit counts of its passes.
+	std::vector<UINT64> mSortValues;
+	std::vector<UINT64> mSortScratch;
+	std::vector<UINT> mRadixCounts;
+};
+
+// Draw counts and the state changes they took.  A change is a bind that
+// differs from the state already bound; the binds skipped are the rest.
+struct DrawStateStats
+{
+	UINT Draws = 0;
+	UINT PsoChanges = 0;
+	UINT GeometryChanges = 0;
+	UINT TopologyChanges = 0;
+	UINT SkinnedCBChanges = 0;
+
+	UINT Changes()const { return PsoChanges + GeometryChanges + TopologyChanges + SkinnedCBChanges; }
+
+	DrawStateStats& operator+=(const DrawStateStats& rhs)
+	{
+		Draws += rhs.Draws;
+		PsoChanges += rhs.PsoChanges;
+		GeometryChanges += rhs.GeometryChanges;
+		TopologyChanges += rhs.TopologyChanges;
+		SkinnedCBChanges += rhs.SkinnedCBChanges;
+		return *this;
+	}
+};
+
+// The state last bound while recording draws.  Each Set returns whether the
+// new state differs, in which case the caller binds it.
+class DrawStateCache
+{
+public:
+	bool SetPso(ID3D12PipelineState* pso);
+	bool SetGeometry(const MeshGeometry* geo);
+	bool SetTopology(D3D12_PRIMITIVE_TOPOLOGY topology);
+	bool SetSkinnedCB(UINT skinnedCBIndex);
+
+	void CountDraw() { ++mStats.Draws; }
+
+	const DrawStateStats& Stats()const { return mStats; }
+
+private:
+	ID3D12PipelineState* mPso = nullptr;
+	const MeshGeometry* mGeo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY mTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	// Matches no skinned constant buffer, not even UINT(-1) for none.
+	UINT mSkinnedCBIndex = UINT(-2);
+
+	DrawStateStats mStats;
+};
@@ -1,14 +1,67 @@
 #include "frame_resource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT skinnedCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT instanceCount, UINT skinnedCount,
+	UINT materialCount)
 {
-	ThrowIfFailed(device->CreateCommandAllocator(
-		D3D12_COMMAND_LIST_TYPE_DIRECT,
-		IID_PPV_ARGS(&CmdAllocator)));
-
 	PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
 	SsaoCB = std::make_unique<UploadBuffer<SsaoConstants>>(device, 1, true);
 	MaterialBuffer = std::make_unique<UploadBuffer<MaterialBufferData>>(device, materialCount, false);
 	ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+	InstanceBuffer = std::make_unique<UploadBuffer<InstanceData>>(device, objectCount, false);
+	InstanceIndexBuffer = std::make_unique<UploadBuffer<UINT>>(device, instanceCount, false);
 	SkinnedCB = std::make_unique<UploadBuffer<SkinnedConstants>>(device, skinnedCount, true);
 }
+
+void FrameResource::ReserveCommandLists(ID3D12Device* device, UINT count)
+{
+	while (CmdLists.size() < count)
+	{
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> allocator;
+		ThrowIfFailed(device->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(&allocator)));
+
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> cmdList;
+		ThrowIfFailed(device->CreateCommandList(
+			0,
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			allocator.Get(),
+			nullptr,
+			IID_PPV_ARGS(&cmdList)));
+
+		// Lists are created open; BeginList expects them closed.
+		ThrowIfFailed(cmdList->Close());
+
+		CmdAllocators.push_back(allocator);
+		CmdLists.push_back(cmdList);
+	}
+}
+
+FrameCommandRecorder::FrameCommandRecorder(FrameResource& frame, ID3D12CommandQueue* queue) :
+	mFrame(frame), mQueue(queue)
+{
+}
+
+ID3D12GraphicsCommandList* FrameCommandRecorder::BeginList(UINT list)
+{
+	ID3D12CommandAllocator* allocator = mFrame.CmdAllocators[list].Get();
+	ID3D12GraphicsCommandList* cmdList = mFrame.CmdLists[list].Get();
+
+	// Reuse the memory associated with command recording.
+	ThrowIfFailed(allocator->Reset());
+	ThrowIfFailed(cmdList->Reset(allocator, nullptr));
+	return cmdList;
+}
+
+void FrameCommandRecorder::EndList(UINT list)
+{
+	ThrowIfFailed(mFrame.CmdLists[list]->Close());
+}
+
+void FrameCommandRecorder::Submit(UINT listCount)
+{
+	std::vector<ID3D12CommandList*> cmdLists(listCount);
+	for (UINT list = 0; list < listCount; ++list)
+		cmdLists[list] = mFrame.CmdLists[list].Get();
+	mQueue->ExecuteCommandLists(listCount, cmdLists.data());
+}
@@ -2,10 +2,12 @@
 #include <Windows.h>
 #include <d3d12.h>
 #include <wrl/client.h>
+#include <vector>
 #include "upload_buffer.h"
 #include <DirectXMath.h>
 #include "math_helper.h"
 #include "light.h"
+#include "command_recorder.h"
 
 struct PassConstants
 {
@@ -43,9 +45,21 @@ struct ObjectConstants
 	UINT     _padding[3];
 };
 
+// The object constants of one item, at its object constant slot, read by
+// instanced draws from a structured buffer; see InstanceData in Common.hlsl.
+struct InstanceData
+{
+	DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+	UINT     MaterialIndex;
+	UINT     _padding[3];
+};
+
 struct SkinnedConstants
 {
-	DirectX::XMFLOAT4X4 BoneTransforms[96];
+	static const UINT MaxBones = 96;
+
+	DirectX::XMFLOAT4X4 BoneTransforms[MaxBones];
 };
 
 struct SsaoConstants
@@ -87,18 +101,28 @@ class FrameResource
 {
 public:
 
-	FrameResource(ID3D12Device *device, UINT passCount, UINT objectCount, UINT skinnedCount, UINT materialCount);
+	FrameResource(ID3D12Device *device, UINT passCount, UINT objectCount, UINT instanceCount, UINT skinnedCount,
+		UINT materialCount);
 	FrameResource(const FrameResource& rhs) = delete;
 	FrameResource& operator=(const FrameResource& rhs) = delete;
 
+	// Creates command lists, closed, until there are at least count.  Call
+	// before recording, from the thread that owns the frame.
+	void ReserveCommandLists(ID3D12Device* device, UINT count);
+
 	// We cannot reset the allocator until the GPU is done processing the commands.
-	// So each frame needs their own allocator.
-	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdAllocator;
+	// So each frame needs their own allocators.  Every command list has its
+	// own as well, since an allocator may only be recorded into from one
+	// thread at a time.
+	std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> CmdAllocators;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> CmdLists;
 
 	// We cannot update a cbuffer until the GPU is done processing the commands
 	// that reference it.  So each frame needs their own cbuffers.
 	std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
 	std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
+	std::unique_ptr<UploadBuffer<InstanceData>> InstanceBuffer = nullptr;
+	std::unique_ptr<UploadBuffer<UINT>> InstanceIndexBuffer = nullptr;
 	std::unique_ptr<UploadBuffer<SkinnedConstants>> SkinnedCB = nullptr;
 	std::unique_ptr<UploadBuffer<SsaoConstants>> SsaoCB = nullptr;
 	std::unique_ptr<UploadBuffer<MaterialBufferData>> MaterialBuffer = nullptr;
@@ -106,4 +130,24 @@ public:
 	// Fence value to mark commands up to this fence point.  This lets us
 	// check if these frame resources are still in use by the GPU.
 	UINT64 Fence = 0;
+
+	// Version of the instance index lists last written to this frame's buffer.
+	UINT64 InstanceIndexVersion = 0;
+};
+
+// Records into the command lists of a frame resource and submits them to a
+// queue.  Reserve enough lists on the frame resource first, and only record
+// once the GPU is done with its previous commands.
+class FrameCommandRecorder : public CommandRecorder
+{
+public:
+	FrameCommandRecorder(FrameResource& frame, ID3D12CommandQueue* queue);
+
+	ID3D12GraphicsCommandList* BeginList(UINT list)override;
+	void EndList(UINT list)override;
+	void Submit(UINT listCount)override;
+
+private:
+	FrameResource& mFrame;
+	ID3D12CommandQueue* mQueue = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "frustum_culler.h"
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+#include "cpu_features.h"
+#include "cull_lanes.h"
+#include "job_system.h"
+#include "math_helper.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Steps from the grid center to the edge of the fitted boxes.  Below the
+	// int16 limit so rounding and a little movement still fit.
+	const float GridHalfSteps = 32000.0f;
+
+	// Sum of the absolute center coefficients of a CullPlane.  The center
+	// and the extent terms then each add up to less than 2^28.
+	const double PlaneCoefficientLimit = 8192.0;
+
+	// Rounding the three center coefficients moves a plane by at most half
+	// a unit per grid step of the center, under 49000 units in all; the
+	// offset is pushed out by more than that so no box inside is lost.
+	const double PlaneRoundingMargin = 65536.0;
+
+	// Lane numbers of the set bits of every 4-bit mask, packed, and the
+	// number of set bits.
+	struct CompactTable
+	{
+		CompactTable()
+		{
+			for (UINT mask = 0; mask < 16; ++mask)
+			{
+				UINT count = 0;
+				for (UINT lane = 0; lane < 4; ++lane)
+				{
+					Lanes[mask][lane] = 0;
+					if (mask & (1u << lane))
+						Lanes[mask][count++] = lane;
+				}
+				Counts[mask] = count;
+			}
+		}
+
+		UINT Lanes[16][4];
+		UINT Counts[16];
+	};
+
+	const CompactTable gCompactTable;
+
+	// Four boxes, one per 32-bit lane of an SSE2 register.
+	struct SseLanes
+	{
+		typedef __m128i Vector;
+		static const UINT Count = 4;
+
+		// Two 16-bit values of each of four items.
+		static Vector Load(const std::int16_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static Vector Splat(std::uint32_t v) { return _mm_set1_epi32((int)v); }
+		static Vector Dot(Vector a, Vector b) { return _mm_madd_epi16(a, b); }
+		static Vector Add(Vector a, Vector b) { return _mm_add_epi32(a, b); }
+		static Vector Or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+
+		// Writes first + lane for the lanes of outside without the sign bit
+		// to out, packed, and returns how many there are.  Always stores 4
+		// values.
+		static UINT StoreVisible(Vector outside, UINT first, UINT* out)
+		{
+			int mask = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf;
+			__m128i lanes = _mm_loadu_si128((const __m128i*)gCompactTable.Lanes[mask]);
+			_mm_storeu_si128((__m128i*)out, _mm_add_epi32(lanes, _mm_set1_epi32((int)first)));
+			return gCompactTable.Counts[mask];
+		}
+	};
+
+	// Low 16 bits x, high 16 bits y.
+	inline std::uint32_t PackPair(int x, int y)
+	{
+		return (std::uint32_t)(std::uint16_t)x | ((std::uint32_t)(std::uint16_t)y << 16);
+	}
+
+	// The plane in grid steps, scaled so its absolute center coefficients
+	// add up to PlaneCoefficientLimit and moved out by their rounding.  The
+	// extent coefficients are rounded up instead.
+	CullPlane ToGridPlane(const XMFLOAT4& plane, const XMFLOAT3& center, float step)
+	{
+		double x = (double)plane.x * step;
+		double y = (double)plane.y * step;
+		double z = (double)plane.z * step;
+		double extent = std::fabs(x) + std::fabs(y) + std::fabs(z);
+		double offset = (double)plane.x * center.x + (double)plane.y * center.y + (double)plane.z * center.z + plane.w;
+
+		CullPlane gridPlane;
+		if (extent == 0.0)
+		{
+			// Keeps every box or none.
+			gridPlane.CenterXY = 0;
+			gridPlane.CenterZExtentX = 0;
+			gridPlane.ExtentYZ = 0;
+			gridPlane.Offset = offset >= 0.0 ? 0 : -1;
+			return gridPlane;
+		}
+
+		double scale = PlaneCoefficientLimit / extent;
+		gridPlane.CenterXY = PackPair((int)std::lround(x * scale), (int)std::lround(y * scale));
+		gridPlane.CenterZExtentX = PackPair((int)std::lround(z * scale), (int)std::ceil(std::fabs(x) * scale));
+		gridPlane.ExtentYZ = PackPair((int)std::ceil(std::fabs(y) * scale), (int)std::ceil(std::fabs(z) * scale));
+
+		// Beyond 2^30 every box is on the same side anyway.
+		const double offsetLimit = 1073741824.0;
+		double gridOffset = MathHelper::Clamp(offset * scale + PlaneRoundingMargin, -offsetLimit, offsetLimit);
+		gridPlane.Offset = (std::int32_t)std::ceil(gridOffset);
+		return gridPlane;
+	}
+}
+
+void FrustumCuller::Resize(UINT count)
+{
+	UINT paddedCount = (count + CullLaneCount - 1) / CullLaneCount * CullLaneCount;
+
+	// New items are empty boxes at the origin.
+	mBoxes.resize(count, BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f)));
+	mCenterXY.resize(2 * paddedCount);
+	mCenterZExtentX.resize(2 * paddedCount);
+	mExtentYZ.resize(2 * paddedCount);
+	mVisible.resize(paddedCount);
+	mVisibleCount = 0;
+
+	for (UINT i = mCount; i < count && !mRequantize; ++i)
+		mRequantize = !Quantize(i);
+
+	mCount = count;
+}
+
+void FrustumCuller::SetBounds(UINT item, const BoundingBox& box)
+{
+	mBoxes[item] = box;
+
+	// Otherwise it is quantized with the rest once the grid has grown.
+	if (!mRequantize)
+		mRequantize = !Quantize(item);
+}
+
+void FrustumCuller::SetBounds(const BoundingBox* boxes, UINT count)
+{
+	Resize(count);
+	std::copy(boxes, boxes + count, mBoxes.begin());
+	Requantize();
+}
+
+void FrustumCuller::Requantize()
+{
+	XMFLOAT3 boundsMin(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 boundsMax(0.0f, 0.0f, 0.0f);
+	for (UINT i = 0; i < mCount; ++i)
+	{
+		const BoundingBox& box = mBoxes[i];
+		XMFLOAT3 boxMin(box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z);
+		XMFLOAT3 boxMax(box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z);
+		boundsMin.x = i == 0 ? boxMin.x : MathHelper::Min(boundsMin.x, boxMin.x);
+		boundsMin.y = i == 0 ? boxMin.y : MathHelper::Min(boundsMin.y, boxMin.y);
+		boundsMin.z = i == 0 ? boxMin.z : MathHelper::Min(boundsMin.z, boxMin.z);
+		boundsMax.x = i == 0 ? boxMax.x : MathHelper::Max(boundsMax.x, boxMax.x);
+		boundsMax.y = i == 0 ? boxMax.y : MathHelper::Max(boundsMax.y, boxMax.y);
+		boundsMax.z = i == 0 ? boxMax.z : MathHelper::Max(boundsMax.z, boxMax.z);
+	}
+
+	// The same step on every axis, sized by the longest one.  An eighth of
+	// the size of room on each side, so items moving a little stay in the
+	// grid, and at least a unit.
+	mGridCenter = XMFLOAT3(0.5f * (boundsMin.x + boundsMax.x), 0.5f * (boundsMin.y + boundsMax.y),
+		0.5f * (boundsMin.z + boundsMax.z));
+	float size = MathHelper::Max(boundsMax.x - boundsMin.x,
+		MathHelper::Max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+	mGridStep = MathHelper::Max(0.625f * size, 1.0f) / GridHalfSteps;
+
+	for (UINT i = 0; i < mCount; ++i)
+		Quantize(i);
+	mRequantize = false;
+}
+
+bool FrustumCuller::Quantize(UINT item)
+{
+	const BoundingBox& box = mBoxes[item];
+	const float center[3] = { box.Center.x, box.Center.y, box.Center.z };
+	const float extents[3] = { box.Extents.x, box.Extents.y, box.Extents.z };
+	const float gridCenter[3] = { mGridCenter.x, mGridCenter.y, mGridCenter.z };
+
+	// The nearest grid step to the center, and the half sizes in steps of a
+	// box around it that holds the box, rounded up.
+	int steps[3];
+	int halfSizes[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		double offset = ((double)center[axis] - gridCenter[axis]) / mGridStep;
+		if (!(std::fabs(offset) <= GridHalfSteps * 1.02))
+			return false;
+
+		steps[axis] = (int)std::lround(offset);
+		double error = std::fabs((double)center[axis] - (gridCenter[axis] + (double)steps[axis] * mGridStep));
+		double halfSize = (error + extents[axis]) / mGridStep;
+		if (!(halfSize < 32766.0))
+			return false;
+		halfSizes[axis] = (int)(halfSize + 1.0);
+	}
+
+	mCenterXY[2 * item] = (std::int16_t)steps[0];
+	mCenterXY[2 * item + 1] = (std::int16_t)steps[1];
+	mCenterZExtentX[2 * item] = (std::int16_t)steps[2];
+	mCenterZExtentX[2 * item + 1] = (std::int16_t)halfSizes[0];
+	mExtentYZ[2 * item] = (std::int16_t)halfSizes[1];
+	mExtentYZ[2 * item + 1] = (std::int16_t)halfSizes[2];
+	return true;
+}
+
+UINT FrustumCuller::CullRange(const CullPlane planes[6], UINT begin, UINT end, UINT* out)const
+{
+	if (CpuHasAvx2())
+		return CullLanesAvx2(mCenterXY.data(), mCenterZExtentX.data(), mExtentYZ.data(), planes, begin, end, out);
+
+	return CullLanes<SseLanes>(mCenterXY.data(), mCenterZExtentX.data(), mExtentYZ.data(), planes, begin, end, out);
+}
+
+void FrustumCuller::Cull(const XMFLOAT4 planes[6])
+{
+	if (mRequantize)
+		Requantize();
+
+	CullPlane gridPlanes[6];
+	for (int p = 0; p < 6; ++p)
+		gridPlanes[p] = ToGridPlane(planes[p], mGridCenter, mGridStep);
+
+	UINT paddedCount = (UINT)mVisible.size();
+	if (Jobs == nullptr || paddedCount <= JobGrainSize)
+	{
+		mVisibleCount = CullRange(gridPlanes, 0, paddedCount, mVisible.data());
+	}
+	else
+	{
+		// Every job writes to its own part of mVisible, starting at its
+		// first item, and the parts are packed together afterwards.
+		UINT rangeCount = (paddedCount + JobGrainSize - 1) / JobGrainSize;
+		mRangeVisible.resize(rangeCount);
+
+		Jobs->ParallelFor(paddedCount, JobGrainSize, [&](UINT begin, UINT end)
+		{
+			mRangeVisible[begin / JobGrainSize] = CullRange(gridPlanes, begin, end, mVisible.data() + begin);
+		});
+
+		mVisibleCount = mRangeVisible[0];
+		for (UINT range = 1; range < rangeCount; ++range)
+		{
+			UINT* first = mVisible.data() + range * JobGrainSize;
+			std::copy(first, first + mRangeVisible[range], mVisible.data() + mVisibleCount);
+			mVisibleCount += mRangeVisible[range];
+		}
+	}
+
+	// The padding holds whatever was quantized last and comes at the end.
+	while (mVisibleCount > 0 && mVisible[mVisibleCount - 1] >= mCount)
+		--mVisibleCount;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+struct CullPlane;
+
+// Number of boxes FrustumCuller tests at once: one per lane of an AVX2
+// register, or two SSE passes of four on CPUs without AVX2.
+const UINT CullLaneCount = 8;
+
+// Culls a flat list of axis-aligned boxes against six planes.  The boxes
+// are quantized to 16-bit steps of a grid around all of them and kept as
+// structure-of-arrays, so each iteration loads 12 bytes per box and tests
+// CullLaneCount boxes against a plane with three integer multiply-adds.
+class FrustumCuller
+{
+public:
+	// Items tested by one job; a multiple of CullLaneCount.
+	static constexpr UINT JobGrainSize = 16384;
+
+	// Bytes of bounds Cull reads per item.
+	static constexpr UINT BoundsBytesPerItem = 6 * sizeof(std::int16_t);
+
+	// Splits Cull over the job system if set.
+	JobSystem* Jobs = nullptr;
+
+	// Sets the item count; new items have empty bounds at the origin.
+	void Resize(UINT count);
+	UINT Count()const { return mCount; }
+
+	void SetBounds(UINT item, const DirectX::BoundingBox& box);
+	void SetBounds(const DirectX::BoundingBox* boxes, UINT count);
+
+	// Finds the items whose boxes are on the inner side of all planes or
+	// cross them.  A plane (a, b, c, d) keeps the points p with
+	// a * p.x + b * p.y + c * p.z + d >= 0.  The test is conservative: each
+	// box is grown to the grid and the planes are moved out by a few grid
+	// steps, so boxes just outside may be found but boxes inside never
+	// missed.
+	void Cull(const DirectX::XMFLOAT4 planes[6]);
+
+	// Items found by the last Cull, in increasing order.
+	const UINT* VisibleItems()const { return mVisible.data(); }
+	UINT VisibleCount()const { return mVisibleCount; }
+
+private:
+	// Fits the grid around every box, with room to move, and quantizes
+	// them all again.
+	void Requantize();
+
+	// Quantizes mBoxes[item]; false if it does not fit in the grid.
+	bool Quantize(UINT item);
+
+	// Writes the visible items of [begin, end) to out and returns how many
+	// there are.  begin is a multiple of CullLaneCount.
+	UINT CullRange(const CullPlane planes[6], UINT begin, UINT end, UINT* out)const;
+
+private:
+	UINT mCount = 0;
+
+	// The boxes as set, to quantize again when one leaves the grid.
+	std::vector<DirectX::BoundingBox> mBoxes;
+	bool mRequantize = false;
+
+	// Grid steps are mGridStep apart on every axis, step 0 at mGridCenter.
+	DirectX::XMFLOAT3 mGridCenter = { 0.0f, 0.0f, 0.0f };
+	float mGridStep = 1.0f;
+
+	// Interleaved pairs per item, in grid steps: the center x and y, the
+	// center z and the x half size, and the y and z half sizes of a box
+	// holding the item's box.  Padded to a multiple of CullLaneCount; Cull
+	// drops the padding it finds.
+	std::vector<std::int16_t> mCenterXY;
+	std::vector<std::int16_t> mCenterZExtentX;
+	std::vector<std::int16_t> mExtentYZ;
+
+	// One slot per padded item, so Cull never grows it, and the visible
+	// items found by each job.
+	std::vector<UINT> mVisible;
+	UINT mVisibleCount = 0;
+	std::vector<UINT> mRangeVisible;
+};
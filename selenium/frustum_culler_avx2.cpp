@@ -0,0 +1,66 @@
+// Compiled with /arch:AVX2; see CpuHasAvx2.  Only plain integer data is used
+// here, so no inline function built for AVX2 can be picked by the linker for
+// the other files.
+#include "cull_lanes.h"
+#include <immintrin.h>
+
+namespace
+{
+	// Lane numbers of the set bits of every 8-bit mask, one per byte, and the
+	// number of set bits.
+	struct CompactTable
+	{
+		CompactTable()
+		{
+			for (UINT mask = 0; mask < 256; ++mask)
+			{
+				std::uint64_t lanes = 0;
+				UINT count = 0;
+				for (UINT lane = 0; lane < 8; ++lane)
+				{
+					if (mask & (1u << lane))
+						lanes |= (std::uint64_t)lane << (8 * count++);
+				}
+				Lanes[mask] = lanes;
+				Counts[mask] = count;
+			}
+		}
+
+		std::uint64_t Lanes[256];
+		UINT Counts[256];
+	};
+
+	const CompactTable gCompactTable;
+
+	// Eight boxes, one per 32-bit lane of a 256-bit register.
+	struct Avx2Lanes
+	{
+		typedef __m256i Vector;
+		static const UINT Count = 8;
+
+		// Two 16-bit values of each of eight items.
+		static Vector Load(const std::int16_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+		static Vector Splat(std::uint32_t v) { return _mm256_set1_epi32((int)v); }
+		static Vector Dot(Vector a, Vector b) { return _mm256_madd_epi16(a, b); }
+		static Vector Add(Vector a, Vector b) { return _mm256_add_epi32(a, b); }
+		static Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+
+		// Writes first + lane for the lanes of outside without the sign bit
+		// to out, packed, and returns how many there are.  Always stores 8
+		// values.
+		static UINT StoreVisible(Vector outside, UINT first, UINT* out)
+		{
+			int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+			__m128i lanes8 = _mm_loadl_epi64((const __m128i*)&gCompactTable.Lanes[mask]);
+			__m256i lanes = _mm256_add_epi32(_mm256_cvtepu8_epi32(lanes8), _mm256_set1_epi32((int)first));
+			_mm256_storeu_si256((__m256i*)out, lanes);
+			return gCompactTable.Counts[mask];
+		}
+	};
+}
+
+UINT CullLanesAvx2(const std::int16_t* centerXY, const std::int16_t* centerZExtentX, const std::int16_t* extentYZ,
+	const CullPlane planes[6], UINT begin, UINT end, UINT* out)
+{
+	return CullLanes<Avx2Lanes>(centerXY, centerZExtentX, extentYZ, planes, begin, end, out);
+}
@@ -1,8 +1,32 @@
 #include "geometry_generator.h"
 #include <algorithm>
+#include "job_system.h"
 
 using namespace DirectX;
 
+namespace
+{
+	// Rough number of vertices or triangles one job fills.
+	const GeometryGenerator::uint32 ParallelGrainSize = 16384;
+
+	// Grain size in rows for rows of rowSize items.
+	GeometryGenerator::uint32 RowGrainSize(GeometryGenerator::uint32 rowSize)
+	{
+		return std::max<GeometryGenerator::uint32>(ParallelGrainSize / std::max<GeometryGenerator::uint32>(rowSize, 1u), 1u);
+	}
+}
+
+void GeometryGenerator::ParallelFor(uint32 count, uint32 grainSize, const std::function<void(uint32, uint32)>& func)
+{
+	if (count == 0)
+		return;
+
+	if (Jobs == nullptr || count <= grainSize)
+		func(0, count);
+	else
+		Jobs->ParallelFor(count, grainSize, func);
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float height, float depth, uint32 numSubdivisions)
 {
 	MeshData meshData;
@@ -88,7 +112,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float heig
 	meshData.Indices32.assign(&i[0], &i[36]);
 
 	// Put a cap on the number of subdivisions.
-	numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+	numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
 
 	for (uint32 i = 0; i < numSubdivisions; ++i)
 		Subdivide(meshData);
@@ -100,6 +124,15 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 {
 	MeshData meshData;
 
+	// Two poles plus stackCount - 1 rings; the first and last vertex of each
+	// ring are duplicated since the texture coordinates are different.
+	uint32 ringVertexCount = sliceCount + 1;
+	uint32 ringCount = stackCount - 1;
+	meshData.Vertices.resize(2 + ringCount * ringVertexCount);
+
+	// A fan at each pole and two triangles per quad of the inner stacks.
+	meshData.Indices32.resize(2 * sliceCount * 3 + (stackCount - 2) * sliceCount * 6);
+
 	//
 	// Compute the vertices stating at the top pole and moving down the stacks.
 	//
@@ -110,58 +143,60 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	Vertex topVertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
 	Vertex bottomVertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
 
-	meshData.Vertices.push_back(topVertex);
+	meshData.Vertices.front() = topVertex;
+	meshData.Vertices.back() = bottomVertex;
 
 	float phiStep = XM_PI / stackCount;
 	float thetaStep = 2.0f*XM_PI / sliceCount;
 
 	// Compute vertices for each stack ring (do not count the poles as rings).
-	for (uint32 i = 1; i <= stackCount - 1; ++i)
+	ParallelFor(ringCount, RowGrainSize(ringVertexCount), [&](uint32 begin, uint32 end)
 	{
-		float phi = i * phiStep;
-
-		// Vertices of ring.
-		for (uint32 j = 0; j <= sliceCount; ++j)
+		for (uint32 ring = begin; ring < end; ++ring)
 		{
-			float theta = j * thetaStep;
+			float phi = (ring + 1) * phiStep;
+			Vertex* rowVertices = &meshData.Vertices[1 + ring * ringVertexCount];
 
-			Vertex v;
+			// Vertices of ring.
+			for (uint32 j = 0; j <= sliceCount; ++j)
+			{
+				float theta = j * thetaStep;
 
-			// spherical to cartesian
-			v.Pos.x = radius * sinf(phi)*cosf(theta);
-			v.Pos.y = radius * cosf(phi);
-			v.Pos.z = radius * sinf(phi)*sinf(theta);
+				Vertex& v = rowVertices[j];
 
-			// Partial derivative of P with respect to theta
-			v.TangentU.x = -radius * sinf(phi)*sinf(theta);
-			v.TangentU.y = 0.0f;
-			v.TangentU.z = +radius * sinf(phi)*cosf(theta);
+				// spherical to cartesian
+				v.Pos.x = radius * sinf(phi)*cosf(theta);
+				v.Pos.y = radius * cosf(phi);
+				v.Pos.z = radius * sinf(phi)*sinf(theta);
 
-			XMVECTOR T = XMLoadFloat3(&v.TangentU);
-			XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
+				// Partial derivative of P with respect to theta
+				v.TangentU.x = -radius * sinf(phi)*sinf(theta);
+				v.TangentU.y = 0.0f;
+				v.TangentU.z = +radius * sinf(phi)*cosf(theta);
 
-			XMVECTOR p = XMLoadFloat3(&v.Pos);
-			XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
+				XMVECTOR T = XMLoadFloat3(&v.TangentU);
+				XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
 
-			v.TexC.x = theta / XM_2PI;
-			v.TexC.y = phi / XM_PI;
+				XMVECTOR p = XMLoadFloat3(&v.Pos);
+				XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
 
-			meshData.Vertices.push_back(v);
+				v.TexC.x = theta / XM_2PI;
+				v.TexC.y = phi / XM_PI;
+			}
 		}
-	}
-
-	meshData.Vertices.push_back(bottomVertex);
+	});
 
 	//
 	// Compute indices for top stack.  The top stack was written first to the vertex buffer
 	// and connects the top pole to the first ring.
 	//
 
+	uint32* indices = meshData.Indices32.data();
 	for (uint32 i = 1; i <= sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(0);
-		meshData.Indices32.push_back(i + 1);
-		meshData.Indices32.push_back(i);
+		*indices++ = 0;
+		*indices++ = i + 1;
+		*indices++ = i;
 	}
 
 	//
@@ -171,20 +206,25 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	// Offset the indices to the index of the first vertex in the first ring.
 	// This is just skipping the top pole vertex.
 	uint32 baseIndex = 1;
-	uint32 ringVertexCount = sliceCount + 1;
-	for (uint32 i = 0; i < stackCount - 2; ++i)
+	uint32* stackIndices = indices;
+	ParallelFor(stackCount - 2, RowGrainSize(sliceCount * 2), [&](uint32 begin, uint32 end)
 	{
-		for (uint32 j = 0; j < sliceCount; ++j)
+		for (uint32 i = begin; i < end; ++i)
 		{
-			meshData.Indices32.push_back(baseIndex + i * ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i * ringVertexCount + j + 1);
-			meshData.Indices32.push_back(baseIndex + (i + 1)*ringVertexCount + j);
-
-			meshData.Indices32.push_back(baseIndex + (i + 1)*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i * ringVertexCount + j + 1);
-			meshData.Indices32.push_back(baseIndex + (i + 1)*ringVertexCount + j + 1);
+			uint32* k = stackIndices + i * sliceCount * 6;
+			for (uint32 j = 0; j < sliceCount; ++j)
+			{
+				*k++ = baseIndex + i * ringVertexCount + j;
+				*k++ = baseIndex + i * ringVertexCount + j + 1;
+				*k++ = baseIndex + (i + 1)*ringVertexCount + j;
+
+				*k++ = baseIndex + (i + 1)*ringVertexCount + j;
+				*k++ = baseIndex + i * ringVertexCount + j + 1;
+				*k++ = baseIndex + (i + 1)*ringVertexCount + j + 1;
+			}
 		}
-	}
+	});
+	indices += (stackCount - 2) * sliceCount * 6;
 
 	//
 	// Compute indices for bottom stack.  The bottom stack was written last to the vertex buffer
@@ -199,9 +239,9 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 
 	for (uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(southPoleIndex);
-		meshData.Indices32.push_back(baseIndex + i);
-		meshData.Indices32.push_back(baseIndex + i + 1);
+		*indices++ = southPoleIndex;
+		*indices++ = baseIndex + i;
+		*indices++ = baseIndex + i + 1;
 	}
 
 	return meshData;
@@ -209,13 +249,6 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 
 void GeometryGenerator::Subdivide(MeshData& meshData)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
-
 	//       v1
 	//       *
 	//      / \
@@ -226,48 +259,137 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size() / 3;
-	for (uint32 i = 0; i < numTris; ++i)
+	uint32 vertexCount = (uint32)meshData.Vertices.size();
+	uint32 numTris = (uint32)meshData.Indices32.size() / 3;
+	const uint32* inputIndices = meshData.Indices32.data();
+
+	//
+	// Give every edge one midpoint vertex.  The midpoints are appended after
+	// the input vertices, which keep their indices.
+	//
+
+	// The edge hash buckets every triangle edge under its lower vertex, so an
+	// edge shared by two triangles lands in one bucket of a few entries.
+	// triMidpoints[i*3 + e] is the midpoint of edge e of triangle i, where
+	// edge 0 is v0v1, edge 1 is v1v2 and edge 2 is v0v2.
+	static const uint32 EdgeCorners[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+
+	std::vector<uint32> bucketStart(vertexCount + 1, 0);
+	for (uint32 i = 0; i < numTris * 3; ++i)
 	{
-		Vertex v0 = inputCopy.Vertices[inputCopy.Indices32[i * 3 + 0]];
-		Vertex v1 = inputCopy.Vertices[inputCopy.Indices32[i * 3 + 1]];
-		Vertex v2 = inputCopy.Vertices[inputCopy.Indices32[i * 3 + 2]];
-
-		//
-		// Generate the midpoints.
-		//
-
-		Vertex m0 = MidPoint(v0, v1);
-		Vertex m1 = MidPoint(v1, v2);
-		Vertex m2 = MidPoint(v0, v2);
-
-		//
-		// Add new geometry.
-		//
-
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
-
-		meshData.Indices32.push_back(i * 6 + 0);
-		meshData.Indices32.push_back(i * 6 + 3);
-		meshData.Indices32.push_back(i * 6 + 5);
-
-		meshData.Indices32.push_back(i * 6 + 3);
-		meshData.Indices32.push_back(i * 6 + 4);
-		meshData.Indices32.push_back(i * 6 + 5);
-
-		meshData.Indices32.push_back(i * 6 + 5);
-		meshData.Indices32.push_back(i * 6 + 4);
-		meshData.Indices32.push_back(i * 6 + 2);
-
-		meshData.Indices32.push_back(i * 6 + 3);
-		meshData.Indices32.push_back(i * 6 + 1);
-		meshData.Indices32.push_back(i * 6 + 4);
+		uint32 a = inputIndices[(i / 3) * 3 + EdgeCorners[i % 3][0]];
+		uint32 b = inputIndices[(i / 3) * 3 + EdgeCorners[i % 3][1]];
+		++bucketStart[std::min<uint32>(a, b) + 1];
 	}
+	for (uint32 v = 0; v < vertexCount; ++v)
+		bucketStart[v + 1] += bucketStart[v];
+
+	// Each entry is the slot of a triangle edge, i.e. i*3 + e.
+	std::vector<uint32> bucketEntries(numTris * 3);
+	{
+		std::vector<uint32> cursor(bucketStart.begin(), bucketStart.end() - 1);
+		for (uint32 i = 0; i < numTris * 3; ++i)
+		{
+			uint32 a = inputIndices[(i / 3) * 3 + EdgeCorners[i % 3][0]];
+			uint32 b = inputIndices[(i / 3) * 3 + EdgeCorners[i % 3][1]];
+			bucketEntries[cursor[std::min<uint32>(a, b)]++] = i;
+		}
+	}
+
+	auto upperVertex = [&](uint32 slot)
+	{
+		uint32 a = inputIndices[(slot / 3) * 3 + EdgeCorners[slot % 3][0]];
+		uint32 b = inputIndices[(slot / 3) * 3 + EdgeCorners[slot % 3][1]];
+		return std::max<uint32>(a, b);
+	};
+
+	// Number the unique edges of each bucket; triMidpoints temporarily holds
+	// the number within the bucket.
+	std::vector<uint32> triMidpoints(numTris * 3);
+	std::vector<uint32> edgeStart(vertexCount + 1, 0);
+	ParallelFor(vertexCount, ParallelGrainSize, [&](uint32 begin, uint32 end)
+	{
+		for (uint32 v = begin; v < end; ++v)
+		{
+			uint32 first = bucketStart[v];
+			uint32 uniqueCount = 0;
+			for (uint32 k = first; k < bucketStart[v + 1]; ++k)
+			{
+				uint32 other = upperVertex(bucketEntries[k]);
+
+				uint32 match = k;
+				for (uint32 prev = first; prev < k; ++prev)
+				{
+					if (upperVertex(bucketEntries[prev]) == other)
+					{
+						match = prev;
+						break;
+					}
+				}
+
+				triMidpoints[bucketEntries[k]] = match == k ? uniqueCount++ : triMidpoints[bucketEntries[match]];
+			}
+			edgeStart[v + 1] = uniqueCount;
+		}
+	});
+	for (uint32 v = 0; v < vertexCount; ++v)
+		edgeStart[v + 1] += edgeStart[v];
+
+	uint32 edgeCount = edgeStart[vertexCount];
+	std::vector<uint32> edgeEnds(edgeCount * 2);
+	ParallelFor(vertexCount, ParallelGrainSize, [&](uint32 begin, uint32 end)
+	{
+		for (uint32 v = begin; v < end; ++v)
+		{
+			for (uint32 k = bucketStart[v]; k < bucketStart[v + 1]; ++k)
+			{
+				uint32 slot = bucketEntries[k];
+				uint32 edge = edgeStart[v] + triMidpoints[slot];
+				edgeEnds[edge * 2] = v;
+				edgeEnds[edge * 2 + 1] = upperVertex(slot);
+				triMidpoints[slot] = vertexCount + edge;
+			}
+		}
+	});
+
+	//
+	// Generate the midpoints.
+	//
+
+	meshData.Vertices.resize(vertexCount + edgeCount);
+
+	Vertex* vertices = meshData.Vertices.data();
+	ParallelFor(edgeCount, ParallelGrainSize, [&](uint32 begin, uint32 end)
+	{
+		for (uint32 e = begin; e < end; ++e)
+			vertices[vertexCount + e] = MidPoint(vertices[edgeEnds[e * 2]], vertices[edgeEnds[e * 2 + 1]]);
+	});
+
+	//
+	// Add new geometry.
+	//
+
+	std::vector<uint32> indices(numTris * 12);
+	ParallelFor(numTris, ParallelGrainSize, [&](uint32 begin, uint32 end)
+	{
+		for (uint32 i = begin; i < end; ++i)
+		{
+			uint32 v0 = inputIndices[i * 3 + 0];
+			uint32 v1 = inputIndices[i * 3 + 1];
+			uint32 v2 = inputIndices[i * 3 + 2];
+			uint32 m0 = triMidpoints[i * 3 + 0];
+			uint32 m1 = triMidpoints[i * 3 + 1];
+			uint32 m2 = triMidpoints[i * 3 + 2];
+
+			uint32* k = &indices[i * 12];
+			k[0] = v0; k[1] = m0; k[2] = m2;
+			k[3] = m0; k[4] = m1; k[5] = m2;
+			k[6] = m2; k[7] = m1; k[8] = v2;
+			k[9] = m0; k[10] = v1; k[11] = m1;
+		}
+	});
+
+	meshData.Indices32.swap(indices);
 }
 
 Vertex GeometryGenerator::MidPoint(const Vertex& v0, const Vertex& v1)
@@ -305,7 +427,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
 	MeshData meshData;
 
 	// Put a cap on the number of subdivisions.
-	numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+	numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
 
 	// Approximate a sphere by tessellating an icosahedron.
 
@@ -340,37 +462,42 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
 		Subdivide(meshData);
 
 	// Project vertices onto sphere and scale.
-	for (uint32 i = 0; i < meshData.Vertices.size(); ++i)
+	ParallelFor((uint32)meshData.Vertices.size(), ParallelGrainSize, [&](uint32 begin, uint32 end)
 	{
-		// Project onto unit sphere.
-		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Pos));
+		for (uint32 i = begin; i < end; ++i)
+		{
+			Vertex& v = meshData.Vertices[i];
 
-		// Project onto sphere.
-		XMVECTOR p = radius * n;
+			// Project onto unit sphere.
+			XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&v.Pos));
 
-		XMStoreFloat3(&meshData.Vertices[i].Pos, p);
-		XMStoreFloat3(&meshData.Vertices[i].Normal, n);
+			// Project onto sphere.
+			XMVECTOR p = radius * n;
 
-		// Derive texture coordinates from spherical coordinates.
-		float theta = atan2f(meshData.Vertices[i].Pos.z, meshData.Vertices[i].Pos.x);
+			XMStoreFloat3(&v.Pos, p);
+			XMStoreFloat3(&v.Normal, n);
 
-		// Put in [0, 2pi).
-		if (theta < 0.0f)
-			theta += XM_2PI;
+			// Derive texture coordinates from spherical coordinates.
+			float theta = atan2f(v.Pos.z, v.Pos.x);
 
-		float phi = acosf(meshData.Vertices[i].Pos.y / radius);  // [-pi, pi]
+			// Put in [0, 2pi).
+			if (theta < 0.0f)
+				theta += XM_2PI;
 
-		meshData.Vertices[i].TexC.x = theta / XM_2PI;
-		meshData.Vertices[i].TexC.y = phi / XM_PI;
+			float phi = acosf(v.Pos.y / radius);  // [-pi, pi]
 
-		// Partial derivative of P with respect to theta
-		meshData.Vertices[i].TangentU.x = -radius * sinf(phi)*sinf(theta);
-		meshData.Vertices[i].TangentU.y = 0.0f;
-		meshData.Vertices[i].TangentU.z = +radius * sinf(phi)*cosf(theta);
+			v.TexC.x = theta / XM_2PI;
+			v.TexC.y = phi / XM_PI;
 
-		XMVECTOR T = XMLoadFloat3(&meshData.Vertices[i].TangentU);
-		XMStoreFloat3(&meshData.Vertices[i].TangentU, XMVector3Normalize(T));
-	}
+			// Partial derivative of P with respect to theta
+			v.TangentU.x = -radius * sinf(phi)*sinf(theta);
+			v.TangentU.y = 0.0f;
+			v.TangentU.z = +radius * sinf(phi)*cosf(theta);
+
+			XMVECTOR T = XMLoadFloat3(&v.TangentU);
+			XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
+		}
+	});
 
 	return meshData;
 }
@@ -390,78 +517,92 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 
 	uint32 ringCount = stackCount + 1;
 
+	// Add one because we duplicate the first and last vertex per ring
+	// since the texture coordinates are different.
+	uint32 ringVertexCount = sliceCount + 1;
+
+	// Each cap adds a ring and a center vertex plus a fan of sliceCount
+	// triangles.  Reserve for them so they can be appended without growing.
+	uint32 stackVertexCount = ringCount * ringVertexCount;
+	uint32 stackIndexCount = stackCount * sliceCount * 6;
+	meshData.Vertices.reserve(stackVertexCount + 2 * (ringVertexCount + 1));
+	meshData.Indices32.reserve(stackIndexCount + 2 * sliceCount * 3);
+	meshData.Vertices.resize(stackVertexCount);
+	meshData.Indices32.resize(stackIndexCount);
+
 	// Compute vertices for each stack ring starting at the bottom and moving up.
-	for (uint32 i = 0; i < ringCount; ++i)
+	ParallelFor(ringCount, RowGrainSize(ringVertexCount), [&](uint32 begin, uint32 end)
 	{
-		float y = -0.5f*height + i * stackHeight;
-		float r = bottomRadius + i * radiusStep;
-
-		// vertices of ring
-		float dTheta = 2.0f*XM_PI / sliceCount;
-		for (uint32 j = 0; j <= sliceCount; ++j)
+		for (uint32 i = begin; i < end; ++i)
 		{
-			Vertex vertex;
-
-			float c = cosf(j*dTheta);
-			float s = sinf(j*dTheta);
-
-			vertex.Pos = XMFLOAT3(r*c, y, r*s);
-
-			vertex.TexC.x = (float)j / sliceCount;
-			vertex.TexC.y = 1.0f - (float)i / stackCount;
-
-			// Cylinder can be parameterized as follows, where we introduce v
-			// parameter that goes in the same direction as the v tex-coord
-			// so that the bitangent goes in the same direction as the v tex-coord.
-			//   Let r0 be the bottom radius and let r1 be the top radius.
-			//   y(v) = h - hv for v in [0,1].
-			//   r(v) = r1 + (r0-r1)v
-			//
-			//   x(t, v) = r(v)*cos(t)
-			//   y(t, v) = h - hv
-			//   z(t, v) = r(v)*sin(t)
-			// 
-			//  dx/dt = -r(v)*sin(t)
-			//  dy/dt = 0
-			//  dz/dt = +r(v)*cos(t)
-			//
-			//  dx/dv = (r0-r1)*cos(t)
-			//  dy/dv = -h
-			//  dz/dv = (r0-r1)*sin(t)
-
-			// This is unit length.
-			vertex.TangentU = XMFLOAT3(-s, 0.0f, c);
-
-			float dr = bottomRadius - topRadius;
-			XMFLOAT3 bitangent(dr*c, -height, dr*s);
-
-			XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
-			XMVECTOR B = XMLoadFloat3(&bitangent);
-			XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
-			XMStoreFloat3(&vertex.Normal, N);
-
-			meshData.Vertices.push_back(vertex);
+			float y = -0.5f*height + i * stackHeight;
+			float r = bottomRadius + i * radiusStep;
+
+			// vertices of ring
+			float dTheta = 2.0f*XM_PI / sliceCount;
+			for (uint32 j = 0; j <= sliceCount; ++j)
+			{
+				Vertex& vertex = meshData.Vertices[i*ringVertexCount + j];
+
+				float c = cosf(j*dTheta);
+				float s = sinf(j*dTheta);
+
+				vertex.Pos = XMFLOAT3(r*c, y, r*s);
+
+				vertex.TexC.x = (float)j / sliceCount;
+				vertex.TexC.y = 1.0f - (float)i / stackCount;
+
+				// Cylinder can be parameterized as follows, where we introduce v
+				// parameter that goes in the same direction as the v tex-coord
+				// so that the bitangent goes in the same direction as the v tex-coord.
+				//   Let r0 be the bottom radius and let r1 be the top radius.
+				//   y(v) = h - hv for v in [0,1].
+				//   r(v) = r1 + (r0-r1)v
+				//
+				//   x(t, v) = r(v)*cos(t)
+				//   y(t, v) = h - hv
+				//   z(t, v) = r(v)*sin(t)
+				// 
+				//  dx/dt = -r(v)*sin(t)
+				//  dy/dt = 0
+				//  dz/dt = +r(v)*cos(t)
+				//
+				//  dx/dv = (r0-r1)*cos(t)
+				//  dy/dv = -h
+				//  dz/dv = (r0-r1)*sin(t)
+
+				// This is unit length.
+				vertex.TangentU = XMFLOAT3(-s, 0.0f, c);
+
+				float dr = bottomRadius - topRadius;
+				XMFLOAT3 bitangent(dr*c, -height, dr*s);
+
+				XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
+				XMVECTOR B = XMLoadFloat3(&bitangent);
+				XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
+				XMStoreFloat3(&vertex.Normal, N);
+			}
 		}
-	}
-
-	// Add one because we duplicate the first and last vertex per ring
-	// since the texture coordinates are different.
-	uint32 ringVertexCount = sliceCount + 1;
+	});
 
 	// Compute indices for each stack.
-	for (uint32 i = 0; i < stackCount; ++i)
+	ParallelFor(stackCount, RowGrainSize(sliceCount * 2), [&](uint32 begin, uint32 end)
 	{
-		for (uint32 j = 0; j < sliceCount; ++j)
+		for (uint32 i = begin; i < end; ++i)
 		{
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i + 1)*ringVertexCount + j);
-			meshData.Indices32.push_back((i + 1)*ringVertexCount + j + 1);
-
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i + 1)*ringVertexCount + j + 1);
-			meshData.Indices32.push_back(i*ringVertexCount + j + 1);
+			uint32* k = &meshData.Indices32[i * sliceCount * 6];
+			for (uint32 j = 0; j < sliceCount; ++j)
+			{
+				*k++ = i * ringVertexCount + j;
+				*k++ = (i + 1)*ringVertexCount + j;
+				*k++ = (i + 1)*ringVertexCount + j + 1;
+
+				*k++ = i * ringVertexCount + j;
+				*k++ = (i + 1)*ringVertexCount + j + 1;
+				*k++ = i * ringVertexCount + j + 1;
+			}
 		}
-	}
+	});
 
 	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
 	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
@@ -565,22 +706,25 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 	float dv = 1.0f / (m - 1);
 
 	meshData.Vertices.resize(vertexCount);
-	for (uint32 i = 0; i < m; ++i)
+	ParallelFor(m, RowGrainSize(n), [&](uint32 begin, uint32 end)
 	{
-		float z = halfDepth - i * dz;
-		for (uint32 j = 0; j < n; ++j)
+		for (uint32 i = begin; i < end; ++i)
 		{
-			float x = -halfWidth + j * dx;
-
-			meshData.Vertices[i*n + j].Pos = XMFLOAT3(x, 0.0f, z);
-			meshData.Vertices[i*n + j].Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
-			meshData.Vertices[i*n + j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
-
-			// Stretch texture over grid.
-			meshData.Vertices[i*n + j].TexC.x = j * du;
-			meshData.Vertices[i*n + j].TexC.y = i * dv;
+			float z = halfDepth - i * dz;
+			for (uint32 j = 0; j < n; ++j)
+			{
+				float x = -halfWidth + j * dx;
+
+				meshData.Vertices[i*n + j].Pos = XMFLOAT3(x, 0.0f, z);
+				meshData.Vertices[i*n + j].Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+				meshData.Vertices[i*n + j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
+
+				// Stretch texture over grid.
+				meshData.Vertices[i*n + j].TexC.x = j * du;
+				meshData.Vertices[i*n + j].TexC.y = i * dv;
+			}
 		}
-	}
+	});
 
 	//
 	// Create the indices.
@@ -588,23 +732,26 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 
 	meshData.Indices32.resize(faceCount * 3); // 3 indices per face
 
-	// Iterate over each quad and compute indices.
-	uint32 k = 0;
-	for (uint32 i = 0; i < m - 1; ++i)
+	// Iterate over each quad and compute indices.  Row i starts at quad i*(n-1).
+	ParallelFor(m - 1, RowGrainSize((n - 1) * 2), [&](uint32 begin, uint32 end)
 	{
-		for (uint32 j = 0; j < n - 1; ++j)
+		for (uint32 i = begin; i < end; ++i)
 		{
-			meshData.Indices32[k] = i * n + j;
-			meshData.Indices32[k + 1] = i * n + j + 1;
-			meshData.Indices32[k + 2] = (i + 1)*n + j;
-
-			meshData.Indices32[k + 3] = (i + 1)*n + j;
-			meshData.Indices32[k + 4] = i * n + j + 1;
-			meshData.Indices32[k + 5] = (i + 1)*n + j + 1;
-
-			k += 6; // next quad
+			uint32 k = i * (n - 1) * 6;
+			for (uint32 j = 0; j < n - 1; ++j)
+			{
+				meshData.Indices32[k] = i * n + j;
+				meshData.Indices32[k + 1] = i * n + j + 1;
+				meshData.Indices32[k + 2] = (i + 1)*n + j;
+
+				meshData.Indices32[k + 3] = (i + 1)*n + j;
+				meshData.Indices32[k + 4] = i * n + j + 1;
+				meshData.Indices32[k + 5] = (i + 1)*n + j + 1;
+
+				k += 6; // next quad
+			}
 		}
-	}
+	});
 
 	return meshData;
 }
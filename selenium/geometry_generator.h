@@ -1,9 +1,15 @@
 #pragma once
 #include <cstdint>
 #include <DirectXMath.h>
+#include <functional>
 #include <vector>
 #include "vertex.h"
 
+class JobSystem;
+
+// Every generator computes its exact vertex and index counts up front and
+// writes into pre-sized arrays, so large meshes never reallocate while they
+// are built.
 class GeometryGenerator
 {
 public:
@@ -11,6 +17,11 @@ public:
 	using uint16 = std::uint16_t;
 	using uint32 = std::uint32_t;
 
+	// Upper bound on numSubdivisions for CreateBox and CreateGeosphere.  Each
+	// level quadruples the triangle count; a geosphere at the cap has 81920
+	// triangles over 40962 vertices, so it still fits 16-bit indices.
+	static constexpr uint32 MaxSubdivisions = 6;
+
 	class MeshData
 	{
 	public:
@@ -55,7 +66,16 @@ public:
 	// Creates a quad aligned with the screen.  This is useful for postprocessing and screen effects.
 	MeshData CreateQuad(float x, float y, float w, float h, float depth);
 
+public:
+	// Fills rows and triangle ranges of large meshes in parallel.  Everything
+	// runs on the calling thread if this is null.
+	JobSystem* Jobs = nullptr;
+
 private:
+	void ParallelFor(uint32 count, uint32 grainSize, const std::function<void(uint32, uint32)>& func);
+
+	// Splits every triangle into four.  Midpoints are shared between the
+	// triangles of an edge, so the output has exactly V + E vertices.
 	void Subdivide(MeshData& meshData);
 	Vertex MidPoint(const Vertex& v0, const Vertex& v1);
 	void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
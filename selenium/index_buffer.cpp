@@ -0,0 +1,94 @@
+#include "index_buffer.h"
+
+namespace
+{
+	const std::uint32_t MaxIndex16 = 0xffff;
+}
+
+UINT PackedIndices::IndexCount()const
+{
+	return Format == DXGI_FORMAT_R16_UINT ? (UINT)Indices16.size() : (UINT)Indices32.size();
+}
+
+UINT PackedIndices::ByteSize()const
+{
+	return IndexCount() * IndexStrideInBytes(Format);
+}
+
+const void* PackedIndices::Data()const
+{
+	if (Format == DXGI_FORMAT_R16_UINT)
+		return Indices16.data();
+	return Indices32.data();
+}
+
+UINT IndexStrideInBytes(DXGI_FORMAT format)
+{
+	return format == DXGI_FORMAT_R16_UINT ? 2 : 4;
+}
+
+void PackIndices(const std::uint32_t* indices, UINT indexCount,
+	SubmeshGeometry* submeshes, UINT submeshCount, PackedIndices& packed)
+{
+	packed.Indices16.clear();
+	packed.Indices32.clear();
+
+	std::uint32_t maxIndex = 0;
+	for (UINT i = 0; i < indexCount; ++i)
+		maxIndex = indices[i] > maxIndex ? indices[i] : maxIndex;
+
+	// Subtracted from every index, per index.  Stays empty if no rebasing is
+	// needed.
+	std::vector<std::uint32_t> rebase;
+
+	bool fits16 = maxIndex <= MaxIndex16;
+	if (!fits16)
+	{
+		rebase.assign(indexCount, 0);
+		std::vector<std::uint32_t> submeshMin(submeshCount, 0);
+
+		fits16 = true;
+		for (UINT s = 0; s < submeshCount && fits16; ++s)
+		{
+			const SubmeshGeometry& submesh = submeshes[s];
+			if (submesh.IndexCount == 0)
+				continue;
+
+			std::uint32_t lo = UINT32_MAX;
+			std::uint32_t hi = 0;
+			for (UINT i = submesh.StartIndexLocation; i < submesh.StartIndexLocation + submesh.IndexCount; ++i)
+			{
+				lo = indices[i] < lo ? indices[i] : lo;
+				hi = indices[i] > hi ? indices[i] : hi;
+			}
+
+			fits16 = hi - lo <= MaxIndex16;
+			submeshMin[s] = lo;
+			for (UINT i = submesh.StartIndexLocation; i < submesh.StartIndexLocation + submesh.IndexCount; ++i)
+				rebase[i] = lo;
+		}
+
+		// Indices outside every submesh keep their value.
+		for (UINT i = 0; i < indexCount && fits16; ++i)
+			fits16 = indices[i] - rebase[i] <= MaxIndex16;
+
+		if (fits16)
+		{
+			for (UINT s = 0; s < submeshCount; ++s)
+				submeshes[s].BaseVertexLocation += (INT)submeshMin[s];
+		}
+	}
+
+	if (fits16)
+	{
+		packed.Format = DXGI_FORMAT_R16_UINT;
+		packed.Indices16.resize(indexCount);
+		for (UINT i = 0; i < indexCount; ++i)
+			packed.Indices16[i] = (std::uint16_t)(rebase.empty() ? indices[i] : indices[i] - rebase[i]);
+	}
+	else
+	{
+		packed.Format = DXGI_FORMAT_R32_UINT;
+		packed.Indices32.assign(indices, indices + indexCount);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <Windows.h>
+#include <cstdint>
+#include <vector>
+#include "mesh_geometry.h"
+
+// Index data in the narrowest format that can address its vertices.  Only one
+// of Indices16 and Indices32 is filled, depending on Format.
+struct PackedIndices
+{
+	DXGI_FORMAT Format = DXGI_FORMAT_R16_UINT;
+	std::vector<std::uint16_t> Indices16;
+	std::vector<std::uint32_t> Indices32;
+
+	UINT IndexCount()const;
+	UINT ByteSize()const;
+	const void* Data()const;
+};
+
+// Bytes per index of an index buffer format.
+UINT IndexStrideInBytes(DXGI_FORMAT format);
+
+// Packs 32-bit indices into DXGI_FORMAT_R16_UINT when every index is below
+// 65536, otherwise tries to rebase the submeshes: the smallest vertex each
+// submesh references is moved into its BaseVertexLocation and subtracted from
+// its indices, so a mesh with more than 65536 vertices still gets 16-bit
+// indices as long as no single submesh spans more than that.  If that fails
+// too the indices are kept as DXGI_FORMAT_R32_UINT and the submeshes are left
+// untouched.
+//
+// The submeshes describe ranges of indices and must not overlap.  Indices not
+// covered by any submesh are never rebased.
+void PackIndices(const std::uint32_t* indices, UINT indexCount,
+	SubmeshGeometry* submeshes, UINT submeshCount, PackedIndices& packed);
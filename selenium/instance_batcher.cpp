@@ -0,0 +1,119 @@
+#include "instance_batcher.h"
+#include <functional>
+
+bool InstanceBatcher::DrawKey::operator==(const DrawKey& rhs)const
+{
+	return Geo == rhs.Geo &&
+		StartIndexLocation == rhs.StartIndexLocation &&
+		BaseVertexLocation == rhs.BaseVertexLocation &&
+		IndexCount == rhs.IndexCount &&
+		PrimitiveTopology == rhs.PrimitiveTopology &&
+		SkinnedCBIndex == rhs.SkinnedCBIndex;
+}
+
+size_t InstanceBatcher::DrawKeyHash::operator()(const DrawKey& key)const
+{
+	// FNV-1a style mixing in 64 bits, so the prime works the same whatever
+	// the width of size_t.
+	UINT64 h = std::hash<const MeshGeometry*>()(key.Geo);
+	UINT fields[] = { key.StartIndexLocation, (UINT)key.BaseVertexLocation, key.IndexCount,
+		key.PrimitiveTopology, key.SkinnedCBIndex };
+	for (UINT field : fields)
+		h = (h ^ field) * 1099511628211ull;
+	return (size_t)(h ^ (h >> 32));
+}
+
+InstanceBatcher::DrawKey InstanceBatcher::MakeKey(const RenderItemDraw& draw)
+{
+	DrawKey key;
+	key.Geo = draw.Geo;
+	key.StartIndexLocation = draw.StartIndexLocation;
+	key.BaseVertexLocation = draw.BaseVertexLocation;
+	key.IndexCount = draw.IndexCount;
+	key.PrimitiveTopology = (UINT)draw.PrimitiveTopology;
+	key.SkinnedCBIndex = draw.SkinnedCBIndex;
+	return key;
+}
+
+bool InstanceBatcher::Build(const std::vector<UINT>& items, const std::vector<RenderItemDraw>& draws)
+{
+	// Comparing the draws is a fraction of the cost of grouping them, and
+	// most frames neither the visible list nor the levels of detail change.
+	mNewKeys.resize(items.size());
+	for (size_t i = 0; i < items.size(); ++i)
+		mNewKeys[i] = MakeKey(draws[items[i]]);
+
+	if (mVersion != 0 && items == mItems && mNewKeys == mItemKeys)
+		return false;
+
+	mItems = items;
+	mItemKeys.swap(mNewKeys);
+	++mVersion;
+
+	mSingleItems.clear();
+	mBatches.clear();
+	mInstances.clear();
+
+	mGroupIndex.clear();
+	mGroupKeys.clear();
+	mGroupSizes.clear();
+
+	// Find the group of every item.  Hashing keeps this linear in the item
+	// count; sorting the items by their draw state took several times longer.
+	mItemGroups.resize(items.size());
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		const DrawKey& key = mItemKeys[i];
+
+		auto inserted = mGroupIndex.emplace(key, (UINT)mGroupKeys.size());
+		if (inserted.second)
+		{
+			mGroupKeys.push_back(key);
+			mGroupSizes.push_back(0);
+		}
+
+		UINT group = inserted.first->second;
+		mItemGroups[i] = group;
+		++mGroupSizes[group];
+	}
+
+	// Place the items group by group, keeping their list order in each.
+	UINT groupCount = (UINT)mGroupKeys.size();
+	mGroupStarts.resize(groupCount);
+	UINT start = 0;
+	for (UINT group = 0; group < groupCount; ++group)
+	{
+		mGroupStarts[group] = start;
+		start += mGroupSizes[group];
+	}
+
+	mGroupedItems.resize(items.size());
+	for (size_t i = 0; i < items.size(); ++i)
+		mGroupedItems[mGroupStarts[mItemGroups[i]]++] = items[i];
+
+	UINT first = 0;
+	for (UINT group = 0; group < groupCount; ++group)
+	{
+		UINT count = mGroupSizes[group];
+		auto begin = mGroupedItems.begin() + first;
+
+		if (count < MinInstances || mGroupKeys[group].SkinnedCBIndex != UINT(-1))
+		{
+			mSingleItems.insert(mSingleItems.end(), begin, begin + count);
+		}
+		else
+		{
+			InstanceBatch batch;
+			batch.Item = *begin;
+			batch.FirstInstance = (UINT)mInstances.size();
+			batch.InstanceCount = count;
+			mBatches.push_back(batch);
+
+			mInstances.insert(mInstances.end(), begin, begin + count);
+		}
+
+		first += count;
+	}
+
+	return true;
+}
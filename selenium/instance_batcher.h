@@ -0,0 +1,93 @@
+#pragma once
+#include <Windows.h>
+#include <unordered_map>
+#include <vector>
+#include "render_item_store.h"
+
+// Items drawn by one DrawIndexedInstanced.
+struct InstanceBatch
+{
+	// An item of the batch; they all share its geometry and index range.
+	UINT Item = 0;
+
+	// The items are Instances()[FirstInstance, FirstInstance + InstanceCount).
+	UINT FirstInstance = 0;
+	UINT InstanceCount = 0;
+};
+
+// Groups the items of a draw list that draw the same index range of the
+// same geometry, so that each group takes one instanced draw.  It only reads
+// the store's draw state and records no commands, so the draws it saves can
+// be counted without a device.
+//
+// Skinned items and groups smaller than MinInstances are left to be drawn
+// one item at a time, keeping meshlet culling.
+//
+// Batches hold item indices, not copies of the items' data, so they only
+// change when the list or the draw state of its items does; Build keeps the
+// previous batches then.
+class InstanceBatcher
+{
+public:
+	UINT MinInstances = 2;
+
+	// Returns false if the list and its items' draws are the same as last
+	// time, keeping the batches.
+	bool Build(const std::vector<UINT>& items, const std::vector<RenderItemDraw>& draws);
+
+	// Counts the builds that changed the batches.
+	UINT64 Version()const { return mVersion; }
+
+	// Items drawn on their own.
+	const std::vector<UINT>& SingleItems()const { return mSingleItems; }
+
+	const std::vector<InstanceBatch>& Batches()const { return mBatches; }
+
+	// Items of all batches, batch after batch.
+	const std::vector<UINT>& Instances()const { return mInstances; }
+
+	// Draws the list takes: one per single item and one per batch.
+	UINT DrawCount()const { return (UINT)(mSingleItems.size() + mBatches.size()); }
+
+private:
+	// The draw state items must share to be instanced together.
+	struct DrawKey
+	{
+		const MeshGeometry* Geo;
+		UINT StartIndexLocation;
+		int BaseVertexLocation;
+		UINT IndexCount;
+		UINT PrimitiveTopology;
+		UINT SkinnedCBIndex;
+
+		bool operator==(const DrawKey& rhs)const;
+	};
+
+	struct DrawKeyHash
+	{
+		size_t operator()(const DrawKey& key)const;
+	};
+
+	static DrawKey MakeKey(const RenderItemDraw& draw);
+
+private:
+	// The list of the last build and the draw of each of its items.
+	std::vector<UINT> mItems;
+	std::vector<DrawKey> mItemKeys;
+	std::vector<DrawKey> mNewKeys;
+	UINT64 mVersion = 0;
+
+	// Group of each distinct draw, in order of first use.
+	std::unordered_map<DrawKey, UINT, DrawKeyHash> mGroupIndex;
+	std::vector<DrawKey> mGroupKeys;
+	std::vector<UINT> mGroupSizes;
+	std::vector<UINT> mGroupStarts;
+
+	// Group of each item of the list, and the items ordered by group.
+	std::vector<UINT> mItemGroups;
+	std::vector<UINT> mGroupedItems;
+
+	std::vector<UINT> mSingleItems;
+	std::vector<InstanceBatch> mBatches;
+	std::vector<UINT> mInstances;
+};
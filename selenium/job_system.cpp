@@ -0,0 +1,157 @@
+#include "job_system.h"
+#include <algorithm>
+
+namespace
+{
+	// Queue index of the current thread, 0 for threads outside the pool.
+	thread_local UINT tQueueIndex = 0;
+	thread_local const void* tOwner = nullptr;
+}
+
+JobSystem::JobSystem(UINT workerCount)
+{
+	if (workerCount == 0)
+	{
+		UINT hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (UINT i = 0; i < workerCount + 1; ++i)
+		mQueues.push_back(std::make_unique<WorkQueue>());
+
+	for (UINT i = 1; i <= workerCount; ++i)
+		mWorkers.emplace_back(&JobSystem::WorkerMain, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStopping = true;
+	}
+	mWakeCondition.notify_all();
+
+	for (auto& worker : mWorkers)
+		worker.join();
+}
+
+UINT JobSystem::ThreadCount()const
+{
+	return (UINT)mWorkers.size() + 1;
+}
+
+UINT JobSystem::CurrentQueueIndex()const
+{
+	return tOwner == this ? tQueueIndex : 0;
+}
+
+void JobSystem::Run(JobCounter& counter, std::function<void()> job)
+{
+	counter.Pending.fetch_add(1);
+
+	WorkQueue& queue = *mQueues[CurrentQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Jobs.push_back(Job{ std::move(job), &counter });
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mQueuedJobs.fetch_add(1);
+	}
+	mWakeCondition.notify_one();
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	UINT queueIndex = CurrentQueueIndex();
+	while (counter.Pending.load() > 0)
+	{
+		// Help out instead of sleeping; the jobs we are waiting on may be
+		// sitting in a queue nobody else has reached yet.
+		if (!TryRunJob(queueIndex))
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(UINT count, UINT grainSize, const std::function<void(UINT, UINT)>& func)
+{
+	if (count == 0)
+		return;
+
+	grainSize = std::max<UINT>(grainSize, 1);
+
+	// Not worth a trip through the queues.
+	if (count <= grainSize || mWorkers.empty())
+	{
+		func(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (UINT begin = 0; begin < count; begin += grainSize)
+	{
+		UINT end = std::min<UINT>(begin + grainSize, count);
+		Run(counter, [&func, begin, end]() { func(begin, end); });
+	}
+	Wait(counter);
+}
+
+bool JobSystem::TryRunJob(UINT queueIndex)
+{
+	Job job;
+	bool found = false;
+
+	// Own queue first, newest job (LIFO keeps the working set warm).
+	{
+		WorkQueue& queue = *mQueues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (!queue.Jobs.empty())
+		{
+			job = std::move(queue.Jobs.back());
+			queue.Jobs.pop_back();
+			found = true;
+		}
+	}
+
+	// Otherwise steal the oldest job of another queue.
+	for (UINT i = 1; !found && i < (UINT)mQueues.size(); ++i)
+	{
+		WorkQueue& victim = *mQueues[(queueIndex + i) % mQueues.size()];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Jobs.empty())
+		{
+			job = std::move(victim.Jobs.front());
+			victim.Jobs.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	mQueuedJobs.fetch_sub(1);
+
+	job.Func();
+	job.Counter->Pending.fetch_sub(1);
+
+	return true;
+}
+
+void JobSystem::WorkerMain(UINT queueIndex)
+{
+	tQueueIndex = queueIndex;
+	tOwner = this;
+
+	while (true)
+	{
+		if (TryRunJob(queueIndex))
+			continue;
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWakeCondition.wait(lock, [this]() { return mStopping.load() || mQueuedJobs.load() > 0; });
+
+		if (mStopping)
+			return;
+	}
+}
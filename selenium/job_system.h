@@ -0,0 +1,69 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the outstanding jobs of a group.  Pass the same counter to every
+// JobSystem::Run call of the group and wait on it with JobSystem::Wait.
+struct JobCounter
+{
+	std::atomic<int> Pending{ 0 };
+};
+
+// A fixed pool of worker threads with one job deque per thread.  Threads pop
+// their own newest job first and steal the oldest job of another thread when
+// they run dry, so a ParallelFor that is split into many chunks balances
+// itself across cores.  A thread that waits on a counter keeps executing jobs
+// instead of blocking, which makes it safe to wait from inside a job.
+class JobSystem
+{
+public:
+	// workerCount == 0 uses one worker per hardware thread, minus the calling thread.
+	explicit JobSystem(UINT workerCount = 0);
+	JobSystem(const JobSystem& rhs) = delete;
+	JobSystem& operator=(const JobSystem& rhs) = delete;
+	~JobSystem();
+
+	// Number of threads that execute jobs, including the thread that waits.
+	UINT ThreadCount()const;
+
+	void Run(JobCounter& counter, std::function<void()> job);
+	void Wait(JobCounter& counter);
+
+	// Calls func(begin, end) for consecutive ranges of at most grainSize items
+	// covering [0, count) and returns when all of them have completed.
+	void ParallelFor(UINT count, UINT grainSize, const std::function<void(UINT, UINT)>& func);
+
+private:
+	struct Job
+	{
+		std::function<void()> Func;
+		JobCounter* Counter = nullptr;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::deque<Job> Jobs;
+	};
+
+	void WorkerMain(UINT queueIndex);
+	bool TryRunJob(UINT queueIndex);
+	UINT CurrentQueueIndex()const;
+
+private:
+	// Queue 0 belongs to threads outside the pool; workers own 1..N.
+	std::vector<std::unique_ptr<WorkQueue>> mQueues;
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mWakeMutex;
+	std::condition_variable mWakeCondition;
+	std::atomic<int> mQueuedJobs{ 0 };
+	std::atomic<bool> mStopping{ false };
+};
@@ -0,0 +1,583 @@
+#include "m3d_binary.h"
+#include <cstring>
+#include <fstream>
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+using namespace DirectX;
+
+namespace
+{
+	const char M3dbMagic[4] = { 'M', '3', 'D', 'B' };
+	const UINT M3dbVersion = 4;
+
+	struct MaterialRecord
+	{
+		XMFLOAT4 DiffuseAlbedo;
+		XMFLOAT3 FresnelR0;
+		float Roughness;
+		UINT AlphaClip;
+
+		// Offsets into the string table.
+		UINT Name;
+		UINT MaterialTypeName;
+		UINT DiffuseMapName;
+		UINT NormalMapName;
+	};
+
+	struct ClipRecord
+	{
+		UINT Name;
+
+		// NumBones TrackRecords starting here.
+		UINT FirstTrack;
+	};
+
+	struct TrackRecord
+	{
+		UINT FirstKeyframe;
+		UINT KeyframeCount;
+	};
+
+	// Builds the file in memory, keeping every section 16 byte aligned.
+	class BlobWriter
+	{
+	public:
+		UINT64 Append(const void* data, size_t byteSize)
+		{
+			mBytes.resize((mBytes.size() + 15) & ~size_t(15));
+			UINT64 offset = mBytes.size();
+			mBytes.resize(mBytes.size() + byteSize);
+			if (byteSize > 0)
+				std::memcpy(&mBytes[offset], data, byteSize);
+			return offset;
+		}
+
+		template<typename T>
+		UINT64 Append(const std::vector<T>& v)
+		{
+			return Append(v.data(), v.size() * sizeof(T));
+		}
+
+		std::vector<char>& Bytes() { return mBytes; }
+
+	private:
+		std::vector<char> mBytes;
+	};
+
+	// Size and last write time of a file, or false if it does not exist.
+	bool GetFileStamp(const std::string& filename, UINT64& size, UINT64& writeTime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes))
+			return false;
+
+		size = ((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		writeTime = ((UINT64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	class StringTable
+	{
+	public:
+		UINT Add(const std::string& s)
+		{
+			UINT offset = (UINT)mChars.size();
+			mChars.insert(mChars.end(), s.begin(), s.end());
+			mChars.push_back('\0');
+			return offset;
+		}
+
+		const std::vector<char>& Chars()const { return mChars; }
+
+	private:
+		std::vector<char> mChars;
+	};
+}
+
+struct M3DBinaryFile::FileHeader
+{
+	char Magic[4];
+	UINT Version;
+
+	// Catch layout changes of the structs stored as is.
+	UINT VertexStride;
+	UINT KeyframeStride;
+
+	// 2 or 4.
+	UINT IndexStride;
+
+	UINT NumMaterials;
+	UINT NumSubsets;
+	UINT NumLods;
+	UINT NumVertices;
+	UINT NumIndices;
+	UINT NumBones;
+	UINT NumClips;
+	UINT NumKeyframes;
+	UINT StringsSize;
+
+	// The .m3d this was converted from, zero if unknown.
+	UINT64 SourceSize;
+	UINT64 SourceWriteTime;
+
+	UINT64 MaterialsOffset;
+	UINT64 SubsetsOffset;
+	UINT64 SubsetBaseVerticesOffset;
+	UINT64 LodsOffset;
+	UINT64 VerticesOffset;
+	UINT64 IndicesOffset;
+	UINT64 BoneOffsetsOffset;
+	UINT64 BoneHierarchyOffset;
+	UINT64 ClipsOffset;
+	UINT64 TracksOffset;
+	UINT64 KeyframesOffset;
+	UINT64 StringsOffset;
+};
+
+M3DBinaryFile::~M3DBinaryFile()
+{
+	Close();
+}
+
+bool M3DBinaryFile::Write(const std::string& filename,
+	const std::vector<SkinnedVertex>& vertices,
+	const std::vector<UINT>& indices,
+	const std::vector<M3DLoader::Subset>& subsets,
+	const std::vector<LodRange>& lods,
+	const std::vector<M3DLoader::MaterialInfo>& mats,
+	const std::vector<XMFLOAT4X4>& boneOffsets,
+	const std::vector<int>& boneHierarchy,
+	const std::unordered_map<std::string, AnimationClip>& animationClips,
+	UINT64 sourceSize, UINT64 sourceWriteTime)
+{
+	UINT numBones = (UINT)boneHierarchy.size();
+
+	// The subsets followed by the levels, each rebased on its own.
+	std::vector<SubmeshGeometry> submeshes(subsets.size() + lods.size());
+	for (size_t i = 0; i < subsets.size(); ++i)
+	{
+		submeshes[i].IndexCount = subsets[i].FaceCount * 3;
+		submeshes[i].StartIndexLocation = subsets[i].FaceStart * 3;
+	}
+	for (size_t i = 0; i < lods.size(); ++i)
+	{
+		submeshes[subsets.size() + i].IndexCount = lods[i].IndexCount;
+		submeshes[subsets.size() + i].StartIndexLocation = lods[i].StartIndexLocation;
+	}
+
+	PackedIndices packedIndices;
+	PackIndices(indices.data(), (UINT)indices.size(), submeshes.data(), (UINT)submeshes.size(), packedIndices);
+
+	std::vector<INT> subsetBaseVertices(subsets.size());
+	for (size_t i = 0; i < subsets.size(); ++i)
+		subsetBaseVertices[i] = submeshes[i].BaseVertexLocation;
+
+	std::vector<LodRange> lodRecords(lods);
+	for (size_t i = 0; i < lods.size(); ++i)
+		lodRecords[i].BaseVertexLocation = submeshes[subsets.size() + i].BaseVertexLocation;
+
+	StringTable strings;
+
+	std::vector<MaterialRecord> materialRecords(mats.size());
+	for (size_t i = 0; i < mats.size(); ++i)
+	{
+		MaterialRecord& r = materialRecords[i];
+		r.DiffuseAlbedo = mats[i].DiffuseAlbedo;
+		r.FresnelR0 = mats[i].FresnelR0;
+		r.Roughness = mats[i].Roughness;
+		r.AlphaClip = mats[i].AlphaClip ? 1 : 0;
+		r.Name = strings.Add(mats[i].Name);
+		r.MaterialTypeName = strings.Add(mats[i].MaterialTypeName);
+		r.DiffuseMapName = strings.Add(mats[i].DiffuseMapName);
+		r.NormalMapName = strings.Add(mats[i].NormalMapName);
+	}
+
+	std::vector<ClipRecord> clipRecords;
+	std::vector<TrackRecord> trackRecords;
+	std::vector<Keyframe> keyframes;
+	for (const auto& clip : animationClips)
+	{
+		ClipRecord clipRecord;
+		clipRecord.Name = strings.Add(clip.first);
+		clipRecord.FirstTrack = (UINT)trackRecords.size();
+		clipRecords.push_back(clipRecord);
+
+		for (UINT i = 0; i < numBones; ++i)
+		{
+			const std::vector<Keyframe>& src = clip.second.BoneAnimations[i].Keyframes;
+
+			TrackRecord track;
+			track.FirstKeyframe = (UINT)keyframes.size();
+			track.KeyframeCount = (UINT)src.size();
+			trackRecords.push_back(track);
+
+			keyframes.insert(keyframes.end(), src.begin(), src.end());
+		}
+	}
+
+	FileHeader header = {};
+	std::memcpy(header.Magic, M3dbMagic, sizeof(M3dbMagic));
+	header.Version = M3dbVersion;
+	header.VertexStride = sizeof(SkinnedVertex);
+	header.KeyframeStride = sizeof(Keyframe);
+	header.IndexStride = IndexStrideInBytes(packedIndices.Format);
+	header.NumMaterials = (UINT)mats.size();
+	header.NumSubsets = (UINT)subsets.size();
+	header.NumLods = (UINT)lodRecords.size();
+	header.NumVertices = (UINT)vertices.size();
+	header.NumIndices = (UINT)indices.size();
+	header.NumBones = numBones;
+	header.NumClips = (UINT)clipRecords.size();
+	header.NumKeyframes = (UINT)keyframes.size();
+	header.StringsSize = (UINT)strings.Chars().size();
+	header.SourceSize = sourceSize;
+	header.SourceWriteTime = sourceWriteTime;
+
+	BlobWriter blob;
+	blob.Append(&header, sizeof(header));
+	header.MaterialsOffset = blob.Append(materialRecords);
+	header.SubsetsOffset = blob.Append(subsets);
+	header.SubsetBaseVerticesOffset = blob.Append(subsetBaseVertices);
+	header.LodsOffset = blob.Append(lodRecords);
+	header.VerticesOffset = blob.Append(vertices);
+	header.IndicesOffset = blob.Append(packedIndices.Data(), packedIndices.ByteSize());
+	header.BoneOffsetsOffset = blob.Append(boneOffsets);
+	header.BoneHierarchyOffset = blob.Append(boneHierarchy);
+	header.ClipsOffset = blob.Append(clipRecords);
+	header.TracksOffset = blob.Append(trackRecords);
+	header.KeyframesOffset = blob.Append(keyframes);
+	header.StringsOffset = blob.Append(strings.Chars());
+
+	// Now that the offsets are known.
+	std::memcpy(blob.Bytes().data(), &header, sizeof(header));
+
+	std::ofstream fout(filename, std::ios::binary);
+	if (!fout)
+		return false;
+
+	fout.write(blob.Bytes().data(), blob.Bytes().size());
+	return (bool)fout;
+}
+
+bool M3DBinaryFile::Convert(const std::string& m3dFilename, const std::string& m3dbFilename,
+	JobSystem* jobs)
+{
+	// Stamp before loading, so a source edited meanwhile is converted again.
+	UINT64 sourceSize = 0;
+	UINT64 sourceWriteTime = 0;
+	if (!GetFileStamp(m3dFilename, sourceSize, sourceWriteTime))
+		return false;
+
+	std::vector<SkinnedVertex> vertices;
+	std::vector<UINT> indices;
+	std::vector<M3DLoader::Subset> subsets;
+	std::vector<M3DLoader::MaterialInfo> mats;
+	std::vector<XMFLOAT4X4> boneOffsets;
+	std::vector<int> boneHierarchy;
+	std::unordered_map<std::string, AnimationClip> animationClips;
+
+	M3DLoader m3dLoader;
+	if (jobs)
+	{
+		m3dLoader.Mode = M3DLoader::ParseMode::Parallel;
+		m3dLoader.Jobs = jobs;
+	}
+	if (!m3dLoader.LoadM3d(m3dFilename, vertices, indices, subsets, mats,
+		boneOffsets, boneHierarchy, animationClips))
+		return false;
+
+	MeshOptimizer meshOptimizer;
+	meshOptimizer.OptimizeSubsets(vertices, indices, subsets);
+
+	std::vector<LodRange> lods;
+	MeshSimplifier meshSimplifier;
+	meshSimplifier.BuildSubsetLods(vertices, indices, subsets, lods);
+
+	return Write(m3dbFilename, vertices, indices, subsets, lods, mats,
+		boneOffsets, boneHierarchy, animationClips, sourceSize, sourceWriteTime);
+}
+
+bool M3DBinaryFile::Open(const std::string& filename)
+{
+	Close();
+
+	mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(FileHeader))
+	{
+		Close();
+		return false;
+	}
+	mSize = (UINT64)fileSize.QuadPart;
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	mBase = (const BYTE*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mBase == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	mHeader = (const FileHeader*)mBase;
+
+	const FileHeader& h = *mHeader;
+	bool valid = std::memcmp(h.Magic, M3dbMagic, sizeof(M3dbMagic)) == 0 &&
+		h.Version == M3dbVersion &&
+		h.VertexStride == sizeof(SkinnedVertex) &&
+		h.KeyframeStride == sizeof(Keyframe) &&
+		(h.IndexStride == sizeof(USHORT) || h.IndexStride == sizeof(UINT));
+
+	// Every section must lie inside the file.
+	auto fits = [this](UINT64 offset, UINT64 count, UINT64 stride)
+	{
+		return offset <= mSize && count * stride <= mSize - offset;
+	};
+	valid = valid &&
+		fits(h.MaterialsOffset, h.NumMaterials, sizeof(MaterialRecord)) &&
+		fits(h.SubsetsOffset, h.NumSubsets, sizeof(M3DLoader::Subset)) &&
+		fits(h.SubsetBaseVerticesOffset, h.NumSubsets, sizeof(INT)) &&
+		fits(h.LodsOffset, h.NumLods, sizeof(LodRange)) &&
+		fits(h.VerticesOffset, h.NumVertices, sizeof(SkinnedVertex)) &&
+		fits(h.IndicesOffset, h.NumIndices, h.IndexStride) &&
+		fits(h.BoneOffsetsOffset, h.NumBones, sizeof(XMFLOAT4X4)) &&
+		fits(h.BoneHierarchyOffset, h.NumBones, sizeof(int)) &&
+		fits(h.ClipsOffset, h.NumClips, sizeof(ClipRecord)) &&
+		fits(h.TracksOffset, (UINT64)h.NumClips * h.NumBones, sizeof(TrackRecord)) &&
+		fits(h.KeyframesOffset, h.NumKeyframes, sizeof(Keyframe)) &&
+		fits(h.StringsOffset, h.StringsSize, 1);
+
+	if (!valid || !RecordsValid())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool M3DBinaryFile::RecordsValid()const
+{
+	const FileHeader& h = *mHeader;
+
+	// Strings are looked up by offset and read up to their terminator.
+	ArrayView<char> strings = View<char>(h.StringsOffset, h.StringsSize);
+	if (!strings.empty() && strings[strings.Size - 1] != '\0')
+		return false;
+	auto validString = [&](UINT offset) { return offset < h.StringsSize; };
+
+	for (const MaterialRecord& m : View<MaterialRecord>(h.MaterialsOffset, h.NumMaterials))
+	{
+		if (!validString(m.Name) || !validString(m.MaterialTypeName) ||
+			!validString(m.DiffuseMapName) || !validString(m.NormalMapName))
+			return false;
+	}
+
+	UINT64 trackCount = (UINT64)h.NumClips * h.NumBones;
+	for (const ClipRecord& c : View<ClipRecord>(h.ClipsOffset, h.NumClips))
+	{
+		if (!validString(c.Name) || (UINT64)c.FirstTrack + h.NumBones > trackCount)
+			return false;
+	}
+
+	// Every track needs a key to sample.
+	for (const TrackRecord& t : View<TrackRecord>(h.TracksOffset, (UINT)trackCount))
+	{
+		if (t.KeyframeCount == 0 || (UINT64)t.FirstKeyframe + t.KeyframeCount > h.NumKeyframes)
+			return false;
+	}
+
+	// Parents come before their children, which the hierarchy pass relies on.
+	ArrayView<int> hierarchy = BoneHierarchy();
+	for (UINT i = 0; i < hierarchy.Size; ++i)
+	{
+		if (hierarchy[i] < -1 || hierarchy[i] >= (int)i)
+			return false;
+	}
+
+	ArrayView<M3DLoader::Subset> subsets = Subsets();
+	ArrayView<INT> baseVertices = SubsetBaseVertices();
+	for (UINT i = 0; i < subsets.Size; ++i)
+	{
+		const M3DLoader::Subset& s = subsets[i];
+		if ((UINT64)s.VertexStart + s.VertexCount > h.NumVertices ||
+			((UINT64)s.FaceStart + s.FaceCount) * 3 > h.NumIndices ||
+			baseVertices[i] < 0 || (UINT)baseVertices[i] > h.NumVertices)
+			return false;
+	}
+
+	for (const LodRange& lod : Lods())
+	{
+		if (lod.Submesh >= h.NumSubsets ||
+			(UINT64)lod.StartIndexLocation + lod.IndexCount > h.NumIndices ||
+			lod.BaseVertexLocation < 0 || (UINT)lod.BaseVertexLocation > h.NumVertices)
+			return false;
+	}
+
+	return true;
+}
+
+bool M3DBinaryFile::IsCurrent(const std::string& m3dFilename)const
+{
+	UINT64 size = 0;
+	UINT64 writeTime = 0;
+	if (!GetFileStamp(m3dFilename, size, writeTime))
+		return true;
+
+	return size == mHeader->SourceSize && writeTime == mHeader->SourceWriteTime;
+}
+
+void M3DBinaryFile::Close()
+{
+	if (mBase != nullptr)
+		UnmapViewOfFile(mBase);
+	if (mMapping != nullptr)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mBase = nullptr;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+	mSize = 0;
+	mHeader = nullptr;
+}
+
+bool M3DBinaryFile::IsOpen()const
+{
+	return mHeader != nullptr;
+}
+
+template<typename T>
+ArrayView<T> M3DBinaryFile::View(UINT64 offset, UINT size)const
+{
+	ArrayView<T> view;
+	view.Data = (const T*)(mBase + offset);
+	view.Size = size;
+	return view;
+}
+
+const char* M3DBinaryFile::String(UINT offset)const
+{
+	return (const char*)(mBase + mHeader->StringsOffset + offset);
+}
+
+ArrayView<SkinnedVertex> M3DBinaryFile::Vertices()const
+{
+	return View<SkinnedVertex>(mHeader->VerticesOffset, mHeader->NumVertices);
+}
+
+ArrayView<M3DLoader::Subset> M3DBinaryFile::Subsets()const
+{
+	return View<M3DLoader::Subset>(mHeader->SubsetsOffset, mHeader->NumSubsets);
+}
+
+ArrayView<INT> M3DBinaryFile::SubsetBaseVertices()const
+{
+	return View<INT>(mHeader->SubsetBaseVerticesOffset, mHeader->NumSubsets);
+}
+
+ArrayView<LodRange> M3DBinaryFile::Lods()const
+{
+	return View<LodRange>(mHeader->LodsOffset, mHeader->NumLods);
+}
+
+DXGI_FORMAT M3DBinaryFile::IndexFormat()const
+{
+	return mHeader->IndexStride == sizeof(USHORT) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+}
+
+ArrayView<USHORT> M3DBinaryFile::Indices16()const
+{
+	if (mHeader->IndexStride != sizeof(USHORT))
+		return ArrayView<USHORT>();
+	return View<USHORT>(mHeader->IndicesOffset, mHeader->NumIndices);
+}
+
+ArrayView<UINT> M3DBinaryFile::Indices32()const
+{
+	if (mHeader->IndexStride != sizeof(UINT))
+		return ArrayView<UINT>();
+	return View<UINT>(mHeader->IndicesOffset, mHeader->NumIndices);
+}
+
+ArrayView<XMFLOAT4X4> M3DBinaryFile::BoneOffsets()const
+{
+	return View<XMFLOAT4X4>(mHeader->BoneOffsetsOffset, mHeader->NumBones);
+}
+
+ArrayView<int> M3DBinaryFile::BoneHierarchy()const
+{
+	return View<int>(mHeader->BoneHierarchyOffset, mHeader->NumBones);
+}
+
+UINT M3DBinaryFile::ClipCount()const
+{
+	return mHeader->NumClips;
+}
+
+const char* M3DBinaryFile::ClipName(UINT clipIndex)const
+{
+	return String(View<ClipRecord>(mHeader->ClipsOffset, mHeader->NumClips)[clipIndex].Name);
+}
+
+ArrayView<Keyframe> M3DBinaryFile::BoneKeyframes(UINT clipIndex, UINT boneIndex)const
+{
+	const ClipRecord& clip = View<ClipRecord>(mHeader->ClipsOffset, mHeader->NumClips)[clipIndex];
+	const TrackRecord& track = View<TrackRecord>(mHeader->TracksOffset,
+		mHeader->NumClips * mHeader->NumBones)[clip.FirstTrack + boneIndex];
+
+	return View<Keyframe>(mHeader->KeyframesOffset + (UINT64)track.FirstKeyframe * sizeof(Keyframe),
+		track.KeyframeCount);
+}
+
+void M3DBinaryFile::GetMaterials(std::vector<M3DLoader::MaterialInfo>& mats)const
+{
+	ArrayView<MaterialRecord> records = View<MaterialRecord>(mHeader->MaterialsOffset, mHeader->NumMaterials);
+
+	mats.resize(records.Size);
+	for (UINT i = 0; i < records.Size; ++i)
+	{
+		mats[i].Name = String(records[i].Name);
+		mats[i].DiffuseAlbedo = records[i].DiffuseAlbedo;
+		mats[i].FresnelR0 = records[i].FresnelR0;
+		mats[i].Roughness = records[i].Roughness;
+		mats[i].AlphaClip = records[i].AlphaClip != 0;
+		mats[i].MaterialTypeName = String(records[i].MaterialTypeName);
+		mats[i].DiffuseMapName = String(records[i].DiffuseMapName);
+		mats[i].NormalMapName = String(records[i].NormalMapName);
+	}
+}
+
+void M3DBinaryFile::GetSkinnedData(SkinnedData& skinnedData)const
+{
+	ArrayView<int> hierarchyView = BoneHierarchy();
+	ArrayView<XMFLOAT4X4> offsetsView = BoneOffsets();
+
+	std::vector<int> boneHierarchy(hierarchyView.begin(), hierarchyView.end());
+	std::vector<XMFLOAT4X4> boneOffsets(offsetsView.begin(), offsetsView.end());
+
+	std::unordered_map<std::string, AnimationClip> animationClips;
+	for (UINT c = 0; c < ClipCount(); ++c)
+	{
+		AnimationClip& clip = animationClips[ClipName(c)];
+		clip.BoneAnimations.resize(mHeader->NumBones);
+		for (UINT i = 0; i < mHeader->NumBones; ++i)
+		{
+			ArrayView<Keyframe> keyframes = BoneKeyframes(c, i);
+			clip.BoneAnimations[i].Keyframes.assign(keyframes.begin(), keyframes.end());
+		}
+	}
+
+	skinnedData.Set(boneHierarchy, boneOffsets, animationClips);
+}
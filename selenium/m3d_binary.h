@@ -0,0 +1,121 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "index_buffer.h"
+#include "m3d_loader.h"
+#include "mesh_simplifier.h"
+#include "skinned_data.h"
+#include "vertex.h"
+
+// Read-only view of an array that lives somewhere else, e.g. in a mapped file.
+template<typename T>
+struct ArrayView
+{
+	const T* Data = nullptr;
+	UINT Size = 0;
+
+	const T* begin()const { return Data; }
+	const T* end()const { return Data + Size; }
+	const T& operator[](UINT i)const { return Data[i]; }
+	bool empty()const { return Size == 0; }
+};
+
+// Binary form of an .m3d model (.m3db).  Every array is stored exactly as it
+// is laid out in memory and 16 byte aligned, so Open only maps the file and
+// validates it; vertices, indices, bone data and keyframes are then
+// handed out as views into the mapping without being parsed or copied.
+//
+// Indices are stored already packed by PackIndices, so they are 16-bit
+// whenever every subset can address its vertices with 16 bits once rebased.
+// SubsetBaseVertices gives the BaseVertexLocation to draw each subset with.
+//
+// The indices of the simplified levels of every subset (see MeshSimplifier)
+// follow the full detail indices and are described by Lods.
+//
+// Files made by Convert remember the size and write time of their source, so
+// IsCurrent can tell when the .m3d has changed since.
+class M3DBinaryFile
+{
+public:
+	M3DBinaryFile() = default;
+	M3DBinaryFile(const M3DBinaryFile& rhs) = delete;
+	M3DBinaryFile& operator=(const M3DBinaryFile& rhs) = delete;
+	~M3DBinaryFile();
+
+	static bool Write(const std::string& filename,
+		const std::vector<SkinnedVertex>& vertices,
+		const std::vector<UINT>& indices,
+		const std::vector<M3DLoader::Subset>& subsets,
+		const std::vector<LodRange>& lods,
+		const std::vector<M3DLoader::MaterialInfo>& mats,
+		const std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
+		const std::vector<int>& boneHierarchy,
+		const std::unordered_map<std::string, AnimationClip>& animationClips,
+		UINT64 sourceSize = 0, UINT64 sourceWriteTime = 0);
+
+	// Loads a text .m3d and writes it out as .m3db.  The text is parsed with
+	// ParseMode::Parallel on jobs, or with ParseMode::Buffer if jobs is null.
+	static bool Convert(const std::string& m3dFilename, const std::string& m3dbFilename,
+		JobSystem* jobs = nullptr);
+
+	// Returns false if the file does not exist or is not a valid .m3db file
+	// of the current version.  Besides the header, every record that refers
+	// to another section (clips, tracks, subsets, levels, the bone hierarchy
+	// and the string table) is checked to stay within it, so the views below
+	// never read outside the mapping.  The indices themselves are not scanned.
+	bool Open(const std::string& filename);
+	void Close();
+	bool IsOpen()const;
+
+	// False if m3dFilename differs in size or write time from the file this
+	// one was converted from.  True if m3dFilename does not exist, since there
+	// is nothing to convert again.
+	bool IsCurrent(const std::string& m3dFilename)const;
+
+	ArrayView<SkinnedVertex> Vertices()const;
+	ArrayView<M3DLoader::Subset> Subsets()const;
+	ArrayView<INT> SubsetBaseVertices()const;
+
+	// Ordered by subset, then by increasing error.  BaseVertexLocation is set.
+	ArrayView<LodRange> Lods()const;
+
+	// DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT.  Only the view matching
+	// the format is non-empty.
+	DXGI_FORMAT IndexFormat()const;
+	ArrayView<USHORT> Indices16()const;
+	ArrayView<UINT> Indices32()const;
+	ArrayView<DirectX::XMFLOAT4X4> BoneOffsets()const;
+	ArrayView<int> BoneHierarchy()const;
+
+	UINT ClipCount()const;
+	const char* ClipName(UINT clipIndex)const;
+	ArrayView<Keyframe> BoneKeyframes(UINT clipIndex, UINT boneIndex)const;
+
+	// Materials hold strings, so they are copied out.
+	void GetMaterials(std::vector<M3DLoader::MaterialInfo>& mats)const;
+
+	// SkinnedData owns its clips; the keyframes are copied in bulk.
+	void GetSkinnedData(SkinnedData& skinnedData)const;
+
+private:
+	struct FileHeader;
+
+	template<typename T>
+	ArrayView<T> View(UINT64 offset, UINT size)const;
+
+	// The cross-section checks of Open, once the sections fit in the file.
+	bool RecordsValid()const;
+
+	const char* String(UINT offset)const;
+
+private:
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+	const BYTE* mBase = nullptr;
+	UINT64 mSize = 0;
+
+	const FileHeader* mHeader = nullptr;
+};
@@ -1,18 +1,97 @@
 #include "m3d_loader.h"
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <DirectXMath.h>
 #include "Vertex.h"
+#include "job_system.h"
 
 using namespace DirectX;
 
+namespace
+{
+	bool ReadWholeFile(const std::string& filename, std::vector<char>& buffer)
+	{
+		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+		if (!fin)
+			return false;
+
+		buffer.resize((size_t)fin.tellg());
+		fin.seekg(0);
+		fin.read(buffer.data(), buffer.size());
+		return (bool)fin;
+	}
+
+	// Start of the line after the one containing p.
+	const char* NextLine(const char* p, const char* end)
+	{
+		const char* eol = (const char*)std::memchr(p, '\n', end - p);
+		return eol != nullptr ? eol + 1 : end;
+	}
+
+	// First non-blank character of the line starting at p.
+	const char* LineText(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			++p;
+		return p;
+	}
+
+	bool StartsWith(const char* p, const char* end, const char* prefix)
+	{
+		size_t n = std::strlen(prefix);
+		return (size_t)(end - p) >= n && std::memcmp(p, prefix, n) == 0;
+	}
+}
+
 bool M3DLoader::LoadM3d(const std::string &filename,
 	std::vector<SkinnedVertex> &vertices,
-	std::vector<USHORT> &indices,
+	std::vector<UINT> &indices,
 	std::vector<Subset> &subsets,
 	std::vector<MaterialInfo> &mats,
 	SkinnedData &skinnedData) {
-	
+
+	std::vector<XMFLOAT4X4> boneOffsets;
+	std::vector<int> boneHierarchy;
+	std::unordered_map<std::string, AnimationClip> animationClips;
+
+	if (!LoadM3d(filename, vertices, indices, subsets, mats,
+		boneOffsets, boneHierarchy, animationClips))
+		return false;
+
+	skinnedData.Set(boneHierarchy, boneOffsets, animationClips);
+
+	return true;
+}
+
+bool M3DLoader::LoadM3d(const std::string &filename,
+	std::vector<SkinnedVertex> &vertices,
+	std::vector<UINT> &indices,
+	std::vector<Subset> &subsets,
+	std::vector<MaterialInfo> &mats,
+	std::vector<XMFLOAT4X4> &boneOffsets,
+	std::vector<int> &boneHierarchy,
+	std::unordered_map<std::string, AnimationClip> &animationClips) {
+
+	if (Mode == ParseMode::Parallel)
+		return ParseParallel(filename, vertices, indices, subsets, mats, boneOffsets, boneHierarchy, animationClips);
+
+	if (Mode == ParseMode::Buffer)
+		return ParseBuffer(filename, vertices, indices, subsets, mats, boneOffsets, boneHierarchy, animationClips);
+
+	return ParseStream(filename, vertices, indices, subsets, mats, boneOffsets, boneHierarchy, animationClips);
+}
+
+bool M3DLoader::ParseStream(const std::string& filename,
+	std::vector<SkinnedVertex>& vertices,
+	std::vector<UINT>& indices,
+	std::vector<Subset>& subsets,
+	std::vector<MaterialInfo>& mats,
+	std::vector<XMFLOAT4X4>& boneOffsets,
+	std::vector<int>& boneHierarchy,
+	std::unordered_map<std::string, AnimationClip>& animationClips)
+{
 	std::ifstream fin(filename);
 
 	UINT numMaterials = 0;
@@ -32,10 +111,6 @@ bool M3DLoader::LoadM3d(const std::string &filename,
 		fin >> ignore >> numBones;
 		fin >> ignore >> numAnimationClips;
 
-		std::vector<XMFLOAT4X4> boneOffsets;
-		std::vector<int> boneHierarchy;
-		std::unordered_map<std::string, AnimationClip> animationClips;
-
 		ReadMaterials(fin, numMaterials, mats);
 		ReadSubsetTable(fin, numMaterials, subsets);
 		ReadSkinnedVertices(fin, numVertices, vertices);
@@ -43,14 +118,169 @@ bool M3DLoader::LoadM3d(const std::string &filename,
 		ReadBoneOffsets(fin, numBones, boneOffsets);
 		ReadBoneHierarchy(fin, numBones, boneHierarchy);
 		ReadAnimationClips(fin, numBones, numAnimationClips, animationClips);
-		
-		skinnedData.Set(boneHierarchy, boneOffsets, animationClips);
 
 		return true;
 	}
 	return false;
 }
 
+bool M3DLoader::ParseBuffer(const std::string& filename,
+	std::vector<SkinnedVertex>& vertices,
+	std::vector<UINT>& indices,
+	std::vector<Subset>& subsets,
+	std::vector<MaterialInfo>& mats,
+	std::vector<XMFLOAT4X4>& boneOffsets,
+	std::vector<int>& boneHierarchy,
+	std::unordered_map<std::string, AnimationClip>& animationClips)
+{
+	std::vector<char> buffer;
+	if (!ReadWholeFile(filename, buffer))
+		return false;
+
+	M3DTokenizer tok(buffer.data(), buffer.data() + buffer.size());
+
+	UINT numMaterials = 0;
+	UINT numVertices = 0;
+	UINT numTriangles = 0;
+	UINT numBones = 0;
+	UINT numAnimationClips = 0;
+
+	tok.Skip(); // file header text
+	tok.Skip(); tok.Read(numMaterials);
+	tok.Skip(); tok.Read(numVertices);
+	tok.Skip(); tok.Read(numTriangles);
+	tok.Skip(); tok.Read(numBones);
+	tok.Skip(); tok.Read(numAnimationClips);
+
+	ReadMaterials(tok, numMaterials, mats);
+	ReadSubsetTable(tok, numMaterials, subsets);
+	ReadSkinnedVertices(tok, numVertices, vertices);
+	ReadTriangles(tok, numTriangles, indices);
+	ReadBoneOffsets(tok, numBones, boneOffsets);
+	ReadBoneHierarchy(tok, numBones, boneHierarchy);
+	ReadAnimationClips(tok, numBones, numAnimationClips, animationClips);
+
+	return !tok.Failed();
+}
+
+bool M3DLoader::ParseParallel(const std::string& filename,
+	std::vector<SkinnedVertex>& vertices,
+	std::vector<UINT>& indices,
+	std::vector<Subset>& subsets,
+	std::vector<MaterialInfo>& mats,
+	std::vector<XMFLOAT4X4>& boneOffsets,
+	std::vector<int>& boneHierarchy,
+	std::unordered_map<std::string, AnimationClip>& animationClips)
+{
+	std::vector<char> buffer;
+	if (!ReadWholeFile(filename, buffer))
+		return false;
+
+	const char* begin = buffer.data();
+	const char* end = begin + buffer.size();
+
+	M3DTokenizer headerTok(begin, end);
+
+	UINT numMaterials = 0;
+	UINT numVertices = 0;
+	UINT numTriangles = 0;
+	UINT numBones = 0;
+	UINT numAnimationClips = 0;
+
+	headerTok.Skip(); // file header text
+	headerTok.Skip(); headerTok.Read(numMaterials);
+	headerTok.Skip(); headerTok.Read(numVertices);
+	headerTok.Skip(); headerTok.Read(numTriangles);
+	headerTok.Skip(); headerTok.Read(numBones);
+	headerTok.Skip(); headerTok.Read(numAnimationClips);
+
+	//
+	// Index pass: section header lines start with '*' and come in a fixed
+	// order, and every clip starts with an "AnimationClip" line.  Finding
+	// them only needs a scan for line starts, not tokenizing.
+	//
+
+	enum Section { Materials, SubsetTable, Vertices, Triangles, BoneOffsets, BoneHierarchy, AnimationClips, SectionCount };
+
+	const char* sections[SectionCount + 1];
+	std::vector<const char*> clipStarts;
+
+	UINT sectionCount = 0;
+	for (const char* line = NextLine(headerTok.Position(), end); line < end; line = NextLine(line, end))
+	{
+		const char* text = LineText(line, end);
+		if (text < end && *text == '*' && sectionCount < SectionCount)
+			sections[sectionCount++] = text;
+		else if (sectionCount == SectionCount && StartsWith(text, end, "AnimationClip"))
+			clipStarts.push_back(text);
+	}
+
+	if (sectionCount != SectionCount || clipStarts.size() != numAnimationClips)
+		return false;
+
+	sections[SectionCount] = end;
+	clipStarts.push_back(end);
+
+	// One failure flag per job so no synchronization is needed.
+	std::vector<char> failed(2 + numAnimationClips, 0);
+	std::vector<std::string> clipNames(numAnimationClips);
+	std::vector<AnimationClip> clips(numAnimationClips);
+
+	JobCounter counter;
+	auto run = [&](std::function<void()> job)
+	{
+		if (Jobs != nullptr)
+			Jobs->Run(counter, std::move(job));
+		else
+			job();
+	};
+
+	run([&]()
+	{
+		M3DTokenizer tok(sections[Vertices], sections[Vertices + 1]);
+		ReadSkinnedVertices(tok, numVertices, vertices);
+		failed[0] = tok.Failed();
+	});
+	run([&]()
+	{
+		M3DTokenizer tok(sections[Triangles], sections[Triangles + 1]);
+		ReadTriangles(tok, numTriangles, indices);
+		failed[1] = tok.Failed();
+	});
+	for (UINT i = 0; i < numAnimationClips; ++i)
+	{
+		run([&, i]()
+		{
+			M3DTokenizer tok(clipStarts[i], clipStarts[i + 1]);
+			ReadAnimationClip(tok, numBones, clipNames[i], clips[i]);
+			failed[2 + i] = tok.Failed();
+		});
+	}
+
+	// The small sections are read here while the jobs run.
+	M3DTokenizer materialTok(sections[Materials], sections[Materials + 1]);
+	ReadMaterials(materialTok, numMaterials, mats);
+	M3DTokenizer subsetTok(sections[SubsetTable], sections[SubsetTable + 1]);
+	ReadSubsetTable(subsetTok, numMaterials, subsets);
+	M3DTokenizer offsetTok(sections[BoneOffsets], sections[BoneOffsets + 1]);
+	ReadBoneOffsets(offsetTok, numBones, boneOffsets);
+	M3DTokenizer hierarchyTok(sections[BoneHierarchy], sections[BoneHierarchy + 1]);
+	ReadBoneHierarchy(hierarchyTok, numBones, boneHierarchy);
+
+	if (Jobs != nullptr)
+		Jobs->Wait(counter);
+
+	for (UINT i = 0; i < numAnimationClips; ++i)
+		animationClips[clipNames[i]] = std::move(clips[i]);
+
+	bool anyFailed = headerTok.Failed() || materialTok.Failed() || subsetTok.Failed() ||
+		offsetTok.Failed() || hierarchyTok.Failed();
+	for (char f : failed)
+		anyFailed = anyFailed || f != 0;
+
+	return !anyFailed;
+}
+
 void M3DLoader::ReadMaterials(std::ifstream &fin, UINT numMaterials, std::vector<MaterialInfo> &mats) {
 	std::string ignore;
 	mats.resize(numMaterials);
@@ -114,7 +344,7 @@ void M3DLoader::ReadSkinnedVertices(std::ifstream& fin, UINT numVertices, std::v
 	}
 }
 
-void M3DLoader::ReadTriangles(std::ifstream& fin, UINT numTriangles, std::vector<USHORT>& indices)
+void M3DLoader::ReadTriangles(std::ifstream& fin, UINT numTriangles, std::vector<UINT>& indices)
 {
 	std::string ignore;
 	indices.resize(numTriangles * 3);
@@ -204,4 +434,149 @@ void M3DLoader::ReadBoneAnimation(std::ifstream& fin, UINT numBones, BoneAnimati
 	}
 
 	fin >> ignore; // }
+}
+
+void M3DLoader::ReadMaterials(M3DTokenizer& tok, UINT numMaterials, std::vector<MaterialInfo>& mats)
+{
+	mats.resize(numMaterials);
+
+	tok.Skip(); // materials header text
+	for (UINT i = 0; i < numMaterials; ++i)
+	{
+		tok.Skip(); tok.Read(mats[i].Name);
+		tok.Skip(); tok.Read(mats[i].DiffuseAlbedo.x); tok.Read(mats[i].DiffuseAlbedo.y); tok.Read(mats[i].DiffuseAlbedo.z);
+		tok.Skip(); tok.Read(mats[i].FresnelR0.x); tok.Read(mats[i].FresnelR0.y); tok.Read(mats[i].FresnelR0.z);
+		tok.Skip(); tok.Read(mats[i].Roughness);
+		tok.Skip(); tok.Read(mats[i].AlphaClip);
+		tok.Skip(); tok.Read(mats[i].MaterialTypeName);
+		tok.Skip(); tok.Read(mats[i].DiffuseMapName);
+		tok.Skip(); tok.Read(mats[i].NormalMapName);
+	}
+}
+
+void M3DLoader::ReadSubsetTable(M3DTokenizer& tok, UINT numSubsets, std::vector<Subset>& subsets)
+{
+	subsets.resize(numSubsets);
+
+	tok.Skip(); // subset header text
+	for (UINT i = 0; i < numSubsets; ++i)
+	{
+		tok.Skip(); tok.Read(subsets[i].Id);
+		tok.Skip(); tok.Read(subsets[i].VertexStart);
+		tok.Skip(); tok.Read(subsets[i].VertexCount);
+		tok.Skip(); tok.Read(subsets[i].FaceStart);
+		tok.Skip(); tok.Read(subsets[i].FaceCount);
+	}
+}
+
+void M3DLoader::ReadSkinnedVertices(M3DTokenizer& tok, UINT numVertices, std::vector<SkinnedVertex>& vertices)
+{
+	vertices.resize(numVertices);
+
+	tok.Skip(); // vertices header text
+	int boneIndices[4];
+	float weights[4];
+	for (UINT i = 0; i < numVertices; ++i)
+	{
+		SkinnedVertex& v = vertices[i];
+		tok.Skip(); tok.Read(v.Pos.x); tok.Read(v.Pos.y); tok.Read(v.Pos.z);
+		tok.Skip(); tok.Read(v.TangentU.x); tok.Read(v.TangentU.y); tok.Read(v.TangentU.z); tok.Skip(); /*TangentU.w*/
+		tok.Skip(); tok.Read(v.Normal.x); tok.Read(v.Normal.y); tok.Read(v.Normal.z);
+		tok.Skip(); tok.Read(v.TexC.x); tok.Read(v.TexC.y);
+		tok.Skip(); tok.Read(weights[0]); tok.Read(weights[1]); tok.Read(weights[2]); tok.Read(weights[3]);
+		tok.Skip(); tok.Read(boneIndices[0]); tok.Read(boneIndices[1]); tok.Read(boneIndices[2]); tok.Read(boneIndices[3]);
+
+		v.BoneWeights.x = weights[0];
+		v.BoneWeights.y = weights[1];
+		v.BoneWeights.z = weights[2];
+
+		v.BoneIndices[0] = (BYTE)boneIndices[0];
+		v.BoneIndices[1] = (BYTE)boneIndices[1];
+		v.BoneIndices[2] = (BYTE)boneIndices[2];
+		v.BoneIndices[3] = (BYTE)boneIndices[3];
+	}
+}
+
+void M3DLoader::ReadTriangles(M3DTokenizer& tok, UINT numTriangles, std::vector<UINT>& indices)
+{
+	indices.resize(numTriangles * 3);
+
+	tok.Skip(); // triangles header text
+	for (UINT i = 0; i < numTriangles * 3; ++i)
+	{
+		tok.Read(indices[i]);
+	}
+}
+
+void M3DLoader::ReadBoneOffsets(M3DTokenizer& tok, UINT numBones, std::vector<XMFLOAT4X4>& boneOffsets)
+{
+	boneOffsets.resize(numBones);
+
+	tok.Skip(); // BoneOffsets header text
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		tok.Skip();
+		for (UINT r = 0; r < 4; ++r)
+		{
+			for (UINT c = 0; c < 4; ++c)
+				tok.Read(boneOffsets[i](r, c));
+		}
+	}
+}
+
+void M3DLoader::ReadBoneHierarchy(M3DTokenizer& tok, UINT numBones, std::vector<int>& boneHierarchy)
+{
+	boneHierarchy.resize(numBones);
+
+	tok.Skip(); // BoneHierarchy header text
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		tok.Skip(); tok.Read(boneHierarchy[i]);
+	}
+}
+
+void M3DLoader::ReadAnimationClips(M3DTokenizer& tok, UINT numBones, UINT numAnimationClips,
+	std::unordered_map<std::string, AnimationClip>& animationClips)
+{
+	tok.Skip(); // AnimationClips header text
+	for (UINT clipIndex = 0; clipIndex < numAnimationClips; ++clipIndex)
+	{
+		std::string clipName;
+		AnimationClip clip;
+		ReadAnimationClip(tok, numBones, clipName, clip);
+
+		animationClips[clipName] = std::move(clip);
+	}
+}
+
+void M3DLoader::ReadAnimationClip(M3DTokenizer& tok, UINT numBones, std::string& clipName, AnimationClip& clip)
+{
+	tok.Skip(); tok.Read(clipName);
+	tok.Skip(); // {
+
+	clip.BoneAnimations.resize(numBones);
+	for (UINT boneIndex = 0; boneIndex < numBones; ++boneIndex)
+	{
+		ReadBoneAnimation(tok, clip.BoneAnimations[boneIndex]);
+	}
+	tok.Skip(); // }
+}
+
+void M3DLoader::ReadBoneAnimation(M3DTokenizer& tok, BoneAnimation& boneAnimation)
+{
+	UINT numKeyframes = 0;
+	tok.Skip(2); tok.Read(numKeyframes);
+	tok.Skip(); // {
+
+	boneAnimation.Keyframes.resize(numKeyframes);
+	for (UINT i = 0; i < numKeyframes; ++i)
+	{
+		Keyframe& key = boneAnimation.Keyframes[i];
+		tok.Skip(); tok.Read(key.TimePos);
+		tok.Skip(); tok.Read(key.Translation.x); tok.Read(key.Translation.y); tok.Read(key.Translation.z);
+		tok.Skip(); tok.Read(key.Scale.x); tok.Read(key.Scale.y); tok.Read(key.Scale.z);
+		tok.Skip(); tok.Read(key.RotationQuat.x); tok.Read(key.RotationQuat.y); tok.Read(key.RotationQuat.z); tok.Read(key.RotationQuat.w);
+	}
+
+	tok.Skip(); // }
 }
\ No newline at end of file
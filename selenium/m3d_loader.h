@@ -3,12 +3,35 @@
 #include <DirectXMath.h>
 #include <string>
 #include <vector>
+#include "m3d_tokenizer.h"
 #include "skinned_data.h"
 #include "vertex.h"
 
+class JobSystem;
+
 class M3DLoader
 {
 public:
+	enum class ParseMode
+	{
+		// Token by token from an std::ifstream.
+		Stream,
+
+		// Whole file read into one buffer and tokenized with std::from_chars.
+		Buffer,
+
+		// Like Buffer, but a first pass finds where each section and clip
+		// starts, then vertices, triangles and every clip are decoded as
+		// separate jobs.
+		Parallel
+	};
+
+	ParseMode Mode = ParseMode::Buffer;
+
+	// Runs the ParseMode::Parallel jobs.  If null they run one after another
+	// on the calling thread.
+	JobSystem* Jobs = nullptr;
+
 	struct Subset
 	{
 		UINT Id = -1;
@@ -34,18 +57,64 @@ public:
 
 	bool LoadM3d(const std::string &filename,
 		std::vector<SkinnedVertex> &vertices,
-		std::vector<USHORT> &indices,
+		std::vector<UINT> &indices,
 		std::vector<Subset> &subsets,
 		std::vector<MaterialInfo> &mats,
 		SkinnedData &skinnedData);
 
+	// Same, but hands back the skeleton and clips instead of building a
+	// SkinnedData from them.
+	bool LoadM3d(const std::string &filename,
+		std::vector<SkinnedVertex> &vertices,
+		std::vector<UINT> &indices,
+		std::vector<Subset> &subsets,
+		std::vector<MaterialInfo> &mats,
+		std::vector<DirectX::XMFLOAT4X4> &boneOffsets,
+		std::vector<int> &boneHierarchy,
+		std::unordered_map<std::string, AnimationClip> &animationClips);
+
 private:
+	bool ParseStream(const std::string& filename,
+		std::vector<SkinnedVertex>& vertices,
+		std::vector<UINT>& indices,
+		std::vector<Subset>& subsets,
+		std::vector<MaterialInfo>& mats,
+		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
+		std::vector<int>& boneHierarchy,
+		std::unordered_map<std::string, AnimationClip>& animationClips);
+	bool ParseBuffer(const std::string& filename,
+		std::vector<SkinnedVertex>& vertices,
+		std::vector<UINT>& indices,
+		std::vector<Subset>& subsets,
+		std::vector<MaterialInfo>& mats,
+		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
+		std::vector<int>& boneHierarchy,
+		std::unordered_map<std::string, AnimationClip>& animationClips);
+	bool ParseParallel(const std::string& filename,
+		std::vector<SkinnedVertex>& vertices,
+		std::vector<UINT>& indices,
+		std::vector<Subset>& subsets,
+		std::vector<MaterialInfo>& mats,
+		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
+		std::vector<int>& boneHierarchy,
+		std::unordered_map<std::string, AnimationClip>& animationClips);
+
 	void ReadMaterials(std::ifstream& fin, UINT numMaterials, std::vector<MaterialInfo>& mats);
 	void ReadSubsetTable(std::ifstream& fin, UINT numSubsets, std::vector<Subset>& subsets);
 	void ReadSkinnedVertices(std::ifstream& fin, UINT numVertices, std::vector<SkinnedVertex>& vertices);
-	void ReadTriangles(std::ifstream& fin, UINT numTriangles, std::vector<USHORT>& indices);
+	void ReadTriangles(std::ifstream& fin, UINT numTriangles, std::vector<UINT>& indices);
 	void ReadBoneOffsets(std::ifstream& fin, UINT numBones, std::vector<DirectX::XMFLOAT4X4>& boneOffsets);
 	void ReadBoneHierarchy(std::ifstream& fin, UINT numBones, std::vector<int>& boneHierarchy);
 	void ReadAnimationClips(std::ifstream& fin, UINT numBones, UINT numAnimationClips, std::unordered_map<std::string, AnimationClip>& animationClips);
 	void ReadBoneAnimation(std::ifstream& fin, UINT numBones, BoneAnimation& boneAnimation);
+
+	void ReadMaterials(M3DTokenizer& tok, UINT numMaterials, std::vector<MaterialInfo>& mats);
+	void ReadSubsetTable(M3DTokenizer& tok, UINT numSubsets, std::vector<Subset>& subsets);
+	void ReadSkinnedVertices(M3DTokenizer& tok, UINT numVertices, std::vector<SkinnedVertex>& vertices);
+	void ReadTriangles(M3DTokenizer& tok, UINT numTriangles, std::vector<UINT>& indices);
+	void ReadBoneOffsets(M3DTokenizer& tok, UINT numBones, std::vector<DirectX::XMFLOAT4X4>& boneOffsets);
+	void ReadBoneHierarchy(M3DTokenizer& tok, UINT numBones, std::vector<int>& boneHierarchy);
+	void ReadAnimationClips(M3DTokenizer& tok, UINT numBones, UINT numAnimationClips, std::unordered_map<std::string, AnimationClip>& animationClips);
+	void ReadAnimationClip(M3DTokenizer& tok, UINT numBones, std::string& clipName, AnimationClip& clip);
+	void ReadBoneAnimation(M3DTokenizer& tok, BoneAnimation& boneAnimation);
 };
@@ -0,0 +1,81 @@
+#pragma once
+#include <Windows.h>
+#include <charconv>
+#include <string>
+
+// Splits an in-memory .m3d file into whitespace separated tokens and converts
+// numbers with std::from_chars, so no stream, locale or temporary string is
+// involved.  A failed conversion sets Failed() and leaves the value as is;
+// the loader checks it once at the end.
+class M3DTokenizer
+{
+public:
+	M3DTokenizer(const char* begin, const char* end)
+		: mCur(begin), mEnd(end) {}
+
+	// Skips one token, e.g. a "Position:" label.
+	void Skip()
+	{
+		SkipSpace();
+		while (mCur < mEnd && !IsSpace(*mCur))
+			++mCur;
+	}
+
+	// Skips n tokens.
+	void Skip(UINT n)
+	{
+		for (UINT i = 0; i < n; ++i)
+			Skip();
+	}
+
+	template<typename T>
+	void Read(T& value)
+	{
+		SkipSpace();
+		auto result = std::from_chars(mCur, mEnd, value);
+		if (result.ec != std::errc())
+		{
+			mFailed = true;
+			Skip();
+			return;
+		}
+		mCur = result.ptr;
+	}
+
+	void Read(bool& value)
+	{
+		int i = 0;
+		Read(i);
+		value = i != 0;
+	}
+
+	void Read(std::string& value)
+	{
+		SkipSpace();
+		const char* begin = mCur;
+		Skip();
+		value.assign(begin, mCur);
+	}
+
+	bool Failed()const { return mFailed; }
+
+	const char* Position()const { return mCur; }
+	const char* End()const { return mEnd; }
+
+private:
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	void SkipSpace()
+	{
+		while (mCur < mEnd && IsSpace(*mCur))
+			++mCur;
+	}
+
+private:
+	const char* mCur;
+	const char* mEnd;
+	bool mFailed = false;
+};
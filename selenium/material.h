@@ -19,13 +19,9 @@ struct Material
 	// Index into heap for normal texture.
 	int NormalHeapIndex = -1;
 
-	// Dirty flag indicating the material has changed and we need to update the constant buffer.
-	// Because we have a material constant buffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify a material we should set 
-	// NumFramesDirty = NumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = -1;
-
-	// Material constant buffer data used for shading.
+	// Material constant buffer data used for shading.  There is a copy for each
+	// FrameResource, so after changing it queue bufferIndex in the owner's
+	// DirtyTracker to have every copy updated.
 	DirectX::XMFLOAT4 DiffuseAlbedo = { 1.0f, 1.0f, 1.0f, 1.0f };
 	DirectX::XMFLOAT3 FresnelR0 = { 0.01f, 0.01f, 0.01f };
 	float Roughness = .25f;
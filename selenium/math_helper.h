@@ -10,6 +10,18 @@ public:
 		return a > b ? a : b;
 	}
 
+	template<typename T>
+	static T Min(const T& a, const T& b)
+	{
+		return a < b ? a : b;
+	}
+
+	template<typename T>
+	static T Clamp(const T& x, const T& low, const T& high)
+	{
+		return x < low ? low : (x > high ? high : x);
+	}
+
 	// Returns random float in [0, 1].
 	static float RandF()
 	{
@@ -22,6 +34,21 @@ public:
 		return a + RandF()*(b - a);
 	}
 
+	// Element index of the Halton sequence in base, the radical inverse of
+	// index.  Bases 2 and 3 give well spread 2D points in [0, 1)^2.
+	static float Halton(UINT index, UINT base)
+	{
+		float result = 0.0f;
+		float fraction = 1.0f;
+		while (index > 0)
+		{
+			fraction /= (float)base;
+			result += fraction * (float)(index % base);
+			index /= base;
+		}
+		return result;
+	}
+
 	static DirectX::XMFLOAT4X4 Identity4x4()
 	{
 		static DirectX::XMFLOAT4X4 I(
@@ -4,6 +4,22 @@
 #include <d3d12.h>
 #include <unordered_map>
 #include <DirectXCollision.h>
+#include <vector>
+#include "meshlet.h"
+
+// A coarser level of detail of a SubmeshGeometry, drawn from the same
+// vertices with its own indices.
+struct SubmeshLod
+{
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	INT BaseVertexLocation = 0;
+
+	// Object space deviation from the full detail submesh.
+	float Error = 0.0f;
+
+	std::vector<Meshlet> Meshlets;
+};
 
 // Defines a subrange of geometry in a MeshGeometry.  This is for when multiple
 // geometries are stored in one vertex and index buffer.  It provides the offsets
@@ -17,6 +33,14 @@ struct SubmeshGeometry
 
 	// Bounding box of the geometry defined by this submesh. 
 	DirectX::BoundingBox Bounds;
+
+	// Clusters of the submesh for per-meshlet culling; empty if it is drawn
+	// as a whole.
+	std::vector<Meshlet> Meshlets;
+
+	// Coarser levels of detail, in order of increasing Error.  The submesh
+	// itself is level 0.
+	std::vector<SubmeshLod> Lods;
 };
 
 struct MeshGeometry
@@ -0,0 +1,463 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "math_helper.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Forsyth's scoring parameters.
+	const UINT ScoredCacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	// Higher valences score the same as this one.
+	const UINT MaxScoredValence = 32;
+
+	const UINT NoTriangle = UINT_MAX;
+
+	struct ScoreTables
+	{
+		ScoreTables()
+		{
+			for (UINT i = 0; i < ScoredCacheSize; ++i)
+			{
+				// The vertices of the last triangle get a fixed score so the
+				// next triangle does not simply reuse all of them.
+				if (i < 3)
+					Cache[i] = LastTriangleScore;
+				else
+					Cache[i] = std::pow(1.0f - (float)(i - 3) / (ScoredCacheSize - 3), CacheDecayPower);
+			}
+
+			Valence[0] = 0.0f;
+			for (UINT i = 1; i <= MaxScoredValence; ++i)
+				Valence[i] = ValenceBoostScale * std::pow((float)i, -ValenceBoostPower);
+		}
+
+		float Cache[ScoredCacheSize];
+		float Valence[MaxScoredValence + 1];
+	};
+
+	float VertexScore(int cachePosition, UINT remainingTriangles)
+	{
+		static const ScoreTables tables;
+
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = cachePosition >= 0 ? tables.Cache[cachePosition] : 0.0f;
+		return score + tables.Valence[MathHelper::Min(remainingTriangles, MaxScoredValence)];
+	}
+
+	// FIFO cache that remembers when each vertex was last loaded.  Hits do
+	// not refresh a vertex, matching the post-transform cache of older GPUs.
+	class FifoCache
+	{
+	public:
+		FifoCache(UINT cacheSize, UINT vertexCount) :
+			mCacheSize(cacheSize), mTime(cacheSize), mLoadTime(vertexCount, 0)
+		{
+		}
+
+		// Returns true on a miss.
+		bool Access(UINT vertex)
+		{
+			if (mTime - mLoadTime[vertex] < mCacheSize)
+				return false;
+
+			mLoadTime[vertex] = ++mTime;
+			return true;
+		}
+
+	private:
+		UINT mCacheSize;
+		UINT mTime;
+		std::vector<UINT> mLoadTime;
+	};
+
+	bool IndicesInRange(const UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount)
+	{
+		for (UINT i = 0; i < indexCount; ++i)
+		{
+			if (indices[i] < firstVertex || indices[i] - firstVertex >= vertexCount)
+				return false;
+		}
+		return true;
+	}
+
+	template<typename T>
+	void OptimizeRange(const MeshOptimizer& optimizer, std::vector<T>& vertices,
+		UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount,
+		VertexCacheStats* before, VertexCacheStats* after)
+	{
+		if (before)
+			before->Merge(optimizer.SimulateVertexCache(indices, indexCount, firstVertex, vertexCount));
+
+		optimizer.OptimizeVertexCache(indices, indexCount, firstVertex, vertexCount);
+
+		if (optimizer.SortForOverdraw)
+			optimizer.OptimizeOverdraw(indices, indexCount, firstVertex, vertexCount, &vertices[0].Pos, sizeof(T));
+
+		optimizer.OptimizeVertexFetch(vertices.data(), sizeof(T), firstVertex, vertexCount, indices, indexCount);
+
+		if (after)
+			after->Merge(optimizer.SimulateVertexCache(indices, indexCount, firstVertex, vertexCount));
+	}
+}
+
+float VertexCacheStats::ACMR()const
+{
+	return Triangles > 0 ? (float)Transforms / Triangles : 0.0f;
+}
+
+float VertexCacheStats::ATVR()const
+{
+	return Vertices > 0 ? (float)Transforms / Vertices : 0.0f;
+}
+
+void VertexCacheStats::Merge(const VertexCacheStats& rhs)
+{
+	Triangles += rhs.Triangles;
+	Vertices += rhs.Vertices;
+	Transforms += rhs.Transforms;
+}
+
+void MeshOptimizer::OptimizeSubsets(std::vector<SkinnedVertex>& vertices, std::vector<UINT>& indices,
+	const std::vector<M3DLoader::Subset>& subsets, VertexCacheStats* before, VertexCacheStats* after)const
+{
+	for (const M3DLoader::Subset& subset : subsets)
+	{
+		UINT startIndex = subset.FaceStart * 3;
+		UINT indexCount = subset.FaceCount * 3;
+
+		if (indexCount == 0 ||
+			startIndex + indexCount > (UINT)indices.size() ||
+			subset.VertexStart + subset.VertexCount > (UINT)vertices.size() ||
+			!IndicesInRange(&indices[startIndex], indexCount, subset.VertexStart, subset.VertexCount))
+			continue;
+
+		OptimizeRange(*this, vertices, &indices[startIndex], indexCount,
+			subset.VertexStart, subset.VertexCount, before, after);
+	}
+}
+
+void MeshOptimizer::OptimizeMesh(GeometryGenerator::MeshData& mesh,
+	VertexCacheStats* before, VertexCacheStats* after)const
+{
+	if (mesh.Indices32.empty())
+		return;
+
+	OptimizeRange(*this, mesh.Vertices, mesh.Indices32.data(), (UINT)mesh.Indices32.size(),
+		0, (UINT)mesh.Vertices.size(), before, after);
+}
+
+void MeshOptimizer::OptimizeVertexCache(UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount)const
+{
+	UINT triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles that still have to be emitted, per vertex.  remaining[v]
+	// entries starting at vertexTriangles[firstTriangle[v]].
+	std::vector<UINT> remaining(vertexCount, 0);
+	for (UINT i = 0; i < triangleCount * 3; ++i)
+		++remaining[indices[i] - firstVertex];
+
+	std::vector<UINT> firstTriangle(vertexCount + 1, 0);
+	for (UINT v = 0; v < vertexCount; ++v)
+		firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+
+	std::vector<UINT> vertexTriangles(triangleCount * 3);
+	{
+		std::vector<UINT> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (UINT i = 0; i < triangleCount * 3; ++i)
+			vertexTriangles[fill[indices[i] - firstVertex]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (UINT v = 0; v < vertexCount; ++v)
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+
+	UINT bestTriangle = NoTriangle;
+	float bestScore = -1.0f;
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		triangleScore[t] =
+			vertexScore[indices[t * 3 + 0] - firstVertex] +
+			vertexScore[indices[t * 3 + 1] - firstVertex] +
+			vertexScore[indices[t * 3 + 2] - firstVertex];
+
+		if (triangleScore[t] > bestScore)
+		{
+			bestScore = triangleScore[t];
+			bestTriangle = t;
+		}
+	}
+
+	std::vector<UINT> cache;
+	std::vector<UINT> newCache;
+	cache.reserve(ScoredCacheSize + 3);
+	newCache.reserve(ScoredCacheSize + 3);
+
+	std::vector<UINT> output(triangleCount * 3);
+	UINT scanPosition = 0;
+
+	for (UINT n = 0; n < triangleCount; ++n)
+	{
+		// None of the cached vertices has triangles left; continue with the
+		// next triangle in input order rather than searching for the best.
+		if (bestTriangle == NoTriangle)
+		{
+			while (emitted[scanPosition])
+				++scanPosition;
+			bestTriangle = scanPosition;
+		}
+
+		UINT t = bestTriangle;
+		emitted[t] = true;
+
+		UINT tri[3];
+		for (UINT k = 0; k < 3; ++k)
+		{
+			output[n * 3 + k] = indices[t * 3 + k];
+			tri[k] = indices[t * 3 + k] - firstVertex;
+		}
+
+		for (UINT k = 0; k < 3; ++k)
+		{
+			UINT v = tri[k];
+			UINT* triangles = &vertexTriangles[firstTriangle[v]];
+			for (UINT j = 0; j < remaining[v]; ++j)
+			{
+				if (triangles[j] == t)
+				{
+					triangles[j] = triangles[remaining[v] - 1];
+					--remaining[v];
+					break;
+				}
+			}
+		}
+
+		// The triangle's vertices move to the front of the cache.
+		newCache.clear();
+		for (UINT k = 0; k < 3; ++k)
+		{
+			if (std::find(newCache.begin(), newCache.end(), tri[k]) == newCache.end())
+				newCache.push_back(tri[k]);
+		}
+		for (UINT v : cache)
+		{
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache.push_back(v);
+		}
+
+		for (UINT i = 0; i < (UINT)newCache.size(); ++i)
+		{
+			UINT v = newCache[i];
+			cachePosition[v] = i < ScoredCacheSize ? (int)i : -1;
+			vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// Only triangles touching the cache (or just pushed out of it) change
+		// score, and the next triangle is picked among them.
+		bestTriangle = NoTriangle;
+		bestScore = -1.0f;
+		for (UINT v : newCache)
+		{
+			const UINT* triangles = &vertexTriangles[firstTriangle[v]];
+			for (UINT j = 0; j < remaining[v]; ++j)
+			{
+				UINT t2 = triangles[j];
+				triangleScore[t2] =
+					vertexScore[indices[t2 * 3 + 0] - firstVertex] +
+					vertexScore[indices[t2 * 3 + 1] - firstVertex] +
+					vertexScore[indices[t2 * 3 + 2] - firstVertex];
+
+				if (triangleScore[t2] > bestScore)
+				{
+					bestScore = triangleScore[t2];
+					bestTriangle = t2;
+				}
+			}
+		}
+
+		if (newCache.size() > ScoredCacheSize)
+			newCache.resize(ScoredCacheSize);
+		cache.swap(newCache);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshOptimizer::OptimizeOverdraw(UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount,
+	const XMFLOAT3* positions, UINT positionStride)const
+{
+	UINT triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	auto position = [positions, positionStride](UINT vertex)
+	{
+		return XMLoadFloat3((const XMFLOAT3*)((const BYTE*)positions + (size_t)vertex * positionStride));
+	};
+
+	struct Cluster
+	{
+		UINT FirstTriangle = 0;
+		UINT TriangleCount = 0;
+		XMFLOAT3 Centroid;
+		XMFLOAT3 Normal;
+		float SortKey = 0.0f;
+	};
+
+	// A triangle that misses the cache with all three vertices starts a new
+	// cluster.  Moving clusters around as a whole then costs little cache
+	// efficiency, since each one starts from a cold cache anyway.
+	std::vector<Cluster> clusters;
+	FifoCache fifo(SimulatedCacheSize, vertexCount);
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		UINT misses = 0;
+		for (UINT k = 0; k < 3; ++k)
+			misses += fifo.Access(indices[t * 3 + k] - firstVertex) ? 1 : 0;
+
+		if (misses == 3 || clusters.empty())
+		{
+			Cluster cluster;
+			cluster.FirstTriangle = t;
+			clusters.push_back(cluster);
+		}
+		++clusters.back().TriangleCount;
+	}
+
+	if (clusters.size() < 2)
+		return;
+
+	// Area weighted centroid and normal of every cluster and of the mesh.
+	XMVECTOR meshCentroid = XMVectorZero();
+	float meshArea = 0.0f;
+	for (Cluster& cluster : clusters)
+	{
+		XMVECTOR centroid = XMVectorZero();
+		XMVECTOR normal = XMVectorZero();
+		float area = 0.0f;
+
+		for (UINT t = cluster.FirstTriangle; t < cluster.FirstTriangle + cluster.TriangleCount; ++t)
+		{
+			XMVECTOR p0 = position(indices[t * 3 + 0]);
+			XMVECTOR p1 = position(indices[t * 3 + 1]);
+			XMVECTOR p2 = position(indices[t * 3 + 2]);
+
+			// Length is twice the triangle area.
+			XMVECTOR n = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+			float triangleArea = XMVectorGetX(XMVector3Length(n));
+
+			XMVECTOR c = XMVectorScale(XMVectorAdd(XMVectorAdd(p0, p1), p2), 1.0f / 3.0f);
+			centroid = XMVectorAdd(centroid, XMVectorScale(c, triangleArea));
+			normal = XMVectorAdd(normal, n);
+			area += triangleArea;
+		}
+
+		meshCentroid = XMVectorAdd(meshCentroid, centroid);
+		meshArea += area;
+
+		if (area > 0.0f)
+			centroid = XMVectorScale(centroid, 1.0f / area);
+
+		XMStoreFloat3(&cluster.Centroid, centroid);
+		XMStoreFloat3(&cluster.Normal, normal);
+	}
+
+	if (meshArea > 0.0f)
+		meshCentroid = XMVectorScale(meshCentroid, 1.0f / meshArea);
+
+	// Clusters far out along their own normal are likely to occlude the rest
+	// of the mesh, so they go first.
+	for (Cluster& cluster : clusters)
+	{
+		XMVECTOR normal = XMLoadFloat3(&cluster.Normal);
+		float normalLength = XMVectorGetX(XMVector3Length(normal));
+		if (normalLength <= 0.0f)
+			continue;
+
+		XMVECTOR offset = XMVectorSubtract(XMLoadFloat3(&cluster.Centroid), meshCentroid);
+		cluster.SortKey = XMVectorGetX(XMVector3Dot(offset, normal)) / normalLength;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(),
+		[](const Cluster& a, const Cluster& b) { return a.SortKey > b.SortKey; });
+
+	std::vector<UINT> output;
+	output.reserve(triangleCount * 3);
+	for (const Cluster& cluster : clusters)
+	{
+		output.insert(output.end(),
+			indices + cluster.FirstTriangle * 3,
+			indices + (cluster.FirstTriangle + cluster.TriangleCount) * 3);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(void* vertices, UINT vertexStride, UINT firstVertex, UINT vertexCount,
+	UINT* indices, UINT indexCount)const
+{
+	const UINT Unused = UINT_MAX;
+
+	std::vector<UINT> remap(vertexCount, Unused);
+	UINT nextVertex = 0;
+	for (UINT i = 0; i < indexCount; ++i)
+	{
+		UINT v = indices[i] - firstVertex;
+		if (remap[v] == Unused)
+			remap[v] = nextVertex++;
+		indices[i] = firstVertex + remap[v];
+	}
+
+	// Unreferenced vertices keep their relative order at the end of the range.
+	for (UINT v = 0; v < vertexCount; ++v)
+	{
+		if (remap[v] == Unused)
+			remap[v] = nextVertex++;
+	}
+
+	BYTE* base = (BYTE*)vertices + (size_t)firstVertex * vertexStride;
+	std::vector<BYTE> reordered((size_t)vertexCount * vertexStride);
+	for (UINT v = 0; v < vertexCount; ++v)
+		std::memcpy(&reordered[(size_t)remap[v] * vertexStride], base + (size_t)v * vertexStride, vertexStride);
+
+	std::memcpy(base, reordered.data(), reordered.size());
+}
+
+VertexCacheStats MeshOptimizer::SimulateVertexCache(const UINT* indices, UINT indexCount,
+	UINT firstVertex, UINT vertexCount)const
+{
+	VertexCacheStats stats;
+	stats.Triangles = indexCount / 3;
+
+	std::vector<bool> referenced(vertexCount, false);
+	FifoCache fifo(SimulatedCacheSize, vertexCount);
+	for (UINT i = 0; i < stats.Triangles * 3; ++i)
+	{
+		UINT v = indices[i] - firstVertex;
+		if (!referenced[v])
+		{
+			referenced[v] = true;
+			++stats.Vertices;
+		}
+
+		if (fifo.Access(v))
+			++stats.Transforms;
+	}
+
+	return stats;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "geometry_generator.h"
+#include "m3d_loader.h"
+#include "vertex.h"
+
+// Post-transform vertex cache behaviour of an index buffer, as measured by
+// MeshOptimizer::SimulateVertexCache.
+struct VertexCacheStats
+{
+	UINT Triangles = 0;
+
+	// Distinct vertices referenced.
+	UINT Vertices = 0;
+
+	// Cache misses, i.e. vertex shader invocations.
+	UINT Transforms = 0;
+
+	// Average cache miss ratio, transforms per triangle.  3 means no reuse at
+	// all; about 0.5 is the best a large regular grid can get.
+	float ACMR()const;
+
+	// Average transform to vertex ratio.  1 means every vertex is shaded once.
+	float ATVR()const;
+
+	void Merge(const VertexCacheStats& rhs);
+};
+
+// Reorders index and vertex buffers for the GPU before they are uploaded:
+//
+// - triangles for post-transform vertex cache hits (Forsyth, "Linear-Speed
+//   Vertex Cache Optimisation"),
+// - optionally, clusters of those triangles so that outward facing clusters
+//   far from the centre are drawn first and occlude the rest (Sander et al.,
+//   "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"),
+// - vertices into the order they are first used, for fetch locality.
+//
+// Every pass works on one range of indices that only references one range of
+// vertices, e.g. an M3D subset, so material ranges stay intact.
+class MeshOptimizer
+{
+public:
+	bool SortForOverdraw = true;
+
+	// FIFO size SimulateVertexCache models.
+	UINT SimulatedCacheSize = 16;
+
+	// Optimizes every subset.  Subsets whose indices reference vertices
+	// outside their vertex range are left alone.  before and after receive
+	// the cache stats of the optimized subsets.
+	void OptimizeSubsets(std::vector<SkinnedVertex>& vertices, std::vector<UINT>& indices,
+		const std::vector<M3DLoader::Subset>& subsets,
+		VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr)const;
+
+	// Optimizes a mesh made of a single range.  Call before
+	// MeshData::GetIndices16, which caches its result.
+	void OptimizeMesh(GeometryGenerator::MeshData& mesh,
+		VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr)const;
+
+	// The passes.  indices must only reference vertices in
+	// [firstVertex, firstVertex + vertexCount).
+	void OptimizeVertexCache(UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount)const;
+	void OptimizeOverdraw(UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount,
+		const DirectX::XMFLOAT3* positions, UINT positionStride)const;
+	void OptimizeVertexFetch(void* vertices, UINT vertexStride, UINT firstVertex, UINT vertexCount,
+		UINT* indices, UINT indexCount)const;
+
+	VertexCacheStats SimulateVertexCache(const UINT* indices, UINT indexCount,
+		UINT firstVertex, UINT vertexCount)const;
+};
@@ -0,0 +1,534 @@
+#include "mesh_simplifier.h"
+#include <DirectXCollision.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include "math_helper.h"
+#include "mesh_optimizer.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Area weighted sum of squared distances to a set of planes,
+	// Q(p) = p^T A p + 2 b^T p + c.
+	struct Quadric
+	{
+		double A00 = 0.0, A01 = 0.0, A02 = 0.0, A11 = 0.0, A12 = 0.0, A22 = 0.0;
+		double B0 = 0.0, B1 = 0.0, B2 = 0.0;
+		double C = 0.0;
+		double Weight = 0.0;
+
+		// (nx, ny, nz) is the unit normal and d the offset of the plane.
+		void AddPlane(double nx, double ny, double nz, double d, double weight)
+		{
+			A00 += weight*nx*nx; A01 += weight*nx*ny; A02 += weight*nx*nz;
+			A11 += weight*ny*ny; A12 += weight*ny*nz; A22 += weight*nz*nz;
+			B0 += weight*nx*d; B1 += weight*ny*d; B2 += weight*nz*d;
+			C += weight*d*d;
+			Weight += weight;
+		}
+
+		void Add(const Quadric& rhs)
+		{
+			A00 += rhs.A00; A01 += rhs.A01; A02 += rhs.A02;
+			A11 += rhs.A11; A12 += rhs.A12; A22 += rhs.A22;
+			B0 += rhs.B0; B1 += rhs.B1; B2 += rhs.B2;
+			C += rhs.C;
+			Weight += rhs.Weight;
+		}
+
+		// Mean squared distance of p to the planes.
+		double Error(const XMFLOAT3& p)const
+		{
+			if (Weight <= 0.0)
+				return 0.0;
+
+			double x = p.x, y = p.y, z = p.z;
+			double e =
+				x*(A00*x + A01*y + A02*z) +
+				y*(A01*x + A11*y + A12*z) +
+				z*(A02*x + A12*y + A22*z) +
+				2.0*(B0*x + B1*y + B2*z) + C;
+
+			// Rounding can make the error of a point on every plane negative.
+			return MathHelper::Max(e, 0.0) / Weight;
+		}
+	};
+
+	struct Collapse
+	{
+		UINT From;
+		UINT To;
+		float Cost;
+	};
+
+	float SkinWeightDelta(const Vertex& a, const Vertex& b)
+	{
+		return 0.0f;
+	}
+
+	// Sum of absolute differences of the per-bone weights.  0 for identical
+	// influences, 2 for disjoint ones.
+	float SkinWeightDelta(const SkinnedVertex& a, const SkinnedVertex& b)
+	{
+		float weightsA[4] = { a.BoneWeights.x, a.BoneWeights.y, a.BoneWeights.z,
+			1.0f - a.BoneWeights.x - a.BoneWeights.y - a.BoneWeights.z };
+		float weightsB[4] = { b.BoneWeights.x, b.BoneWeights.y, b.BoneWeights.z,
+			1.0f - b.BoneWeights.x - b.BoneWeights.y - b.BoneWeights.z };
+
+		// Unused slots usually repeat a bone with zero weight, so sum per bone.
+		BYTE bones[8];
+		float delta[8];
+		UINT boneCount = 0;
+		auto add = [&](BYTE bone, float weight)
+		{
+			for (UINT i = 0; i < boneCount; ++i)
+			{
+				if (bones[i] == bone)
+				{
+					delta[i] += weight;
+					return;
+				}
+			}
+			bones[boneCount] = bone;
+			delta[boneCount++] = weight;
+		};
+
+		for (UINT i = 0; i < 4; ++i)
+		{
+			add(a.BoneIndices[i], weightsA[i]);
+			add(b.BoneIndices[i], -weightsB[i]);
+		}
+
+		float sum = 0.0f;
+		for (UINT i = 0; i < boneCount; ++i)
+			sum += std::fabs(delta[i]);
+		return sum;
+	}
+
+	// Distance from p to the triangle abc.
+	float TriangleDistance(FXMVECTOR p, FXMVECTOR a, FXMVECTOR b, GXMVECTOR c)
+	{
+		auto segmentDistance = [&](FXMVECTOR s0, FXMVECTOR s1)
+		{
+			XMVECTOR d = XMVectorSubtract(s1, s0);
+			float lengthSq = XMVectorGetX(XMVector3LengthSq(d));
+			float t = lengthSq > 0.0f ? XMVectorGetX(XMVector3Dot(XMVectorSubtract(p, s0), d)) / lengthSq : 0.0f;
+			XMVECTOR closest = XMVectorAdd(s0, XMVectorScale(d, MathHelper::Clamp(t, 0.0f, 1.0f)));
+			return XMVectorGetX(XMVector3Length(XMVectorSubtract(p, closest)));
+		};
+
+		XMVECTOR n = XMVector3Cross(XMVectorSubtract(b, a), XMVectorSubtract(c, a));
+		if (XMVectorGetX(XMVector3LengthSq(n)) > 0.0f)
+		{
+			// Inside the prism over the triangle the plane is closest.
+			XMVECTOR q = XMVectorSubtract(p, XMVectorScale(n, XMVectorGetX(XMVector3Dot(XMVectorSubtract(p, a), n)) /
+				XMVectorGetX(XMVector3LengthSq(n))));
+			auto inside = [&](FXMVECTOR e0, FXMVECTOR e1)
+			{
+				return XMVectorGetX(XMVector3Dot(XMVector3Cross(XMVectorSubtract(e1, e0), XMVectorSubtract(q, e0)), n)) >= 0.0f;
+			};
+			if (inside(a, b) && inside(b, c) && inside(c, a))
+				return XMVectorGetX(XMVector3Length(XMVectorSubtract(p, q)));
+		}
+
+		return MathHelper::Min(segmentDistance(a, b), MathHelper::Min(segmentDistance(b, c), segmentDistance(c, a)));
+	}
+
+	bool IndicesInRange(const UINT* indices, UINT indexCount, UINT firstVertex, UINT vertexCount)
+	{
+		for (UINT i = 0; i < indexCount; ++i)
+		{
+			if (indices[i] < firstVertex || indices[i] - firstVertex >= vertexCount)
+				return false;
+		}
+		return true;
+	}
+
+	template<typename T>
+	UINT SimplifyRange(const MeshSimplifier& simplifier, UINT* destination, const UINT* indices, UINT indexCount,
+		const T* vertices, UINT firstVertex, UINT vertexCount,
+		UINT targetIndexCount, float maxError, float* resultError)
+	{
+		indexCount -= indexCount % 3;
+
+		// Local vertex numbers from here on.
+		std::vector<UINT> current(indices, indices + indexCount);
+		for (UINT& index : current)
+			index -= firstVertex;
+
+		auto position = [&](UINT v) -> const XMFLOAT3& { return vertices[firstVertex + v].Pos; };
+
+		// Vertices sharing their position with another one sit on a seam, and
+		// are locked so both sides of the seam stay together.
+		std::vector<UINT> order(vertexCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](UINT a, UINT b)
+		{
+			const XMFLOAT3& pa = position(a);
+			const XMFLOAT3& pb = position(b);
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		});
+
+		std::vector<UINT> welded(vertexCount);
+		std::vector<bool> locked(vertexCount, false);
+		for (UINT i = 0; i < vertexCount;)
+		{
+			const XMFLOAT3& p = position(order[i]);
+
+			UINT end = i + 1;
+			while (end < vertexCount &&
+				position(order[end]).x == p.x && position(order[end]).y == p.y && position(order[end]).z == p.z)
+				++end;
+
+			for (UINT j = i; j < end; ++j)
+			{
+				welded[order[j]] = order[i];
+				locked[order[j]] = end - i > 1;
+			}
+
+			i = end;
+		}
+
+		// Lock the ends of open and non-manifold edges of the welded mesh.
+		{
+			std::vector<UINT64> edges;
+			edges.reserve(indexCount);
+			for (UINT i = 0; i < indexCount; ++i)
+			{
+				UINT a = welded[current[i]];
+				UINT b = welded[current[i - i % 3 + (i + 1) % 3]];
+				edges.push_back((UINT64)a << 32 | b);
+			}
+			std::sort(edges.begin(), edges.end());
+
+			auto edgeCount = [&](UINT a, UINT b)
+			{
+				auto range = std::equal_range(edges.begin(), edges.end(), (UINT64)a << 32 | b);
+				return range.second - range.first;
+			};
+
+			for (UINT i = 0; i < indexCount; ++i)
+			{
+				UINT v0 = current[i];
+				UINT v1 = current[i - i % 3 + (i + 1) % 3];
+				if (edgeCount(welded[v0], welded[v1]) != 1 || edgeCount(welded[v1], welded[v0]) != 1)
+				{
+					locked[v0] = true;
+					locked[v1] = true;
+				}
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (UINT i = 0; i < indexCount; i += 3)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&position(current[i + 0]));
+			XMVECTOR p1 = XMLoadFloat3(&position(current[i + 1]));
+			XMVECTOR p2 = XMLoadFloat3(&position(current[i + 2]));
+
+			XMVECTOR n = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+			float length = XMVectorGetX(XMVector3Length(n));
+			if (length <= 0.0f)
+				continue;
+
+			XMFLOAT3 normal;
+			XMStoreFloat3(&normal, XMVectorScale(n, 1.0f / length));
+			float d = -XMVectorGetX(XMVector3Dot(XMLoadFloat3(&normal), p0));
+
+			for (UINT j = 0; j < 3; ++j)
+				quadrics[current[i + j]].AddPlane(normal.x, normal.y, normal.z, d, 0.5f*length);
+		}
+
+		const double maxCost = (double)maxError * maxError;
+		double worstCost = 0.0;
+
+		// The vertex every vertex has been moved onto so far.
+		std::vector<UINT> remap(vertexCount);
+		std::iota(remap.begin(), remap.end(), 0);
+
+		std::vector<UINT> firstTriangle(vertexCount + 1);
+		std::vector<UINT> vertexTriangles;
+		std::vector<Collapse> candidates;
+		std::vector<UINT> collapseTarget(vertexCount);
+		std::vector<bool> touched(vertexCount);
+
+		// Would moving from onto to turn one of the remaining triangles of from
+		// over (or nearly so)?
+		auto flips = [&](UINT from, UINT to)
+		{
+			for (UINT k = firstTriangle[from]; k < firstTriangle[from + 1]; ++k)
+			{
+				const UINT* tri = &current[vertexTriangles[k] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+					continue;
+
+				XMVECTOR p[3];
+				XMVECTOR q[3];
+				for (UINT j = 0; j < 3; ++j)
+				{
+					p[j] = XMLoadFloat3(&position(tri[j]));
+					q[j] = tri[j] == from ? XMLoadFloat3(&position(to)) : p[j];
+				}
+
+				XMVECTOR n0 = XMVector3Cross(XMVectorSubtract(p[1], p[0]), XMVectorSubtract(p[2], p[0]));
+				XMVECTOR n1 = XMVector3Cross(XMVectorSubtract(q[1], q[0]), XMVectorSubtract(q[2], q[0]));
+
+				float dot = XMVectorGetX(XMVector3Dot(n0, n1));
+				float lengths = XMVectorGetX(XMVector3Length(n0)) * XMVectorGetX(XMVector3Length(n1));
+				if (dot < 0.25f*lengths || lengths <= 0.0f)
+					return true;
+			}
+			return false;
+		};
+
+		// Each pass collapses the cheapest edges whose neighbourhoods do not
+		// overlap, then rebuilds the adjacency.
+		while ((UINT)current.size() > targetIndexCount)
+		{
+			UINT triangleCount = (UINT)current.size() / 3;
+
+			std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+			for (UINT index : current)
+				++firstTriangle[index + 1];
+			for (UINT v = 0; v < vertexCount; ++v)
+				firstTriangle[v + 1] += firstTriangle[v];
+
+			vertexTriangles.resize(current.size());
+			{
+				std::vector<UINT> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+				for (UINT i = 0; i < (UINT)current.size(); ++i)
+					vertexTriangles[fill[current[i]]++] = i / 3;
+			}
+
+			candidates.clear();
+			for (UINT i = 0; i < (UINT)current.size(); ++i)
+			{
+				UINT from = current[i];
+				if (locked[from])
+					continue;
+
+				for (UINT j = 1; j < 3; ++j)
+				{
+					UINT to = current[i - i % 3 + (i + j) % 3];
+					if (SkinWeightDelta(vertices[firstVertex + from], vertices[firstVertex + to]) > simplifier.MaxSkinWeightDelta)
+						continue;
+
+					Quadric q = quadrics[from];
+					q.Add(quadrics[to]);
+
+					double cost = q.Error(position(to));
+					if (cost <= maxCost)
+						candidates.push_back({ from, to, (float)cost });
+				}
+			}
+
+			if (candidates.empty())
+				break;
+
+			std::sort(candidates.begin(), candidates.end(),
+				[](const Collapse& a, const Collapse& b) { return a.Cost < b.Cost; });
+
+			std::iota(collapseTarget.begin(), collapseTarget.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+
+			UINT trianglesToRemove = triangleCount - targetIndexCount / 3;
+			UINT trianglesRemoved = 0;
+			UINT collapses = 0;
+			for (const Collapse& c : candidates)
+			{
+				if (trianglesRemoved >= trianglesToRemove)
+					break;
+
+				if (touched[c.From] || touched[c.To] || flips(c.From, c.To))
+					continue;
+
+				collapseTarget[c.From] = c.To;
+				quadrics[c.To].Add(quadrics[c.From]);
+				worstCost = MathHelper::Max(worstCost, (double)c.Cost);
+				++collapses;
+
+				// Every triangle around from changes, so its vertices wait for
+				// the next pass.
+				for (UINT k = firstTriangle[c.From]; k < firstTriangle[c.From + 1]; ++k)
+				{
+					const UINT* tri = &current[vertexTriangles[k] * 3];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+
+					if (tri[0] == c.To || tri[1] == c.To || tri[2] == c.To)
+						++trianglesRemoved;
+				}
+			}
+
+			if (collapses == 0)
+				break;
+
+			for (UINT& v : remap)
+				v = collapseTarget[v];
+
+			UINT written = 0;
+			for (UINT i = 0; i < (UINT)current.size(); i += 3)
+			{
+				UINT a = collapseTarget[current[i + 0]];
+				UINT b = collapseTarget[current[i + 1]];
+				UINT c = collapseTarget[current[i + 2]];
+				if (a == b || b == c || a == c)
+					continue;
+
+				current[written++] = a;
+				current[written++] = b;
+				current[written++] = c;
+			}
+			current.resize(written);
+		}
+
+		for (UINT i = 0; i < (UINT)current.size(); ++i)
+			destination[i] = current[i] + firstVertex;
+
+		if (resultError)
+		{
+			// The quadrics average their planes, so they underestimate the
+			// distance of sharp features.  Also measure how far each removed
+			// vertex is from the triangles around the vertex it was moved onto.
+			std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+			for (UINT index : current)
+				++firstTriangle[index + 1];
+			for (UINT v = 0; v < vertexCount; ++v)
+				firstTriangle[v + 1] += firstTriangle[v];
+
+			vertexTriangles.resize(current.size());
+			std::vector<UINT> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+			for (UINT i = 0; i < (UINT)current.size(); ++i)
+				vertexTriangles[fill[current[i]]++] = i / 3;
+
+			auto ringDistance = [&](const XMVECTOR& p, UINT center, float distance)
+			{
+				for (UINT k = firstTriangle[center]; k < firstTriangle[center + 1]; ++k)
+				{
+					const UINT* tri = &current[vertexTriangles[k] * 3];
+					distance = MathHelper::Min(distance, TriangleDistance(p, XMLoadFloat3(&position(tri[0])),
+						XMLoadFloat3(&position(tri[1])), XMLoadFloat3(&position(tri[2]))));
+				}
+				return distance;
+			};
+
+			float worstDistance = (float)std::sqrt(worstCost);
+			for (UINT v = 0; v < vertexCount; ++v)
+			{
+				UINT to = remap[v];
+				if (to == v || firstTriangle[to] == firstTriangle[to + 1])
+					continue;
+
+				// Try the triangles around to first.  Only if they are farther
+				// than the worst so far, also try those around its neighbours.
+				XMVECTOR p = XMLoadFloat3(&position(v));
+				float distance = ringDistance(p, to, FLT_MAX);
+				for (UINT k = firstTriangle[to]; k < firstTriangle[to + 1] && distance > worstDistance; ++k)
+				{
+					for (UINT j = 0; j < 3; ++j)
+						distance = ringDistance(p, current[vertexTriangles[k] * 3 + j], distance);
+				}
+				worstDistance = MathHelper::Max(worstDistance, distance);
+			}
+
+			*resultError = worstDistance;
+		}
+
+		return (UINT)current.size();
+	}
+
+	template<typename T>
+	void BuildLodChain(const MeshSimplifier& simplifier, const T* vertices, UINT firstVertex, UINT vertexCount,
+		const UINT* indices, UINT indexCount, UINT submesh, std::vector<UINT>& lodIndices, std::vector<LodRange>& lods)
+	{
+		if (indexCount < 3 || vertexCount == 0)
+			return;
+
+		BoundingSphere bounds;
+		BoundingSphere::CreateFromPoints(bounds, vertexCount, &vertices[firstVertex].Pos, sizeof(T));
+		float maxError = simplifier.MaxRelativeError * bounds.Radius;
+
+		MeshOptimizer optimizer;
+		std::vector<UINT> lod(indexCount);
+
+		UINT previousCount = indexCount;
+		float previousError = 0.0f;
+		for (UINT level = 0; level < simplifier.MaxLodLevels; ++level)
+		{
+			UINT target = (UINT)(previousCount / 3 * simplifier.LodTriangleRatio) * 3;
+
+			// Every level starts from the full detail mesh, so its error is
+			// measured against the real surface.
+			float error = 0.0f;
+			UINT count = SimplifyRange(simplifier, lod.data(), indices, indexCount,
+				vertices, firstVertex, vertexCount, target, maxError, &error);
+
+			// Not worth a level of its own, or too far from the surface.
+			if (count == 0 || (UINT64)count * 10 > (UINT64)previousCount * 9 || error > maxError)
+				break;
+
+			optimizer.OptimizeVertexCache(lod.data(), count, firstVertex, vertexCount);
+
+			LodRange range;
+			range.Submesh = submesh;
+			range.StartIndexLocation = (UINT)lodIndices.size();
+			range.IndexCount = count;
+			range.Error = MathHelper::Max(error, previousError);
+			lods.push_back(range);
+
+			lodIndices.insert(lodIndices.end(), lod.begin(), lod.begin() + count);
+
+			previousCount = count;
+			previousError = range.Error;
+		}
+	}
+}
+
+UINT MeshSimplifier::Simplify(UINT* destination, const UINT* indices, UINT indexCount,
+	const Vertex* vertices, UINT firstVertex, UINT vertexCount,
+	UINT targetIndexCount, float maxError, float* resultError)const
+{
+	return SimplifyRange(*this, destination, indices, indexCount, vertices, firstVertex, vertexCount,
+		targetIndexCount, maxError, resultError);
+}
+
+UINT MeshSimplifier::Simplify(UINT* destination, const UINT* indices, UINT indexCount,
+	const SkinnedVertex* vertices, UINT firstVertex, UINT vertexCount,
+	UINT targetIndexCount, float maxError, float* resultError)const
+{
+	return SimplifyRange(*this, destination, indices, indexCount, vertices, firstVertex, vertexCount,
+		targetIndexCount, maxError, resultError);
+}
+
+void MeshSimplifier::BuildSubsetLods(const std::vector<SkinnedVertex>& vertices, std::vector<UINT>& indices,
+	const std::vector<M3DLoader::Subset>& subsets, std::vector<LodRange>& lods)const
+{
+	for (UINT s = 0; s < (UINT)subsets.size(); ++s)
+	{
+		const M3DLoader::Subset& subset = subsets[s];
+		UINT startIndex = subset.FaceStart * 3;
+		UINT indexCount = subset.FaceCount * 3;
+
+		if (indexCount == 0 ||
+			startIndex + indexCount > (UINT)indices.size() ||
+			subset.VertexStart + subset.VertexCount > (UINT)vertices.size() ||
+			!IndicesInRange(&indices[startIndex], indexCount, subset.VertexStart, subset.VertexCount))
+			continue;
+
+		// Copied, the levels are appended to the same vector.
+		std::vector<UINT> source(indices.begin() + startIndex, indices.begin() + startIndex + indexCount);
+		BuildLodChain(*this, vertices.data(), subset.VertexStart, subset.VertexCount,
+			source.data(), indexCount, s, indices, lods);
+	}
+}
+
+void MeshSimplifier::BuildMeshLods(const GeometryGenerator::MeshData& mesh,
+	std::vector<UINT>& lodIndices, std::vector<LodRange>& lods)const
+{
+	BuildLodChain(*this, mesh.Vertices.data(), 0, (UINT)mesh.Vertices.size(),
+		mesh.Indices32.data(), (UINT)mesh.Indices32.size(), 0, lodIndices, lods);
+}
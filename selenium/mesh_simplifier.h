@@ -0,0 +1,75 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "geometry_generator.h"
+#include "m3d_loader.h"
+#include "vertex.h"
+
+// One simplified level of a submesh.  Its indices follow the full detail
+// indices in the same index buffer and reference the same vertices.
+struct LodRange
+{
+	// Index of the submesh (or M3D subset) this is a level of.
+	UINT Submesh = 0;
+
+	UINT StartIndexLocation = 0;
+	UINT IndexCount = 0;
+
+	// Filled in when the indices are packed, see PackIndices.
+	INT BaseVertexLocation = 0;
+
+	// Estimated object space distance between this level's surface and the
+	// full detail one.
+	float Error = 0.0f;
+};
+
+// Builds coarser levels of detail of a triangle mesh by quadric error metric
+// edge collapses (Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics").  A collapse moves a vertex onto one of its neighbours, so
+// a level only needs new indices, never new vertices.
+//
+// Vertices that share their position with another vertex (UV or normal
+// seams) and vertices on open borders are never removed, which keeps seams
+// closed and silhouettes of open meshes intact.  Skinned vertices are only
+// merged with neighbours that have about the same bone influences.
+class MeshSimplifier
+{
+public:
+	// Coarser levels built per submesh, at most.
+	UINT MaxLodLevels = 3;
+
+	// Triangle count of a level relative to the previous one.
+	float LodTriangleRatio = 0.5f;
+
+	// Levels stop once their error would exceed this fraction of the
+	// submesh's bounding radius.
+	float MaxRelativeError = 0.1f;
+
+	// Largest sum of absolute bone weight differences of two skinned
+	// vertices that may be merged.
+	float MaxSkinWeightDelta = 0.5f;
+
+	// Simplifies indices[0, indexCount) towards targetIndexCount indices
+	// without exceeding maxError and writes the result to destination, which
+	// must hold indexCount indices.  Returns the new index count.  indices
+	// must only reference vertices in [firstVertex, firstVertex + vertexCount).
+	UINT Simplify(UINT* destination, const UINT* indices, UINT indexCount,
+		const Vertex* vertices, UINT firstVertex, UINT vertexCount,
+		UINT targetIndexCount, float maxError, float* resultError = nullptr)const;
+	UINT Simplify(UINT* destination, const UINT* indices, UINT indexCount,
+		const SkinnedVertex* vertices, UINT firstVertex, UINT vertexCount,
+		UINT targetIndexCount, float maxError, float* resultError = nullptr)const;
+
+	// Appends the levels of every subset to indices, vertex cache optimized,
+	// and describes them in lods in order of subset and then level.  Subsets
+	// whose indices reference vertices outside their vertex range get no
+	// levels.
+	void BuildSubsetLods(const std::vector<SkinnedVertex>& vertices, std::vector<UINT>& indices,
+		const std::vector<M3DLoader::Subset>& subsets, std::vector<LodRange>& lods)const;
+
+	// Levels of a mesh made of a single range.  Their indices are written to
+	// lodIndices and their StartIndexLocation is relative to it.
+	void BuildMeshLods(const GeometryGenerator::MeshData& mesh,
+		std::vector<UINT>& lodIndices, std::vector<LodRange>& lods)const;
+};
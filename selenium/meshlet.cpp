@@ -0,0 +1,194 @@
+#include "meshlet.h"
+#include <cmath>
+#include "math_helper.h"
+
+using namespace DirectX;
+
+namespace
+{
+	const XMFLOAT3& PositionAt(const XMFLOAT3* positions, UINT positionStride, UINT index)
+	{
+		return *(const XMFLOAT3*)((const BYTE*)positions + (size_t)index * positionStride);
+	}
+
+	// Fills in the bounds and normal cone of a meshlet from its triangles.
+	void ComputeMeshletBounds(const UINT* indices, const XMFLOAT3* positions, UINT positionStride,
+		const std::vector<XMFLOAT3>& meshletPositions, Meshlet& meshlet)
+	{
+		BoundingSphere::CreateFromPoints(meshlet.Bounds, meshletPositions.size(),
+			meshletPositions.data(), sizeof(XMFLOAT3));
+
+		// Unit triangle normals, and their average as the cone axis.
+		std::vector<XMFLOAT3> normals;
+		normals.reserve(meshlet.IndexCount / 3);
+
+		XMVECTOR axis = XMVectorZero();
+		for (UINT i = 0; i < meshlet.IndexCount; i += 3)
+		{
+			const UINT* tri = indices + meshlet.StartIndex + i;
+			XMVECTOR p0 = XMLoadFloat3(&PositionAt(positions, positionStride, tri[0]));
+			XMVECTOR p1 = XMLoadFloat3(&PositionAt(positions, positionStride, tri[1]));
+			XMVECTOR p2 = XMLoadFloat3(&PositionAt(positions, positionStride, tri[2]));
+
+			XMVECTOR n = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+
+			// Degenerate triangles are never visible and do not constrain the cone.
+			float length = XMVectorGetX(XMVector3Length(n));
+			if (length < 1e-12f)
+				continue;
+
+			n = XMVectorScale(n, 1.0f / length);
+			axis = XMVectorAdd(axis, n);
+
+			XMFLOAT3 normal;
+			XMStoreFloat3(&normal, n);
+			normals.push_back(normal);
+		}
+
+		float axisLength = XMVectorGetX(XMVector3Length(axis));
+		if (normals.empty() || axisLength < 1e-6f)
+		{
+			meshlet.ConeAxis = XMFLOAT3(0.0f, 0.0f, 1.0f);
+			meshlet.ConeCutoff = 1.0f;
+			return;
+		}
+
+		axis = XMVectorScale(axis, 1.0f / axisLength);
+		XMStoreFloat3(&meshlet.ConeAxis, axis);
+
+		float minDot = 1.0f;
+		for (const XMFLOAT3& normal : normals)
+			minDot = MathHelper::Min(minDot, XMVectorGetX(XMVector3Dot(XMLoadFloat3(&normal), axis)));
+
+		// Store the sine of the cone's half angle, the backface test compares
+		// against the complement of the angle to the eye.
+		meshlet.ConeCutoff = minDot <= 0.0f ? 1.0f : std::sqrt(MathHelper::Max(1.0f - minDot*minDot, 0.0f));
+	}
+}
+
+UINT MeshletCullStats::Visible()const
+{
+	return Tested - FrustumCulled - BackfaceCulled;
+}
+
+void MeshletCullStats::Merge(const MeshletCullStats& rhs)
+{
+	Tested += rhs.Tested;
+	FrustumCulled += rhs.FrustumCulled;
+	BackfaceCulled += rhs.BackfaceCulled;
+}
+
+void BuildMeshlets(const UINT* indices, UINT indexCount,
+	const XMFLOAT3* positions, UINT positionStride, std::vector<Meshlet>& meshlets)
+{
+	meshlets.clear();
+	if (indexCount < 3)
+		return;
+
+	UINT maxIndex = 0;
+	for (UINT i = 0; i < indexCount; ++i)
+		maxIndex = MathHelper::Max(maxIndex, indices[i]);
+
+	// Meshlet a vertex was last added to, so membership is a single compare.
+	std::vector<UINT> vertexMeshlet(maxIndex + 1, UINT_MAX);
+	std::vector<XMFLOAT3> meshletPositions;
+	meshletPositions.reserve(MaxMeshletVertices);
+
+	Meshlet meshlet;
+	UINT meshletIndex = 0;
+
+	for (UINT i = 0; i + 2 < indexCount; i += 3)
+	{
+		const UINT* tri = indices + i;
+
+		UINT newVertices = 0;
+		for (UINT j = 0; j < 3; ++j)
+		{
+			if (vertexMeshlet[tri[j]] != meshletIndex)
+				++newVertices;
+		}
+
+		// Repeated vertices within the triangle are counted twice; that only
+		// happens for degenerate triangles and just closes the meshlet early.
+		if (meshlet.VertexCount + newVertices > MaxMeshletVertices ||
+			meshlet.IndexCount / 3 == MaxMeshletTriangles)
+		{
+			ComputeMeshletBounds(indices, positions, positionStride, meshletPositions, meshlet);
+			meshlets.push_back(meshlet);
+
+			meshlet = Meshlet();
+			meshlet.StartIndex = i;
+			meshletPositions.clear();
+			++meshletIndex;
+		}
+
+		for (UINT j = 0; j < 3; ++j)
+		{
+			if (vertexMeshlet[tri[j]] != meshletIndex)
+			{
+				vertexMeshlet[tri[j]] = meshletIndex;
+				meshletPositions.push_back(PositionAt(positions, positionStride, tri[j]));
+				++meshlet.VertexCount;
+			}
+		}
+
+		meshlet.IndexCount += 3;
+	}
+
+	ComputeMeshletBounds(indices, positions, positionStride, meshletPositions, meshlet);
+	meshlets.push_back(meshlet);
+}
+
+void MeshletCuller::SetCamera(const BoundingFrustum& viewFrustum, FXMMATRIX view, const XMFLOAT3& eyePosW)
+{
+	mFrustum = viewFrustum;
+	XMStoreFloat4x4(&mView, view);
+	mEyePosW = eyePosW;
+}
+
+void MeshletCuller::Cull(const std::vector<Meshlet>& meshlets, UINT startIndexLocation, FXMMATRIX world,
+	std::vector<MeshletDrawRange>& ranges, MeshletCullStats* stats)const
+{
+	XMMATRIX worldView = XMMatrixMultiply(world, XMLoadFloat4x4(&mView));
+
+	// The backface test runs in object space.  Whether a point lies in front
+	// of a plane survives any affine transform, so this stays exact for
+	// non-uniformly scaled render items.
+	XMVECTOR det = XMMatrixDeterminant(world);
+	XMMATRIX invWorld = XMMatrixInverse(&det, world);
+	XMVECTOR eyeL = XMVector3TransformCoord(XMLoadFloat3(&mEyePosW), invWorld);
+
+	MeshletCullStats localStats;
+	for (const Meshlet& meshlet : meshlets)
+	{
+		++localStats.Tested;
+
+		BoundingSphere viewBounds;
+		meshlet.Bounds.Transform(viewBounds, worldView);
+		if (mFrustum.Contains(viewBounds) == DISJOINT)
+		{
+			++localStats.FrustumCulled;
+			continue;
+		}
+
+		// Every triangle faces away if the eye is inside the cone opposite
+		// the normal cone, widened by the meshlet's radius.
+		XMVECTOR toCenter = XMVectorSubtract(XMLoadFloat3(&meshlet.Bounds.Center), eyeL);
+		float distance = XMVectorGetX(XMVector3Length(toCenter));
+		float facing = XMVectorGetX(XMVector3Dot(toCenter, XMLoadFloat3(&meshlet.ConeAxis)));
+		if (facing >= meshlet.ConeCutoff * distance + meshlet.Bounds.Radius)
+		{
+			++localStats.BackfaceCulled;
+			continue;
+		}
+
+		UINT start = startIndexLocation + meshlet.StartIndex;
+		if (!ranges.empty() && ranges.back().StartIndexLocation + ranges.back().IndexCount == start)
+			ranges.back().IndexCount += meshlet.IndexCount;
+		else
+			ranges.push_back({ start, meshlet.IndexCount });
+	}
+
+	if (stats != nullptr)
+		stats->Merge(localStats);
+}
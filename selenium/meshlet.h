@@ -0,0 +1,78 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+// Limits of one meshlet, the sizes mesh shader pipelines are tuned for.
+const UINT MaxMeshletVertices = 64;
+const UINT MaxMeshletTriangles = 124;
+
+// A cluster of neighbouring triangles of a submesh that is culled as a unit.
+// The triangles of a meshlet are a contiguous range of the index buffer, so a
+// visible meshlet is drawn with the submesh's BaseVertexLocation and its own
+// index range.
+struct Meshlet
+{
+	// Relative to the StartIndexLocation of the submesh.
+	UINT StartIndex = 0;
+	UINT IndexCount = 0;
+
+	// Distinct vertices referenced.
+	UINT VertexCount = 0;
+
+	// Object space.
+	DirectX::BoundingSphere Bounds;
+
+	// Normal cone: every triangle normal is within acos(sqrt(1 - ConeCutoff^2))
+	// of ConeAxis.  ConeCutoff is 1 when the normals spread over a half space
+	// or more, which disables the backface test.
+	DirectX::XMFLOAT3 ConeAxis = { 0.0f, 0.0f, 1.0f };
+	float ConeCutoff = 1.0f;
+};
+
+// Index range of the index buffer to draw, absolute.
+struct MeshletDrawRange
+{
+	UINT StartIndexLocation = 0;
+	UINT IndexCount = 0;
+};
+
+struct MeshletCullStats
+{
+	UINT Tested = 0;
+	UINT FrustumCulled = 0;
+	UINT BackfaceCulled = 0;
+
+	UINT Visible()const;
+
+	void Merge(const MeshletCullStats& rhs);
+};
+
+// Splits the triangle list indices[0, indexCount) into meshlets by scanning it
+// in order, so run it after MeshOptimizer to get compact clusters.  positions
+// is indexed by the values in indices.  Front faces are clockwise, as for the
+// default rasterizer state.
+void BuildMeshlets(const UINT* indices, UINT indexCount,
+	const DirectX::XMFLOAT3* positions, UINT positionStride, std::vector<Meshlet>& meshlets);
+
+// Rejects meshlets that are outside the view frustum or face away from the
+// eye.  Call SetCamera once per view, then Cull per render item.
+class MeshletCuller
+{
+public:
+	// viewFrustum is in view space, e.g. BoundingFrustum::CreateFromMatrix of
+	// the projection matrix.
+	void SetCamera(const DirectX::BoundingFrustum& viewFrustum, DirectX::FXMMATRIX view,
+		const DirectX::XMFLOAT3& eyePosW);
+
+	// Appends the index ranges of the visible meshlets of a submesh starting at
+	// startIndexLocation to ranges, merging neighbours into one range.
+	void Cull(const std::vector<Meshlet>& meshlets, UINT startIndexLocation, DirectX::FXMMATRIX world,
+		std::vector<MeshletDrawRange>& ranges, MeshletCullStats* stats = nullptr)const;
+
+private:
+	DirectX::BoundingFrustum mFrustum;
+	DirectX::XMFLOAT4X4 mView;
+	DirectX::XMFLOAT3 mEyePosW = { 0.0f, 0.0f, 0.0f };
+};
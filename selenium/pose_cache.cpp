@@ -0,0 +1,157 @@
+#include "pose_cache.h"
+#include "math_helper.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+using namespace DirectX;
+
+size_t PoseCache::KeyHash::operator()(const Key& key)const
+{
+	size_t h = std::hash<const void*>()(key.Data);
+	h ^= std::hash<const void*>()(key.Clip) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	h ^= std::hash<UINT>()(key.Frame) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	return h;
+}
+
+PoseCache::PoseCache(UINT maxEntries, float sampleRate)
+	: mSampleRate(sampleRate)
+{
+	// Round the share of each shard down and hand the remainder to the first
+	// shards, so the capacities add up to exactly maxEntries.
+	for (UINT i = 0; i < ShardCount; ++i)
+	{
+		Shard& shard = mShards[i];
+		shard.MaxEntries = maxEntries / ShardCount + (i < maxEntries % ShardCount ? 1 : 0);
+		shard.Lookup.reserve(shard.MaxEntries);
+	}
+}
+
+float PoseCache::SampleRate()const
+{
+	return mSampleRate;
+}
+
+UINT PoseCache::SnapFrame(float timePos)const
+{
+	return (UINT)(MathHelper::Max(timePos, 0.0f) * mSampleRate + 0.5f);
+}
+
+PoseCache::Key PoseCache::MakeKey(const SkinnedData& data, const AnimationClip& clip, float timePos)const
+{
+	Key key;
+	key.Data = &data;
+	key.Clip = &clip;
+	key.Frame = SnapFrame(timePos);
+	return key;
+}
+
+void PoseCache::GetFinalTransforms(const SkinnedData& data, const AnimationClip& clip, float timePos,
+	PoseWorkspace& workspace, XMFLOAT4X4* finalTransforms)
+{
+	if (TryGetFinalTransforms(data, clip, timePos, finalTransforms))
+		return;
+
+	// Evaluate at the snapped time so every controller sharing the entry sees
+	// exactly the same pose.  finalTransforms may be write-combined, so the
+	// palette is built in the workspace and only ever copied out.
+	workspace.Reserve(data.BoneCount());
+	const XMFLOAT4X4* palette = workspace.FinalTransforms.data();
+	data.GetFinalTransforms(clip, SnapTime(timePos), workspace, workspace.FinalTransforms.data());
+	std::memcpy(finalTransforms, palette, data.BoneCount() * sizeof(XMFLOAT4X4));
+
+	Insert(data, clip, timePos, palette);
+}
+
+bool PoseCache::TryGetFinalTransforms(const SkinnedData& data, const AnimationClip& clip, float timePos,
+	XMFLOAT4X4* finalTransforms)
+{
+	Key key = MakeKey(data, clip, timePos);
+
+	Shard& shard = mShards[KeyHash()(key) % ShardCount];
+	{
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		auto it = shard.Lookup.find(key);
+		if (it != shard.Lookup.end())
+		{
+			shard.Entries.splice(shard.Entries.begin(), shard.Entries, it->second);
+			std::memcpy(finalTransforms, it->second->Palette.data(), data.BoneCount() * sizeof(XMFLOAT4X4));
+			mHits.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	mMisses.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+float PoseCache::SnapTime(float timePos)const
+{
+	return SnapFrame(timePos) / mSampleRate;
+}
+
+void PoseCache::Insert(const SkinnedData& data, const AnimationClip& clip, float timePos,
+	const XMFLOAT4X4* finalTransforms)
+{
+	Key key = MakeKey(data, clip, timePos);
+
+	Shard& shard = mShards[KeyHash()(key) % ShardCount];
+	std::lock_guard<std::mutex> lock(shard.Mutex);
+
+	// Another thread may have filled the entry while we were evaluating.
+	if (shard.MaxEntries == 0 || shard.Lookup.count(key) != 0)
+		return;
+
+	if (shard.Entries.size() < shard.MaxEntries)
+	{
+		shard.Entries.emplace_front();
+	}
+	else
+	{
+		// Recycle the least recently used entry and its palette storage.
+		shard.Lookup.erase(shard.Entries.back().EntryKey);
+		shard.Entries.splice(shard.Entries.begin(), shard.Entries, std::prev(shard.Entries.end()));
+	}
+
+	Entry& entry = shard.Entries.front();
+	entry.EntryKey = key;
+	entry.Palette.assign(finalTransforms, finalTransforms + data.BoneCount());
+	shard.Lookup[key] = shard.Entries.begin();
+}
+
+void PoseCache::Clear()
+{
+	for (auto& shard : mShards)
+	{
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		shard.Lookup.clear();
+		shard.Entries.clear();
+	}
+}
+
+UINT PoseCache::Size()const
+{
+	UINT size = 0;
+	for (auto& shard : mShards)
+	{
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		size += (UINT)shard.Entries.size();
+	}
+	return size;
+}
+
+UINT64 PoseCache::Hits()const
+{
+	return mHits.load();
+}
+
+UINT64 PoseCache::Misses()const
+{
+	return mMisses.load();
+}
+
+void PoseCache::ResetCounters()
+{
+	mHits = 0;
+	mMisses = 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "skinned_data.h"
+
+// Shares final bone palettes between SkinnedControllers that play the same
+// clip at (nearly) the same time, e.g. a crowd walking in step.  Time
+// positions are snapped to SampleRate frames per second so controllers that
+// are a fraction of a frame apart hit the same entry.  The cache holds at most
+// maxEntries palettes and evicts the least recently used one when full.
+//
+// Safe to use from several threads at once.  Entries are spread over a few
+// independently locked shards so parallel animation does not serialize on
+// one mutex; a palette is evaluated outside the lock on a miss.
+class PoseCache
+{
+public:
+	PoseCache(UINT maxEntries, float sampleRate = 30.0f);
+	PoseCache(const PoseCache& rhs) = delete;
+	PoseCache& operator=(const PoseCache& rhs) = delete;
+
+	float SampleRate()const;
+
+	// Copies the palette of clip at the quantized timePos into finalTransforms
+	// (data.BoneCount() matrices), evaluating it with workspace on a miss.
+	// finalTransforms is only written, so it may point into an upload buffer.
+	void GetFinalTransforms(const SkinnedData& data, const AnimationClip& clip, float timePos,
+		PoseWorkspace& workspace, DirectX::XMFLOAT4X4* finalTransforms);
+
+	// The two halves of GetFinalTransforms, for callers that evaluate misses
+	// themselves.  TryGetFinalTransforms copies a cached palette and returns
+	// true, or counts a miss and returns false; the caller then evaluates the
+	// pose at SnapTime(timePos) and hands it to Insert.
+	bool TryGetFinalTransforms(const SkinnedData& data, const AnimationClip& clip, float timePos,
+		DirectX::XMFLOAT4X4* finalTransforms);
+	float SnapTime(float timePos)const;
+	void Insert(const SkinnedData& data, const AnimationClip& clip, float timePos,
+		const DirectX::XMFLOAT4X4* finalTransforms);
+
+	void Clear();
+
+	// Palettes held, at most maxEntries.
+	UINT Size()const;
+
+	UINT64 Hits()const;
+	UINT64 Misses()const;
+	void ResetCounters();
+
+private:
+	struct Key
+	{
+		const SkinnedData* Data;
+		const AnimationClip* Clip;
+		UINT Frame;
+
+		bool operator==(const Key& rhs)const
+		{
+			return Data == rhs.Data && Clip == rhs.Clip && Frame == rhs.Frame;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key)const;
+	};
+
+	// timePos in whole frames of SampleRate.
+	UINT SnapFrame(float timePos)const;
+	Key MakeKey(const SkinnedData& data, const AnimationClip& clip, float timePos)const;
+
+	struct Entry
+	{
+		Key EntryKey;
+		std::vector<DirectX::XMFLOAT4X4> Palette;
+	};
+
+	// Front of Entries is the most recently used.  The shards split
+	// maxEntries between them, so a shard may hold no entries at all.
+	struct Shard
+	{
+		UINT MaxEntries = 0;
+		mutable std::mutex Mutex;
+		std::list<Entry> Entries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> Lookup;
+	};
+
+	static const UINT ShardCount = 16;
+
+	Shard mShards[ShardCount];
+	float mSampleRate;
+
+	std::atomic<UINT64> mHits{ 0 };
+	std::atomic<UINT64> mMisses{ 0 };
+};
@@ -3,15 +3,13 @@
 #include "math_helper.h"
 #include "material.h"
 #include "mesh_geometry.h"
-#include "skinned_controller.h"
+#include "render_layer.h"
 
 // Lightweight structure stores parameters to draw a shape.  This will
-// vary from app-to-app.
+// vary from app-to-app.  RenderItemStore::Add splits it into the store's
+// component arrays.
 struct RenderItem
 {
-	RenderItem() = default;
-	RenderItem(const RenderItem& rhs) = delete;
-
 	// World matrix of the shape that describes the object's local space
 	// relative to the world space, which defines the position, orientation,
 	// and scale of the object in the world.
@@ -19,15 +17,6 @@ struct RenderItem
 
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = NumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = -1;
-
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-	UINT ObjCBIndex = -1;
-
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 	
@@ -39,9 +28,19 @@ struct RenderItem
 	UINT StartIndexLocation = 0;
 	int BaseVertexLocation = 0;
 
-	// Only applicable to skinned render-items.
+	// Submesh the draw range comes from.  If it has levels of detail, the
+	// range and meshlets of the level picked by SelectLods are used.  Items
+	// with a submesh are culled against the camera by its bounds.
+	const SubmeshGeometry* Submesh = nullptr;
+
+	// Meshlets of the submesh drawn, nullptr to always draw the whole range.
+	// Must not be set for skinned or otherwise deformed geometry, the
+	// meshlet bounds are those of the bind pose.
+	const std::vector<Meshlet>* Meshlets = nullptr;
+
+	// Slot in the SkinnedCB, -1 if the item is not skinned.
 	UINT SkinnedCBIndex = -1;
 
-	// nullptr if this render-item is not animated by skinned controller.
-	SkinnedController* skinnedController = nullptr;
+	// Pass the item is drawn in; Count for items drawn by hand.
+	RenderLayer Layer = RenderLayer::Count;
 };
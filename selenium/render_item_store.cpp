@@ -0,0 +1,124 @@
+#include "render_item_store.h"
+#include <cassert>
+#include <utility>
+
+using namespace DirectX;
+
+RenderItemHandle RenderItemStore::Add(const RenderItem& item)
+{
+	UINT index = Count();
+
+	UINT slot = mFreeSlot;
+	if (slot != UINT(-1))
+	{
+		mFreeSlot = mSlots[slot].Index;
+	}
+	else
+	{
+		slot = (UINT)mSlots.size();
+		mSlots.emplace_back();
+	}
+	mSlots[slot].Index = index;
+
+	RenderItemDraw draw;
+	draw.Geo = item.Geo;
+	draw.PrimitiveTopology = item.PrimitiveTopology;
+	draw.IndexCount = item.IndexCount;
+	draw.StartIndexLocation = item.StartIndexLocation;
+	draw.BaseVertexLocation = item.BaseVertexLocation;
+	draw.SkinnedCBIndex = item.SkinnedCBIndex;
+	draw.GeometryId = mGeometryIds.emplace(item.Geo, (UINT)mGeometryIds.size()).first->second;
+
+	RenderItemMesh mesh;
+	mesh.Submesh = item.Submesh;
+	mesh.Meshlets = item.Meshlets;
+
+	mWorld.push_back(item.World);
+	mTexTransform.push_back(item.TexTransform);
+	mMaterialIndex.push_back(item.Mat != nullptr ? (UINT)item.Mat->bufferIndex : 0);
+	mDraw.push_back(draw);
+	mMesh.push_back(std::move(mesh));
+	mLayer.push_back(item.Layer);
+	mItemSlot.push_back(slot);
+
+	mDirty.Resize(Count());
+	MarkDirty(index);
+
+	++mLayoutVersion;
+
+	RenderItemHandle handle;
+	handle.Slot = slot;
+	handle.Generation = mSlots[slot].Generation;
+	return handle;
+}
+
+void RenderItemStore::Remove(RenderItemHandle handle)
+{
+	assert(IsValid(handle));
+
+	UINT index = mSlots[handle.Slot].Index;
+	UINT last = Count() - 1;
+
+	// Move the last item into the hole.  Its constants now live in another
+	// slot of the constant buffer, so they have to be written again.
+	if (index != last)
+	{
+		mWorld[index] = mWorld[last];
+		mTexTransform[index] = mTexTransform[last];
+		mMaterialIndex[index] = mMaterialIndex[last];
+		mDraw[index] = mDraw[last];
+		mMesh[index] = std::move(mMesh[last]);
+		mLayer[index] = mLayer[last];
+		mItemSlot[index] = mItemSlot[last];
+		mSlots[mItemSlot[index]].Index = index;
+		MarkDirty(index);
+	}
+
+	mWorld.pop_back();
+	mTexTransform.pop_back();
+	mMaterialIndex.pop_back();
+	mDraw.pop_back();
+	mMesh.pop_back();
+	mLayer.pop_back();
+	mItemSlot.pop_back();
+	mDirty.Resize(Count());
+
+	Slot& slot = mSlots[handle.Slot];
+	++slot.Generation;
+	slot.Index = mFreeSlot;
+	mFreeSlot = handle.Slot;
+
+	++mLayoutVersion;
+}
+
+bool RenderItemStore::IsValid(RenderItemHandle handle)const
+{
+	return handle.Slot < mSlots.size() && mSlots[handle.Slot].Generation == handle.Generation;
+}
+
+RenderItemHandle RenderItemStore::HandleAt(UINT index)const
+{
+	RenderItemHandle handle;
+	handle.Slot = mItemSlot[index];
+	handle.Generation = mSlots[handle.Slot].Generation;
+	return handle;
+}
+
+void RenderItemStore::SetWorld(UINT index, const XMFLOAT4X4& world)
+{
+	mWorld[index] = world;
+	mMesh[index].BoundsDirty = true;
+	MarkDirty(index);
+}
+
+void RenderItemStore::SetTexTransform(UINT index, const XMFLOAT4X4& texTransform)
+{
+	mTexTransform[index] = texTransform;
+	MarkDirty(index);
+}
+
+void RenderItemStore::SetMaterialIndex(UINT index, UINT materialIndex)
+{
+	mMaterialIndex[index] = materialIndex;
+	MarkDirty(index);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <unordered_map>
+#include <vector>
+#include "dirty_tracker.h"
+#include "render_item.h"
+
+// Names an item of a RenderItemStore.  Stays valid until the item is
+// removed; after that IsValid returns false even if the slot is reused.
+struct RenderItemHandle
+{
+	UINT Slot = UINT(-1);
+	UINT Generation = 0;
+};
+
+// What DrawPackets needs of an item.
+struct RenderItemDraw
+{
+	MeshGeometry* Geo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY PrimitiveTopology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	// Small number naming Geo, for draw sort keys.
+	UINT GeometryId = 0;
+
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	int BaseVertexLocation = 0;
+
+	// -1 if the item is not skinned.
+	UINT SkinnedCBIndex = UINT(-1);
+};
+
+// Level of detail, meshlet and culling state of an item.
+struct RenderItemMesh
+{
+	const SubmeshGeometry* Submesh = nullptr;
+	UINT LodIndex = 0;
+
+	// Meshlets of the level drawn, and the index ranges that survived
+	// meshlet culling this frame.
+	const std::vector<Meshlet>* Meshlets = nullptr;
+	std::vector<MeshletDrawRange> VisibleRanges;
+
+	// Set when World changes, so the culling bounds get updated.
+	bool BoundsDirty = false;
+};
+
+// Render items kept as one array per component, so a pass over all items
+// (updating constants, building draw lists) streams through the
+// components it needs instead of chasing a pointer per item.
+//
+// The items are packed at indices [0, Count()), which are also their slots
+// in the object constant buffer.  Remove moves the last item into the hole,
+// so indices change on Add and Remove; handles do not.
+class RenderItemStore
+{
+public:
+	// Copies of the object constants, one per frame resource.  Items are
+	// queued for all of them when they change.  Call before Add.
+	void SetFrameResourceCount(int count) { mDirty.SetFrameResourceCount(count); }
+
+	RenderItemHandle Add(const RenderItem& item);
+	void Remove(RenderItemHandle handle);
+
+	bool IsValid(RenderItemHandle handle)const;
+	UINT IndexOf(RenderItemHandle handle)const { return mSlots[handle.Slot].Index; }
+	RenderItemHandle HandleAt(UINT index)const;
+
+	UINT Count()const { return (UINT)mWorld.size(); }
+
+	// Changes whenever items are added, removed or moved, i.e. whenever
+	// indices kept outside the store go stale.
+	UINT64 LayoutVersion()const { return mLayoutVersion; }
+
+	// Queues the item for every frame resource.
+	void SetWorld(UINT index, const DirectX::XMFLOAT4X4& world);
+	void SetTexTransform(UINT index, const DirectX::XMFLOAT4X4& texTransform);
+	void SetMaterialIndex(UINT index, UINT materialIndex);
+	void MarkDirty(UINT index) { mDirty.MarkDirty(index); }
+
+	// Components, indexed by item index.
+	const std::vector<DirectX::XMFLOAT4X4>& World()const { return mWorld; }
+	const std::vector<DirectX::XMFLOAT4X4>& TexTransform()const { return mTexTransform; }
+	const std::vector<UINT>& MaterialIndex()const { return mMaterialIndex; }
+	const std::vector<RenderLayer>& Layer()const { return mLayer; }
+
+	std::vector<RenderItemDraw>& Draw() { return mDraw; }
+	const std::vector<RenderItemDraw>& Draw()const { return mDraw; }
+	std::vector<RenderItemMesh>& Mesh() { return mMesh; }
+	const std::vector<RenderItemMesh>& Mesh()const { return mMesh; }
+
+	// Items whose constants changed since they were last taken for
+	// frameResource.  Valid until the next call.
+	const std::vector<UINT>& TakeDirty(int frameResource) { return mDirty.TakeDirty(frameResource); }
+
+private:
+	struct Slot
+	{
+		// Item index while the slot is in use, next free slot otherwise.
+		UINT Index = 0;
+		UINT Generation = 0;
+	};
+
+private:
+	std::vector<DirectX::XMFLOAT4X4> mWorld;
+	std::vector<DirectX::XMFLOAT4X4> mTexTransform;
+	std::vector<UINT> mMaterialIndex;
+	std::vector<RenderItemDraw> mDraw;
+	std::vector<RenderItemMesh> mMesh;
+	std::vector<RenderLayer> mLayer;
+	DirtyTracker mDirty;
+
+	// Slot of each item, and the item of each slot.
+	std::vector<UINT> mItemSlot;
+	std::vector<Slot> mSlots;
+	UINT mFreeSlot = UINT(-1);
+
+	// GeometryId of each geometry, numbered in order of first use.
+	std::unordered_map<const MeshGeometry*, UINT> mGeometryIds;
+
+	UINT64 mLayoutVersion = 0;
+};
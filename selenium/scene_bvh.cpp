@@ -0,0 +1,190 @@
+#include "scene_bvh.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+namespace
+{
+	bool SameBox(const BoundingBox& a, const BoundingBox& b)
+	{
+		return a.Center.x == b.Center.x && a.Center.y == b.Center.y && a.Center.z == b.Center.z &&
+			a.Extents.x == b.Extents.x && a.Extents.y == b.Extents.y && a.Extents.z == b.Extents.z;
+	}
+
+	float Component(const XMFLOAT3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+}
+
+void SceneBvh::Build(const BoundingBox* boxes, UINT count)
+{
+	mItemBounds.assign(boxes, boxes + count);
+	mItemOrder.resize(count);
+	mItemLeaf.assign(count, 0);
+	for (UINT i = 0; i < count; ++i)
+		mItemOrder[i] = i;
+
+	mNodes.clear();
+	mDirtyLeaves.clear();
+	if (count == 0)
+	{
+		mLeafDirty.clear();
+		return;
+	}
+
+	// A binary tree with leaves of at least MaxLeafItems / 2 items.
+	mNodes.reserve(2 * (count / (MaxLeafItems / 2) + 1));
+	BuildNode(UINT(-1), 0, count);
+
+	mLeafDirty.assign(mNodes.size(), false);
+}
+
+UINT SceneBvh::BuildNode(UINT parent, UINT firstItem, UINT itemCount)
+{
+	UINT nodeIndex = (UINT)mNodes.size();
+	mNodes.emplace_back();
+	mNodes[nodeIndex].Parent = parent;
+	mNodes[nodeIndex].FirstItem = firstItem;
+	mNodes[nodeIndex].ItemCount = itemCount;
+
+	if (itemCount <= MaxLeafItems)
+	{
+		ComputeLeafBounds(mNodes[nodeIndex]);
+		for (UINT i = firstItem; i < firstItem + itemCount; ++i)
+			mItemLeaf[mItemOrder[i]] = nodeIndex;
+		return nodeIndex;
+	}
+
+	// Split along the longest axis of the item centers.
+	XMVECTOR centerMin = XMLoadFloat3(&mItemBounds[mItemOrder[firstItem]].Center);
+	XMVECTOR centerMax = centerMin;
+	for (UINT i = firstItem + 1; i < firstItem + itemCount; ++i)
+	{
+		XMVECTOR c = XMLoadFloat3(&mItemBounds[mItemOrder[i]].Center);
+		centerMin = XMVectorMin(centerMin, c);
+		centerMax = XMVectorMax(centerMax, c);
+	}
+
+	XMFLOAT3 size;
+	XMStoreFloat3(&size, XMVectorSubtract(centerMax, centerMin));
+	int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+
+	UINT half = itemCount / 2;
+	std::nth_element(mItemOrder.begin() + firstItem, mItemOrder.begin() + firstItem + half,
+		mItemOrder.begin() + firstItem + itemCount, [&](UINT a, UINT b)
+	{
+		return Component(mItemBounds[a].Center, axis) < Component(mItemBounds[b].Center, axis);
+	});
+
+	BuildNode(nodeIndex, firstItem, half);
+	UINT right = BuildNode(nodeIndex, firstItem + half, itemCount - half);
+
+	// mNodes may have grown, take the reference only now.
+	Node& node = mNodes[nodeIndex];
+	node.RightChild = right;
+	BoundingBox::CreateMerged(node.Bounds, mNodes[nodeIndex + 1].Bounds, mNodes[right].Bounds);
+
+	return nodeIndex;
+}
+
+void SceneBvh::ComputeLeafBounds(Node& node)const
+{
+	node.Bounds = mItemBounds[mItemOrder[node.FirstItem]];
+	for (UINT i = node.FirstItem + 1; i < node.FirstItem + node.ItemCount; ++i)
+		BoundingBox::CreateMerged(node.Bounds, node.Bounds, mItemBounds[mItemOrder[i]]);
+}
+
+void SceneBvh::SetItemBounds(UINT item, const BoundingBox& box)
+{
+	mItemBounds[item] = box;
+
+	UINT leaf = mItemLeaf[item];
+	if (!mLeafDirty[leaf])
+	{
+		mLeafDirty[leaf] = true;
+		mDirtyLeaves.push_back(leaf);
+	}
+}
+
+void SceneBvh::Refit()
+{
+	for (UINT leaf : mDirtyLeaves)
+	{
+		mLeafDirty[leaf] = false;
+
+		BoundingBox old = mNodes[leaf].Bounds;
+		ComputeLeafBounds(mNodes[leaf]);
+		if (SameBox(old, mNodes[leaf].Bounds))
+			continue;
+
+		for (UINT node = mNodes[leaf].Parent; node != UINT(-1); node = mNodes[node].Parent)
+		{
+			old = mNodes[node].Bounds;
+			BoundingBox::CreateMerged(mNodes[node].Bounds,
+				mNodes[node + 1].Bounds, mNodes[mNodes[node].RightChild].Bounds);
+			if (SameBox(old, mNodes[node].Bounds))
+				break;
+		}
+	}
+
+	mDirtyLeaves.clear();
+}
+
+void SceneBvh::Query(const BoundingFrustum& frustum, std::vector<UINT>& visible, SceneBvhStats* stats)const
+{
+	if (mNodes.empty())
+		return;
+
+	SceneBvhStats queryStats;
+	size_t firstVisible = visible.size();
+
+	// The tree is balanced, so its depth is about log2 of the leaf count.
+	UINT stack[64];
+	UINT stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = mNodes[stack[--stackSize]];
+
+		++queryStats.NodesTested;
+		ContainmentType containment = frustum.Contains(node.Bounds);
+		if (containment == DISJOINT)
+			continue;
+
+		if (containment == CONTAINS)
+		{
+			visible.insert(visible.end(), mItemOrder.begin() + node.FirstItem,
+				mItemOrder.begin() + node.FirstItem + node.ItemCount);
+		}
+		else if (node.RightChild == 0)
+		{
+			// A single item has the box of the leaf, which was just tested.
+			for (UINT i = node.FirstItem; i < node.FirstItem + node.ItemCount; ++i)
+			{
+				if (node.ItemCount > 1)
+				{
+					++queryStats.ItemsTested;
+					if (frustum.Contains(mItemBounds[mItemOrder[i]]) == DISJOINT)
+						continue;
+				}
+				visible.push_back(mItemOrder[i]);
+			}
+		}
+		else
+		{
+			// Visit the left child first so the output follows the tree order.
+			stack[stackSize++] = node.RightChild;
+			stack[stackSize++] = (UINT)(&node - mNodes.data()) + 1;
+		}
+	}
+
+	if (stats != nullptr)
+	{
+		queryStats.Visible = (UINT)(visible.size() - firstVisible);
+		stats->NodesTested += queryStats.NodesTested;
+		stats->ItemsTested += queryStats.ItemsTested;
+		stats->Visible += queryStats.Visible;
+	}
+}
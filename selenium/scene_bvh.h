@@ -0,0 +1,75 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+struct SceneBvhStats
+{
+	UINT NodesTested = 0;
+	UINT ItemsTested = 0;
+	UINT Visible = 0;
+};
+
+// Bounding volume hierarchy over the world space boxes of a set of items,
+// which are named by their index in the array passed to Build.  Nodes are
+// stored depth first, so the items under a node are one contiguous range
+// and a node that is fully inside the frustum is accepted without visiting
+// its children.
+class SceneBvh
+{
+public:
+	// Most items kept in one leaf.
+	static const UINT MaxLeafItems = 4;
+
+	// Builds the tree top-down, splitting each node at the median of its item
+	// centers along the longest axis.
+	void Build(const DirectX::BoundingBox* boxes, UINT count);
+
+	UINT ItemCount()const { return (UINT)mItemBounds.size(); }
+	UINT NodeCount()const { return (UINT)mNodes.size(); }
+
+	const DirectX::BoundingBox& ItemBounds(UINT item)const { return mItemBounds[item]; }
+
+	// Moves an item.  The nodes above it are refit by the next Refit, the
+	// tree is not rebuilt.
+	void SetItemBounds(UINT item, const DirectX::BoundingBox& box);
+
+	// Grows and shrinks the nodes above the items moved since the last Refit.
+	// Walking up from each moved leaf stops at the first node whose box does
+	// not change, so the cost follows the number of moved items.
+	void Refit();
+
+	// Appends the items whose boxes are not disjoint from frustum, which is in
+	// world space.
+	void Query(const DirectX::BoundingFrustum& frustum, std::vector<UINT>& visible,
+		SceneBvhStats* stats = nullptr)const;
+
+private:
+	struct Node
+	{
+		DirectX::BoundingBox Bounds;
+
+		// Items under this node are mItemOrder[FirstItem, FirstItem + ItemCount).
+		UINT FirstItem = 0;
+		UINT ItemCount = 0;
+
+		// The left child directly follows its parent; RightChild is 0 for leaves.
+		UINT RightChild = 0;
+		UINT Parent = UINT(-1);
+	};
+
+	UINT BuildNode(UINT parent, UINT firstItem, UINT itemCount);
+	void ComputeLeafBounds(Node& node)const;
+
+private:
+	std::vector<Node> mNodes;
+
+	std::vector<DirectX::BoundingBox> mItemBounds;
+	std::vector<UINT> mItemOrder;
+	std::vector<UINT> mItemLeaf;
+
+	// Leaves with moved items, each listed once.
+	std::vector<UINT> mDirtyLeaves;
+	std::vector<bool> mLeafDirty;
+};
@@ -8,6 +8,11 @@
 #include "DDSTextureLoader.h"
 #include <wrl/client.h>
 #include "geometry_generator.h"
+#include "index_buffer.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet.h"
+#include "vertex_packing.h"
 #include "render_item.h"
 #include <DirectXColors.h>
 
@@ -41,6 +46,8 @@ bool SeleniumApp::Initialize()
 	
 	mCamera.SetPosition(0.0f, 2.0f, -15.0f);
 
+	mJobSystem = std::make_unique<JobSystem>();
+
 	mShadowMap = std::make_unique<ShadowMap>(md3dDevice.Get(), 2048, 2048);
 
 	mSsao = std::make_unique<Ssao>(
@@ -55,8 +62,10 @@ bool SeleniumApp::Initialize()
 	BuildDescriptorHeaps();
 	BuildShadersAndInputLayout();
 	BuildShapeGeometry();
+	BuildTerrainGeometry();
 	BuildMaterials();
 	BuildRenderItems();
+	BuildDrawLists();
 	BuildFrameResources();
 	BuildPSOs();
 
@@ -75,39 +84,152 @@ bool SeleniumApp::Initialize()
 
 void SeleniumApp::LoadSkinnedModel() {
 	std::vector<SkinnedVertex> vertices;
-	std::vector<std::uint16_t> indices;
+	std::vector<UINT> indices;
+	PackedIndices packedIndices;
+
+	// Prefer the binary model next to the text one, converting it on first
+	// use.  Its indices are uploaded straight from the mapping and its
+	// vertices are packed from it.
+	ArrayView<SkinnedVertex> vertexView;
+	const void* indexData = nullptr;
+	UINT indexCount = 0;
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT;
+
+	// One per subset.
+	std::vector<SubmeshGeometry> submeshes;
+
+	// Simplified levels of the subsets, see MeshSimplifier.
+	std::vector<LodRange> lods;
+
+	std::string binaryFilename = mSkinnedModelFilename + "b";
+	M3DBinaryFile binaryModel;
+	bool binaryLoaded = binaryModel.Open(binaryFilename) && binaryModel.IsCurrent(mSkinnedModelFilename);
+	if (!binaryLoaded)
+	{
+		// Missing, invalid or older than the text model.  Unmap it first so
+		// it can be overwritten.
+		binaryModel.Close();
+		binaryLoaded = M3DBinaryFile::Convert(mSkinnedModelFilename, binaryFilename, mJobSystem.get()) &&
+			binaryModel.Open(binaryFilename);
+	}
+	if (binaryLoaded)
+	{
+		ArrayView<M3DLoader::Subset> subsets = binaryModel.Subsets();
+		mSkinnedSubsets.assign(subsets.begin(), subsets.end());
+		binaryModel.GetMaterials(mSkinnedMatInfo);
+		binaryModel.GetSkinnedData(mSkinnedData);
 
-	M3DLoader m3dLoader;
-	m3dLoader.LoadM3d(mSkinnedModelFilename, vertices, indices,
-		mSkinnedSubsets, mSkinnedMatInfo, mSkinnedData);
+		vertexView = binaryModel.Vertices();
 
-	mSkinnedController = std::make_unique<SkinnedController>();
-	mSkinnedController->Data = &mSkinnedData;
-	mSkinnedController->FinalTransforms.resize(mSkinnedData.BoneCount());
-	mSkinnedController->ClipName = "Take1";
-	mSkinnedController->TimePos = 0.0f;
+		indexFormat = binaryModel.IndexFormat();
+		if (indexFormat == DXGI_FORMAT_R16_UINT)
+		{
+			indexData = binaryModel.Indices16().Data;
+			indexCount = binaryModel.Indices16().Size;
+		}
+		else
+		{
+			indexData = binaryModel.Indices32().Data;
+			indexCount = binaryModel.Indices32().Size;
+		}
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(SkinnedVertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+		// The file stores the indices already rebased per subset.
+		ArrayView<INT> baseVertices = binaryModel.SubsetBaseVertices();
+		submeshes.resize(mSkinnedSubsets.size());
+		for (UINT i = 0; i < (UINT)mSkinnedSubsets.size(); ++i)
+			submeshes[i].BaseVertexLocation = baseVertices[i];
+
+		ArrayView<LodRange> lodView = binaryModel.Lods();
+		lods.assign(lodView.begin(), lodView.end());
+	}
+	else
+	{
+		// Sections are decoded on the job system when there is one.
+		M3DLoader m3dLoader;
+		if (mJobSystem)
+		{
+			m3dLoader.Mode = M3DLoader::ParseMode::Parallel;
+			m3dLoader.Jobs = mJobSystem.get();
+		}
+		m3dLoader.LoadM3d(mSkinnedModelFilename, vertices, indices,
+			mSkinnedSubsets, mSkinnedMatInfo, mSkinnedData);
+
+		// The binary file gets the same treatment in M3DBinaryFile::Convert.
+		MeshOptimizer meshOptimizer;
+		meshOptimizer.OptimizeSubsets(vertices, indices, mSkinnedSubsets);
+
+		MeshSimplifier meshSimplifier;
+		meshSimplifier.BuildSubsetLods(vertices, indices, mSkinnedSubsets, lods);
+
+		vertexView.Data = vertices.data();
+		vertexView.Size = (UINT)vertices.size();
+
+		submeshes.resize(mSkinnedSubsets.size());
+		for (UINT i = 0; i < (UINT)mSkinnedSubsets.size(); ++i)
+		{
+			submeshes[i].IndexCount = (UINT)mSkinnedSubsets[i].FaceCount * 3;
+			submeshes[i].StartIndexLocation = mSkinnedSubsets[i].FaceStart * 3;
+		}
+
+		// The levels are packed as ranges of their own, after the subsets.
+		for (const LodRange& lod : lods)
+		{
+			SubmeshGeometry range;
+			range.IndexCount = lod.IndexCount;
+			range.StartIndexLocation = lod.StartIndexLocation;
+			submeshes.push_back(range);
+		}
+
+		PackIndices(indices.data(), (UINT)indices.size(),
+			submeshes.data(), (UINT)submeshes.size(), packedIndices);
+
+		for (UINT i = 0; i < (UINT)lods.size(); ++i)
+			lods[i].BaseVertexLocation = submeshes[mSkinnedSubsets.size() + i].BaseVertexLocation;
+
+		indexData = packedIndices.Data();
+		indexCount = packedIndices.IndexCount();
+		indexFormat = packedIndices.Format;
+	}
+
+	// Quantize and key-reduce the clips once at load time.
+	mSkinnedData.CompressClips(AnimationCompressionSettings());
+
+	// One controller per soldier; controller i owns SkinnedCB slot i.
+	const float clipEndTime = mSkinnedData.GetClipEndTime("Take1");
+	for (UINT i = 0; i < SoldierRows * SoldierColumns; ++i)
+	{
+		auto skinnedController = std::make_unique<SkinnedController>();
+		skinnedController->Data = &mSkinnedData;
+		skinnedController->FinalTransforms.resize(mSkinnedData.BoneCount());
+		skinnedController->ClipName = "Take1";
+		skinnedController->TimePos = clipEndTime * (i % SoldierPhases) / SoldierPhases;
+		skinnedController->Cache = &mPoseCache;
+
+		mAnimationBatch.Add(skinnedController.get());
+		mSkinnedControllers.push_back(std::move(skinnedController));
+	}
+
+	const UINT vbByteSize = vertexView.Size * sizeof(PackedSkinnedVertex);
+	const UINT ibByteSize = indexCount * IndexStrideInBytes(indexFormat);
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = mSkinnedModelFilename;
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	PackVertices(vertexView.Data, vertexView.Size, (PackedSkinnedVertex*)geo->VertexBufferCPU->GetBufferPointer());
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indexData, ibByteSize);
 
 	geo->VertexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCmdList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		mCmdList.Get(), geo->VertexBufferCPU->GetBufferPointer(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCmdList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+		mCmdList.Get(), indexData, ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexStrideInBytes = sizeof(SkinnedVertex);
+	geo->VertexStrideInBytes = sizeof(PackedSkinnedVertex);
 	geo->VertexBufferSizeInBytes = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = indexFormat;
 	geo->IndexBufferSizeInBytes = ibByteSize;
 
 	for (UINT i = 0; i < (UINT)mSkinnedSubsets.size(); ++i)
@@ -117,7 +239,28 @@ void SeleniumApp::LoadSkinnedModel() {
 
 		submesh.IndexCount = (UINT)mSkinnedSubsets[i].FaceCount * 3;
 		submesh.StartIndexLocation = mSkinnedSubsets[i].FaceStart * 3;
-		submesh.BaseVertexLocation = 0;
+		submesh.BaseVertexLocation = submeshes[i].BaseVertexLocation;
+
+		// Bind pose bounds, used to pick the level of detail.
+		const M3DLoader::Subset& subset = mSkinnedSubsets[i];
+		if (subset.VertexCount > 0 && subset.VertexStart + subset.VertexCount <= vertexView.Size)
+		{
+			BoundingBox::CreateFromPoints(submesh.Bounds, subset.VertexCount,
+				&vertexView[subset.VertexStart].Pos, sizeof(SkinnedVertex));
+		}
+
+		for (const LodRange& lod : lods)
+		{
+			if (lod.Submesh != i)
+				continue;
+
+			SubmeshLod level;
+			level.IndexCount = lod.IndexCount;
+			level.StartIndexLocation = lod.StartIndexLocation;
+			level.BaseVertexLocation = lod.BaseVertexLocation;
+			level.Error = lod.Error;
+			submesh.Lods.push_back(level);
+		}
 
 		geo->DrawArgs[name] = submesh;
 	}
@@ -195,7 +338,7 @@ void SeleniumApp::BuildRootSignature() {
 	descriptorRange1.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 48, 3, 0);
 
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER rootParams[6];
+	CD3DX12_ROOT_PARAMETER rootParams[9];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
 	rootParams[0].InitAsConstantBufferView(0);
@@ -205,10 +348,16 @@ void SeleniumApp::BuildRootSignature() {
 	rootParams[4].InitAsDescriptorTable(1, &descriptorRange0, D3D12_SHADER_VISIBILITY_PIXEL);
 	rootParams[5].InitAsDescriptorTable(1, &descriptorRange1, D3D12_SHADER_VISIBILITY_PIXEL);
 
+	// Instance data, the first instance of instanced draws and the item of
+	// each instance.
+	rootParams[6].InitAsShaderResourceView(1, 1, D3D12_SHADER_VISIBILITY_VERTEX);
+	rootParams[7].InitAsConstants(1, 3, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+	rootParams[8].InitAsShaderResourceView(2, 1, D3D12_SHADER_VISIBILITY_VERTEX);
+
 	auto staticSamplers = GetStaticSamplers();
 
 	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(6, rootParams,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(9, rootParams,
 		(UINT)staticSamplers.size(), staticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -533,12 +682,20 @@ void SeleniumApp::BuildShadersAndInputLayout()
 		NULL, NULL
 	};
 
+	const D3D_SHADER_MACRO instancedDefines[] =
+	{
+		"INSTANCED", "1",
+		NULL, NULL
+	};
+
 	mShaders["standardVS"] = D3DUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
 	mShaders["skinnedVS"] = D3DUtil::CompileShader(L"Shaders\\Default.hlsl", skinnedDefines, "VS", "vs_5_1");
+	mShaders["instancedVS"] = D3DUtil::CompileShader(L"Shaders\\Default.hlsl", instancedDefines, "VS", "vs_5_1");
 	mShaders["opaquePS"] = D3DUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_1");
 
 	mShaders["shadowVS"] = D3DUtil::CompileShader(L"Shaders\\Shadows.hlsl", nullptr, "VS", "vs_5_1");
 	mShaders["skinnedShadowVS"] = D3DUtil::CompileShader(L"Shaders\\Shadows.hlsl", skinnedDefines, "VS", "vs_5_1");
+	mShaders["instancedShadowVS"] = D3DUtil::CompileShader(L"Shaders\\Shadows.hlsl", instancedDefines, "VS", "vs_5_1");
 	mShaders["shadowOpaquePS"] = D3DUtil::CompileShader(L"Shaders\\Shadows.hlsl", nullptr, "PS", "ps_5_1");
 	mShaders["shadowAlphaTestedPS"] = D3DUtil::CompileShader(L"Shaders\\Shadows.hlsl", alphaTestDefines, "PS", "ps_5_1");
 
@@ -547,6 +704,7 @@ void SeleniumApp::BuildShadersAndInputLayout()
 
 	mShaders["drawNormalsVS"] = D3DUtil::CompileShader(L"Shaders\\DrawNormals.hlsl", nullptr, "VS", "vs_5_1");
 	mShaders["skinnedDrawNormalsVS"] = D3DUtil::CompileShader(L"Shaders\\DrawNormals.hlsl", skinnedDefines, "VS", "vs_5_1");
+	mShaders["instancedDrawNormalsVS"] = D3DUtil::CompileShader(L"Shaders\\DrawNormals.hlsl", instancedDefines, "VS", "vs_5_1");
 	mShaders["drawNormalsPS"] = D3DUtil::CompileShader(L"Shaders\\DrawNormals.hlsl", nullptr, "PS", "ps_5_1");
 
 	mShaders["ssaoVS"] = D3DUtil::CompileShader(L"Shaders\\Ssao.hlsl", nullptr, "VS", "vs_5_1");
@@ -558,34 +716,41 @@ void SeleniumApp::BuildShadersAndInputLayout()
 	mShaders["skyVS"] = D3DUtil::CompileShader(L"Shaders\\Sky.hlsl", nullptr, "VS", "vs_5_1");
 	mShaders["skyPS"] = D3DUtil::CompileShader(L"Shaders\\Sky.hlsl", nullptr, "PS", "ps_5_1");
 
+	// PackedVertex and PackedSkinnedVertex, see vertex_packing.h.
 	mInputLayout =
 	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, 20, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 	};
 
 	mSkinnedInputLayout =
 	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "WEIGHTS", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 44, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "BONEINDICES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 56, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, 20, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "WEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "BONEINDICES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 28, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
 	};
 }
 
 void SeleniumApp::BuildShapeGeometry()
 {
 	GeometryGenerator geoGen;
+	geoGen.Jobs = mJobSystem.get();
 	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3);
 	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
 	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
 	GeometryGenerator::MeshData cylinder = geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20);
 	GeometryGenerator::MeshData quad = geoGen.CreateQuad(0.0f, 0.0f, 1.0f, 1.0f, 0.0f);
 
+	// Reorder for the post-transform cache.
+	MeshOptimizer meshOptimizer;
+	for (GeometryGenerator::MeshData* mesh : { &box, &grid, &sphere, &cylinder, &quad })
+		meshOptimizer.OptimizeMesh(*mesh);
+
 	//
 	// We are concatenating all the geometry into one big vertex/index buffer.  So
 	// define the regions in the buffer each submesh covers.
@@ -685,42 +850,176 @@ void SeleniumApp::BuildShapeGeometry()
 		vertices[k].TangentU = quad.Vertices[i].TangentU;
 	}
 
-	std::vector<std::uint16_t> indices;
-	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
-	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
-	indices.insert(indices.end(), std::begin(quad.GetIndices16()), std::end(quad.GetIndices16()));
+	std::vector<std::uint32_t> indices;
+	indices.insert(indices.end(), std::begin(box.Indices32), std::end(box.Indices32));
+	indices.insert(indices.end(), std::begin(grid.Indices32), std::end(grid.Indices32));
+	indices.insert(indices.end(), std::begin(sphere.Indices32), std::end(sphere.Indices32));
+	indices.insert(indices.end(), std::begin(cylinder.Indices32), std::end(cylinder.Indices32));
+	indices.insert(indices.end(), std::begin(quad.Indices32), std::end(quad.Indices32));
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	// In the order of the concatenated buffers.
+	SubmeshGeometry submeshes[] = { boxSubmesh, gridSubmesh, sphereSubmesh, cylinderSubmesh, quadSubmesh };
+
+	// Split every shape into meshlets for per-cluster culling.
+	const GeometryGenerator::MeshData* meshes[] = { &box, &grid, &sphere, &cylinder, &quad };
+	for (UINT i = 0; i < _countof(submeshes); ++i)
+	{
+		BuildMeshlets(meshes[i]->Indices32.data(), (UINT)meshes[i]->Indices32.size(),
+			&meshes[i]->Vertices[0].Pos, sizeof(Vertex), submeshes[i].Meshlets);
+	}
+
+	// Simplified levels of every shape go after the full detail indices.
+	MeshSimplifier meshSimplifier;
+	for (UINT i = 0; i < _countof(submeshes); ++i)
+	{
+		BoundingBox::CreateFromPoints(submeshes[i].Bounds, meshes[i]->Vertices.size(),
+			&meshes[i]->Vertices[0].Pos, sizeof(Vertex));
+
+		std::vector<UINT> lodIndices;
+		std::vector<LodRange> lods;
+		meshSimplifier.BuildMeshLods(*meshes[i], lodIndices, lods);
+
+		for (const LodRange& lod : lods)
+		{
+			SubmeshLod level;
+			level.IndexCount = lod.IndexCount;
+			level.StartIndexLocation = (UINT)indices.size() + lod.StartIndexLocation;
+			level.BaseVertexLocation = submeshes[i].BaseVertexLocation;
+			level.Error = lod.Error;
+			BuildMeshlets(&lodIndices[lod.StartIndexLocation], lod.IndexCount,
+				&meshes[i]->Vertices[0].Pos, sizeof(Vertex), level.Meshlets);
+
+			submeshes[i].Lods.push_back(std::move(level));
+		}
+
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+	}
+
+	// 16-bit unless one of the ranges is too large for it even once rebased.
+	std::vector<SubmeshGeometry> ranges;
+	for (const SubmeshGeometry& submesh : submeshes)
+	{
+		SubmeshGeometry range;
+		range.IndexCount = submesh.IndexCount;
+		range.StartIndexLocation = submesh.StartIndexLocation;
+		range.BaseVertexLocation = submesh.BaseVertexLocation;
+		ranges.push_back(range);
+
+		for (const SubmeshLod& level : submesh.Lods)
+		{
+			range.IndexCount = level.IndexCount;
+			range.StartIndexLocation = level.StartIndexLocation;
+			range.BaseVertexLocation = level.BaseVertexLocation;
+			ranges.push_back(range);
+		}
+	}
+
+	PackedIndices packedIndices;
+	PackIndices(indices.data(), (UINT)indices.size(), ranges.data(), (UINT)ranges.size(), packedIndices);
+
+	UINT rangeIndex = 0;
+	for (SubmeshGeometry& submesh : submeshes)
+	{
+		submesh.BaseVertexLocation = ranges[rangeIndex++].BaseVertexLocation;
+		for (SubmeshLod& level : submesh.Lods)
+			level.BaseVertexLocation = ranges[rangeIndex++].BaseVertexLocation;
+	}
+
+	std::vector<PackedVertex> packedVertices(vertices.size());
+	PackVertices(vertices.data(), (UINT)vertices.size(), packedVertices.data());
+
+	const UINT vbByteSize = (UINT)packedVertices.size() * sizeof(PackedVertex);
+	const UINT ibByteSize = packedIndices.ByteSize();
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "shapeGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), packedVertices.data(), vbByteSize);
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), packedIndices.Data(), ibByteSize);
+
+	geo->VertexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCmdList.Get(), packedVertices.data(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->IndexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCmdList.Get(), packedIndices.Data(), ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexStrideInBytes = sizeof(PackedVertex);
+	geo->VertexBufferSizeInBytes = vbByteSize;
+	geo->IndexFormat = packedIndices.Format;
+	geo->IndexBufferSizeInBytes = ibByteSize;
+
+	geo->DrawArgs["box"] = submeshes[0];
+	geo->DrawArgs["grid"] = submeshes[1];
+	geo->DrawArgs["sphere"] = submeshes[2];
+	geo->DrawArgs["cylinder"] = submeshes[3];
+	geo->DrawArgs["quad"] = submeshes[4];
+
+	mGeometries[geo->Name] = std::move(geo);
+}
+
+void SeleniumApp::BuildTerrainGeometry()
+{
+	mTerrain.Jobs = mJobSystem.get();
+	mTerrain.CellSpacing = 1.0f;
+	mTerrain.HeightScale = 40.0f;
+
+	// Just below the shape grid so the two do not z-fight.
+	mTerrain.HeightOffset = -0.05f;
+
+	if (!mTerrain.LoadHeightmap(mTerrainHeightmapFilename))
+	{
+		// Rolling hills rising out of a flat valley that holds the scene.
+		const UINT size = 513;
+		std::vector<std::uint16_t> samples(size * size);
+		for (UINT row = 0; row < size; ++row)
+		{
+			for (UINT col = 0; col < size; ++col)
+			{
+				float x = col - 0.5f * (size - 1);
+				float z = 0.5f * (size - 1) - row;
+
+				float valley = MathHelper::Clamp((sqrtf(x*x + z*z) - 30.0f) / 50.0f, 0.0f, 1.0f);
+				float hills = 0.5f + 0.3f*sinf(0.031f*x)*cosf(0.027f*z) + 0.15f*sinf(0.11f*x + 0.07f*z);
+				samples[row * size + col] = (std::uint16_t)(65535.0f * MathHelper::Clamp(valley * hills, 0.0f, 1.0f));
+			}
+		}
+		mTerrain.SetHeightmap(std::move(samples), size, size);
+	}
+
+	mTerrain.Build();
+
+	const std::vector<Vertex>& vertices = mTerrain.Vertices();
+	const std::vector<std::uint16_t>& indices = mTerrain.Indices();
+
+	std::vector<PackedVertex> packedVertices(vertices.size());
+	PackVertices(vertices.data(), (UINT)vertices.size(), packedVertices.data());
+
+	const UINT vbByteSize = (UINT)packedVertices.size() * sizeof(PackedVertex);
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "terrainGeo";
+
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), packedVertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
 	geo->VertexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCmdList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		mCmdList.Get(), packedVertices.data(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = D3DUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCmdList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexStrideInBytes = sizeof(Vertex);
+	geo->VertexStrideInBytes = sizeof(PackedVertex);
 	geo->VertexBufferSizeInBytes = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
 	geo->IndexBufferSizeInBytes = ibByteSize;
 
-	geo->DrawArgs["box"] = boxSubmesh;
-	geo->DrawArgs["grid"] = gridSubmesh;
-	geo->DrawArgs["sphere"] = sphereSubmesh;
-	geo->DrawArgs["cylinder"] = cylinderSubmesh;
-	geo->DrawArgs["quad"] = quadSubmesh;
-
 	mGeometries[geo->Name] = std::move(geo);
 }
 
@@ -734,7 +1033,6 @@ void SeleniumApp::BuildMaterials()
 	bricks0->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	bricks0->FresnelR0 = XMFLOAT3(0.1f, 0.1f, 0.1f);
 	bricks0->Roughness = 0.3f;
-	bricks0->NumFramesDirty = NumFrameResources;
 
 	auto tile0 = std::make_unique<Material>();
 	tile0->Name = "tile0";
@@ -744,7 +1042,6 @@ void SeleniumApp::BuildMaterials()
 	tile0->DiffuseAlbedo = XMFLOAT4(0.9f, 0.9f, 0.9f, 1.0f);
 	tile0->FresnelR0 = XMFLOAT3(0.2f, 0.2f, 0.2f);
 	tile0->Roughness = 0.1f;
-	tile0->NumFramesDirty = NumFrameResources;
 
 	auto mirror0 = std::make_unique<Material>();
 	mirror0->Name = "mirror0";
@@ -754,7 +1051,6 @@ void SeleniumApp::BuildMaterials()
 	mirror0->DiffuseAlbedo = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
 	mirror0->FresnelR0 = XMFLOAT3(0.98f, 0.97f, 0.95f);
 	mirror0->Roughness = 0.1f;
-	mirror0->NumFramesDirty = NumFrameResources;
 
 	auto sky = std::make_unique<Material>();
 	sky->Name = "sky";
@@ -764,7 +1060,6 @@ void SeleniumApp::BuildMaterials()
 	sky->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	sky->FresnelR0 = XMFLOAT3(0.1f, 0.1f, 0.1f);
 	sky->Roughness = 1.0f;
-	sky->NumFramesDirty = NumFrameResources;
 
 	mMaterials["bricks0"] = std::move(bricks0);
 	mMaterials["tile0"] = std::move(tile0);
@@ -783,78 +1078,82 @@ void SeleniumApp::BuildMaterials()
 		mat->DiffuseAlbedo = mSkinnedMatInfo[i].DiffuseAlbedo;
 		mat->FresnelR0 = mSkinnedMatInfo[i].FresnelR0;
 		mat->Roughness = mSkinnedMatInfo[i].Roughness;
-		mat->NumFramesDirty = NumFrameResources;
 
 		mMaterials[mat->Name] = std::move(mat);
 	}
+
+	mMaterialByIndex.resize(mMaterials.size());
+	for (auto& e : mMaterials)
+		mMaterialByIndex[e.second->bufferIndex] = e.second.get();
+
+	mMaterialDirty.SetFrameResourceCount(NumFrameResources);
+	mMaterialDirty.Resize((UINT)mMaterialByIndex.size());
+	mMaterialDirty.MarkAllDirty();
 }
 
 void SeleniumApp::BuildRenderItems()
 {
-	auto skyRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&skyRitem->World, XMMatrixScaling(5000.0f, 5000.0f, 5000.0f));
-	skyRitem->TexTransform = MathHelper::Identity4x4();
-	skyRitem->ObjCBIndex = 0;
-	skyRitem->Mat = mMaterials["sky"].get();
-	skyRitem->Geo = mGeometries["shapeGeo"].get();
-	skyRitem->IndexCount = skyRitem->Geo->DrawArgs["sphere"].IndexCount;
-	skyRitem->StartIndexLocation = skyRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-	skyRitem->BaseVertexLocation = skyRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-	skyRitem->NumFramesDirty = NumFrameResources;
-
-	mRitemLayer[(int)RenderLayer::Sky].push_back(skyRitem.get());
-	mAllRitems.push_back(std::move(skyRitem));
-
-	auto quadRitem = std::make_unique<RenderItem>();
-	quadRitem->World = MathHelper::Identity4x4();
-	quadRitem->TexTransform = MathHelper::Identity4x4();
-	quadRitem->ObjCBIndex = 1;
-	quadRitem->Mat = mMaterials["bricks0"].get();
-	quadRitem->Geo = mGeometries["shapeGeo"].get();
-	quadRitem->IndexCount = quadRitem->Geo->DrawArgs["quad"].IndexCount;
-	quadRitem->StartIndexLocation = quadRitem->Geo->DrawArgs["quad"].StartIndexLocation;
-	quadRitem->BaseVertexLocation = quadRitem->Geo->DrawArgs["quad"].BaseVertexLocation;
-	quadRitem->NumFramesDirty = NumFrameResources;
-
-	mRitemLayer[(int)RenderLayer::Debug].push_back(quadRitem.get());
-	mAllRitems.push_back(std::move(quadRitem));
-
-	auto boxRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&boxRitem->World, XMMatrixScaling(2.0f, 1.0f, 2.0f)*XMMatrixTranslation(0.0f, 0.5f, 0.0f));
-	XMStoreFloat4x4(&boxRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	boxRitem->ObjCBIndex = 2;
-	boxRitem->Mat = mMaterials["bricks0"].get();
-	boxRitem->Geo = mGeometries["shapeGeo"].get();
-	boxRitem->IndexCount = boxRitem->Geo->DrawArgs["box"].IndexCount;
-	boxRitem->StartIndexLocation = boxRitem->Geo->DrawArgs["box"].StartIndexLocation;
-	boxRitem->BaseVertexLocation = boxRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-	boxRitem->NumFramesDirty = NumFrameResources;
-
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(boxRitem.get());
-	mAllRitems.push_back(std::move(boxRitem));
-
-	auto gridRitem = std::make_unique<RenderItem>();
-	gridRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&gridRitem->TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
-	gridRitem->ObjCBIndex = 3;
-	gridRitem->Mat = mMaterials["tile0"].get();
-	gridRitem->Geo = mGeometries["shapeGeo"].get();
-	gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
-	gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-	gridRitem->NumFramesDirty = NumFrameResources;
-
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gridRitem.get());
-	mAllRitems.push_back(std::move(gridRitem));
+	mRenderItems.SetFrameResourceCount(NumFrameResources);
+
+	RenderItem skyRitem;
+	XMStoreFloat4x4(&skyRitem.World, XMMatrixScaling(5000.0f, 5000.0f, 5000.0f));
+	skyRitem.TexTransform = MathHelper::Identity4x4();
+	skyRitem.Mat = mMaterials["sky"].get();
+	skyRitem.Geo = mGeometries["shapeGeo"].get();
+	skyRitem.IndexCount = skyRitem.Geo->DrawArgs["sphere"].IndexCount;
+	skyRitem.StartIndexLocation = skyRitem.Geo->DrawArgs["sphere"].StartIndexLocation;
+	skyRitem.BaseVertexLocation = skyRitem.Geo->DrawArgs["sphere"].BaseVertexLocation;
+	skyRitem.Layer = RenderLayer::Sky;
+
+	mRenderItems.Add(skyRitem);
+
+	RenderItem quadRitem;
+	quadRitem.World = MathHelper::Identity4x4();
+	quadRitem.TexTransform = MathHelper::Identity4x4();
+	quadRitem.Mat = mMaterials["bricks0"].get();
+	quadRitem.Geo = mGeometries["shapeGeo"].get();
+	quadRitem.IndexCount = quadRitem.Geo->DrawArgs["quad"].IndexCount;
+	quadRitem.StartIndexLocation = quadRitem.Geo->DrawArgs["quad"].StartIndexLocation;
+	quadRitem.BaseVertexLocation = quadRitem.Geo->DrawArgs["quad"].BaseVertexLocation;
+	quadRitem.Layer = RenderLayer::Debug;
+
+	mRenderItems.Add(quadRitem);
+
+	RenderItem boxRitem;
+	XMStoreFloat4x4(&boxRitem.World, XMMatrixScaling(2.0f, 1.0f, 2.0f)*XMMatrixTranslation(0.0f, 0.5f, 0.0f));
+	XMStoreFloat4x4(&boxRitem.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	boxRitem.Mat = mMaterials["bricks0"].get();
+	boxRitem.Geo = mGeometries["shapeGeo"].get();
+	boxRitem.IndexCount = boxRitem.Geo->DrawArgs["box"].IndexCount;
+	boxRitem.StartIndexLocation = boxRitem.Geo->DrawArgs["box"].StartIndexLocation;
+	boxRitem.BaseVertexLocation = boxRitem.Geo->DrawArgs["box"].BaseVertexLocation;
+	boxRitem.Submesh = &boxRitem.Geo->DrawArgs["box"];
+	boxRitem.Meshlets = &boxRitem.Geo->DrawArgs["box"].Meshlets;
+	boxRitem.Layer = RenderLayer::Opaque;
+
+	mRenderItems.Add(boxRitem);
+
+	RenderItem gridRitem;
+	gridRitem.World = MathHelper::Identity4x4();
+	XMStoreFloat4x4(&gridRitem.TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
+	gridRitem.Mat = mMaterials["tile0"].get();
+	gridRitem.Geo = mGeometries["shapeGeo"].get();
+	gridRitem.IndexCount = gridRitem.Geo->DrawArgs["grid"].IndexCount;
+	gridRitem.StartIndexLocation = gridRitem.Geo->DrawArgs["grid"].StartIndexLocation;
+	gridRitem.BaseVertexLocation = gridRitem.Geo->DrawArgs["grid"].BaseVertexLocation;
+	gridRitem.Submesh = &gridRitem.Geo->DrawArgs["grid"];
+	gridRitem.Meshlets = &gridRitem.Geo->DrawArgs["grid"].Meshlets;
+	gridRitem.Layer = RenderLayer::Opaque;
+
+	mRenderItems.Add(gridRitem);
 
 	XMMATRIX brickTexTransform = XMMatrixScaling(1.5f, 2.0f, 1.0f);
-	UINT objCBIndex = 4;
 	for (int i = 0; i < 5; ++i)
 	{
-		auto leftCylRitem = std::make_unique<RenderItem>();
-		auto rightCylRitem = std::make_unique<RenderItem>();
-		auto leftSphereRitem = std::make_unique<RenderItem>();
-		auto rightSphereRitem = std::make_unique<RenderItem>();
+		RenderItem leftCylRitem;
+		RenderItem rightCylRitem;
+		RenderItem leftSphereRitem;
+		RenderItem rightSphereRitem;
 
 		XMMATRIX leftCylWorld = XMMatrixTranslation(-5.0f, 1.5f, -10.0f + i * 5.0f);
 		XMMATRIX rightCylWorld = XMMatrixTranslation(+5.0f, 1.5f, -10.0f + i * 5.0f);
@@ -862,84 +1161,143 @@ void SeleniumApp::BuildRenderItems()
 		XMMATRIX leftSphereWorld = XMMatrixTranslation(-5.0f, 3.5f, -10.0f + i * 5.0f);
 		XMMATRIX rightSphereWorld = XMMatrixTranslation(+5.0f, 3.5f, -10.0f + i * 5.0f);
 
-		XMStoreFloat4x4(&leftCylRitem->World, leftCylWorld);
-		XMStoreFloat4x4(&leftCylRitem->TexTransform, brickTexTransform);
-		leftCylRitem->ObjCBIndex = objCBIndex++;
-		leftCylRitem->Mat = mMaterials["bricks0"].get();
-		leftCylRitem->Geo = mGeometries["shapeGeo"].get();
-		leftCylRitem->IndexCount = leftCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
-		leftCylRitem->StartIndexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-		leftCylRitem->BaseVertexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-		leftCylRitem->NumFramesDirty = NumFrameResources;
-
-		XMStoreFloat4x4(&rightCylRitem->World, rightCylWorld);
-		XMStoreFloat4x4(&rightCylRitem->TexTransform, brickTexTransform);
-		rightCylRitem->ObjCBIndex = objCBIndex++;
-		rightCylRitem->Mat = mMaterials["bricks0"].get();
-		rightCylRitem->Geo = mGeometries["shapeGeo"].get();
-		rightCylRitem->IndexCount = rightCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
-		rightCylRitem->StartIndexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-		rightCylRitem->BaseVertexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-		rightCylRitem->NumFramesDirty = NumFrameResources;
-
-		XMStoreFloat4x4(&leftSphereRitem->World, leftSphereWorld);
-		leftSphereRitem->TexTransform = MathHelper::Identity4x4();
-		leftSphereRitem->ObjCBIndex = objCBIndex++;
-		leftSphereRitem->Mat = mMaterials["mirror0"].get();
-		leftSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-		leftSphereRitem->NumFramesDirty = NumFrameResources;
-
-		XMStoreFloat4x4(&rightSphereRitem->World, rightSphereWorld);
-		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
-		rightSphereRitem->ObjCBIndex = objCBIndex++;
-		rightSphereRitem->Mat = mMaterials["mirror0"].get();
-		rightSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-		rightSphereRitem->NumFramesDirty = NumFrameResources;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(leftCylRitem.get());
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(rightCylRitem.get());
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(leftSphereRitem.get());
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(rightSphereRitem.get());
-
-		mAllRitems.push_back(std::move(leftCylRitem));
-		mAllRitems.push_back(std::move(rightCylRitem));
-		mAllRitems.push_back(std::move(leftSphereRitem));
-		mAllRitems.push_back(std::move(rightSphereRitem));
+		XMStoreFloat4x4(&leftCylRitem.World, leftCylWorld);
+		XMStoreFloat4x4(&leftCylRitem.TexTransform, brickTexTransform);
+		leftCylRitem.Mat = mMaterials["bricks0"].get();
+		leftCylRitem.Geo = mGeometries["shapeGeo"].get();
+		leftCylRitem.IndexCount = leftCylRitem.Geo->DrawArgs["cylinder"].IndexCount;
+		leftCylRitem.StartIndexLocation = leftCylRitem.Geo->DrawArgs["cylinder"].StartIndexLocation;
+		leftCylRitem.BaseVertexLocation = leftCylRitem.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		leftCylRitem.Submesh = &leftCylRitem.Geo->DrawArgs["cylinder"];
+		leftCylRitem.Meshlets = &leftCylRitem.Geo->DrawArgs["cylinder"].Meshlets;
+
+		XMStoreFloat4x4(&rightCylRitem.World, rightCylWorld);
+		XMStoreFloat4x4(&rightCylRitem.TexTransform, brickTexTransform);
+		rightCylRitem.Mat = mMaterials["bricks0"].get();
+		rightCylRitem.Geo = mGeometries["shapeGeo"].get();
+		rightCylRitem.IndexCount = rightCylRitem.Geo->DrawArgs["cylinder"].IndexCount;
+		rightCylRitem.StartIndexLocation = rightCylRitem.Geo->DrawArgs["cylinder"].StartIndexLocation;
+		rightCylRitem.BaseVertexLocation = rightCylRitem.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		rightCylRitem.Submesh = &rightCylRitem.Geo->DrawArgs["cylinder"];
+		rightCylRitem.Meshlets = &rightCylRitem.Geo->DrawArgs["cylinder"].Meshlets;
+
+		XMStoreFloat4x4(&leftSphereRitem.World, leftSphereWorld);
+		leftSphereRitem.TexTransform = MathHelper::Identity4x4();
+		leftSphereRitem.Mat = mMaterials["mirror0"].get();
+		leftSphereRitem.Geo = mGeometries["shapeGeo"].get();
+		leftSphereRitem.IndexCount = leftSphereRitem.Geo->DrawArgs["sphere"].IndexCount;
+		leftSphereRitem.StartIndexLocation = leftSphereRitem.Geo->DrawArgs["sphere"].StartIndexLocation;
+		leftSphereRitem.BaseVertexLocation = leftSphereRitem.Geo->DrawArgs["sphere"].BaseVertexLocation;
+		leftSphereRitem.Submesh = &leftSphereRitem.Geo->DrawArgs["sphere"];
+		leftSphereRitem.Meshlets = &leftSphereRitem.Geo->DrawArgs["sphere"].Meshlets;
+
+		XMStoreFloat4x4(&rightSphereRitem.World, rightSphereWorld);
+		rightSphereRitem.TexTransform = MathHelper::Identity4x4();
+		rightSphereRitem.Mat = mMaterials["mirror0"].get();
+		rightSphereRitem.Geo = mGeometries["shapeGeo"].get();
+		rightSphereRitem.IndexCount = rightSphereRitem.Geo->DrawArgs["sphere"].IndexCount;
+		rightSphereRitem.StartIndexLocation = rightSphereRitem.Geo->DrawArgs["sphere"].StartIndexLocation;
+		rightSphereRitem.BaseVertexLocation = rightSphereRitem.Geo->DrawArgs["sphere"].BaseVertexLocation;
+		rightSphereRitem.Submesh = &rightSphereRitem.Geo->DrawArgs["sphere"];
+		rightSphereRitem.Meshlets = &rightSphereRitem.Geo->DrawArgs["sphere"].Meshlets;
+
+		leftCylRitem.Layer = RenderLayer::Opaque;
+		rightCylRitem.Layer = RenderLayer::Opaque;
+		leftSphereRitem.Layer = RenderLayer::Opaque;
+		rightSphereRitem.Layer = RenderLayer::Opaque;
+
+		mRenderItems.Add(leftCylRitem);
+		mRenderItems.Add(rightCylRitem);
+		mRenderItems.Add(leftSphereRitem);
+		mRenderItems.Add(rightSphereRitem);
 	}
 
-	for (UINT i = 0; i < mSkinnedMatInfo.size(); ++i)
+	// Reflect to change coordinate system from the RHS the data was exported out as.
+	XMMATRIX modelScale = XMMatrixScaling(0.05f, 0.05f, -0.05f);
+	XMMATRIX modelRot = XMMatrixRotationY(MathHelper::Pi);
+
+	// A grid of soldiers centered on x, the first row where the single
+	// soldier used to stand.
+	for (UINT soldier = 0; soldier < SoldierRows * SoldierColumns; ++soldier)
 	{
-		std::string submeshName = "sm_" + std::to_string(i);
+		UINT row = soldier / SoldierColumns;
+		UINT column = soldier % SoldierColumns;
+		XMMATRIX modelOffset = XMMatrixTranslation(
+			(column - 0.5f * (SoldierColumns - 1)) * SoldierSpacing,
+			0.0f,
+			-5.0f + row * SoldierSpacing);
+
+		for (UINT i = 0; i < mSkinnedMatInfo.size(); ++i)
+		{
+			std::string submeshName = "sm_" + std::to_string(i);
+
+			RenderItem ritem;
+			XMStoreFloat4x4(&ritem.World, modelScale*modelRot*modelOffset);
+
+			ritem.TexTransform = MathHelper::Identity4x4();
+			ritem.Mat = mMaterials[mSkinnedMatInfo[i].Name].get();
+			ritem.Geo = mGeometries[mSkinnedModelFilename].get();
+			ritem.IndexCount = ritem.Geo->DrawArgs[submeshName].IndexCount;
+			ritem.StartIndexLocation = ritem.Geo->DrawArgs[submeshName].StartIndexLocation;
+			ritem.BaseVertexLocation = ritem.Geo->DrawArgs[submeshName].BaseVertexLocation;
+			ritem.Submesh = &ritem.Geo->DrawArgs[submeshName];
 
-		auto ritem = std::make_unique<RenderItem>();
+			// Controller soldier writes its palette into SkinnedCB slot soldier.
+			ritem.SkinnedCBIndex = soldier;
+			ritem.Layer = RenderLayer::SkinnedOpaque;
 
-		// Reflect to change coordinate system from the RHS the data was exported out as.
-		XMMATRIX modelScale = XMMatrixScaling(0.05f, 0.05f, -0.05f);
-		XMMATRIX modelRot = XMMatrixRotationY(MathHelper::Pi);
-		XMMATRIX modelOffset = XMMatrixTranslation(0.0f, 0.0f, -5.0f);
-		XMStoreFloat4x4(&ritem->World, modelScale*modelRot*modelOffset);
+			mRenderItems.Add(ritem);
+		}
+	}
+
+	// Holds the constants of the terrain; its chunks are drawn by DrawTerrain,
+	// so it is in no layer.
+	RenderItem terrainRitem;
+	terrainRitem.World = MathHelper::Identity4x4();
+	XMStoreFloat4x4(&terrainRitem.TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
+	terrainRitem.Mat = mMaterials["tile0"].get();
+	terrainRitem.Geo = mGeometries["terrainGeo"].get();
 
-		ritem->TexTransform = MathHelper::Identity4x4();
-		ritem->ObjCBIndex = objCBIndex++;
-		ritem->Mat = mMaterials[mSkinnedMatInfo[i].Name].get();
-		ritem->Geo = mGeometries[mSkinnedModelFilename].get();
-		ritem->IndexCount = ritem->Geo->DrawArgs[submeshName].IndexCount;
-		ritem->StartIndexLocation = ritem->Geo->DrawArgs[submeshName].StartIndexLocation;
-		ritem->BaseVertexLocation = ritem->Geo->DrawArgs[submeshName].BaseVertexLocation;
-		ritem->NumFramesDirty = NumFrameResources;
+	mTerrainItem = mRenderItems.Add(terrainRitem);
+}
 
-		ritem->SkinnedCBIndex = 0;
-		ritem->skinnedController = mSkinnedController.get();
+void SeleniumApp::BuildDrawLists()
+{
+	const std::vector<RenderLayer>& layers = mRenderItems.Layer();
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	std::vector<RenderItemMesh>& meshes = mRenderItems.Mesh();
+
+	for (int layer = 0; layer < (int)RenderLayer::Count; ++layer)
+		mRitemLayer[layer].clear();
+	mCullItems.clear();
+	mUnculledItems.clear();
+
+	std::vector<BoundingBox> boxes;
+	for (UINT i = 0; i < mRenderItems.Count(); ++i)
+	{
+		if (layers[i] == RenderLayer::Count)
+			continue;
+		mRitemLayer[(int)layers[i]].push_back(i);
 
-		mRitemLayer[(int)RenderLayer::SkinnedOpaque].push_back(ritem.get());
-		mAllRitems.push_back(std::move(ritem));
+		if (meshes[i].Submesh == nullptr || draws[i].SkinnedCBIndex != UINT(-1))
+		{
+			mUnculledItems.push_back(i);
+			continue;
+		}
+
+		BoundingBox box;
+		meshes[i].Submesh->Bounds.Transform(box, XMLoadFloat4x4(&worlds[i]));
+
+		meshes[i].BoundsDirty = false;
+		boxes.push_back(box);
+		mCullItems.push_back(i);
 	}
+
+	mSceneBvh.Build(boxes.data(), (UINT)boxes.size());
+
+	mDrawListLayoutVersion = mRenderItems.LayoutVersion();
+	mCulledCameraVersion = 0;
 }
 
 void SeleniumApp::BuildFrameResources()
@@ -947,8 +1305,8 @@ void SeleniumApp::BuildFrameResources()
 	for (int i = 0; i < NumFrameResources; ++i)
 	{
 		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-			2, (UINT)mAllRitems.size(),
-			1,
+			2, mRenderItems.Count(), InstanceBufferCapacity(),
+			mAnimationBatch.Size(),
 			(UINT)mMaterials.size()));
 	}
 }
@@ -1002,6 +1360,17 @@ void SeleniumApp::BuildPSOs()
 	};
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedOpaquePsoDesc, IID_PPV_ARGS(&mPSOs["skinnedOpaque"])));
 
+	//
+	// PSO for instanced opaque objects.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC instancedOpaquePsoDesc = opaquePsoDesc;
+	instancedOpaquePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["instancedVS"]->GetBufferPointer()),
+		mShaders["instancedVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&instancedOpaquePsoDesc, IID_PPV_ARGS(&mPSOs["instancedOpaque"])));
+
 	//
 	// PSO for shadow map pass.
 	//
@@ -1040,6 +1409,14 @@ void SeleniumApp::BuildPSOs()
 	};
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedSmapPsoDesc, IID_PPV_ARGS(&mPSOs["shadowSkinnedOpaque"])));
 
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC instancedSmapPsoDesc = smapPsoDesc;
+	instancedSmapPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["instancedShadowVS"]->GetBufferPointer()),
+		mShaders["instancedShadowVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&instancedSmapPsoDesc, IID_PPV_ARGS(&mPSOs["shadowInstancedOpaque"])));
+
 	//
 	// PSO for debug layer.
 	//
@@ -1091,6 +1468,14 @@ void SeleniumApp::BuildPSOs()
 	};
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedDrawNormalsPsoDesc, IID_PPV_ARGS(&mPSOs["skinnedDrawNormals"])));
 
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC instancedDrawNormalsPsoDesc = drawNormalsPsoDesc;
+	instancedDrawNormalsPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["instancedDrawNormalsVS"]->GetBufferPointer()),
+		mShaders["instancedDrawNormalsVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&instancedDrawNormalsPsoDesc, IID_PPV_ARGS(&mPSOs["instancedDrawNormals"])));
+
 	//
 	// PSO for SSAO.
 	//
@@ -1157,6 +1542,17 @@ void SeleniumApp::BuildPSOs()
 		mShaders["skyPS"]->GetBufferSize()
 	};
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skyPsoDesc, IID_PPV_ARGS(&mPSOs["sky"])));
+
+	mMainPassPsos[(int)RenderLayer::Opaque] = mPSOs["opaque"].Get();
+	mMainPassPsos[(int)RenderLayer::SkinnedOpaque] = mPSOs["skinnedOpaque"].Get();
+	mMainPassPsos[(int)RenderLayer::Debug] = mPSOs["debug"].Get();
+	mMainPassPsos[(int)RenderLayer::Sky] = mPSOs["sky"].Get();
+
+	mNormalsPassPsos[(int)RenderLayer::Opaque] = mPSOs["drawNormals"].Get();
+	mNormalsPassPsos[(int)RenderLayer::SkinnedOpaque] = mPSOs["skinnedDrawNormals"].Get();
+
+	mShadowPassPsos[(int)RenderLayer::Opaque] = mPSOs["shadowOpaque"].Get();
+	mShadowPassPsos[(int)RenderLayer::SkinnedOpaque] = mPSOs["shadowSkinnedOpaque"].Get();
 }
 
 void SeleniumApp::OnResize()
@@ -1243,227 +1639,405 @@ void SeleniumApp::Update(const Timer& gt)
 	UpdateMainPassCB(gt);
 	UpdateShadowPassCB(gt);
 	UpdateSsaoCB(gt);
+	CullRenderItems();
+	SelectLods();
+	CullMeshlets();
+	UpdateInstanceBuffer();
+	BuildDrawPackets();
+	UpdateTerrain();
+
+#if defined(DEBUG) || defined(_DEBUG)
+	LogDrawStats(gt);
+#endif
 }
 
 void SeleniumApp::Draw(const Timer& gt)
 {
-	auto cmdAllocator = mCurrFrameResource->CmdAllocator;
+	mDrawStats = DrawStateStats();
 
-	// Reuse the memory associated with command recording.
-	// We can only reset when the associated command lists have finished execution on the GPU.
-	ThrowIfFailed(cmdAllocator->Reset());
+	// The passes in the order the GPU runs them.  The lists are recorded in
+	// parallel and submitted together.
+	mRecording.Clear();
+	AddShadowPassLists();
+	AddNormalsAndDepthLists();
+	AddSsaoList();
+	AddMainPassLists();
 
-	// A command list can be reset after it has been added to the command queue via ExecuteCommandList.
-	// Reusing the command list reuses memory.
-	ThrowIfFailed(mCmdList->Reset(cmdAllocator.Get(), mPSOs["opaque"].Get()));
+	// Lists are only created here, never from the recording jobs.
+	mCurrFrameResource->ReserveCommandLists(md3dDevice.Get(), mRecording.ListCount());
 
-	ID3D12DescriptorHeap* descriptorHeaps[] = { mCbvSrvUavHeap.Get() };
-	mCmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+	FrameCommandRecorder recorder(*mCurrFrameResource, mCmdQueue.Get());
+	mRecording.Execute(recorder, mRecordInParallel ? mJobSystem.get() : nullptr);
 
-	mCmdList->SetGraphicsRootSignature(mRootSignature.Get());
+	// Swap the back and front buffers
+	ThrowIfFailed(mSwapChain->Present(1, 0));
+	mCurrSwapChainBuffer = (mCurrSwapChainBuffer + 1) % SwapChainBufferCount;
 
-	// Bind all the materials used in this scene.  For structured buffers, we can bypass the heap and 
-	// set as a root descriptor.
-	auto matBuffer = mCurrFrameResource->MaterialBuffer->Resource();
-	mCmdList->SetGraphicsRootShaderResourceView(3, matBuffer->GetGPUVirtualAddress());
+	// Advance the fence value to mark commands up to this fence point.
+	mCurrentFence++;
+	mCurrFrameResource->Fence = mCurrentFence;
 
-	// Bind null SRV for shadow map pass.
-	mCmdList->SetGraphicsRootDescriptorTable(4, mNullCubeSrvGpuHandle);
+	// Add an instruction to the command queue to set a new fence point. 
+	// Because we are on the GPU timeline, the new fence point won't be 
+	// set until the GPU finishes processing all the commands prior to this Signal().
+	mCmdQueue->Signal(mFence.Get(), mCurrentFence);
+}
 
-	// Bind all the textures used in this scene.  Observe
-	// that we only have to specify the first descriptor in the table.  
-	// The root signature knows how many descriptors are expected in the table.
-	mCmdList->SetGraphicsRootDescriptorTable(5, mCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart());
+void SeleniumApp::DrawPackets(ID3D12GraphicsCommandList* cmdList, const DrawPacketList& packets,
+	UINT begin, UINT end, ID3D12PipelineState* const psos[], bool cullMeshlets)
+{
+	UINT objCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
+	UINT skinnedCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(SkinnedConstants));
 
-	DrawSceneToShadowMap();
+	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
+	auto skinnedCB = mCurrFrameResource->SkinnedCB->Resource();
 
-	DrawNormalsAndDepth();
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	const std::vector<RenderItemMesh>& meshes = mRenderItems.Mesh();
 
-	mCmdList->SetGraphicsRootSignature(mSsaoRootSignature.Get());
-	mSsao->ComputeSsao(mCmdList.Get(), mCurrFrameResource, 2);
+	// Packets are sorted so draws that share state are adjacent; only bind
+	// what differs from the previous draw.  Every call records into a list
+	// of its own, so nothing is bound yet.
+	DrawStateCache state;
+	for (UINT p = begin; p < end; ++p)
+	{
+		const DrawPacket& packet = packets.Packets()[p];
+		UINT item = packet.Item;
+		const RenderItemDraw& ri = draws[item];
 
-	//
-	// Main rendering pass.
-	//
+		ID3D12PipelineState* pso = psos[DrawKeyPso(packet.Key)];
+		if (state.SetPso(pso))
+			cmdList->SetPipelineState(pso);
 
-	mCmdList->SetGraphicsRootSignature(mRootSignature.Get());
+		if (state.SetGeometry(ri.Geo))
+		{
+			cmdList->IASetVertexBuffers(0, 1, &ri.Geo->VertexBufferView());
+			cmdList->IASetIndexBuffer(&ri.Geo->IndexBufferView());
+		}
+		if (state.SetTopology(ri.PrimitiveTopology))
+			cmdList->IASetPrimitiveTopology(ri.PrimitiveTopology);
 
-	// Rebind state whenever graphics root signature changes.
+		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + item*objCBByteSize;
 
-	// Bind all the materials used in this scene.  For structured buffers, we can bypass the heap and 
-	// set as a root descriptor.
-	matBuffer = mCurrFrameResource->MaterialBuffer->Resource();
-	mCmdList->SetGraphicsRootShaderResourceView(3, matBuffer->GetGPUVirtualAddress());
+		cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
 
-	mCmdList->RSSetViewports(1, &mScreenViewport);
-	mCmdList->RSSetScissorRects(1, &mScissorRect);
+		if (state.SetSkinnedCB(ri.SkinnedCBIndex))
+		{
+			if (ri.SkinnedCBIndex != UINT(-1))
+			{
+				D3D12_GPU_VIRTUAL_ADDRESS skinnedCBAddress = skinnedCB->GetGPUVirtualAddress() + ri.SkinnedCBIndex*skinnedCBByteSize;
+				cmdList->SetGraphicsRootConstantBufferView(1, skinnedCBAddress);
+			}
+			else
+			{
+				cmdList->SetGraphicsRootConstantBufferView(1, 0);
+			}
+		}
 
-	// Indicate a state transition on the resource usage.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentSwapChainBuffer(),
-		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+		if (cullMeshlets && meshes[item].Meshlets != nullptr)
+		{
+			for (const MeshletDrawRange& range : meshes[item].VisibleRanges)
+				cmdList->DrawIndexedInstanced(range.IndexCount, 1, range.StartIndexLocation, ri.BaseVertexLocation, 0);
+		}
+		else
+		{
+			cmdList->DrawIndexedInstanced(ri.IndexCount, 1, ri.StartIndexLocation, ri.BaseVertexLocation, 0);
+		}
+		state.CountDraw();
+	}
 
-	// Clear the back buffer and depth buffer.
-	mCmdList->ClearRenderTargetView(CurrentSwapChainBufferView(), Colors::LightSteelBlue, 0, nullptr);
-	mCmdList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	std::lock_guard<std::mutex> lock(mDrawStatsMutex);
+	mDrawStats += state.Stats();
+}
 
-	// Specify the buffers we are going to render to.
-	mCmdList->OMSetRenderTargets(1, &CurrentSwapChainBufferView(), true, &DepthStencilView());
+void SeleniumApp::DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, const InstanceBatcher& batcher,
+	UINT firstInstance)
+{
+	auto instanceBuffer = mCurrFrameResource->InstanceBuffer->Resource();
+	auto instanceIndexBuffer = mCurrFrameResource->InstanceIndexBuffer->Resource();
+	cmdList->SetGraphicsRootShaderResourceView(6, instanceBuffer->GetGPUVirtualAddress());
+	cmdList->SetGraphicsRootShaderResourceView(8, instanceIndexBuffer->GetGPUVirtualAddress());
+	cmdList->SetGraphicsRootConstantBufferView(1, 0);
+
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	for (const InstanceBatch& batch : batcher.Batches())
+	{
+		const RenderItemDraw& ri = draws[batch.Item];
 
-	// Bind all the textures used in this scene.  Observe
-	// that we only have to specify the first descriptor in the table.  
-	// The root signature knows how many descriptors are expected in the table.
-	mCmdList->SetGraphicsRootDescriptorTable(5, mCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart());
+		cmdList->IASetVertexBuffers(0, 1, &ri.Geo->VertexBufferView());
+		cmdList->IASetIndexBuffer(&ri.Geo->IndexBufferView());
+		cmdList->IASetPrimitiveTopology(ri.PrimitiveTopology);
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCmdList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+		// SV_InstanceID does not include StartInstanceLocation, so the first
+		// instance is passed as a root constant.
+		cmdList->SetGraphicsRoot32BitConstant(7, firstInstance + batch.FirstInstance, 0);
+		cmdList->DrawIndexedInstanced(ri.IndexCount, batch.InstanceCount, ri.StartIndexLocation, ri.BaseVertexLocation, 0);
+	}
+}
 
-	// Bind the sky cube map.  For our demos, we just use one "world" cube map representing the environment
-	// from far away, so all objects will use the same cube map and we only need to set it once per-frame.  
-	// If we wanted to use "local" cube maps, we would have to change them per-object, or dynamically
-	// index into an array of cube maps.
+void SeleniumApp::DrawTerrain(ID3D12GraphicsCommandList* cmdList, const std::vector<TerrainDraw>& draws)
+{
+	if (draws.empty())
+		return;
 
-	CD3DX12_GPU_DESCRIPTOR_HANDLE skyTexDescriptor(mCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart());
-	skyTexDescriptor.Offset(mSkyTexHeapIndex, mCbvSrvUavDescriptorSize);
-	mCmdList->SetGraphicsRootDescriptorTable(4, skyTexDescriptor);
+	UINT objCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
+	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
 
-	mCmdList->SetPipelineState(mPSOs["opaque"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	UINT item = mRenderItems.IndexOf(mTerrainItem);
+	const RenderItemDraw& terrainDraw = mRenderItems.Draw()[item];
 
-	mCmdList->SetPipelineState(mPSOs["skinnedOpaque"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+	cmdList->IASetVertexBuffers(0, 1, &terrainDraw.Geo->VertexBufferView());
+	cmdList->IASetIndexBuffer(&terrainDraw.Geo->IndexBufferView());
+	cmdList->IASetPrimitiveTopology(terrainDraw.PrimitiveTopology);
 
-	mCmdList->SetPipelineState(mPSOs["debug"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::Debug]);
+	D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + item*objCBByteSize;
+	cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
+	cmdList->SetGraphicsRootConstantBufferView(1, 0);
 
-	mCmdList->SetPipelineState(mPSOs["sky"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::Sky]);
+	// Every chunk is one draw of its level's shared index range.
+	for (const TerrainDraw& draw : draws)
+		cmdList->DrawIndexedInstanced(draw.IndexCount, 1, draw.StartIndexLocation, draw.BaseVertexLocation, 0);
+}
 
-	// Indicate a state transition on the resource usage.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentSwapChainBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+void SeleniumApp::SetPassState(ID3D12GraphicsCommandList* cmdList, const PassState& pass)
+{
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mCbvSrvUavHeap.Get() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-	// Done recording commands.
-	ThrowIfFailed(mCmdList->Close());
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
 
-	// Add the command list to the queue for execution.
-	ID3D12CommandList* cmdLists[] = { mCmdList.Get() };
-	mCmdQueue->ExecuteCommandLists(_countof(cmdLists), cmdLists);
+	cmdList->RSSetViewports(1, &pass.Viewport);
+	cmdList->RSSetScissorRects(1, &pass.ScissorRect);
 
-	// Swap the back and front buffers
-	ThrowIfFailed(mSwapChain->Present(1, 0));
-	mCurrSwapChainBuffer = (mCurrSwapChainBuffer + 1) % SwapChainBufferCount;
+	// Specify the buffers we are going to render to.
+	cmdList->OMSetRenderTargets(pass.RtvCount, pass.RtvCount > 0 ? &pass.Rtv : nullptr, true, &pass.Dsv);
 
-	// Advance the fence value to mark commands up to this fence point.
-	mCurrentFence++;
-	mCurrFrameResource->Fence = mCurrentFence;
+	cmdList->SetGraphicsRootConstantBufferView(2, pass.PassCB);
 
-	// Add an instruction to the command queue to set a new fence point. 
-	// Because we are on the GPU timeline, the new fence point won't be 
-	// set until the GPU finishes processing all the commands prior to this Signal().
-	mCmdQueue->Signal(mFence.Get(), mCurrentFence);
-}
+	// Bind all the materials used in this scene.  For structured buffers, we can bypass the heap and 
+	// set as a root descriptor.
+	auto matBuffer = mCurrFrameResource->MaterialBuffer->Resource();
+	cmdList->SetGraphicsRootShaderResourceView(3, matBuffer->GetGPUVirtualAddress());
 
-void SeleniumApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
-{
-	UINT objCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-	UINT skinnedCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(SkinnedConstants));
+	cmdList->SetGraphicsRootDescriptorTable(4, pass.CubeMap);
 
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
-	auto skinnedCB = mCurrFrameResource->SkinnedCB->Resource();
+	// Bind all the textures used in this scene.  Observe
+	// that we only have to specify the first descriptor in the table.  
+	// The root signature knows how many descriptors are expected in the table.
+	cmdList->SetGraphicsRootDescriptorTable(5, mCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart());
+}
 
-	// For each render item...
-	for (size_t i = 0; i < ritems.size(); ++i)
+void SeleniumApp::AddPassLists(const PassState& pass, std::vector<ParallelRecording::RecordFunc>& draws)
+{
+	for (size_t i = 0; i < draws.size(); ++i)
 	{
-		auto ri = ritems[i];
+		bool first = i == 0;
+		bool last = i + 1 == draws.size();
+		ParallelRecording::RecordFunc draw = std::move(draws[i]);
 
-		cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->PrimitiveTopology);
+		mRecording.Add([this, pass, first, last, draw](ID3D12GraphicsCommandList* cmdList)
+		{
+			if (first && pass.Begin)
+				pass.Begin(cmdList);
 
-		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
+			SetPassState(cmdList, pass);
+			draw(cmdList);
 
-		cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
+			if (last && pass.End)
+				pass.End(cmdList);
+		});
+	}
+}
 
-		if (ri->skinnedController != nullptr)
-		{
-			D3D12_GPU_VIRTUAL_ADDRESS skinnedCBAddress = skinnedCB->GetGPUVirtualAddress() + ri->SkinnedCBIndex*skinnedCBByteSize;
-			cmdList->SetGraphicsRootConstantBufferView(1, skinnedCBAddress);
-		}
-		else
-		{
-			cmdList->SetGraphicsRootConstantBufferView(1, 0);
-		}
+void SeleniumApp::AddPacketDraws(std::vector<ParallelRecording::RecordFunc>& draws, const DrawPacketList& packets,
+	RenderLayer firstLayer, RenderLayer lastLayer, ID3D12PipelineState* const psos[], bool cullMeshlets)
+{
+	UINT begin = 0;
+	UINT end = 0;
+	packets.LayerRange((UINT)firstLayer, (UINT)lastLayer, begin, end);
 
-		cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+	for (UINT first = begin; first < end; first += RecordGrainSize)
+	{
+		UINT last = MathHelper::Min(first + RecordGrainSize, end);
+		draws.push_back([this, &packets, first, last, psos, cullMeshlets](ID3D12GraphicsCommandList* cmdList)
+		{
+			DrawPackets(cmdList, packets, first, last, psos, cullMeshlets);
+		});
 	}
 }
 
-void SeleniumApp::DrawSceneToShadowMap()
+void SeleniumApp::AddShadowPassLists()
 {
-	mCmdList->RSSetViewports(1, &mShadowMap->Viewport());
-	mCmdList->RSSetScissorRects(1, &mShadowMap->ScissorRect());
+	// Pass constants for the shadow map pass.
+	UINT passCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(PassConstants));
+	auto passCB = mCurrFrameResource->PassCB->Resource();
 
-	// Change to DEPTH_WRITE.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mShadowMap->Resource(),
-		D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_DEPTH_WRITE));
+	PassState pass;
+	pass.Viewport = mShadowMap->Viewport();
+	pass.ScissorRect = mShadowMap->ScissorRect();
+	pass.Dsv = mShadowMap->CpuDsv();
+	pass.PassCB = passCB->GetGPUVirtualAddress() + 1 * passCBByteSize;
+	// Bind null SRV for shadow map pass.
+	pass.CubeMap = mNullCubeSrvGpuHandle;
 
-	// Clear the back buffer and depth buffer.
-	mCmdList->ClearDepthStencilView(mShadowMap->CpuDsv(),
-		D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	ID3D12Resource* shadowMap = mShadowMap->Resource();
+	D3D12_CPU_DESCRIPTOR_HANDLE dsv = pass.Dsv;
+	pass.Begin = [shadowMap, dsv](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Change to DEPTH_WRITE.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(shadowMap,
+			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_DEPTH_WRITE));
 
-	// Specify the buffers we are going to render to.
-	mCmdList->OMSetRenderTargets(0, nullptr, false, &mShadowMap->CpuDsv());
+		// Clear the back buffer and depth buffer.
+		cmdList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	};
+	pass.End = [shadowMap](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Change back to GENERIC_READ so we can read the texture in a shader.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(shadowMap,
+			D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_GENERIC_READ));
+	};
 
-	// Bind the pass constant buffer for the shadow map pass.
-	UINT passCBByteSize = D3DUtil::CalcConstantBufferByteSize(sizeof(PassConstants));
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	D3D12_GPU_VIRTUAL_ADDRESS passCBAddress = passCB->GetGPUVirtualAddress() + 1 * passCBByteSize;
-	mCmdList->SetGraphicsRootConstantBufferView(2, passCBAddress);
+	// Looked up here since the map is not safe to index from the jobs.
+	ID3D12PipelineState* terrainPso = mPSOs["shadowOpaque"].Get();
+	ID3D12PipelineState* instancedPso = mPSOs["shadowInstancedOpaque"].Get();
 
-	mCmdList->SetPipelineState(mPSOs["shadowOpaque"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	std::vector<ParallelRecording::RecordFunc> draws;
+	AddPacketDraws(draws, mShadowPackets, RenderLayer::Opaque, RenderLayer::Opaque, mShadowPassPsos);
+	draws.push_back([this, terrainPso, instancedPso](ID3D12GraphicsCommandList* cmdList)
+	{
+		cmdList->SetPipelineState(terrainPso);
+		DrawTerrain(cmdList, mTerrain.AllDraws());
 
-	mCmdList->SetPipelineState(mPSOs["shadowSkinnedOpaque"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+		cmdList->SetPipelineState(instancedPso);
+		DrawInstanceBatches(cmdList, mShadowBatcher, mShadowFirstInstance);
+	});
+	AddPacketDraws(draws, mShadowPackets, RenderLayer::SkinnedOpaque, RenderLayer::SkinnedOpaque, mShadowPassPsos);
 
-	// Change back to GENERIC_READ so we can read the texture in a shader.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mShadowMap->Resource(),
-		D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_GENERIC_READ));
+	AddPassLists(pass, draws);
 }
 
-void SeleniumApp::DrawNormalsAndDepth()
+void SeleniumApp::AddNormalsAndDepthLists()
 {
-	mCmdList->RSSetViewports(1, &mScreenViewport);
-	mCmdList->RSSetScissorRects(1, &mScissorRect);
+	auto passCB = mCurrFrameResource->PassCB->Resource();
+
+	PassState pass;
+	pass.Viewport = mScreenViewport;
+	pass.ScissorRect = mScissorRect;
+	pass.RtvCount = 1;
+	pass.Rtv = mSsao->NormalMapCpuRtv();
+	pass.Dsv = DepthStencilView();
+	pass.PassCB = passCB->GetGPUVirtualAddress();
+	pass.CubeMap = mNullCubeSrvGpuHandle;
+
+	ID3D12Resource* normalMap = mSsao->NormalMap();
+	D3D12_CPU_DESCRIPTOR_HANDLE rtv = pass.Rtv;
+	D3D12_CPU_DESCRIPTOR_HANDLE dsv = pass.Dsv;
+	pass.Begin = [normalMap, rtv, dsv](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Change to RENDER_TARGET.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(normalMap,
+			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET));
+
+		// Clear the screen normal map and depth buffer.
+		float clearValue[] = { 0.0f, 0.0f, 1.0f, 0.0f };
+		cmdList->ClearRenderTargetView(rtv, clearValue, 0, nullptr);
+		cmdList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	};
+	pass.End = [normalMap](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Change back to GENERIC_READ so we can read the texture in a shader.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(normalMap,
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
+	};
 
-	auto normalMap = mSsao->NormalMap();
-	auto normalMapCpuRtv = mSsao->NormalMapCpuRtv();
+	ID3D12PipelineState* terrainPso = mPSOs["drawNormals"].Get();
+	ID3D12PipelineState* instancedPso = mPSOs["instancedDrawNormals"].Get();
 
-	// Change to RENDER_TARGET.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(normalMap,
-		D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET));
+	std::vector<ParallelRecording::RecordFunc> draws;
+	AddPacketDraws(draws, mMainPackets, RenderLayer::Opaque, RenderLayer::Opaque, mNormalsPassPsos, true);
+	draws.push_back([this, terrainPso, instancedPso](ID3D12GraphicsCommandList* cmdList)
+	{
+		cmdList->SetPipelineState(terrainPso);
+		DrawTerrain(cmdList, mTerrain.VisibleDraws());
 
-	// Clear the screen normal map and depth buffer.
-	float clearValue[] = { 0.0f, 0.0f, 1.0f, 0.0f };
-	mCmdList->ClearRenderTargetView(normalMapCpuRtv, clearValue, 0, nullptr);
-	mCmdList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+		cmdList->SetPipelineState(instancedPso);
+		DrawInstanceBatches(cmdList, mOpaqueBatcher, 0);
+	});
+	AddPacketDraws(draws, mMainPackets, RenderLayer::SkinnedOpaque, RenderLayer::SkinnedOpaque, mNormalsPassPsos);
 
-	// Specify the buffers we are going to render to.
-	mCmdList->OMSetRenderTargets(1, &normalMapCpuRtv, true, &DepthStencilView());
+	AddPassLists(pass, draws);
+}
+
+void SeleniumApp::AddSsaoList()
+{
+	mRecording.Add([this](ID3D12GraphicsCommandList* cmdList)
+	{
+		ID3D12DescriptorHeap* descriptorHeaps[] = { mCbvSrvUavHeap.Get() };
+		cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-	// Bind the constant buffer for this pass.
+		cmdList->SetGraphicsRootSignature(mSsaoRootSignature.Get());
+		mSsao->ComputeSsao(cmdList, mCurrFrameResource, 2);
+	});
+}
+
+void SeleniumApp::AddMainPassLists()
+{
 	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCmdList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
 
-	mCmdList->SetPipelineState(mPSOs["drawNormals"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	PassState pass;
+	pass.Viewport = mScreenViewport;
+	pass.ScissorRect = mScissorRect;
+	pass.RtvCount = 1;
+	pass.Rtv = CurrentSwapChainBufferView();
+	pass.Dsv = DepthStencilView();
+	pass.PassCB = passCB->GetGPUVirtualAddress();
+
+	// Bind the sky cube map.  For our demos, we just use one "world" cube map representing the environment
+	// from far away, so all objects will use the same cube map and we only need to set it once per-frame.  
+	// If we wanted to use "local" cube maps, we would have to change them per-object, or dynamically
+	// index into an array of cube maps.
+	CD3DX12_GPU_DESCRIPTOR_HANDLE skyTexDescriptor(mCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart());
+	skyTexDescriptor.Offset(mSkyTexHeapIndex, mCbvSrvUavDescriptorSize);
+	pass.CubeMap = skyTexDescriptor;
+
+	ID3D12Resource* backBuffer = CurrentSwapChainBuffer();
+	D3D12_CPU_DESCRIPTOR_HANDLE rtv = pass.Rtv;
+	D3D12_CPU_DESCRIPTOR_HANDLE dsv = pass.Dsv;
+	pass.Begin = [backBuffer, rtv, dsv](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Indicate a state transition on the resource usage.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(backBuffer,
+			D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+
+		// Clear the back buffer and depth buffer.
+		cmdList->ClearRenderTargetView(rtv, Colors::LightSteelBlue, 0, nullptr);
+		cmdList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	};
+	pass.End = [backBuffer](ID3D12GraphicsCommandList* cmdList)
+	{
+		// Indicate a state transition on the resource usage.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(backBuffer,
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	};
+
+	ID3D12PipelineState* terrainPso = mPSOs["opaque"].Get();
+	ID3D12PipelineState* instancedPso = mPSOs["instancedOpaque"].Get();
+
+	std::vector<ParallelRecording::RecordFunc> draws;
+	AddPacketDraws(draws, mMainPackets, RenderLayer::Opaque, RenderLayer::Opaque, mMainPassPsos, true);
+	draws.push_back([this, terrainPso, instancedPso](ID3D12GraphicsCommandList* cmdList)
+	{
+		cmdList->SetPipelineState(terrainPso);
+		DrawTerrain(cmdList, mTerrain.VisibleDraws());
 
-	mCmdList->SetPipelineState(mPSOs["skinnedDrawNormals"].Get());
-	DrawRenderItems(mCmdList.Get(), mRitemLayer[(int)RenderLayer::SkinnedOpaque]);
+		cmdList->SetPipelineState(instancedPso);
+		DrawInstanceBatches(cmdList, mOpaqueBatcher, 0);
+	});
+	// The sky is drawn last, where it only fills what is left.
+	AddPacketDraws(draws, mMainPackets, RenderLayer::SkinnedOpaque, RenderLayer::Sky, mMainPassPsos);
 
-	// Change back to GENERIC_READ so we can read the texture in a shader.
-	mCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(normalMap,
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
+	AddPassLists(pass, draws);
 }
 
 void SeleniumApp::OnKeyboardInput(const Timer& gt)
@@ -1493,69 +2067,142 @@ void SeleniumApp::AnimateMaterials(const Timer& gt)
 void SeleniumApp::UpdateObjectCB(const Timer& gt)
 {
 	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for (auto& e : mAllRitems)
+	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();
+
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+	const std::vector<XMFLOAT4X4>& texTransforms = mRenderItems.TexTransform();
+	const std::vector<UINT>& materialIndices = mRenderItems.MaterialIndex();
+
+	// Only the items that changed since this frame resource was last used;
+	// item i uses constant buffer and instance slot i.
+	for (UINT i : mRenderItems.TakeDirty(mCurrFrameResourceIndex))
 	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if (e->NumFramesDirty > 0)
-		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+		XMMATRIX world = XMLoadFloat4x4(&worlds[i]);
+		XMMATRIX texTransform = XMLoadFloat4x4(&texTransforms[i]);
 
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
-			objConstants.MaterialIndex = e->Mat->bufferIndex;
+		ObjectConstants objConstants;
+		XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
+		XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+		objConstants.MaterialIndex = materialIndices[i];
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+		currObjectCB->CopyData(i, objConstants);
 
-			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
-		}
+		InstanceData instData;
+		instData.World = objConstants.World;
+		instData.TexTransform = objConstants.TexTransform;
+		instData.MaterialIndex = objConstants.MaterialIndex;
+		currInstanceBuffer->CopyData(i, instData);
 	}
 }
 
-void SeleniumApp::UpdateSkinnedCB(const Timer& gt)
+UINT SeleniumApp::InstanceBufferCapacity()const
 {
-	auto currSkinnedCB = mCurrFrameResource->SkinnedCB.get();
-
-	// We only have one skinned model being animated.
-	mSkinnedController->UpdateAnimation(gt.DeltaTime());
+	// Room for the index of every item in both the main and the shadow pass
+	// lists.
+	return 2 * mRenderItems.Count();
+}
 
-	SkinnedConstants skinnedConstants;
-	std::copy(
-		std::begin(mSkinnedController->FinalTransforms),
-		std::end(mSkinnedController->FinalTransforms),
-		&skinnedConstants.BoneTransforms[0]);
+void SeleniumApp::UpdateInstanceBuffer()
+{
+	// The instance data itself is written with the object constants, only
+	// for dirty items; the batches only list which items to draw.
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	bool opaqueChanged = mOpaqueBatcher.Build(mVisibleRitemLayer[(int)RenderLayer::Opaque], draws);
+	bool shadowChanged = mShadowBatcher.Build(mRitemLayer[(int)RenderLayer::Opaque], draws);
+	if (opaqueChanged || shadowChanged)
+		++mInstanceIndexVersion;
+
+	// The main and normal passes share the visible batches; the shadow pass
+	// batches every item and follows them in the buffer.
+	mShadowFirstInstance = (UINT)mOpaqueBatcher.Instances().size();
+	assert(mShadowFirstInstance + mShadowBatcher.Instances().size() <= InstanceBufferCapacity());
+
+	// Each frame resource has its own copy of the lists, rewritten the first
+	// time it is used after they change.
+	if (mCurrFrameResource->InstanceIndexVersion == mInstanceIndexVersion)
+		return;
+
+	auto currIndexBuffer = mCurrFrameResource->InstanceIndexBuffer.get();
+	auto writeIndices = [&](const std::vector<UINT>& items, UINT firstInstance)
+	{
+		for (UINT i = 0; i < (UINT)items.size(); ++i)
+			currIndexBuffer->CopyData(firstInstance + i, items[i]);
+	};
+	writeIndices(mOpaqueBatcher.Instances(), 0);
+	writeIndices(mShadowBatcher.Instances(), mShadowFirstInstance);
 
-	currSkinnedCB->CopyData(0, skinnedConstants);
+	mCurrFrameResource->InstanceIndexVersion = mInstanceIndexVersion;
 }
 
-void SeleniumApp::UpdateMaterialBuffer(const Timer& gt)
+void SeleniumApp::BuildDrawPackets()
 {
-	auto currMaterialBuffer = mCurrFrameResource->MaterialBuffer.get();
-	for (auto& e : mMaterials)
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	const std::vector<UINT>& materialIndices = mRenderItems.MaterialIndex();
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+
+	// Every pass keeps one pipeline state per layer, so the PSO field of the
+	// keys is the layer.
+	auto addPackets = [&](DrawPacketList& packets, const std::vector<UINT>& items, RenderLayer layer,
+		const XMMATRIX* view, float maxDepth)
 	{
-		// Only update the buffer data if the data have changed.  If the buffer
-		// data changes, it needs to be updated for each FrameResource.
-		Material* mat = e.second.get();
-		if (mat->NumFramesDirty > 0)
+		for (UINT item : items)
 		{
-			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+			// Item origins are close enough to their centers for ordering.
+			UINT depth = 0;
+			if (view != nullptr)
+			{
+				XMVECTOR origin = XMVectorSet(worlds[item]._41, worlds[item]._42, worlds[item]._43, 1.0f);
+				depth = DrawKeyDepth(XMVectorGetZ(XMVector3TransformCoord(origin, *view)), maxDepth);
+			}
+			packets.Add(MakeDrawKey((UINT)layer, (UINT)layer, draws[item].GeometryId, materialIndices[item], depth), item);
+		}
+	};
+
+	// The main and normal passes draw near to far, to reject hidden pixels
+	// early; the shadow pass only needs its draws grouped by state.
+	XMMATRIX view = mCamera.GetView();
+	float farZ = mCamera.GetViewFrustum().Far;
+
+	mMainPackets.Clear();
+	addPackets(mMainPackets, mOpaqueBatcher.SingleItems(), RenderLayer::Opaque, &view, farZ);
+	addPackets(mMainPackets, mVisibleRitemLayer[(int)RenderLayer::SkinnedOpaque], RenderLayer::SkinnedOpaque, &view, farZ);
+	addPackets(mMainPackets, mVisibleRitemLayer[(int)RenderLayer::Debug], RenderLayer::Debug, &view, farZ);
+	addPackets(mMainPackets, mVisibleRitemLayer[(int)RenderLayer::Sky], RenderLayer::Sky, &view, farZ);
+	mMainPackets.Sort();
+
+	mShadowPackets.Clear();
+	addPackets(mShadowPackets, mShadowBatcher.SingleItems(), RenderLayer::Opaque, nullptr, 0.0f);
+	addPackets(mShadowPackets, mRitemLayer[(int)RenderLayer::SkinnedOpaque], RenderLayer::SkinnedOpaque, nullptr, 0.0f);
+	mShadowPackets.Sort();
+}
 
-			MaterialBufferData matData;
-			matData.DiffuseAlbedo = mat->DiffuseAlbedo;
-			matData.FresnelR0 = mat->FresnelR0;
-			matData.Roughness = mat->Roughness;
-			XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
-			matData.DiffuseMapIndex = mat->DiffuseHeapIndex;
-			matData.NormalMapIndex = mat->NormalHeapIndex;
+void SeleniumApp::UpdateSkinnedCB(const Timer& gt)
+{
+	auto currSkinnedCB = mCurrFrameResource->SkinnedCB.get();
 
-			currMaterialBuffer->CopyData(mat->bufferIndex, matData);
+	// Each controller writes its palette directly into its own SkinnedCB slot.
+	mAnimationBatch.Update(*mJobSystem, gt.DeltaTime(), *currSkinnedCB);
+}
 
-			// Next FrameResource need to be updated too.
-			mat->NumFramesDirty--;
-		}
+void SeleniumApp::UpdateMaterialBuffer(const Timer& gt)
+{
+	auto currMaterialBuffer = mCurrFrameResource->MaterialBuffer.get();
+
+	// Only the materials that changed since this frame resource was last used.
+	for (UINT index : mMaterialDirty.TakeDirty(mCurrFrameResourceIndex))
+	{
+		Material* mat = mMaterialByIndex[index];
+		XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+
+		MaterialBufferData matData;
+		matData.DiffuseAlbedo = mat->DiffuseAlbedo;
+		matData.FresnelR0 = mat->FresnelR0;
+		matData.Roughness = mat->Roughness;
+		XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
+		matData.DiffuseMapIndex = mat->DiffuseHeapIndex;
+		matData.NormalMapIndex = mat->NormalHeapIndex;
+
+		currMaterialBuffer->CopyData(mat->bufferIndex, matData);
 	}
 }
 
@@ -1711,3 +2358,195 @@ void SeleniumApp::UpdateSsaoCB(const Timer& gt)
 	currSsaoCB->CopyData(0, ssaoCB);
 }
 
+void SeleniumApp::CullRenderItems()
+{
+	// Items were added or removed, their indices changed.
+	if (mRenderItems.LayoutVersion() != mDrawListLayoutVersion)
+		BuildDrawLists();
+
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+	const std::vector<RenderLayer>& layers = mRenderItems.Layer();
+	std::vector<RenderItemMesh>& meshes = mRenderItems.Mesh();
+
+	// Update the bounds of the items that moved since the last frame.
+	bool boundsChanged = false;
+	for (UINT cullIndex = 0; cullIndex < (UINT)mCullItems.size(); ++cullIndex)
+	{
+		RenderItemMesh& mesh = meshes[mCullItems[cullIndex]];
+		if (!mesh.BoundsDirty)
+			continue;
+
+		BoundingBox box;
+		mesh.Submesh->Bounds.Transform(box, XMLoadFloat4x4(&worlds[mCullItems[cullIndex]]));
+		mSceneBvh.SetItemBounds(cullIndex, box);
+		mesh.BoundsDirty = false;
+		boundsChanged = true;
+	}
+
+	// Only the nodes above the moved items change.
+	if (boundsChanged)
+		mSceneBvh.Refit();
+
+	// Nothing moved, last frame's lists still hold.
+	if (!boundsChanged && mCamera.GetVersion() == mCulledCameraVersion)
+		return;
+	mCulledCameraVersion = mCamera.GetVersion();
+
+	mVisibleBvhItems.clear();
+	mSceneBvhStats = SceneBvhStats();
+	mSceneBvh.Query(mCamera.GetFrustum(), mVisibleBvhItems, &mSceneBvhStats);
+
+	for (int layer = 0; layer < (int)RenderLayer::Count; ++layer)
+		mVisibleRitemLayer[layer].clear();
+
+	for (UINT item : mUnculledItems)
+		mVisibleRitemLayer[(int)layers[item]].push_back(item);
+
+	for (UINT bvhItem : mVisibleBvhItems)
+	{
+		UINT item = mCullItems[bvhItem];
+		mVisibleRitemLayer[(int)layers[item]].push_back(item);
+	}
+}
+
+void SeleniumApp::SelectLods()
+{
+	// Pixels covered by one unit of object space error one unit in front of
+	// the camera.
+	XMFLOAT4X4 proj;
+	XMStoreFloat4x4(&proj, mCamera.GetProj());
+	float pixelsPerUnit = 0.5f * mClientHeight * proj(1, 1);
+
+	XMFLOAT3 eyePosW = mCamera.GetPosition3f();
+
+	mLodTriangles = 0;
+	mFullDetailTriangles = 0;
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+	std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	std::vector<RenderItemMesh>& meshes = mRenderItems.Mesh();
+	for (UINT i = 0; i < mRenderItems.Count(); ++i)
+	{
+		RenderItemMesh& mesh = meshes[i];
+		const SubmeshGeometry* submesh = mesh.Submesh;
+		if (submesh == nullptr || submesh->Lods.empty())
+			continue;
+
+		RenderItemDraw& draw = draws[i];
+		XMMATRIX world = XMLoadFloat4x4(&worlds[i]);
+
+		// Largest scale of the world matrix, errors grow with it.
+		XMFLOAT4X4 w;
+		XMStoreFloat4x4(&w, world);
+		float scale = 0.0f;
+		for (int row = 0; row < 3; ++row)
+			scale = MathHelper::Max(scale, w(row, 0)*w(row, 0) + w(row, 1)*w(row, 1) + w(row, 2)*w(row, 2));
+		scale = sqrtf(scale);
+
+		XMFLOAT3 centerW;
+		XMStoreFloat3(&centerW, XMVector3TransformCoord(XMLoadFloat3(&submesh->Bounds.Center), world));
+		float radius = scale * XMVectorGetX(XMVector3Length(XMLoadFloat3(&submesh->Bounds.Extents)));
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&centerW), XMLoadFloat3(&eyePosW)))) - radius;
+
+		// Levels are ordered by error, take the last one that is still fine.
+		UINT lod = 0;
+		if (distance > 0.0f)
+		{
+			while (lod < (UINT)submesh->Lods.size() &&
+				submesh->Lods[lod].Error * scale * pixelsPerUnit <= mLodPixelError * distance)
+				++lod;
+		}
+
+		mesh.LodIndex = lod;
+		if (lod == 0)
+		{
+			draw.IndexCount = submesh->IndexCount;
+			draw.StartIndexLocation = submesh->StartIndexLocation;
+			draw.BaseVertexLocation = submesh->BaseVertexLocation;
+			mesh.Meshlets = submesh->Meshlets.empty() ? nullptr : &submesh->Meshlets;
+		}
+		else
+		{
+			const SubmeshLod& level = submesh->Lods[lod - 1];
+			draw.IndexCount = level.IndexCount;
+			draw.StartIndexLocation = level.StartIndexLocation;
+			draw.BaseVertexLocation = level.BaseVertexLocation;
+			mesh.Meshlets = level.Meshlets.empty() ? nullptr : &level.Meshlets;
+		}
+
+		mLodTriangles += draw.IndexCount / 3;
+		mFullDetailTriangles += submesh->IndexCount / 3;
+	}
+}
+
+void SeleniumApp::CullMeshlets()
+{
+	mMeshletCuller.SetCamera(mCamera.GetViewFrustum(), mCamera.GetView(), mCamera.GetPosition3f());
+
+	mMeshletCullStats = MeshletCullStats();
+	const std::vector<XMFLOAT4X4>& worlds = mRenderItems.World();
+	const std::vector<RenderItemDraw>& draws = mRenderItems.Draw();
+	std::vector<RenderItemMesh>& meshes = mRenderItems.Mesh();
+	for (UINT i = 0; i < mRenderItems.Count(); ++i)
+	{
+		RenderItemMesh& mesh = meshes[i];
+		if (mesh.Meshlets == nullptr)
+			continue;
+
+		mesh.VisibleRanges.clear();
+		mMeshletCuller.Cull(*mesh.Meshlets, draws[i].StartIndexLocation, XMLoadFloat4x4(&worlds[i]),
+			mesh.VisibleRanges, &mMeshletCullStats);
+	}
+}
+
+void SeleniumApp::UpdateTerrain()
+{
+	XMFLOAT4X4 proj;
+	XMStoreFloat4x4(&proj, mCamera.GetProj());
+	float pixelsPerUnit = 0.5f * mClientHeight * proj(1, 1);
+
+	mTerrain.Update(mCamera.GetViewFrustum(), mCamera.GetView(), mCamera.GetPosition3f(), pixelsPerUnit, mLodPixelError);
+}
+
+void SeleniumApp::LogDrawStats(const Timer& gt)
+{
+	// Report the counts about once a second.
+	if (gt.TotalTime() - mDrawStatsLogTime >= 1.0f)
+	{
+		mDrawStatsLogTime = gt.TotalTime();
+
+		std::string lodStr = "LODs: " + std::to_string(mLodTriangles) + " of " +
+			std::to_string(mFullDetailTriangles) + " triangles\n";
+		::OutputDebugStringA(lodStr.c_str());
+
+		std::string cullStr = "Meshlets: " + std::to_string(mMeshletCullStats.Tested) + " tested, " +
+			std::to_string(mMeshletCullStats.FrustumCulled) + " outside the frustum, " +
+			std::to_string(mMeshletCullStats.BackfaceCulled) + " back-facing, " +
+			std::to_string(mMeshletCullStats.Visible()) + " drawn\n";
+		::OutputDebugStringA(cullStr.c_str());
+
+		std::string itemStr = "Scene BVH: " + std::to_string(mSceneBvhStats.Visible) + " of " +
+			std::to_string(mSceneBvh.ItemCount()) + " render items visible, " +
+			std::to_string(mSceneBvhStats.NodesTested) + " nodes and " +
+			std::to_string(mSceneBvhStats.ItemsTested) + " items tested\n";
+		::OutputDebugStringA(itemStr.c_str());
+
+		std::string drawStr = "Opaque draws: " + std::to_string(mOpaqueBatcher.DrawCount()) + " for " +
+			std::to_string(mVisibleRitemLayer[(int)RenderLayer::Opaque].size()) + " items, " +
+			std::to_string(mOpaqueBatcher.Batches().size()) + " instanced\n";
+		::OutputDebugStringA(drawStr.c_str());
+
+		std::string stateStr = "Draw state: " + std::to_string(mDrawStats.Changes()) + " changes for " +
+			std::to_string(mDrawStats.Draws) + " packet draws (" + std::to_string(mDrawStats.PsoChanges) +
+			" PSO, " + std::to_string(mDrawStats.GeometryChanges) + " geometry, " +
+			std::to_string(mDrawStats.TopologyChanges) + " topology, " +
+			std::to_string(mDrawStats.SkinnedCBChanges) + " skinned CB)\n";
+		::OutputDebugStringA(stateStr.c_str());
+
+		const TerrainStats& terrainStats = mTerrain.Stats();
+		std::string terrainStr = "Terrain: " + std::to_string(terrainStats.VisibleChunks) + " of " +
+			std::to_string(mTerrain.Chunks().size()) + " chunks, " + std::to_string(terrainStats.Triangles) +
+			" of " + std::to_string(terrainStats.FullDetailTriangles) + " triangles\n";
+		::OutputDebugStringA(terrainStr.c_str());
+	}
+}
+
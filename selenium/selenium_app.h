@@ -7,18 +7,29 @@
 #include "ssao.h"
 #include <string>
 #include "m3d_loader.h"
+#include "m3d_binary.h"
 #include "skinned_data.h"
 #include "skinned_controller.h"
 #include "mesh_geometry.h"
+#include "meshlet.h"
 #include "texture.h"
 #include <array>
 #include "d3dx12.h"
 #include <wrl/client.h>
 #include <vector>
+#include <mutex>
 #include "material.h"
-#include "render_item.h"
+#include "dirty_tracker.h"
+#include "render_item_store.h"
+#include "instance_batcher.h"
+#include "draw_packet.h"
+#include "command_recorder.h"
 #include "render_layer.h"
+#include "scene_bvh.h"
+#include "terrain.h"
 #include "frame_resource.h"
+#include "job_system.h"
+#include "animation_batch.h"
 
 class SeleniumApp : public D3DApp {
 public:
@@ -48,24 +59,73 @@ private:
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayout();
 	void BuildShapeGeometry();
+	void BuildTerrainGeometry();
 	void BuildMaterials();
 	void BuildRenderItems();
+	void BuildDrawLists();
 	void BuildFrameResources();
 	void BuildPSOs();
 
 	void OnKeyboardInput(const Timer& gt);
 	void AnimateMaterials(const Timer& gt);
 	void UpdateObjectCB(const Timer& gt);
+	void UpdateInstanceBuffer();
+	UINT InstanceBufferCapacity()const;
+	void BuildDrawPackets();
 	void UpdateSkinnedCB(const Timer& gt);
 	void UpdateMaterialBuffer(const Timer& gt);
 	void UpdateShadowTransform(const Timer& gt);
 	void UpdateMainPassCB(const Timer& gt);
 	void UpdateShadowPassCB(const Timer& gt);
 	void UpdateSsaoCB(const Timer& gt);
+	void CullRenderItems();
+	void SelectLods();
+	void CullMeshlets();
+	void UpdateTerrain();
+	// Debug builds only: writes the draw counts to the debugger output
+	// about once a second.
+	void LogDrawStats(const Timer& gt);
 
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
-	void DrawSceneToShadowMap();
-	void DrawNormalsAndDepth();
+	// Render targets and constants that every command list of a pass binds
+	// before drawing, and the transitions and clears around the pass.
+	struct PassState
+	{
+		D3D12_VIEWPORT Viewport = {};
+		D3D12_RECT ScissorRect = {};
+		UINT RtvCount = 0;
+		D3D12_CPU_DESCRIPTOR_HANDLE Rtv = {};
+		D3D12_CPU_DESCRIPTOR_HANDLE Dsv = {};
+		D3D12_GPU_VIRTUAL_ADDRESS PassCB = 0;
+		D3D12_GPU_DESCRIPTOR_HANDLE CubeMap = {};
+
+		// Recorded at the start of the first list and the end of the last.
+		ParallelRecording::RecordFunc Begin;
+		ParallelRecording::RecordFunc End;
+	};
+
+	// The draws of a pass are split into lists of at most this many packets.
+	static constexpr UINT RecordGrainSize = 1024;
+
+	void SetPassState(ID3D12GraphicsCommandList* cmdList, const PassState& pass);
+	// Adds a list per draw function to mRecording, each starting with the
+	// pass state.
+	void AddPassLists(const PassState& pass, std::vector<ParallelRecording::RecordFunc>& draws);
+	// Adds draw functions for the packets of layers [firstLayer, lastLayer],
+	// RecordGrainSize packets each.
+	void AddPacketDraws(std::vector<ParallelRecording::RecordFunc>& draws, const DrawPacketList& packets,
+		RenderLayer firstLayer, RenderLayer lastLayer, ID3D12PipelineState* const psos[], bool cullMeshlets = false);
+	void AddShadowPassLists();
+	void AddNormalsAndDepthLists();
+	void AddSsaoList();
+	void AddMainPassLists();
+
+	// Draws packets [begin, end) with psos[DrawKeyPso(key)].  cullMeshlets
+	// draws only the VisibleRanges of render items with meshlets.  Safe to
+	// call from several jobs at once.
+	void DrawPackets(ID3D12GraphicsCommandList* cmdList, const DrawPacketList& packets,
+		UINT begin, UINT end, ID3D12PipelineState* const psos[], bool cullMeshlets);
+	void DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, const InstanceBatcher& batcher, UINT firstInstance);
+	void DrawTerrain(ID3D12GraphicsCommandList* cmdList, const std::vector<TerrainDraw>& draws);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 7> GetStaticSamplers();
 
@@ -81,28 +141,110 @@ private:
 
 	Camera mCamera;
 
+	// Render items draw the coarsest level of detail whose error projects to
+	// at most this many pixels.
+	float mLodPixelError = 1.0f;
+
+	// Triangles drawn this frame after LOD selection, and at full detail.
+	UINT mLodTriangles = 0;
+	UINT mFullDetailTriangles = 0;
+
+	MeshletCuller mMeshletCuller;
+	MeshletCullStats mMeshletCullStats;
+	float mDrawStatsLogTime = 0.0f;
+
+	// Chunked heightfield around the scene.  A procedural heightmap is used if
+	// the file is missing.
+	std::string mTerrainHeightmapFilename = "Textures\\terrain.r16";
+	Terrain mTerrain;
+	RenderItemHandle mTerrainItem;
+
 	std::unique_ptr<ShadowMap> mShadowMap;
 
 	std::unique_ptr<Ssao> mSsao;
 
 	std::string mSkinnedModelFilename = "Models\\soldier.m3d";
+
 	std::vector<M3DLoader::Subset> mSkinnedSubsets;
 	std::vector<M3DLoader::MaterialInfo> mSkinnedMatInfo;
 	std::vector<std::string> mSkinnedTexNames;
 	UINT mSkinnedTexHeapIndexStart = 0;
 	SkinnedData mSkinnedData;
-	std::unique_ptr<SkinnedController> mSkinnedController;
+	std::vector<std::unique_ptr<SkinnedController>> mSkinnedControllers;
+
+	// The soldier is spawned SoldierRows x SoldierColumns times, SoldierSpacing
+	// apart, each with its own controller and SkinnedCB slot.  Instance i starts
+	// (i % SoldierPhases) / SoldierPhases of the clip in, so the crowd is out of
+	// step but still shares poses in the cache.
+	static constexpr UINT SoldierRows = 8;
+	static constexpr UINT SoldierColumns = 8;
+	static constexpr UINT SoldierPhases = 4;
+	static constexpr float SoldierSpacing = 2.5f;
+
+	// Evaluates every skinned controller in parallel into its SkinnedCB slot.
+	AnimationBatch mAnimationBatch;
+
+	// Shared by all controllers so crowds playing the same clip in step
+	// evaluate each pose once.
+	PoseCache mPoseCache{ 256 };
+
+	std::unique_ptr<JobSystem> mJobSystem;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
 	std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3DBlob>> mShaders;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
+
+	// mMaterials by bufferIndex, and the ones whose buffer data changed.
+	std::vector<Material*> mMaterialByIndex;
+	DirtyTracker mMaterialDirty;
 	
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// All the render items, one array per component.
+	RenderItemStore mRenderItems;
+
+	// Indices of the render items divided by PSO, rebuilt when the layout
+	// of mRenderItems changes.
+	std::vector<UINT> mRitemLayer[(int)RenderLayer::Count];
+	UINT64 mDrawListLayoutVersion = 0;
+
+	// World bounds of the rigid render items that have a Submesh, in a BVH
+	// queried with the camera frustum; BVH item i is render item
+	// mCullItems[i].  Skinned items are animated away from the bind pose
+	// bounds of their Submesh, so they are never culled, like the items
+	// without a Submesh.
+	std::vector<UINT> mCullItems;
+	std::vector<UINT> mUnculledItems;
+	SceneBvh mSceneBvh;
+	std::vector<UINT> mVisibleBvhItems;
+	SceneBvhStats mSceneBvhStats;
+
+	// Camera version the visible lists below were built for.
+	UINT64 mCulledCameraVersion = 0;
 
-	// Render items divided by PSO.
-	std::vector<RenderItem *> mRitemLayer[(int)RenderLayer::Count];
+	// Render items of each layer inside the camera frustum this frame.
+	std::vector<UINT> mVisibleRitemLayer[(int)RenderLayer::Count];
+
+	// The opaque items of the main and shadow passes grouped into instanced
+	// draws, and where the shadow pass instances start in the instance buffer.
+	InstanceBatcher mOpaqueBatcher;
+	InstanceBatcher mShadowBatcher;
+	UINT mShadowFirstInstance = 0;
+	UINT64 mInstanceIndexVersion = 0;
+
+	// The items drawn one by one in the main and shadow passes, sorted by
+	// state, and the state changes made drawing them last frame.  The jobs
+	// recording draws add their counts under the mutex.
+	DrawPacketList mMainPackets;
+	DrawPacketList mShadowPackets;
+	DrawStateStats mDrawStats;
+	std::mutex mDrawStatsMutex;
+
+	// The command lists of the frame being drawn, in submission order.
+	ParallelRecording mRecording;
+
+	// Records the command lists on the job system; off records them one
+	// after another on the calling thread.
+	bool mRecordInParallel = true;
 
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mSkinnedInputLayout;
@@ -127,6 +269,12 @@ private:
 
 	std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D12PipelineState>> mPSOs;
 
+	// Pipeline state of each layer in each pass, picked by the PSO field of a
+	// draw key.  Null for layers a pass does not draw.
+	ID3D12PipelineState* mMainPassPsos[(int)RenderLayer::Count] = {};
+	ID3D12PipelineState* mNormalsPassPsos[(int)RenderLayer::Count] = {};
+	ID3D12PipelineState* mShadowPassPsos[(int)RenderLayer::Count] = {};
+
 	float mLightRotationAngle = 0.0f;
 	DirectX::XMFLOAT3 mBaseLightDirections[3] = {
 		DirectX::XMFLOAT3(0.57735f, -0.57735f, 0.57735f),
@@ -0,0 +1,83 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+
+// The hierarchy pass of SkinnedData::ConcatenateHierarchyLanes for one lane
+// width.  Lanes supplies the vector type of Lanes::Count floats and its
+// operations.  skinned_data.cpp instantiates it for SSE and
+// skinned_data_avx2.cpp for AVX2, each with a Lanes type of its own in an
+// anonymous namespace, so the two instantiations never merge at link time.
+//
+// src[j] holds the local transforms of lane j and its palette is written to
+// dst[j]; toRootLanes holds boneCount * 16 * Lanes::Count floats.
+template<class Lanes>
+void ConcatenateLanes(const DirectX::XMFLOAT4X4* const* src, DirectX::XMFLOAT4X4* const* dst,
+	const int* boneHierarchy, const DirectX::XMFLOAT4X4* boneOffsets, UINT boneCount, float* toRootLanes)
+{
+	typedef typename Lanes::Vector LaneVector;
+	const UINT laneMatrixFloats = 16 * Lanes::Count;
+
+	// Parents come before their children, so one pass in bone order computes
+	// both the root space transform and the final transform of each bone.
+	for (UINT i = 0; i < boneCount; ++i)
+	{
+		LaneVector toParent[16];
+		Lanes::GatherMatrix(src, i, toParent);
+
+		LaneVector toRoot[16];
+		if (i == 0)
+		{
+			for (UINT e = 0; e < 16; ++e)
+				toRoot[e] = toParent[e];
+		}
+		else
+		{
+			const float* parentLanes = &toRootLanes[boneHierarchy[i] * laneMatrixFloats];
+
+			LaneVector parentToRoot[16];
+			for (UINT e = 0; e < 16; ++e)
+				parentToRoot[e] = Lanes::Load(parentLanes + e * Lanes::Count);
+
+			// Products are summed in the same order as XMMatrixMultiply.
+			for (UINT r = 0; r < 4; ++r)
+			{
+				for (UINT c = 0; c < 4; ++c)
+				{
+					LaneVector xz = Lanes::Add(Lanes::Mul(toParent[r * 4 + 0], parentToRoot[c]),
+						Lanes::Mul(toParent[r * 4 + 2], parentToRoot[8 + c]));
+					LaneVector yw = Lanes::Add(Lanes::Mul(toParent[r * 4 + 1], parentToRoot[4 + c]),
+						Lanes::Mul(toParent[r * 4 + 3], parentToRoot[12 + c]));
+					toRoot[r * 4 + c] = Lanes::Add(xz, yw);
+				}
+			}
+		}
+
+		float* boneLanes = &toRootLanes[i * laneMatrixFloats];
+		for (UINT e = 0; e < 16; ++e)
+			Lanes::Store(boneLanes + e * Lanes::Count, toRoot[e]);
+
+		// The bone offset is the same for every lane.
+		const DirectX::XMFLOAT4X4& offset = boneOffsets[i];
+		LaneVector finalTransform[16];
+		for (UINT r = 0; r < 4; ++r)
+		{
+			LaneVector x = Lanes::Splat(offset.m[r][0]);
+			LaneVector y = Lanes::Splat(offset.m[r][1]);
+			LaneVector z = Lanes::Splat(offset.m[r][2]);
+			LaneVector w = Lanes::Splat(offset.m[r][3]);
+			for (UINT c = 0; c < 4; ++c)
+			{
+				LaneVector xz = Lanes::Add(Lanes::Mul(x, toRoot[c]), Lanes::Mul(z, toRoot[8 + c]));
+				LaneVector yw = Lanes::Add(Lanes::Mul(y, toRoot[4 + c]), Lanes::Mul(w, toRoot[12 + c]));
+				finalTransform[r * 4 + c] = Lanes::Add(xz, yw);
+			}
+		}
+
+		Lanes::ScatterTransposed(finalTransform, dst, i);
+	}
+}
+
+// The AVX2 instantiation for 8 lanes, in skinned_data_avx2.cpp.  Only call it
+// when CpuHasAvx2() is true.
+void ConcatenateLanesAvx2(const DirectX::XMFLOAT4X4* const* src, DirectX::XMFLOAT4X4* const* dst,
+	const int* boneHierarchy, const DirectX::XMFLOAT4X4* boneOffsets, UINT boneCount, float* toRootLanes);
@@ -0,0 +1,137 @@
+#include "skinned_controller.h"
+#include <cstring>
+
+using namespace DirectX;
+
+void SkinnedController::UpdateAnimation(float dt)
+{
+	FinalTransforms.resize(Data->BoneCount());
+	UpdateAnimation(dt, FinalTransforms.data());
+}
+
+void SkinnedController::UpdateAnimation(float dt, XMFLOAT4X4* finalTransforms)
+{
+	AdvanceTime(dt);
+
+	const AnimationClip* clip = Data->FindClip(ClipName);
+
+	// Compute the final transforms for this time position.
+	if (mFadeFromClip == nullptr && Layers.empty())
+	{
+		if (Cache != nullptr)
+			Cache->GetFinalTransforms(*Data, *clip, TimePos, Workspace, finalTransforms);
+		else
+			Data->GetFinalTransforms(*clip, TimePos, Workspace, finalTransforms);
+		return;
+	}
+
+	mEvalLayers.clear();
+
+	AnimationLayer layer;
+	if (mFadeFromClip != nullptr)
+	{
+		layer.Clip = mFadeFromClip;
+		layer.TimePos = mFadeFromTimePos;
+		mEvalLayers.push_back(layer);
+
+		layer.Clip = clip;
+		layer.TimePos = TimePos;
+		layer.Weight = mFadeElapsed / mFadeDuration;
+		mEvalLayers.push_back(layer);
+	}
+	else
+	{
+		layer.Clip = clip;
+		layer.TimePos = TimePos;
+		mEvalLayers.push_back(layer);
+	}
+
+	mEvalLayers.insert(mEvalLayers.end(), Layers.begin(), Layers.end());
+
+	Data->GetFinalTransforms(mEvalLayers.data(), (UINT)mEvalLayers.size(), Workspace, finalTransforms);
+}
+
+bool SkinnedController::BeginUpdate(float dt, XMFLOAT4X4* finalTransforms)
+{
+	if (mFadeFromClip != nullptr || !Layers.empty())
+	{
+		UpdateAnimation(dt, finalTransforms);
+		return false;
+	}
+
+	AdvanceTime(dt);
+
+	const AnimationClip* clip = Data->FindClip(ClipName);
+	if (Cache != nullptr && Cache->TryGetFinalTransforms(*Data, *clip, TimePos, finalTransforms))
+		return false;
+
+	// Misses are evaluated at the snapped time, as PoseCache does.
+	Workspace.Reserve(Data->BoneCount());
+	clip->Interpolate(Cache != nullptr ? Cache->SnapTime(TimePos) : TimePos, Workspace.ToParentTransforms);
+	return true;
+}
+
+XMFLOAT4X4* SkinnedController::BatchOutput(XMFLOAT4X4* finalTransforms)
+{
+	return Cache != nullptr ? Workspace.FinalTransforms.data() : finalTransforms;
+}
+
+void SkinnedController::EndUpdate(XMFLOAT4X4* finalTransforms)
+{
+	if (Cache == nullptr)
+		return;
+
+	const XMFLOAT4X4* palette = Workspace.FinalTransforms.data();
+	std::memcpy(finalTransforms, palette, Data->BoneCount() * sizeof(XMFLOAT4X4));
+	Cache->Insert(*Data, *Data->FindClip(ClipName), TimePos, palette);
+}
+
+void SkinnedController::CrossFade(const std::string& clipName, float fadeDuration)
+{
+	if (fadeDuration > 0.0f)
+	{
+		mFadeFromClip = Data->FindClip(ClipName);
+		mFadeFromTimePos = TimePos;
+		mFadeDuration = fadeDuration;
+		mFadeElapsed = 0.0f;
+	}
+	else
+	{
+		mFadeFromClip = nullptr;
+	}
+
+	ClipName = clipName;
+	TimePos = 0.0f;
+}
+
+void SkinnedController::AdvanceTime(float dt)
+{
+	TimePos += dt;
+
+	// Loop animation
+	if (TimePos > Data->GetClipEndTime(ClipName))
+		TimePos = 0.0f;
+
+	if (mFadeFromClip != nullptr)
+	{
+		mFadeElapsed += dt;
+		if (mFadeElapsed >= mFadeDuration)
+		{
+			mFadeFromClip = nullptr;
+		}
+		else
+		{
+			// Keep the outgoing clip playing while it fades.
+			mFadeFromTimePos += dt;
+			if (mFadeFromTimePos > mFadeFromClip->GetClipEndTime())
+				mFadeFromTimePos = 0.0f;
+		}
+	}
+
+	for (auto& layer : Layers)
+	{
+		layer.TimePos += dt;
+		if (layer.TimePos > layer.Clip->GetClipEndTime())
+			layer.TimePos = 0.0f;
+	}
+}
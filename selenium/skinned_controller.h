@@ -1,5 +1,6 @@
 #pragma once
 #include "skinned_data.h"
+#include "pose_cache.h"
 #include <DirectXMath.h>
 
 struct SkinnedController
@@ -9,19 +10,59 @@ struct SkinnedController
 	std::string ClipName;
 	float TimePos = 0.0f;
 
+	// Reused every frame so animating does not allocate.
+	PoseWorkspace Workspace;
+
+	// Optional cache shared with other controllers.  Only single clip
+	// playback goes through it; layered and cross-faded poses are unique to
+	// the controller and always evaluated directly.
+	PoseCache* Cache = nullptr;
+
+	// Extra layers evaluated on top of the current clip, such as an upper body
+	// override or an additive lean.  Each layer's TimePos is advanced and
+	// looped on its own clip every update.
+	std::vector<AnimationLayer> Layers;
+
 	// Called every frame and increments the time position, interpolates the 
     // animations for each bone based on the current animation clip, and 
     // generates the final transforms which are ultimately set for 
 	// processing in the vertex shader.
-	void UpdateAnimation(float dt)
-	{
-		TimePos += dt;
+	void UpdateAnimation(float dt);
+
+	// Same as above, but writes the final transforms straight to
+	// finalTransforms, which must have room for Data->BoneCount() matrices.
+	void UpdateAnimation(float dt, DirectX::XMFLOAT4X4* finalTransforms);
+
+	// First half of UpdateAnimation for batched evaluation.  Advances time and,
+	// if the pose is a plain clip sample that Cache does not already hold,
+	// interpolates it into Workspace.ToParentTransforms and returns true; the
+	// caller then runs SkinnedData::ConcatenateHierarchyLanes into
+	// BatchOutput(finalTransforms) and calls EndUpdate.  Otherwise (cache hits,
+	// layered or cross-faded poses) writes finalTransforms directly and
+	// returns false.
+	bool BeginUpdate(float dt, DirectX::XMFLOAT4X4* finalTransforms);
+
+	// Where the hierarchy pass of a pose begun by BeginUpdate writes its
+	// palette: finalTransforms, or Workspace.FinalTransforms for a pose that
+	// also goes into Cache, so the cache never reads back finalTransforms.
+	DirectX::XMFLOAT4X4* BatchOutput(DirectX::XMFLOAT4X4* finalTransforms);
+
+	// Finishes a pose begun by BeginUpdate after the hierarchy pass.
+	void EndUpdate(DirectX::XMFLOAT4X4* finalTransforms);
+
+	// Switches to clipName, blending from the current clip over fadeDuration
+	// seconds.  The new clip starts at time zero.
+	void CrossFade(const std::string& clipName, float fadeDuration);
+
+	void AdvanceTime(float dt);
 
-		// Loop animation
-		if (TimePos > Data->GetClipEndTime(ClipName))
-			TimePos = 0.0f;
+private:
+	// The clip being faded out, if a cross-fade is in progress.
+	const AnimationClip* mFadeFromClip = nullptr;
+	float mFadeFromTimePos = 0.0f;
+	float mFadeDuration = 0.0f;
+	float mFadeElapsed = 0.0f;
 
-		// Compute the final transforms for this time position.
-		Data->GetFinalTransforms(ClipName, TimePos, FinalTransforms);
-	}
+	// Layer list handed to SkinnedData, rebuilt in place every update.
+	std::vector<AnimationLayer> mEvalLayers;
 };
@@ -1,9 +1,69 @@
 #include "skinned_data.h"
+#include "cpu_features.h"
 #include "math_helper.h"
+#include "skeleton_lanes.h"
 #include <DirectXMath.h>
+#include <immintrin.h>
 
 using namespace DirectX;
 
+namespace
+{
+	// Loads one row of a bone matrix from 4 instances and transposes it so
+	// out[c] holds element (row, c) of every instance.
+	inline void GatherRow4(const XMFLOAT4X4* const* m, UINT bone, UINT row, __m128 out[4])
+	{
+		__m128 a = _mm_loadu_ps(&m[0][bone].m[row][0]);
+		__m128 b = _mm_loadu_ps(&m[1][bone].m[row][0]);
+		__m128 c = _mm_loadu_ps(&m[2][bone].m[row][0]);
+		__m128 d = _mm_loadu_ps(&m[3][bone].m[row][0]);
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		out[0] = a;
+		out[1] = b;
+		out[2] = c;
+		out[3] = d;
+	}
+
+	// Inverse of GatherRow4: a, b, c, d hold one element of 4 instances each
+	// and become row `row` of each instance's matrix.
+	inline void ScatterRow4(__m128 a, __m128 b, __m128 c, __m128 d, XMFLOAT4X4* const* m, UINT bone, UINT row)
+	{
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps(&m[0][bone].m[row][0], a);
+		_mm_storeu_ps(&m[1][bone].m[row][0], b);
+		_mm_storeu_ps(&m[2][bone].m[row][0], c);
+		_mm_storeu_ps(&m[3][bone].m[row][0], d);
+	}
+
+	// Four skeleton instances, one per float of an SSE register.  Used when
+	// the CPU has no AVX2.
+	struct SseLanes
+	{
+		typedef __m128 Vector;
+		static const UINT Count = 4;
+
+		static Vector Load(const float* p) { return _mm_loadu_ps(p); }
+		static void Store(float* p, Vector v) { _mm_storeu_ps(p, v); }
+		static Vector Splat(float f) { return _mm_set1_ps(f); }
+		static Vector Add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+
+		// Element (r, c) of the bone matrix of every lane goes to out[r * 4 + c].
+		static void GatherMatrix(const XMFLOAT4X4* const* m, UINT bone, Vector out[16])
+		{
+			for (UINT r = 0; r < 4; ++r)
+				GatherRow4(m, bone, r, &out[r * 4]);
+		}
+
+		// Writes the transpose of the lane matrix v to the bone of every lane.
+		static void ScatterTransposed(const Vector v[16], XMFLOAT4X4* const* m, UINT bone)
+		{
+			for (UINT c = 0; c < 4; ++c)
+				ScatterRow4(v[c], v[4 + c], v[8 + c], v[12 + c], m, bone, c);
+		}
+	};
+}
+
 Keyframe::Keyframe()
 	: TimePos(0.0f),
 	Translation(0.0f, 0.0f, 0.0f),
@@ -72,6 +132,10 @@ void BoneAnimation::Interpolate(float timePos, XMFLOAT4X4& toParentTransform)con
 
 float AnimationClip::GetClipEndTime()const
 {
+	// The end time is cached when the clip is compiled.
+	if (IsCompiled())
+		return mEndTime;
+
 	// Find largest end time over all bones in this clip.
 	float t = 0.0f;
 	for (UINT i = 0; i < BoneAnimations.size(); ++i)
@@ -84,9 +148,194 @@ float AnimationClip::GetClipEndTime()const
 
 void AnimationClip::Interpolate(float timePos, std::vector<XMFLOAT4X4>& toParentTransforms)const
 {
+	if (!IsCompiled())
+	{
+		for (UINT i = 0; i < BoneAnimations.size(); ++i)
+		{
+			BoneAnimations[i].Interpolate(timePos, toParentTransforms[i]);
+		}
+		return;
+	}
+
+	XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	for (UINT i = 0; i < BoneCount(); ++i)
+	{
+		XMVECTOR S, Q, P;
+		SampleBone(i, timePos, S, Q, P);
+		XMStoreFloat4x4(&toParentTransforms[i], XMMatrixAffineTransformation(S, zero, Q, P));
+	}
+}
+
+void AnimationClip::Interpolate(float timePos, LocalPose& pose)const
+{
+	UINT numBones = BoneCount();
+	pose.Resize(numBones);
+
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		XMVECTOR S, Q, P;
+		SampleBone(i, timePos, S, Q, P);
+		XMStoreFloat4A(&pose.Scales[i], S);
+		XMStoreFloat4A(&pose.Rotations[i], Q);
+		XMStoreFloat4A(&pose.Translations[i], P);
+	}
+}
+
+void AnimationClip::Compile()
+{
+	UINT totalKeys = 0;
+	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+		totalKeys += (UINT)BoneAnimations[i].Keyframes.size();
+
+	mTracks.resize(BoneAnimations.size());
+	mKeyTimes.resize(totalKeys);
+	mKeyTranslations.resize(totalKeys);
+	mKeyScales.resize(totalKeys);
+	mKeyRotations.resize(totalKeys);
+
+	// One bucket per key keeps the table small while still giving an
+	// expected O(1) step count for roughly uniformly spaced keys.
+	mBucketKeys.resize(totalKeys);
+
+	mEndTime = 0.0f;
+
+	UINT key = 0;
 	for (UINT i = 0; i < BoneAnimations.size(); ++i)
 	{
-		BoneAnimations[i].Interpolate(timePos, toParentTransforms[i]);
+		const std::vector<Keyframe>& keyframes = BoneAnimations[i].Keyframes;
+		BoneTrack& track = mTracks[i];
+
+		track.FirstKey = key;
+		track.KeyCount = (UINT)keyframes.size();
+		track.FirstBucket = key;
+		track.BucketCount = track.KeyCount;
+		track.StartTime = keyframes.empty() ? 0.0f : keyframes.front().TimePos;
+		track.EndTime = keyframes.empty() ? 0.0f : keyframes.back().TimePos;
+
+		float duration = track.EndTime - track.StartTime;
+		track.BucketsPerSecond = duration > 0.0f ? track.BucketCount / duration : 0.0f;
+
+		for (UINT k = 0; k < track.KeyCount; ++k)
+		{
+			const Keyframe& kf = keyframes[k];
+			mKeyTimes[key + k] = kf.TimePos;
+			mKeyTranslations[key + k] = XMFLOAT4A(kf.Translation.x, kf.Translation.y, kf.Translation.z, 0.0f);
+			mKeyScales[key + k] = XMFLOAT4A(kf.Scale.x, kf.Scale.y, kf.Scale.z, 0.0f);
+			mKeyRotations[key + k] = XMFLOAT4A(kf.RotationQuat.x, kf.RotationQuat.y, kf.RotationQuat.z, kf.RotationQuat.w);
+		}
+
+		// For each bucket record the last key starting at or before the bucket
+		// start.  Never point at the last key so a sample always has a next key.
+		UINT k = 0;
+		for (UINT b = 0; b < track.BucketCount; ++b)
+		{
+			float bucketStart = track.StartTime + b / MathHelper::Max(track.BucketsPerSecond, 1e-6f);
+			while (k + 2 < track.KeyCount && mKeyTimes[key + k + 1] <= bucketStart)
+				++k;
+			mBucketKeys[track.FirstBucket + b] = k;
+		}
+
+		mEndTime = MathHelper::Max(mEndTime, track.EndTime);
+		key += track.KeyCount;
+	}
+}
+
+bool AnimationClip::IsCompiled()const
+{
+	return IsCompressed() || (!BoneAnimations.empty() && mTracks.size() == BoneAnimations.size());
+}
+
+UINT AnimationClip::BoneCount()const
+{
+	return IsCompressed() ? (UINT)mChannels.size() / 3 : (UINT)mTracks.size();
+}
+
+void AnimationClip::SampleBone(UINT boneIndex, float timePos, XMVECTOR& S, XMVECTOR& Q, XMVECTOR& P)const
+{
+	if (IsCompressed())
+		SampleBoneCompressed(boneIndex, timePos, S, Q, P);
+	else
+		SampleBoneTracks(boneIndex, timePos, S, Q, P);
+}
+
+void AnimationClip::SampleBoneTracks(UINT boneIndex, float timePos, XMVECTOR& S, XMVECTOR& Q, XMVECTOR& P)const
+{
+	const BoneTrack& track = mTracks[boneIndex];
+	const UINT first = track.FirstKey;
+
+	// A bone without keys stays at its bind pose.
+	if (track.KeyCount == 0)
+	{
+		S = XMVectorSplatOne();
+		Q = XMQuaternionIdentity();
+		P = XMVectorZero();
+		return;
+	}
+
+	if (track.KeyCount < 2 || timePos <= track.StartTime)
+	{
+		S = XMLoadFloat4A(&mKeyScales[first]);
+		P = XMLoadFloat4A(&mKeyTranslations[first]);
+		Q = XMLoadFloat4A(&mKeyRotations[first]);
+		return;
+	}
+
+	if (timePos >= track.EndTime)
+	{
+		const UINT last = first + track.KeyCount - 1;
+		S = XMLoadFloat4A(&mKeyScales[last]);
+		P = XMLoadFloat4A(&mKeyTranslations[last]);
+		Q = XMLoadFloat4A(&mKeyRotations[last]);
+		return;
+	}
+
+	UINT bucket = (UINT)((timePos - track.StartTime) * track.BucketsPerSecond);
+	if (bucket >= track.BucketCount)
+		bucket = track.BucketCount - 1;
+
+	// timePos < EndTime, so this stops before running off the track.
+	UINT k = first + mBucketKeys[track.FirstBucket + bucket];
+	while (mKeyTimes[k + 1] < timePos)
+		++k;
+
+	float lerpPercent = (timePos - mKeyTimes[k]) / (mKeyTimes[k + 1] - mKeyTimes[k]);
+
+	S = XMVectorLerp(XMLoadFloat4A(&mKeyScales[k]), XMLoadFloat4A(&mKeyScales[k + 1]), lerpPercent);
+	P = XMVectorLerp(XMLoadFloat4A(&mKeyTranslations[k]), XMLoadFloat4A(&mKeyTranslations[k + 1]), lerpPercent);
+	Q = XMQuaternionSlerp(XMLoadFloat4A(&mKeyRotations[k]), XMLoadFloat4A(&mKeyRotations[k + 1]), lerpPercent);
+}
+
+void AnimationClip::SampleBoneAdditive(UINT boneIndex, float timePos, XMVECTOR& S, XMVECTOR& Q, XMVECTOR& P)const
+{
+	SampleBone(boneIndex, timePos, S, Q, P);
+
+	// The first key is the reference pose the offsets are taken from.
+	XMVECTOR refS, refQ, refP;
+	if (IsCompressed())
+	{
+		SampleBoneCompressed(boneIndex, 0.0f, refS, refQ, refP);
+	}
+	else
+	{
+		const UINT first = mTracks[boneIndex].FirstKey;
+		refS = XMLoadFloat4A(&mKeyScales[first]);
+		refQ = XMLoadFloat4A(&mKeyRotations[first]);
+		refP = XMLoadFloat4A(&mKeyTranslations[first]);
+	}
+
+	// sample = ref * delta, so delta = ref^-1 * sample.
+	S = XMVectorDivide(S, refS);
+	Q = XMQuaternionMultiply(Q, XMQuaternionConjugate(refQ));
+	P = XMVectorSubtract(P, refP);
+}
+
+void LocalPose::Resize(UINT boneCount)
+{
+	if (Scales.size() < boneCount)
+	{
+		Scales.resize(boneCount);
+		Rotations.resize(boneCount);
+		Translations.resize(boneCount);
 	}
 }
 
@@ -97,6 +346,11 @@ void SkinnedData::Set(std::vector<int>& boneHierarchy,
 	mBoneHierarchy = boneHierarchy;
 	mBoneOffsets = boneOffsets;
 	mAnimationClips = animationClips;
+
+	// Build the SoA sampling tracks once up front instead of searching the
+	// keyframe lists every frame.
+	for (auto& clip : mAnimationClips)
+		clip.second.Compile();
 }
 
 UINT SkinnedData::BoneCount()const
@@ -110,21 +364,139 @@ float SkinnedData::GetClipEndTime(const std::string& clipName)const
 	return clip->second.GetClipEndTime();
 }
 
+const AnimationClip* SkinnedData::FindClip(const std::string& clipName)const
+{
+	auto clip = mAnimationClips.find(clipName);
+	return clip != mAnimationClips.end() ? &clip->second : nullptr;
+}
+
+void PoseWorkspace::Reserve(UINT boneCount)
+{
+	// Only ever grow, so switching between skeletons does not reallocate.
+	if (ToParentTransforms.size() < boneCount)
+		ToParentTransforms.resize(boneCount);
+	if (ToRootTransforms.size() < boneCount)
+		ToRootTransforms.resize(boneCount);
+	if (FinalTransforms.size() < boneCount)
+		FinalTransforms.resize(boneCount);
+	Pose.Resize(boneCount);
+}
+
 void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos, std::vector<XMFLOAT4X4>& finalTransforms)const
+{
+	thread_local PoseWorkspace workspace;
+	GetFinalTransforms(clipName, timePos, workspace, finalTransforms);
+}
+
+void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,
+	PoseWorkspace& workspace, std::vector<XMFLOAT4X4>& finalTransforms)const
+{
+	auto clip = mAnimationClips.find(clipName);
+	GetFinalTransforms(clip->second, timePos, workspace, finalTransforms.data());
+}
+
+void SkinnedData::GetFinalTransforms(const AnimationClip& clip, float timePos,
+	PoseWorkspace& workspace, XMFLOAT4X4* finalTransforms)const
 {
 	UINT numBones = static_cast<UINT>(mBoneOffsets.size());
 
-	std::vector<XMFLOAT4X4> toParentTransforms(numBones);
+	workspace.Reserve(numBones);
+	std::vector<XMFLOAT4X4>& toParentTransforms = workspace.ToParentTransforms;
 
 	// Interpolate all the bones of this clip at the given time instance.
-	auto clip = mAnimationClips.find(clipName);
-	clip->second.Interpolate(timePos, toParentTransforms);
+	clip.Interpolate(timePos, toParentTransforms);
+
+	ConcatenateHierarchy(workspace, finalTransforms);
+}
+
+void SkinnedData::GetFinalTransforms(const AnimationLayer* layers, UINT layerCount,
+	PoseWorkspace& workspace, XMFLOAT4X4* finalTransforms)const
+{
+	UINT numBones = static_cast<UINT>(mBoneOffsets.size());
+
+	workspace.Reserve(numBones);
+	LocalPose& pose = workspace.Pose;
+
+	// The base layer provides the starting pose.
+	layers[0].Clip->Interpolate(layers[0].TimePos, pose);
+
+	for (UINT l = 1; l < layerCount; ++l)
+	{
+		const AnimationLayer& layer = layers[l];
+		if (layer.Weight <= 0.0f)
+			continue;
+
+		for (UINT i = 0; i < numBones; ++i)
+		{
+			float w = layer.Mask != nullptr ? layer.Weight * (*layer.Mask)[i] : layer.Weight;
+
+			// Masked out bones are not even sampled.
+			if (w <= 0.0f)
+				continue;
+
+			XMVECTOR s0 = XMLoadFloat4A(&pose.Scales[i]);
+			XMVECTOR q0 = XMLoadFloat4A(&pose.Rotations[i]);
+			XMVECTOR p0 = XMLoadFloat4A(&pose.Translations[i]);
+
+			XMVECTOR s1, q1, p1;
+			if (layer.BlendMode == AnimationBlendMode::Additive)
+			{
+				layer.Clip->SampleBoneAdditive(i, layer.TimePos, s1, q1, p1);
+
+				// Scale the offset by the weight, then apply it on top.
+				XMVECTOR one = XMVectorSplatOne();
+				s1 = XMVectorLerp(one, s1, w);
+				q1 = XMQuaternionSlerp(XMQuaternionIdentity(), q1, w);
+				p1 = XMVectorScale(p1, w);
+
+				s0 = XMVectorMultiply(s0, s1);
+				q0 = XMQuaternionMultiply(q1, q0);
+				p0 = XMVectorAdd(p0, p1);
+			}
+			else
+			{
+				layer.Clip->SampleBone(i, layer.TimePos, s1, q1, p1);
+
+				// Normalized lerp along the shorter arc; close enough to slerp
+				// for blending and much cheaper.
+				if (XMVectorGetX(XMQuaternionDot(q0, q1)) < 0.0f)
+					q1 = XMVectorNegate(q1);
+
+				s0 = XMVectorLerp(s0, s1, w);
+				q0 = XMQuaternionNormalize(XMVectorLerp(q0, q1, w));
+				p0 = XMVectorLerp(p0, p1, w);
+			}
+
+			XMStoreFloat4A(&pose.Scales[i], s0);
+			XMStoreFloat4A(&pose.Rotations[i], q0);
+			XMStoreFloat4A(&pose.Translations[i], p0);
+		}
+	}
+
+	// Only now build one matrix per bone.
+	XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		XMVECTOR S = XMLoadFloat4A(&pose.Scales[i]);
+		XMVECTOR Q = XMLoadFloat4A(&pose.Rotations[i]);
+		XMVECTOR P = XMLoadFloat4A(&pose.Translations[i]);
+		XMStoreFloat4x4(&workspace.ToParentTransforms[i], XMMatrixAffineTransformation(S, zero, Q, P));
+	}
+
+	ConcatenateHierarchy(workspace, finalTransforms);
+}
+
+void SkinnedData::ConcatenateHierarchy(PoseWorkspace& workspace, XMFLOAT4X4* finalTransforms)const
+{
+	UINT numBones = static_cast<UINT>(mBoneOffsets.size());
+
+	std::vector<XMFLOAT4X4>& toParentTransforms = workspace.ToParentTransforms;
 
 	//
 	// Traverse the hierarchy and transform all the bones to the root space.
 	//
 
-	std::vector<XMFLOAT4X4> toRootTransforms(numBones);
+	std::vector<XMFLOAT4X4>& toRootTransforms = workspace.ToRootTransforms;
 
 	toRootTransforms[0] = toParentTransforms[0];
 
@@ -148,4 +520,43 @@ void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,
 		XMMATRIX finalTransform = XMMatrixMultiply(offset, toRoot);
 		XMStoreFloat4x4(&finalTransforms[i], XMMatrixTranspose(finalTransform));
 	}
+}
+
+void SkeletonLaneWorkspace::Reserve(UINT boneCount)
+{
+	if (ToRootLanes.size() < boneCount * 16 * SkeletonLaneCount)
+		ToRootLanes.resize(boneCount * 16 * SkeletonLaneCount);
+	if (Discard.size() < boneCount)
+		Discard.resize(boneCount);
+}
+
+void SkinnedData::ConcatenateHierarchyLanes(const XMFLOAT4X4* const* toParentTransforms,
+	XMFLOAT4X4* const* finalTransforms, UINT instanceCount, SkeletonLaneWorkspace& workspace)const
+{
+	UINT numBones = static_cast<UINT>(mBoneOffsets.size());
+
+	workspace.Reserve(numBones);
+
+	// Unused lanes repeat the first instance and write to scratch.
+	const XMFLOAT4X4* src[SkeletonLaneCount];
+	XMFLOAT4X4* dst[SkeletonLaneCount];
+	for (UINT j = 0; j < SkeletonLaneCount; ++j)
+	{
+		src[j] = j < instanceCount ? toParentTransforms[j] : toParentTransforms[0];
+		dst[j] = j < instanceCount ? finalTransforms[j] : workspace.Discard.data();
+	}
+
+	if (CpuHasAvx2())
+	{
+		ConcatenateLanesAvx2(src, dst, mBoneHierarchy.data(), mBoneOffsets.data(), numBones,
+			workspace.ToRootLanes.data());
+		return;
+	}
+
+	// Without AVX2 the instances go through the 4-lane kernel in two halves.
+	for (UINT first = 0; first < instanceCount; first += SseLanes::Count)
+	{
+		ConcatenateLanes<SseLanes>(src + first, dst + first, mBoneHierarchy.data(), mBoneOffsets.data(),
+			numBones, workspace.ToRootLanes.data());
+	}
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <vector>
 #include <unordered_map>
 #include <DirectXMath.h>
+#include "animation_compression.h"
 
 // A Keyframe defines the bone transformation at an instant in time.
 struct Keyframe
@@ -29,6 +30,33 @@ struct BoneAnimation
 	std::vector<Keyframe> Keyframes;
 };
 
+// A BoneTrack locates the keys of one bone inside the SoA key arrays of a
+// compiled AnimationClip.  The time range of the track is split into
+// uniformly sized buckets and each bucket remembers the last key that starts
+// at or before it, so finding the pair of keys bounding a time is a table
+// lookup plus a step or two forward instead of a scan from the first key.
+struct BoneTrack
+{
+	UINT FirstKey = 0;
+	UINT KeyCount = 0;
+	UINT FirstBucket = 0;
+	UINT BucketCount = 0;
+	float StartTime = 0.0f;
+	float EndTime = 0.0f;
+	float BucketsPerSecond = 0.0f;
+};
+
+// Local (to-parent) scale, rotation quaternion and translation of every bone,
+// before they are combined into matrices.  Poses are blended in this form.
+struct LocalPose
+{
+	void Resize(UINT boneCount);
+
+	std::vector<DirectX::XMFLOAT4A> Scales;
+	std::vector<DirectX::XMFLOAT4A> Rotations;
+	std::vector<DirectX::XMFLOAT4A> Translations;
+};
+
 // Examples of AnimationClips are "Walk", "Run", "Attack", "Defend".
 // An AnimationClip requires a BoneAnimation for every bone to form
 // the animation clip.    
@@ -36,8 +64,129 @@ struct AnimationClip
 {
 	float GetClipEndTime()const;
 	void Interpolate(float timePos, std::vector<DirectX::XMFLOAT4X4>& toParentTransforms)const;
+	void Interpolate(float timePos, LocalPose& pose)const;
+
+	// Packs the keyframes of every BoneAnimation into contiguous per-channel
+	// arrays (time, translation, scale, rotation) and builds the bucket tables
+	// used for constant time key lookup.  Must be called again if
+	// BoneAnimations is modified afterwards.
+	void Compile();
+	bool IsCompiled()const;
+
+	// Replaces the compiled tracks with reduced, quantized keys (see
+	// CompressedChannel) and releases the source keyframes, so BoneAnimations
+	// is empty afterwards and Compile must not be called again.  Sampling
+	// decodes the compressed keys directly.
+	void Compress(const AnimationCompressionSettings& settings, AnimationCompressionStats* stats = nullptr);
+	bool IsCompressed()const;
+
+	UINT BoneCount()const;
+
+	// Samples the local scale, rotation quaternion and translation of a bone
+	// from the compiled tracks.
+	void SampleBone(UINT boneIndex, float timePos,
+		DirectX::XMVECTOR& S, DirectX::XMVECTOR& Q, DirectX::XMVECTOR& P)const;
+
+	// Samples a bone relative to its first key, for additive blending.
+	void SampleBoneAdditive(UINT boneIndex, float timePos,
+		DirectX::XMVECTOR& S, DirectX::XMVECTOR& Q, DirectX::XMVECTOR& P)const;
 
 	std::vector<BoneAnimation> BoneAnimations;
+
+private:
+	void SampleBoneTracks(UINT boneIndex, float timePos,
+		DirectX::XMVECTOR& S, DirectX::XMVECTOR& Q, DirectX::XMVECTOR& P)const;
+	void SampleBoneCompressed(UINT boneIndex, float timePos,
+		DirectX::XMVECTOR& S, DirectX::XMVECTOR& Q, DirectX::XMVECTOR& P)const;
+	DirectX::XMVECTOR SampleChannel(const CompressedChannel& channel, bool rotation, float keyTime)const;
+
+private:
+	std::vector<BoneTrack> mTracks;
+
+	// Keys of all bones, SoA.  The w components of translation and scale
+	// are padding so each key can be fetched with one aligned load.
+	std::vector<float> mKeyTimes;
+	std::vector<DirectX::XMFLOAT4A> mKeyTranslations;
+	std::vector<DirectX::XMFLOAT4A> mKeyScales;
+	std::vector<DirectX::XMFLOAT4A> mKeyRotations;
+
+	// Per track bucket -> key index (relative to BoneTrack::FirstKey).
+	std::vector<UINT> mBucketKeys;
+
+	float mEndTime = 0.0f;
+
+	// Compressed form, three channels (translation, scale, rotation) per bone.
+	std::vector<CompressedChannel> mChannels;
+	std::vector<UINT16> mPackedTimes;
+	std::vector<UINT16> mPackedValues;
+
+	// Per channel bucket -> key index (relative to CompressedChannel::FirstKey).
+	std::vector<UINT16> mChannelBucketKeys;
+
+	// Seconds to 16-bit key time.
+	float mKeyTimeScale = 0.0f;
+};
+
+enum class AnimationBlendMode
+{
+	// Blend from the pose below towards this layer by the layer weight.
+	Override,
+
+	// Add the layer's offset from its first key on top of the pose below.
+	Additive
+};
+
+// Per-bone weights in [0, 1] limiting which bones a layer affects, e.g. only
+// the spine and arms for an upper body override.
+typedef std::vector<float> BoneMask;
+
+// One clip in a layered evaluation.  The first layer is the base pose; its
+// weight, blend mode and mask are ignored.
+struct AnimationLayer
+{
+	const AnimationClip* Clip = nullptr;
+	float TimePos = 0.0f;
+	float Weight = 1.0f;
+	AnimationBlendMode BlendMode = AnimationBlendMode::Override;
+
+	// nullptr affects every bone.
+	const BoneMask* Mask = nullptr;
+};
+
+// Scratch storage used while evaluating a pose.  Keep one per thread (or per
+// controller) and pass it back in every frame; once it has grown to the bone
+// count of the largest skeleton it is evaluated with, pose evaluation performs
+// no heap allocations.
+struct PoseWorkspace
+{
+	void Reserve(UINT boneCount);
+
+	std::vector<DirectX::XMFLOAT4X4> ToParentTransforms;
+	std::vector<DirectX::XMFLOAT4X4> ToRootTransforms;
+	LocalPose Pose;
+
+	// A whole palette, for callers that must not evaluate into their output
+	// directly, e.g. because it is write-combined memory.
+	std::vector<DirectX::XMFLOAT4X4> FinalTransforms;
+};
+
+// Number of skeleton instances SkinnedData::ConcatenateHierarchyLanes
+// processes at once: one per lane of an AVX2 register, or two SSE passes of
+// four on CPUs without AVX2.
+const UINT SkeletonLaneCount = 8;
+
+// Scratch storage for SkinnedData::ConcatenateHierarchyLanes.  Grows to the
+// largest skeleton it is used with and is then reused without allocating.
+struct SkeletonLaneWorkspace
+{
+	void Reserve(UINT boneCount);
+
+	// Root space transform of every bone, AoSoA: per bone, 16 matrix
+	// elements of one float per lane each.
+	std::vector<float> ToRootLanes;
+
+	// Output of unused lanes.
+	std::vector<DirectX::XMFLOAT4X4> Discard;
 };
 
 class SkinnedData
@@ -51,12 +200,47 @@ public:
 
 	float GetClipEndTime(const std::string& clipName)const;
 
+	// Compresses every clip, see AnimationClip::Compress.  The stats of all
+	// clips are merged into stats.
+	void CompressClips(const AnimationCompressionSettings& settings, AnimationCompressionStats* stats = nullptr);
+
+	// Returns nullptr if there is no clip with the given name.
+	const AnimationClip* FindClip(const std::string& clipName)const;
+
 	// In a real project, you'd want to cache the result if there was a chance
 	// that you were calling this several times with the same clipName at 
-	// the same timePos.
+	// the same timePos.  PoseCache does this for controllers sharing a clip.
+	//
+	// This overload uses a thread local workspace.
 	void GetFinalTransforms(const std::string& clipName, float timePos,
 		std::vector<DirectX::XMFLOAT4X4>& finalTransforms)const;
 
+	// Allocation free versions.  finalTransforms must hold BoneCount() matrices.
+	void GetFinalTransforms(const std::string& clipName, float timePos,
+		PoseWorkspace& workspace, std::vector<DirectX::XMFLOAT4X4>& finalTransforms)const;
+	void GetFinalTransforms(const AnimationClip& clip, float timePos,
+		PoseWorkspace& workspace, DirectX::XMFLOAT4X4* finalTransforms)const;
+
+	// Blends the layers in order in local TRS space and builds one matrix per
+	// bone from the result, so the cost is about one clip evaluation plus the
+	// blends rather than one full palette per layer.
+	void GetFinalTransforms(const AnimationLayer* layers, UINT layerCount,
+		PoseWorkspace& workspace, DirectX::XMFLOAT4X4* finalTransforms)const;
+
+	// Same as the hierarchy pass of GetFinalTransforms, but for up to
+	// SkeletonLaneCount instances of this skeleton at once with each instance
+	// in its own SIMD lane.  toParentTransforms[j] holds the local transforms
+	// of instance j (e.g. PoseWorkspace::ToParentTransforms after
+	// AnimationClip::Interpolate) and its palette is written to
+	// finalTransforms[j].  Matches the scalar path within float rounding.
+	void ConcatenateHierarchyLanes(const DirectX::XMFLOAT4X4* const* toParentTransforms,
+		DirectX::XMFLOAT4X4* const* finalTransforms, UINT instanceCount,
+		SkeletonLaneWorkspace& workspace)const;
+
+private:
+	// Converts workspace.ToParentTransforms to final (offset * toRoot)^T transforms.
+	void ConcatenateHierarchy(PoseWorkspace& workspace, DirectX::XMFLOAT4X4* finalTransforms)const;
+
 private:
 	// Gives parentIndex of ith bone.
 	std::vector<int> mBoneHierarchy;
@@ -0,0 +1,80 @@
+// Compiled with /arch:AVX2; see CpuHasAvx2.  Only plain DirectXMath data is
+// used here, so no inline function built for AVX2 can be picked by the linker
+// for the other files.
+#include "skeleton_lanes.h"
+#include <immintrin.h>
+
+using namespace DirectX;
+
+namespace
+{
+	// Loads one row of a bone matrix from 4 instances and transposes it so
+	// out[c] holds element (row, c) of every instance.
+	inline void GatherRow4(const XMFLOAT4X4* const* m, UINT bone, UINT row, __m128 out[4])
+	{
+		__m128 a = _mm_loadu_ps(&m[0][bone].m[row][0]);
+		__m128 b = _mm_loadu_ps(&m[1][bone].m[row][0]);
+		__m128 c = _mm_loadu_ps(&m[2][bone].m[row][0]);
+		__m128 d = _mm_loadu_ps(&m[3][bone].m[row][0]);
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		out[0] = a;
+		out[1] = b;
+		out[2] = c;
+		out[3] = d;
+	}
+
+	// Inverse of GatherRow4: a, b, c, d hold one element of 4 instances each
+	// and become row `row` of each instance's matrix.
+	inline void ScatterRow4(__m128 a, __m128 b, __m128 c, __m128 d, XMFLOAT4X4* const* m, UINT bone, UINT row)
+	{
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps(&m[0][bone].m[row][0], a);
+		_mm_storeu_ps(&m[1][bone].m[row][0], b);
+		_mm_storeu_ps(&m[2][bone].m[row][0], c);
+		_mm_storeu_ps(&m[3][bone].m[row][0], d);
+	}
+
+	// Eight skeleton instances, one per float of a 256-bit register.
+	struct Avx2Lanes
+	{
+		typedef __m256 Vector;
+		static const UINT Count = 8;
+
+		static Vector Load(const float* p) { return _mm256_loadu_ps(p); }
+		static void Store(float* p, Vector v) { _mm256_storeu_ps(p, v); }
+		static Vector Splat(float f) { return _mm256_set1_ps(f); }
+		static Vector Add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+
+		// Element (r, c) of the bone matrix of every lane goes to out[r * 4 + c].
+		static void GatherMatrix(const XMFLOAT4X4* const* m, UINT bone, Vector out[16])
+		{
+			for (UINT r = 0; r < 4; ++r)
+			{
+				__m128 lo[4], hi[4];
+				GatherRow4(m, bone, r, lo);
+				GatherRow4(m + 4, bone, r, hi);
+				for (UINT c = 0; c < 4; ++c)
+					out[r * 4 + c] = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[c]), hi[c], 1);
+			}
+		}
+
+		// Writes the transpose of the lane matrix v to the bone of every lane.
+		static void ScatterTransposed(const Vector v[16], XMFLOAT4X4* const* m, UINT bone)
+		{
+			for (UINT c = 0; c < 4; ++c)
+			{
+				ScatterRow4(_mm256_castps256_ps128(v[c]), _mm256_castps256_ps128(v[4 + c]),
+					_mm256_castps256_ps128(v[8 + c]), _mm256_castps256_ps128(v[12 + c]), m, bone, c);
+				ScatterRow4(_mm256_extractf128_ps(v[c], 1), _mm256_extractf128_ps(v[4 + c], 1),
+					_mm256_extractf128_ps(v[8 + c], 1), _mm256_extractf128_ps(v[12 + c], 1), m + 4, bone, c);
+			}
+		}
+	};
+}
+
+void ConcatenateLanesAvx2(const XMFLOAT4X4* const* src, XMFLOAT4X4* const* dst,
+	const int* boneHierarchy, const XMFLOAT4X4* boneOffsets, UINT boneCount, float* toRootLanes)
+{
+	ConcatenateLanes<Avx2Lanes>(src, dst, boneHierarchy, boneOffsets, boneCount, toRootLanes);
+}
@@ -0,0 +1,394 @@
+#include "terrain.h"
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include "geometry_generator.h"
+#include "job_system.h"
+#include "math_helper.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Largest power of two n whose (n+1)^2 grid and 4n skirt vertices fit
+	// 16-bit indices.
+	const UINT MaxChunkCells = 128;
+}
+
+bool Terrain::LoadHeightmap(const std::string& filename, UINT width, UINT depth)
+{
+	std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+	if (!fin)
+		return false;
+
+	std::streamsize byteSize = fin.tellg();
+	fin.seekg(0, std::ios::beg);
+
+	if (width == 0 && depth == 0)
+	{
+		UINT side = (UINT)(sqrt((double)(byteSize / 2)) + 0.5);
+		width = side;
+		depth = side;
+	}
+
+	if (width == 0 || depth == 0 || byteSize != (std::streamsize)width * depth * 2)
+		return false;
+
+	std::vector<unsigned char> bytes((size_t)byteSize);
+	if (!fin.read((char*)bytes.data(), byteSize))
+		return false;
+
+	std::vector<std::uint16_t> samples((size_t)width * depth);
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i] = (std::uint16_t)(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+
+	SetHeightmap(std::move(samples), width, depth);
+	return true;
+}
+
+void Terrain::SetHeightmap(std::vector<std::uint16_t> samples, UINT width, UINT depth)
+{
+	mHeightmap = std::move(samples);
+	mWidth = width;
+	mDepth = depth;
+}
+
+float Terrain::Sample(INT row, INT col)const
+{
+	row = MathHelper::Clamp(row, 0, (INT)mDepth - 1);
+	col = MathHelper::Clamp(col, 0, (INT)mWidth - 1);
+	return HeightOffset + HeightScale * mHeightmap[(size_t)row * mWidth + col] / 65535.0f;
+}
+
+XMFLOAT3 Terrain::SampleNormal(INT row, INT col)const
+{
+	// Central differences; +z is towards row 0.
+	float dhdx = (Sample(row, col + 1) - Sample(row, col - 1)) / (2.0f * CellSpacing);
+	float dhdz = (Sample(row - 1, col) - Sample(row + 1, col)) / (2.0f * CellSpacing);
+
+	XMFLOAT3 normal;
+	XMStoreFloat3(&normal, XMVector3Normalize(XMVectorSet(-dhdx, 1.0f, -dhdz, 0.0f)));
+	return normal;
+}
+
+float Terrain::Height(float x, float z)const
+{
+	if (mHeightmap.empty())
+		return HeightOffset;
+
+	float col = x / CellSpacing + 0.5f * (mWidth - 1);
+	float row = 0.5f * (mDepth - 1) - z / CellSpacing;
+
+	col = MathHelper::Clamp(col, 0.0f, (float)(mWidth - 1));
+	row = MathHelper::Clamp(row, 0.0f, (float)(mDepth - 1));
+
+	INT c0 = (INT)col;
+	INT r0 = (INT)row;
+	float s = col - c0;
+	float t = row - r0;
+
+	float top = Sample(r0, c0) + s * (Sample(r0, c0 + 1) - Sample(r0, c0));
+	float bottom = Sample(r0 + 1, c0) + s * (Sample(r0 + 1, c0 + 1) - Sample(r0 + 1, c0));
+	return top + t * (bottom - top);
+}
+
+UINT Terrain::RingVertex(UINT r)const
+{
+	const UINT C = mChunkCells;
+	const UINT n = C + 1;
+
+	if (r < C)
+		return C * n + r;               // -z edge, towards +x
+	if (r < 2 * C)
+		return (C - (r - C)) * n + C;   // +x edge, towards +z
+	if (r < 3 * C)
+		return C - (r - 2 * C);         // +z edge, towards -x
+	return (r - 3 * C) * n;             // -x edge, towards -z
+}
+
+void Terrain::Build()
+{
+	mVertices.clear();
+	mIndices.clear();
+	mLods.clear();
+	mChunks.clear();
+	mVisibleDraws.clear();
+	mAllDraws.clear();
+	mStats = TerrainStats();
+
+	if (mHeightmap.empty())
+		return;
+
+	// Round down to a power of two.
+	mChunkCells = 2;
+	while (mChunkCells * 2 <= MathHelper::Min(ChunkCells, MaxChunkCells))
+		mChunkCells *= 2;
+
+	UINT maxLevels = 1;
+	while ((1u << maxLevels) <= mChunkCells)
+		++maxLevels;
+	mLodLevels = MathHelper::Clamp(LodLevels, 1u, maxLevels);
+
+	// Chunks past the heightmap edge repeat the edge samples.
+	mChunkCols = MathHelper::Max((mWidth - 1 + mChunkCells - 1) / mChunkCells, 1u);
+	mChunkRows = MathHelper::Max((mDepth - 1 + mChunkCells - 1) / mChunkCells, 1u);
+	mChunkVertexCount = (mChunkCells + 1) * (mChunkCells + 1) + 4 * mChunkCells;
+
+	BuildIndices();
+
+	mChunks.resize(mChunkRows * mChunkCols);
+	mVertices.resize((size_t)mChunks.size() * mChunkVertexCount);
+
+	auto forEachChunk = [&](const std::function<void(UINT)>& func)
+	{
+		UINT chunkCount = (UINT)mChunks.size();
+		if (Jobs == nullptr)
+		{
+			for (UINT i = 0; i < chunkCount; ++i)
+				func(i);
+		}
+		else
+		{
+			Jobs->ParallelFor(chunkCount, 1, [&](UINT begin, UINT end)
+			{
+				for (UINT i = begin; i < end; ++i)
+					func(i);
+			});
+		}
+	};
+
+	// The skirts depend on the errors of the neighbours, so compute all of
+	// those first.
+	forEachChunk([&](UINT i)
+	{
+		TerrainChunk& chunk = mChunks[i];
+		chunk.BaseVertexLocation = (INT)(i * mChunkVertexCount);
+		chunk.LodErrors.resize(mLodLevels);
+		chunk.LodErrors[0] = 0.0f;
+		for (UINT level = 1; level < mLodLevels; ++level)
+		{
+			chunk.LodErrors[level] = MathHelper::Max(chunk.LodErrors[level - 1],
+				LodError(i / mChunkCols, i % mChunkCols, 1u << level));
+		}
+	});
+
+	forEachChunk([&](UINT i)
+	{
+		BuildChunk(i / mChunkCols, i % mChunkCols);
+	});
+
+	std::vector<BoundingBox> bounds(mChunks.size());
+	for (size_t i = 0; i < mChunks.size(); ++i)
+		bounds[i] = mChunks[i].Bounds;
+	mChunkCuller.SetBounds(bounds.data(), (UINT)bounds.size());
+}
+
+void Terrain::BuildIndices()
+{
+	const UINT n = mChunkCells + 1;
+	const UINT ringLength = 4 * mChunkCells;
+
+	GeometryGenerator geoGen;
+	for (UINT level = 0; level < mLodLevels; ++level)
+	{
+		UINT step = 1u << level;
+		UINT cells = mChunkCells / step;
+
+		TerrainLod lod;
+		lod.StartIndexLocation = (UINT)mIndices.size();
+
+		// Every step-th row and column of the chunk grid.
+		GeometryGenerator::MeshData grid = geoGen.CreateGrid(1.0f, 1.0f, cells + 1, cells + 1);
+		for (GeometryGenerator::uint32 index : grid.Indices32)
+		{
+			UINT i = index / (cells + 1);
+			UINT j = index % (cells + 1);
+			mIndices.push_back((std::uint16_t)(i * step * n + j * step));
+		}
+
+		// Skirt quads between the border vertices of this level and the skirt
+		// vertices below them.  The ring runs counterclockwise seen from
+		// above, so the quads face outwards.
+		for (UINT r = 0; r < ringLength; r += step)
+		{
+			UINT next = (r + step) % ringLength;
+
+			std::uint16_t topA = (std::uint16_t)RingVertex(r);
+			std::uint16_t topB = (std::uint16_t)RingVertex(next);
+			std::uint16_t skirtA = (std::uint16_t)(n * n + r);
+			std::uint16_t skirtB = (std::uint16_t)(n * n + next);
+
+			mIndices.push_back(topA);
+			mIndices.push_back(topB);
+			mIndices.push_back(skirtB);
+
+			mIndices.push_back(topA);
+			mIndices.push_back(skirtB);
+			mIndices.push_back(skirtA);
+		}
+
+		lod.IndexCount = (UINT)mIndices.size() - lod.StartIndexLocation;
+		mLods.push_back(lod);
+	}
+}
+
+float Terrain::LodError(UINT chunkRow, UINT chunkCol, UINT step)const
+{
+	// Each quad of the level is split along the diagonal from its +x,+z to
+	// its -x,-z corner, like CreateGrid.  Compare the heightmap samples inside
+	// with the plane of the triangle they fall in.
+	INT row0 = (INT)(chunkRow * mChunkCells);
+	INT col0 = (INT)(chunkCol * mChunkCells);
+
+	float error = 0.0f;
+	for (UINT i = 0; i < mChunkCells; i += step)
+	{
+		for (UINT j = 0; j < mChunkCells; j += step)
+		{
+			INT r = row0 + (INT)i;
+			INT c = col0 + (INT)j;
+			INT s = (INT)step;
+
+			float h00 = Sample(r, c);
+			float h01 = Sample(r, c + s);
+			float h10 = Sample(r + s, c);
+			float h11 = Sample(r + s, c + s);
+
+			for (INT di = 0; di <= s; ++di)
+			{
+				for (INT dj = 0; dj <= s; ++dj)
+				{
+					float u = (float)dj / s;
+					float v = (float)di / s;
+
+					float h = u + v <= 1.0f ?
+						h00 + u * (h01 - h00) + v * (h10 - h00) :
+						h11 + (1.0f - u) * (h10 - h11) + (1.0f - v) * (h01 - h11);
+
+					error = MathHelper::Max(error, fabsf(Sample(r + di, c + dj) - h));
+				}
+			}
+		}
+	}
+
+	return error;
+}
+
+void Terrain::BuildChunk(UINT chunkRow, UINT chunkCol)
+{
+	const UINT n = mChunkCells + 1;
+	TerrainChunk& chunk = mChunks[chunkRow * mChunkCols + chunkCol];
+	Vertex* vertices = &mVertices[chunk.BaseVertexLocation];
+
+	// Positions in the xz-plane and texture coordinates stretched over the
+	// chunk come from the grid; the heightmap supplies the rest.
+	float chunkSize = mChunkCells * CellSpacing;
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData grid = geoGen.CreateGrid(chunkSize, chunkSize, n, n);
+
+	INT row0 = (INT)(chunkRow * mChunkCells);
+	INT col0 = (INT)(chunkCol * mChunkCells);
+	float centerX = (col0 + 0.5f * mChunkCells - 0.5f * (mWidth - 1)) * CellSpacing;
+	float centerZ = (0.5f * (mDepth - 1) - row0 - 0.5f * mChunkCells) * CellSpacing;
+
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT j = 0; j < n; ++j)
+		{
+			Vertex& v = vertices[i * n + j];
+			v = grid.Vertices[i * n + j];
+
+			v.Pos.x += centerX;
+			v.Pos.y = Sample(row0 + (INT)i, col0 + (INT)j);
+			v.Pos.z += centerZ;
+			v.Normal = SampleNormal(row0 + (INT)i, col0 + (INT)j);
+
+			// Along +x on the surface.
+			XMVECTOR T = XMVectorSet(v.Normal.y, -v.Normal.x, 0.0f, 0.0f);
+			XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
+		}
+	}
+
+	// Along a shared edge this chunk's level and its neighbour's are each off
+	// the heightmap by at most their coarsest error, so the sum of the two
+	// bounds the crack between them wherever the levels meet.
+	float neighbourError = 0.0f;
+	const INT offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	for (const auto& offset : offsets)
+	{
+		INT r = (INT)chunkRow + offset[0];
+		INT c = (INT)chunkCol + offset[1];
+		if (r >= 0 && r < (INT)mChunkRows && c >= 0 && c < (INT)mChunkCols)
+			neighbourError = MathHelper::Max(neighbourError, mChunks[r * mChunkCols + c].LodErrors.back());
+	}
+	float skirtDepth = chunk.LodErrors.back() + neighbourError + CellSpacing;
+
+	for (UINT r = 0; r < 4 * mChunkCells; ++r)
+	{
+		Vertex& skirt = vertices[n * n + r];
+		skirt = vertices[RingVertex(r)];
+		skirt.Pos.y -= skirtDepth;
+	}
+
+	BoundingBox::CreateFromPoints(chunk.Bounds, mChunkVertexCount, &vertices[0].Pos, sizeof(Vertex));
+}
+
+void Terrain::Update(const BoundingFrustum& viewFrustum, FXMMATRIX view,
+	const XMFLOAT3& eyePosW, float pixelsPerUnit, float maxPixelError)
+{
+	XMVECTOR det = XMMatrixDeterminant(view);
+	XMMATRIX invView = XMMatrixInverse(&det, view);
+
+	BoundingFrustum worldFrustum;
+	viewFrustum.Transform(worldFrustum, invView);
+
+	// BoundingFrustum planes face out; the culler keeps the inner side.
+	XMVECTOR worldPlanes[6];
+	worldFrustum.GetPlanes(&worldPlanes[0], &worldPlanes[1], &worldPlanes[2],
+		&worldPlanes[3], &worldPlanes[4], &worldPlanes[5]);
+	XMFLOAT4 planes[6];
+	for (int p = 0; p < 6; ++p)
+		XMStoreFloat4(&planes[p], XMVectorNegate(worldPlanes[p]));
+
+	mChunkCuller.Cull(planes);
+	for (TerrainChunk& chunk : mChunks)
+		chunk.Visible = false;
+	for (UINT i = 0; i < mChunkCuller.VisibleCount(); ++i)
+		mChunks[mChunkCuller.VisibleItems()[i]].Visible = true;
+
+	XMVECTOR eyePos = XMLoadFloat3(&eyePosW);
+
+	mVisibleDraws.clear();
+	mAllDraws.clear();
+	mStats = TerrainStats();
+	for (TerrainChunk& chunk : mChunks)
+	{
+		float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&chunk.Bounds.Extents)));
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&chunk.Bounds.Center), eyePos))) - radius;
+
+		// Levels are ordered by error, take the last one that is still fine.
+		UINT lod = 0;
+		if (distance > 0.0f)
+		{
+			while (lod + 1 < (UINT)chunk.LodErrors.size() &&
+				chunk.LodErrors[lod + 1] * pixelsPerUnit <= maxPixelError * distance)
+				++lod;
+		}
+		chunk.LodIndex = lod;
+
+		TerrainDraw draw;
+		draw.IndexCount = mLods[lod].IndexCount;
+		draw.StartIndexLocation = mLods[lod].StartIndexLocation;
+		draw.BaseVertexLocation = chunk.BaseVertexLocation;
+		mAllDraws.push_back(draw);
+
+		if (chunk.Visible)
+		{
+			mVisibleDraws.push_back(draw);
+
+			++mStats.VisibleChunks;
+			mStats.Triangles += draw.IndexCount / 3;
+			mStats.FullDetailTriangles += mLods[0].IndexCount / 3;
+		}
+	}
+}
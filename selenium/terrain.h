@@ -0,0 +1,154 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "frustum_culler.h"
+#include "vertex.h"
+
+class JobSystem;
+
+// Index range of one level of detail.  Every chunk has the same vertex
+// layout, so the ranges are shared by all chunks and only the
+// BaseVertexLocation differs.
+struct TerrainLod
+{
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+};
+
+struct TerrainChunk
+{
+	// World space, skirts included.
+	DirectX::BoundingBox Bounds;
+
+	INT BaseVertexLocation = 0;
+
+	// Largest height difference between level i and the heightmap; 0 for
+	// level 0 and non-decreasing.
+	std::vector<float> LodErrors;
+
+	// Picked by the last Update.
+	UINT LodIndex = 0;
+	bool Visible = true;
+};
+
+struct TerrainDraw
+{
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	INT BaseVertexLocation = 0;
+};
+
+struct TerrainStats
+{
+	UINT VisibleChunks = 0;
+	UINT Triangles = 0;
+	UINT FullDetailTriangles = 0;
+};
+
+// Heightfield terrain split into square chunks of ChunkCells x ChunkCells
+// quads.  Each chunk is a CreateGrid displaced by the heightmap and gets
+// LodLevels levels of detail, each halving the resolution of the one before.
+// Skirts hang down from the chunk borders to hide the cracks between
+// neighbours drawn at different levels.
+//
+// The heightmap is centered at the origin in the xz-plane with row 0 at +z,
+// like CreateGrid, and sample (row, col) is at height
+// HeightOffset + HeightScale * sample / 65535.
+class Terrain
+{
+public:
+	// Quads along one side of a chunk; a power of two so that every level
+	// keeps the chunk corners.  Chunks have at most 65536 vertices so the
+	// indices are 16-bit.  Build rounds it down to a power of two of at most
+	// 128, leaving this field as it was set.
+	UINT ChunkCells = 64;
+
+	// Including the full detail level; capped at log2(ChunkCells) + 1.
+	UINT LodLevels = 5;
+
+	float CellSpacing = 1.0f;
+	float HeightScale = 50.0f;
+	float HeightOffset = 0.0f;
+
+	// Builds the chunks in parallel if set.
+	JobSystem* Jobs = nullptr;
+
+	// Reads width * depth little-endian 16-bit samples, row by row.  A square
+	// heightmap is assumed if width and depth are 0.  Returns false if the
+	// file cannot be read or has the wrong size.
+	bool LoadHeightmap(const std::string& filename, UINT width = 0, UINT depth = 0);
+	void SetHeightmap(std::vector<std::uint16_t> samples, UINT width, UINT depth);
+
+	// Generates the chunks, their levels and their bounds from the heightmap.
+	void Build();
+
+	// World space height at (x, z), bilinearly filtered and clamped to the
+	// edges of the heightmap.
+	float Height(float x, float z)const;
+
+	// Culls the chunks against the camera and picks the coarsest level of each
+	// whose error projects to at most maxPixelError pixels.  viewFrustum is in
+	// view space and pixelsPerUnit is the size of one unit one unit in front
+	// of the camera.
+	void Update(const DirectX::BoundingFrustum& viewFrustum, DirectX::FXMMATRIX view,
+		const DirectX::XMFLOAT3& eyePosW, float pixelsPerUnit, float maxPixelError);
+
+	// Levels picked by the last Update, for the visible chunks and for all of
+	// them (e.g. for shadow maps, whose frustum is not the camera's).
+	const std::vector<TerrainDraw>& VisibleDraws()const { return mVisibleDraws; }
+	const std::vector<TerrainDraw>& AllDraws()const { return mAllDraws; }
+	const TerrainStats& Stats()const { return mStats; }
+
+	// Geometry of all chunks, one after the other, and the shared level
+	// index ranges.
+	const std::vector<Vertex>& Vertices()const { return mVertices; }
+	const std::vector<std::uint16_t>& Indices()const { return mIndices; }
+	const std::vector<TerrainLod>& Lods()const { return mLods; }
+	const std::vector<TerrainChunk>& Chunks()const { return mChunks; }
+
+	UINT Width()const { return mWidth; }
+	UINT Depth()const { return mDepth; }
+
+	// ChunkCells and LodLevels as clamped by the last Build.
+	UINT BuiltChunkCells()const { return mChunkCells; }
+	UINT BuiltLodLevels()const { return mLodLevels; }
+
+private:
+	float Sample(INT row, INT col)const;
+	DirectX::XMFLOAT3 SampleNormal(INT row, INT col)const;
+
+	// Border vertex r of a chunk, walking the border counterclockwise seen
+	// from above starting at the -x,-z corner.
+	UINT RingVertex(UINT r)const;
+
+	void BuildIndices();
+	void BuildChunk(UINT chunkRow, UINT chunkCol);
+	float LodError(UINT chunkRow, UINT chunkCol, UINT step)const;
+
+private:
+	std::vector<std::uint16_t> mHeightmap;
+	UINT mWidth = 0;
+	UINT mDepth = 0;
+
+	UINT mChunkCells = 0;
+	UINT mLodLevels = 0;
+	UINT mChunkRows = 0;
+	UINT mChunkCols = 0;
+	UINT mChunkVertexCount = 0;
+
+	std::vector<Vertex> mVertices;
+	std::vector<std::uint16_t> mIndices;
+	std::vector<TerrainLod> mLods;
+	std::vector<TerrainChunk> mChunks;
+
+	// The chunk bounds, culled by Update.
+	FrustumCuller mChunkCuller;
+
+	std::vector<TerrainDraw> mVisibleDraws;
+	std::vector<TerrainDraw> mAllDraws;
+	TerrainStats mStats;
+};
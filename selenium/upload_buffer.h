@@ -56,6 +56,14 @@ public:
 		memcpy(&mMappedData[elementIndex*mStrideInBytes], &data, sizeof(T));
 	}
 
+	// Lets producers write an element in place instead of building it on the
+	// stack and copying it.  The memory is write-combined, so only write
+	// through this pointer, never read.
+	T* MappedElement(int elementIndex)
+	{
+		return reinterpret_cast<T*>(&mMappedData[elementIndex*mStrideInBytes]);
+	}
+
 private:
 	Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
 	BYTE* mMappedData = nullptr;
@@ -0,0 +1,258 @@
+#include "vertex_packing.h"
+#include <cmath>
+#include "math_helper.h"
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace
+{
+	const float SnormScale = 32767.0f;
+
+	float SignNotZero(float x)
+	{
+		return x >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	XMHALF2 PackTexC(const XMFLOAT2& texC)
+	{
+		XMHALF2 packed;
+		XMStoreHalf2(&packed, XMLoadFloat2(&texC));
+		return packed;
+	}
+
+	XMFLOAT2 UnpackTexC(const XMHALF2& texC)
+	{
+		XMFLOAT2 unpacked;
+		XMStoreFloat2(&unpacked, XMLoadHalf2(&texC));
+		return unpacked;
+	}
+
+	XMSHORTN2 PackDirection(const XMFLOAT3& v)
+	{
+		return OctEncode(XMLoadFloat3(&v));
+	}
+
+	XMFLOAT3 UnpackDirection(const XMSHORTN2& e)
+	{
+		XMFLOAT3 v;
+		XMStoreFloat3(&v, OctDecode(e));
+		return v;
+	}
+
+	XMUBYTEN4 PackBoneWeights(const XMFLOAT3& weights)
+	{
+		int q[3] =
+		{
+			(int)std::lround(MathHelper::Clamp(weights.x, 0.0f, 1.0f) * 255.0f),
+			(int)std::lround(MathHelper::Clamp(weights.y, 0.0f, 1.0f) * 255.0f),
+			(int)std::lround(MathHelper::Clamp(weights.z, 0.0f, 1.0f) * 255.0f)
+		};
+
+		// The shader derives the fourth weight as one minus the others, so
+		// rounding must not push their sum above one.
+		while (q[0] + q[1] + q[2] > 255)
+		{
+			int largest = q[0] >= q[1] ? (q[0] >= q[2] ? 0 : 2) : (q[1] >= q[2] ? 1 : 2);
+			--q[largest];
+		}
+
+		XMUBYTEN4 packed;
+		packed.x = (uint8_t)q[0];
+		packed.y = (uint8_t)q[1];
+		packed.z = (uint8_t)q[2];
+		packed.w = (uint8_t)(255 - q[0] - q[1] - q[2]);
+		return packed;
+	}
+}
+
+PositionQuantization PositionQuantization::Fit(const XMFLOAT3* positions, UINT count, UINT stride)
+{
+	PositionQuantization quantization;
+	if (count == 0)
+		return quantization;
+
+	XMVECTOR vMin = XMLoadFloat3(positions);
+	XMVECTOR vMax = vMin;
+	for (UINT i = 1; i < count; ++i)
+	{
+		XMVECTOR p = XMLoadFloat3((const XMFLOAT3*)((const BYTE*)positions + (size_t)i * stride));
+		vMin = XMVectorMin(vMin, p);
+		vMax = XMVectorMax(vMax, p);
+	}
+
+	XMFLOAT3 extent;
+	XMStoreFloat3(&extent, XMVectorSubtract(vMax, vMin));
+	XMStoreFloat3(&quantization.Offset, vMin);
+
+	float scale = MathHelper::Max(extent.x, MathHelper::Max(extent.y, extent.z));
+	quantization.Scale = scale > 0.0f ? scale : 1.0f;
+
+	return quantization;
+}
+
+XMUSHORTN4 PositionQuantization::Quantize(const XMFLOAT3& position)const
+{
+	XMVECTOR p = XMVectorScale(XMVectorSubtract(XMLoadFloat3(&position), XMLoadFloat3(&Offset)), 1.0f / Scale);
+
+	XMUSHORTN4 quantized;
+	XMStoreUShortN4(&quantized, XMVectorSetW(p, 1.0f));
+	return quantized;
+}
+
+XMFLOAT3 PositionQuantization::Dequantize(const XMUSHORTN4& position)const
+{
+	XMFLOAT3 p;
+	XMStoreFloat3(&p, XMVectorAdd(XMVectorScale(XMLoadUShortN4(&position), Scale), XMLoadFloat3(&Offset)));
+	return p;
+}
+
+XMFLOAT4X4 PositionQuantization::DequantizeTransform()const
+{
+	XMFLOAT4X4 transform;
+	XMStoreFloat4x4(&transform,
+		XMMatrixScaling(Scale, Scale, Scale) * XMMatrixTranslation(Offset.x, Offset.y, Offset.z));
+	return transform;
+}
+
+XMSHORTN2 OctEncode(FXMVECTOR v)
+{
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, v);
+
+	float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	if (l1 <= 0.0f)
+		return XMSHORTN2(0, 0);
+
+	float x = n.x / l1;
+	float y = n.y / l1;
+
+	// Fold the lower hemisphere over the diagonals.
+	if (n.z < 0.0f)
+	{
+		float foldedX = (1.0f - std::fabs(y)) * SignNotZero(x);
+		float foldedY = (1.0f - std::fabs(x)) * SignNotZero(y);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	XMVECTOR unit = XMVector3Normalize(v);
+
+	XMSHORTN2 best(0, 0);
+	float bestDot = -2.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		float qx = (i & 1) ? std::ceil(x * SnormScale) : std::floor(x * SnormScale);
+		float qy = (i & 2) ? std::ceil(y * SnormScale) : std::floor(y * SnormScale);
+
+		XMSHORTN2 candidate(
+			(int16_t)MathHelper::Clamp(qx, -SnormScale, SnormScale),
+			(int16_t)MathHelper::Clamp(qy, -SnormScale, SnormScale));
+
+		float d = XMVectorGetX(XMVector3Dot(OctDecode(candidate), unit));
+		if (d > bestDot)
+		{
+			bestDot = d;
+			best = candidate;
+		}
+	}
+
+	return best;
+}
+
+XMVECTOR OctDecode(const XMSHORTN2& e)
+{
+	XMFLOAT2 f;
+	XMStoreFloat2(&f, XMLoadShortN2(&e));
+
+	float z = 1.0f - std::fabs(f.x) - std::fabs(f.y);
+	float t = MathHelper::Max(-z, 0.0f);
+	float x = f.x + (f.x >= 0.0f ? -t : t);
+	float y = f.y + (f.y >= 0.0f ? -t : t);
+
+	return XMVector3Normalize(XMVectorSet(x, y, z, 0.0f));
+}
+
+PackedVertex PackVertex(const Vertex& v)
+{
+	PackedVertex packed;
+	packed.Pos = v.Pos;
+	packed.Normal = PackDirection(v.Normal);
+	packed.TexC = PackTexC(v.TexC);
+	packed.TangentU = PackDirection(v.TangentU);
+	return packed;
+}
+
+PackedSkinnedVertex PackVertex(const SkinnedVertex& v)
+{
+	PackedSkinnedVertex packed;
+	packed.Pos = v.Pos;
+	packed.Normal = PackDirection(v.Normal);
+	packed.TexC = PackTexC(v.TexC);
+	packed.TangentU = PackDirection(v.TangentU);
+	packed.BoneWeights = PackBoneWeights(v.BoneWeights);
+	for (int i = 0; i < 4; ++i)
+		packed.BoneIndices[i] = v.BoneIndices[i];
+	return packed;
+}
+
+QuantizedVertex PackVertex(const Vertex& v, const PositionQuantization& quantization)
+{
+	QuantizedVertex packed;
+	packed.Pos = quantization.Quantize(v.Pos);
+	packed.Normal = PackDirection(v.Normal);
+	packed.TexC = PackTexC(v.TexC);
+	packed.TangentU = PackDirection(v.TangentU);
+	return packed;
+}
+
+void PackVertices(const Vertex* src, UINT count, PackedVertex* dst)
+{
+	for (UINT i = 0; i < count; ++i)
+		dst[i] = PackVertex(src[i]);
+}
+
+void PackVertices(const SkinnedVertex* src, UINT count, PackedSkinnedVertex* dst)
+{
+	for (UINT i = 0; i < count; ++i)
+		dst[i] = PackVertex(src[i]);
+}
+
+void PackVertices(const Vertex* src, UINT count, const PositionQuantization& quantization, QuantizedVertex* dst)
+{
+	for (UINT i = 0; i < count; ++i)
+		dst[i] = PackVertex(src[i], quantization);
+}
+
+Vertex UnpackVertex(const PackedVertex& v)
+{
+	Vertex unpacked;
+	unpacked.Pos = v.Pos;
+	unpacked.Normal = UnpackDirection(v.Normal);
+	unpacked.TexC = UnpackTexC(v.TexC);
+	unpacked.TangentU = UnpackDirection(v.TangentU);
+	return unpacked;
+}
+
+SkinnedVertex UnpackVertex(const PackedSkinnedVertex& v)
+{
+	SkinnedVertex unpacked;
+	unpacked.Pos = v.Pos;
+	unpacked.Normal = UnpackDirection(v.Normal);
+	unpacked.TexC = UnpackTexC(v.TexC);
+	unpacked.TangentU = UnpackDirection(v.TangentU);
+	unpacked.BoneWeights = XMFLOAT3(v.BoneWeights.x / 255.0f, v.BoneWeights.y / 255.0f, v.BoneWeights.z / 255.0f);
+	for (int i = 0; i < 4; ++i)
+		unpacked.BoneIndices[i] = v.BoneIndices[i];
+	return unpacked;
+}
+
+Vertex UnpackVertex(const QuantizedVertex& v, const PositionQuantization& quantization)
+{
+	Vertex unpacked;
+	unpacked.Pos = quantization.Dequantize(v.Pos);
+	unpacked.Normal = UnpackDirection(v.Normal);
+	unpacked.TexC = UnpackTexC(v.TexC);
+	unpacked.TangentU = UnpackDirection(v.TangentU);
+	return unpacked;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+#include "vertex.h"
+
+// Vertex in 24 instead of 44 bytes.  Normal and tangent are octahedral
+// encoded into two SNORM16 values each and the texture coordinates are half
+// floats.  Bind with DXGI_FORMAT_R16G16_SNORM for Normal and TangentU and
+// DXGI_FORMAT_R16G16_FLOAT for TexC; shaders decode with OctDecode.
+struct PackedVertex
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::PackedVector::XMSHORTN2 Normal;
+	DirectX::PackedVector::XMHALF2 TexC;
+	DirectX::PackedVector::XMSHORTN2 TangentU;
+};
+
+// SkinnedVertex in 32 instead of 60 bytes.  Like PackedVertex, plus bone
+// weights as UNORM8 (DXGI_FORMAT_R8G8B8A8_UNORM).  The three weights used by
+// the shaders are rounded so their sum never exceeds one; w holds the rest.
+struct PackedSkinnedVertex
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::PackedVector::XMSHORTN2 Normal;
+	DirectX::PackedVector::XMHALF2 TexC;
+	DirectX::PackedVector::XMSHORTN2 TangentU;
+	DirectX::PackedVector::XMUBYTEN4 BoneWeights;
+	BYTE BoneIndices[4];
+};
+
+// PackedVertex with the position quantized to UNORM16 (DXGI_FORMAT_R16G16B16A16_UNORM),
+// 20 bytes.  See PositionQuantization.
+struct QuantizedVertex
+{
+	DirectX::PackedVector::XMUSHORTN4 Pos;
+	DirectX::PackedVector::XMSHORTN2 Normal;
+	DirectX::PackedVector::XMHALF2 TexC;
+	DirectX::PackedVector::XMSHORTN2 TangentU;
+};
+
+// Maps the positions of one mesh into [0, 1]^3 for UNORM16 storage.  The
+// scale is the same on every axis, so DequantizeTransform can be folded into
+// the world matrix of the mesh without breaking the normal transform.
+struct PositionQuantization
+{
+	DirectX::XMFLOAT3 Offset = { 0.0f, 0.0f, 0.0f };
+	float Scale = 1.0f;
+
+	// Fits the bounding cube of count positions, stride bytes apart.
+	static PositionQuantization Fit(const DirectX::XMFLOAT3* positions, UINT count, UINT stride);
+
+	DirectX::PackedVector::XMUSHORTN4 Quantize(const DirectX::XMFLOAT3& position)const;
+	DirectX::XMFLOAT3 Dequantize(const DirectX::PackedVector::XMUSHORTN4& position)const;
+
+	// Quantized position to mesh local space.
+	DirectX::XMFLOAT4X4 DequantizeTransform()const;
+};
+
+// Octahedral encoding of a unit vector.  Of the four SNORM16 values around
+// the exact encoding, the one that decodes closest to v is picked.
+DirectX::PackedVector::XMSHORTN2 OctEncode(DirectX::FXMVECTOR v);
+DirectX::XMVECTOR OctDecode(const DirectX::PackedVector::XMSHORTN2& e);
+
+PackedVertex PackVertex(const Vertex& v);
+PackedSkinnedVertex PackVertex(const SkinnedVertex& v);
+QuantizedVertex PackVertex(const Vertex& v, const PositionQuantization& quantization);
+
+void PackVertices(const Vertex* src, UINT count, PackedVertex* dst);
+void PackVertices(const SkinnedVertex* src, UINT count, PackedSkinnedVertex* dst);
+void PackVertices(const Vertex* src, UINT count, const PositionQuantization& quantization, QuantizedVertex* dst);
+
+// Inverse of PackVertex, for tools and error checks.
+Vertex UnpackVertex(const PackedVertex& v);
+SkinnedVertex UnpackVertex(const PackedSkinnedVertex& v);
+Vertex UnpackVertex(const QuantizedVertex& v, const PositionQuantization& quantization);
@@ -0,0 +1,468 @@
+#include "animation_tests.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include "animation_batch.h"
+#include "counting_allocator.h"
+#include "job_system.h"
+#include "math_helper.h"
+#include "skinned_controller.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// A skeleton of boneCount bones, each the child of bone (i - 1) / 2, with
+	// one clip per name of keyCount keys over two seconds.  Every bone sways
+	// about its own axis so all channels change between keys.
+	void BuildTestSkeleton(UINT boneCount, UINT keyCount,
+		const std::vector<std::string>& clipNames, SkinnedData& data)
+	{
+		std::vector<int> hierarchy(boneCount);
+		std::vector<XMFLOAT4X4> offsets(boneCount, MathHelper::Identity4x4());
+		for (UINT i = 0; i < boneCount; ++i)
+		{
+			hierarchy[i] = i == 0 ? -1 : (int)(i - 1) / 2;
+			offsets[i]._42 = -(float)i;
+		}
+
+		std::unordered_map<std::string, AnimationClip> clips;
+		for (size_t c = 0; c < clipNames.size(); ++c)
+		{
+			AnimationClip& clip = clips[clipNames[c]];
+			clip.BoneAnimations.resize(boneCount);
+			for (UINT i = 0; i < boneCount; ++i)
+			{
+				XMVECTOR axis = XMVector3Normalize(XMVectorSet(1.0f + (i % 3), (float)(i % 5), 1.0f + (i % 2), 0.0f));
+
+				std::vector<Keyframe>& keys = clip.BoneAnimations[i].Keyframes;
+				keys.resize(keyCount);
+				for (UINT k = 0; k < keyCount; ++k)
+				{
+					float t = 2.0f * k / (keyCount - 1);
+					float angle = 0.5f * std::sin(t * (1.0f + c) + 0.3f * i);
+
+					keys[k].TimePos = t;
+					keys[k].Translation = XMFLOAT3(0.0f, 1.0f + 0.05f * std::sin(t + i), 0.0f);
+					XMStoreFloat4(&keys[k].RotationQuat, XMVectorSetW(
+						XMVectorScale(axis, std::sin(0.5f * angle)), std::cos(0.5f * angle)));
+				}
+			}
+		}
+
+		data.Set(hierarchy, offsets, clips);
+	}
+
+	// Largest difference of any element of two palettes.
+	float MaxPaletteDifference(const XMFLOAT4X4* a, const XMFLOAT4X4* b, UINT boneCount)
+	{
+		float maxDifference = 0.0f;
+		for (UINT i = 0; i < boneCount; ++i)
+		{
+			for (UINT r = 0; r < 4; ++r)
+			{
+				for (UINT c = 0; c < 4; ++c)
+					maxDifference = MathHelper::Max(maxDifference, std::fabs(a[i].m[r][c] - b[i].m[r][c]));
+			}
+		}
+		return maxDifference;
+	}
+}
+
+TestReport TestPoseAllocations()
+{
+	const UINT boneCount = 60;
+	const int frameCount = 10000;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedData data;
+	BuildTestSkeleton(boneCount, 31, { "walk", "run", "lean" }, data);
+	const std::string walk = "walk";
+	const std::string run = "run";
+
+	// Upper body override and an additive lean on top of the clip.
+	BoneMask upperBody(boneCount, 0.0f);
+	for (UINT i = boneCount / 2; i < boneCount; ++i)
+		upperBody[i] = 1.0f;
+
+	AnimationLayer overrideLayer;
+	overrideLayer.Clip = data.FindClip(run);
+	overrideLayer.Weight = 0.7f;
+	overrideLayer.Mask = &upperBody;
+
+	AnimationLayer additiveLayer;
+	additiveLayer.Clip = data.FindClip("lean");
+	additiveLayer.BlendMode = AnimationBlendMode::Additive;
+
+	// Animates one frame of the case.  Runs once before counting so the
+	// workspaces have grown to the skeleton.
+	struct Case
+	{
+		const char* Name;
+		std::function<void(SkinnedController&, int)> Frame;
+	};
+
+	const Case cases[] =
+	{
+		{ "single clip", [&](SkinnedController& c, int) { c.UpdateAnimation(dt); } },
+		{ "cross-fade every 50 frames", [&](SkinnedController& c, int frame)
+		{
+			if (frame % 50 == 0)
+				c.CrossFade(frame % 100 == 0 ? run : walk, 0.5f);
+			c.UpdateAnimation(dt);
+		} },
+		{ "two layers", [&](SkinnedController& c, int) { c.UpdateAnimation(dt); } },
+		{ "thread local workspace", [&](SkinnedController& c, int frame)
+		{
+			c.FinalTransforms.resize(boneCount);
+			data.GetFinalTransforms(walk, frame * dt, c.FinalTransforms);
+		} },
+	};
+
+	TestReport report("Pose allocation check (" + std::to_string(boneCount) + " bones, " +
+		std::to_string(frameCount) + " frames)");
+	for (const Case& test : cases)
+	{
+		SkinnedController controller;
+		controller.Data = &data;
+		controller.ClipName = walk;
+		if (std::strcmp(test.Name, "two layers") == 0)
+			controller.Layers = { overrideLayer, additiveLayer };
+
+		test.Frame(controller, 0);
+
+		UINT64 allocations = ThreadAllocationCount();
+		double ms = TimeOnce([&]()
+		{
+			for (int frame = 1; frame <= frameCount; ++frame)
+				test.Frame(controller, frame);
+		});
+		allocations = ThreadAllocationCount() - allocations;
+
+		report.Line(std::string(test.Name) + ": " + std::to_string(allocations) + " allocations, " +
+			std::to_string(1000.0 * ms / frameCount) + " us per frame");
+		report.Check(allocations == 0, std::string(test.Name) + " allocates");
+	}
+
+	return report;
+}
+
+TestReport TestAnimationBatch(JobSystem& jobs)
+{
+	const UINT controllerCount = 2001;
+	const UINT boneCount = 60;
+	const UINT smallBoneCount = 37;
+	const int frameCount = 10;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedData data;
+	BuildTestSkeleton(boneCount, 31, { "walk", "run" }, data);
+	SkinnedData smallData;
+	BuildTestSkeleton(smallBoneCount, 31, { "walk", "run" }, smallData);
+
+	AnimationLayer additiveLayer;
+	additiveLayer.BlendMode = AnimationBlendMode::Additive;
+
+	// A crowd playing two clips, each controller at its own time.  The
+	// skeletons alternate in runs of five so lane groups are cut short by a
+	// change of skeleton, a few controllers carry a layer and skip the lane
+	// pass, and the count is not a whole number of lane groups.  Both sets
+	// start out the same; one is animated a controller at a time and the
+	// other by the batch.
+	std::mt19937 rng(17);
+	std::uniform_real_distribution<float> pickTime(0.0f, 2.0f);
+	std::vector<SkinnedController> controllers(controllerCount);
+	std::vector<SkinnedController> batchControllers(controllerCount);
+	AnimationBatch batch;
+	for (UINT i = 0; i < controllerCount; ++i)
+	{
+		SkinnedData* skeleton = (i / 5) % 2 == 0 ? &data : &smallData;
+		float time = pickTime(rng);
+		for (SkinnedController* controller : { &controllers[i], &batchControllers[i] })
+		{
+			controller->Data = skeleton;
+			controller->ClipName = i % 2 == 0 ? "walk" : "run";
+			controller->TimePos = time;
+			if (i % 16 == 0)
+			{
+				additiveLayer.Clip = skeleton->FindClip("run");
+				controller->Layers = { additiveLayer };
+			}
+		}
+		batch.Add(&batchControllers[i]);
+	}
+
+	std::vector<SkinnedConstants> skinned(controllerCount);
+	std::vector<SkinnedConstants> batchSkinned(controllerCount);
+
+	// One controller at a time on the calling thread, the way the app
+	// animated its single controller.
+	double scalarMs = BestTime([&]()
+	{
+		for (int frame = 0; frame < frameCount; ++frame)
+		{
+			for (UINT i = 0; i < controllerCount; ++i)
+				controllers[i].UpdateAnimation(dt, skinned[i].BoneTransforms);
+		}
+	}) / frameCount;
+
+	double batchMs = BestTime([&]()
+	{
+		for (int frame = 0; frame < frameCount; ++frame)
+			batch.Update(jobs, dt, batchSkinned.data());
+	}) / frameCount;
+
+	// Both sets took the same steps, so every slot must hold the palette of
+	// its own controller, up to the rounding of the lane hierarchy pass.
+	float maxDifference = 0.0f;
+	bool sameTimes = true;
+	for (UINT i = 0; i < controllerCount; ++i)
+	{
+		maxDifference = MathHelper::Max(maxDifference, MaxPaletteDifference(skinned[i].BoneTransforms,
+			batchSkinned[i].BoneTransforms, controllers[i].Data->BoneCount()));
+		sameTimes = sameTimes && controllers[i].TimePos == batchControllers[i].TimePos;
+	}
+
+	TestReport report("AnimationBatch benchmark (" + std::to_string(controllerCount) + " controllers, " +
+		std::to_string(boneCount) + " and " + std::to_string(smallBoneCount) + " bones, " +
+		std::to_string(SkeletonLaneCount) + " lanes)");
+	report.Line("one at a time: " + std::to_string(scalarMs) + " ms per frame, " +
+		std::to_string(controllerCount / scalarMs) + " instances/ms");
+	report.Line("AnimationBatch: " + std::to_string(batchMs) + " ms per frame, " +
+		std::to_string(controllerCount / batchMs) + " instances/ms on " + std::to_string(jobs.ThreadCount()) +
+		" threads, " + std::to_string(scalarMs / batchMs) + "x, max difference " + std::to_string(maxDifference));
+	report.Check(sameTimes, "batched time differs from one at a time");
+	report.Check(maxDifference <= 1e-3f, "batched palette differs from one at a time");
+
+	return report;
+}
+
+TestReport TestPoseCache(JobSystem& jobs)
+{
+	const UINT controllerCount = 2000;
+	const UINT boneCount = 60;
+	const UINT groupCount = 8;
+	const int frameCount = 10;
+	const float dt = 1.0f / 60.0f;
+
+	SkinnedData data;
+	BuildTestSkeleton(boneCount, 31, { "walk", "run" }, data);
+
+	// A crowd walking and running in a few groups, each group in step to
+	// within a fraction of a cache frame.
+	std::mt19937 rng(19);
+	std::uniform_real_distribution<float> pickTime(0.0f, 2.0f);
+	std::uniform_real_distribution<float> jitter(0.0f, 0.01f);
+	float groupTimes[groupCount];
+	for (float& time : groupTimes)
+		time = pickTime(rng);
+
+	PoseCache cache(256);
+	std::vector<SkinnedController> controllers(controllerCount);
+	AnimationBatch batch;
+	for (UINT i = 0; i < controllerCount; ++i)
+	{
+		controllers[i].Data = &data;
+		controllers[i].ClipName = i % 2 == 0 ? "walk" : "run";
+		controllers[i].TimePos = groupTimes[i % groupCount] + jitter(rng);
+		batch.Add(&controllers[i]);
+	}
+
+	std::vector<SkinnedConstants> skinned(controllerCount);
+	auto run = [&]()
+	{
+		return BestTime([&]()
+		{
+			for (int frame = 0; frame < frameCount; ++frame)
+				batch.Update(jobs, dt, skinned.data());
+		}) / frameCount;
+	};
+
+	double uncachedMs = run();
+
+	for (SkinnedController& controller : controllers)
+		controller.Cache = &cache;
+	cache.ResetCounters();
+	double cachedMs = run();
+	UINT64 hits = cache.Hits();
+	UINT64 misses = cache.Misses();
+
+	// Every cached palette must be the pose of the snapped time, up to the
+	// rounding of the lane hierarchy pass that evaluates misses.
+	bool exact = true;
+	std::vector<XMFLOAT4X4> expected(boneCount);
+	PoseWorkspace workspace;
+	for (UINT i = 0; i < controllerCount && exact; ++i)
+	{
+		const SkinnedController& controller = controllers[i];
+		float snapped = (UINT)(controller.TimePos * cache.SampleRate() + 0.5f) / cache.SampleRate();
+		data.GetFinalTransforms(*data.FindClip(controller.ClipName), snapped, workspace, expected.data());
+		exact = MaxPaletteDifference(expected.data(), skinned[i].BoneTransforms, boneCount) <= 1e-3f;
+	}
+
+	// A capacity that does not divide over the shards must still bound the
+	// cache exactly.
+	const UINT smallCapacity = 37;
+	PoseCache smallCache(smallCapacity);
+	const AnimationClip& walk = *data.FindClip("walk");
+	for (UINT frame = 0; frame < 500; ++frame)
+		smallCache.Insert(data, walk, frame / smallCache.SampleRate(), expected.data());
+
+	TestReport report("PoseCache benchmark (" + std::to_string(controllerCount) + " controllers in " +
+		std::to_string(groupCount) + " groups, " + std::to_string(boneCount) + " bones, " +
+		std::to_string(jobs.ThreadCount()) + " threads)");
+	report.Line("no cache: " + std::to_string(uncachedMs) + " ms per frame");
+	report.Line("cache: " + std::to_string(cachedMs) + " ms per frame, " + std::to_string(uncachedMs / cachedMs) +
+		"x, " + std::to_string(hits) + " hits, " + std::to_string(misses) + " misses");
+	report.Check(exact, "cached palette differs from the snapped time");
+	report.Line("capacity " + std::to_string(smallCapacity) + ": " + std::to_string(smallCache.Size()) +
+		" palettes after 500 inserts");
+	report.Check(smallCache.Size() <= smallCapacity, "cache holds more palettes than its capacity");
+
+	return report;
+}
+
+TestReport TestAnimationCompression()
+{
+	const UINT boneCount = 60;
+	const UINT keyCount = 121;
+	const UINT sampleCount = 2000;
+
+	SkinnedData source;
+	BuildTestSkeleton(boneCount, keyCount, { "walk", "run" }, source);
+
+	AnimationCompressionSettings settings;
+	AnimationCompressionStats stats;
+	SkinnedData compressed = source;
+	compressed.CompressClips(settings, &stats);
+
+	// Sample both at random times, apart from the keys and halfway points
+	// Compress measures itself, and keep the largest difference.
+	std::mt19937 rng(23);
+	std::uniform_real_distribution<float> pickTime(0.0f, source.GetClipEndTime("walk"));
+	std::vector<float> times(sampleCount);
+	for (float& t : times)
+		t = pickTime(rng);
+
+	float maxTranslationError = 0.0f;
+	float maxRotationError = 0.0f;
+	float maxScaleError = 0.0f;
+	for (const char* name : { "walk", "run" })
+	{
+		const AnimationClip* a = source.FindClip(name);
+		const AnimationClip* b = compressed.FindClip(name);
+		for (float t : times)
+		{
+			for (UINT i = 0; i < boneCount; ++i)
+			{
+				XMVECTOR s0, q0, p0, s1, q1, p1;
+				a->SampleBone(i, t, s0, q0, p0);
+				b->SampleBone(i, t, s1, q1, p1);
+
+				float dot = std::fabs(XMVectorGetX(XMQuaternionDot(XMQuaternionNormalize(q0), XMQuaternionNormalize(q1))));
+				maxTranslationError = MathHelper::Max(maxTranslationError, XMVectorGetX(XMVector3Length(XMVectorSubtract(p0, p1))));
+				maxRotationError = MathHelper::Max(maxRotationError, 2.0f * std::acos(MathHelper::Min(dot, 1.0f)));
+				maxScaleError = MathHelper::Max(maxScaleError, XMVectorGetX(XMVector3Length(XMVectorSubtract(s0, s1))));
+			}
+		}
+	}
+
+	// Reduced keys are within the tolerances; quantization adds a little on
+	// top, well under a second tolerance.
+	bool withinTolerance = maxTranslationError <= 2.0f * settings.TranslationTolerance &&
+		maxRotationError <= 2.0f * settings.RotationTolerance &&
+		maxScaleError <= 2.0f * settings.ScaleTolerance;
+
+	PoseWorkspace workspace;
+	std::vector<XMFLOAT4X4> palette(boneCount);
+	auto timeSampling = [&](const SkinnedData& data)
+	{
+		const AnimationClip* clip = data.FindClip("walk");
+		return BestTime([&]()
+		{
+			for (float t : times)
+				data.GetFinalTransforms(*clip, t, workspace, palette.data());
+		}) * 1000.0 / sampleCount;
+	};
+	double sourceUs = timeSampling(source);
+	double compressedUs = timeSampling(compressed);
+
+	TestReport report("Animation compression benchmark (2 clips, " + std::to_string(boneCount) + " bones, " +
+		std::to_string(keyCount) + " keys)");
+	report.Line("size: " + std::to_string(stats.SourceBytes) + " bytes become " + std::to_string(stats.CompressedBytes) +
+		", ratio " + std::to_string(stats.Ratio()) + ", " + std::to_string(stats.SourceKeys) + " keys become " +
+		std::to_string(stats.CompressedKeys) + " channel keys, " + std::to_string(stats.ConstantChannels) + " constant channels");
+	report.Line("max error at keys: " + std::to_string(stats.MaxTranslationError) + " translation, " +
+		std::to_string(stats.MaxRotationError) + " rad rotation, " + std::to_string(stats.MaxScaleError) + " scale");
+	report.Line("max error at " + std::to_string(sampleCount) + " random times: " + std::to_string(maxTranslationError) +
+		" translation, " + std::to_string(maxRotationError) + " rad rotation, " + std::to_string(maxScaleError) + " scale");
+	report.Line("palette: " + std::to_string(sourceUs) + " us float tracks, " + std::to_string(compressedUs) + " us compressed");
+	report.Check(withinTolerance, "error at random times above tolerance");
+
+	return report;
+}
+
+TestReport TestSkeletonLanes()
+{
+	const UINT instanceCount = 1024;
+	const UINT boneCount = 60;
+
+	SkinnedData data;
+	BuildTestSkeleton(boneCount, 31, { "walk" }, data);
+	const AnimationClip* clip = data.FindClip("walk");
+
+	std::mt19937 rng(29);
+	std::uniform_real_distribution<float> pickTime(0.0f, 2.0f);
+	std::vector<float> times(instanceCount);
+	for (float& t : times)
+		t = pickTime(rng);
+
+	std::vector<PoseWorkspace> workspaces(instanceCount);
+	std::vector<XMFLOAT4X4> scalar(instanceCount * boneCount);
+	std::vector<XMFLOAT4X4> lanes(instanceCount * boneCount);
+
+	double scalarMs = BestTime([&]()
+	{
+		for (UINT j = 0; j < instanceCount; ++j)
+			data.GetFinalTransforms(*clip, times[j], workspaces[j], &scalar[j * boneCount]);
+	});
+
+	double interpolateMs = BestTime([&]()
+	{
+		for (UINT j = 0; j < instanceCount; ++j)
+			clip->Interpolate(times[j], workspaces[j].ToParentTransforms);
+	});
+
+	SkeletonLaneWorkspace laneWorkspace;
+	double hierarchyMs = BestTime([&]()
+	{
+		for (UINT j = 0; j < instanceCount; j += SkeletonLaneCount)
+		{
+			const XMFLOAT4X4* toParent[SkeletonLaneCount];
+			XMFLOAT4X4* finalTransforms[SkeletonLaneCount];
+			for (UINT lane = 0; lane < SkeletonLaneCount; ++lane)
+			{
+				toParent[lane] = workspaces[j + lane].ToParentTransforms.data();
+				finalTransforms[lane] = &lanes[(j + lane) * boneCount];
+			}
+			data.ConcatenateHierarchyLanes(toParent, finalTransforms, SkeletonLaneCount, laneWorkspace);
+		}
+	});
+
+	float maxDifference = MaxPaletteDifference(scalar.data(), lanes.data(), instanceCount * boneCount);
+
+	// The scalar hierarchy pass is what remains of a palette after interpolation.
+	double scalarHierarchyMs = scalarMs - interpolateMs;
+	double perInstance = 1000.0 / instanceCount;
+
+	TestReport report("Skeleton lane benchmark (" + std::to_string(instanceCount) + " instances, " +
+		std::to_string(boneCount) + " bones, " + std::to_string(SkeletonLaneCount) + " lanes)");
+	report.Line("scalar palette: " + std::to_string(scalarMs * perInstance) + " us per instance, of which interpolation " +
+		std::to_string(interpolateMs * perInstance) + " us");
+	report.Line("hierarchy pass: " + std::to_string(scalarHierarchyMs * perInstance) + " us scalar, " +
+		std::to_string(hierarchyMs * perInstance) + " us in lanes, " + std::to_string(scalarHierarchyMs / hierarchyMs) +
+		"x, max difference " + std::to_string(maxDifference));
+	report.Check(maxDifference <= 1e-3f, "lane palettes differ from scalar");
+
+	return report;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "test_report.h"
+
+class JobSystem;
+
+// Animates a controller for 10k frames with a plain clip, cross-fades, blend
+// layers and the thread local workspace, counting the heap allocations made
+// after the first frame; each case should make none.
+TestReport TestPoseAllocations();
+
+// Animates 2001 controllers of two skeletons one at a time on the calling
+// thread and with AnimationBatch on the job system, reports instances
+// animated per millisecond and checks every batched palette against the
+// same controller animated on its own.
+TestReport TestAnimationBatch(JobSystem& jobs);
+
+// Animates a crowd of 2000 controllers playing in eight groups with
+// AnimationBatch, without and with a shared PoseCache, and checks the cached
+// palettes against evaluating each snapped time directly.
+TestReport TestPoseCache(JobSystem& jobs);
+
+// Compresses two 60-bone clips with the default tolerances, reports the
+// compression ratio and the largest error against the float tracks at
+// random times, and times sampling a palette from each.
+TestReport TestAnimationCompression();
+
+// Builds 1024 palettes of a 60-bone skeleton one at a time and with
+// SkinnedData::ConcatenateHierarchyLanes, and reports the time of the
+// hierarchy pass each way and the largest difference.
+TestReport TestSkeletonLanes();
@@ -0,0 +1,33 @@
+#include "counting_allocator.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	thread_local UINT64 gThreadAllocations = 0;
+}
+
+UINT64 ThreadAllocationCount()
+{
+	return gThreadAllocations;
+}
+
+// Counts every allocation so the tests can check a code path does not
+// allocate.
+void* operator new(std::size_t size)
+{
+	++gThreadAllocations;
+	if (void* p = std::malloc(size > 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p)noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t)noexcept
+{
+	std::free(p);
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <Windows.h>
+
+// Heap allocations made by the calling thread so far.  Counted by the global
+// operator new of counting_allocator.cpp, which only the test executable
+// links; the app keeps the default allocator.
+UINT64 ThreadAllocationCount();
@@ -0,0 +1,381 @@
+#include "draw_tests.h"
+#include <algorithm>
+#include <random>
+#include "command_recorder.h"
+#include "draw_packet.h"
+#include "frame_resource.h"
+#include "instance_batcher.h"
+#include "job_system.h"
+#include "math_helper.h"
+
+namespace
+{
+	// Stands in for the device when recording command lists: hands out no
+	// lists, and logs the calls so the recording can be checked.
+	class MockCommandRecorder : public CommandRecorder
+	{
+	public:
+		explicit MockCommandRecorder(UINT listCount) :
+			mBegun(listCount, 0), mEnded(listCount, 0)
+		{
+		}
+
+		ID3D12GraphicsCommandList* BeginList(UINT list)override
+		{
+			++mBegun[list];
+			return nullptr;
+		}
+
+		void EndList(UINT list)override
+		{
+			++mEnded[list];
+		}
+
+		void Submit(UINT listCount)override
+		{
+			++mSubmits;
+			mSubmittedLists = listCount;
+
+			// Every list must be recorded exactly once before the submit.
+			for (UINT list = 0; list < (UINT)mBegun.size(); ++list)
+				mRecordedOnce = mRecordedOnce && mBegun[list] == 1 && mEnded[list] == 1;
+		}
+
+		// One submit of every list, each recorded once.
+		bool Valid()const
+		{
+			return mSubmits == 1 && mSubmittedLists == mBegun.size() && mRecordedOnce;
+		}
+
+	private:
+		// Lists are begun and ended on different threads, but each list only
+		// on one, so each slot has a single writer.
+		std::vector<UINT> mBegun;
+		std::vector<UINT> mEnded;
+		UINT mSubmits = 0;
+		UINT mSubmittedLists = 0;
+		bool mRecordedOnce = true;
+	};
+
+	// Pipeline states are only compared by pointer, so the tests hand out
+	// distinct pointers that are never dereferenced.
+	ID3D12PipelineState* FakePso(UINT i)
+	{
+		return reinterpret_cast<ID3D12PipelineState*>((UINT_PTR)(i + 1) * 64);
+	}
+}
+
+TestReport TestInstanceBatcher()
+{
+	const UINT itemCount = 100000;
+	const UINT meshCount = 64;
+	const UINT lodCount = 4;
+
+	// Items spread over a few meshes of two geometries, each drawn at one of
+	// its levels of detail.  Only the draw state matters to the batcher.
+	MeshGeometry geos[2];
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<UINT> pickMesh(0, meshCount - 1);
+	std::uniform_int_distribution<UINT> pickLod(0, lodCount - 1);
+
+	std::vector<RenderItemDraw> draws(itemCount);
+	std::vector<UINT> items(itemCount);
+	for (UINT i = 0; i < itemCount; ++i)
+	{
+		UINT mesh = pickMesh(rng);
+		UINT lod = pickLod(rng);
+
+		RenderItemDraw& draw = draws[i];
+		draw.Geo = &geos[mesh % 2];
+		draw.IndexCount = 3000 >> lod;
+		draw.StartIndexLocation = (mesh * lodCount + lod) * 3000;
+		draw.BaseVertexLocation = (int)mesh * 1000;
+
+		items[i] = i;
+	}
+
+	// Time regrouping a list that changed every run, then a list that did
+	// not, which keeps the batches.
+	InstanceBatcher batcher;
+	std::vector<UINT> reversed(items.rbegin(), items.rend());
+	bool flip = false;
+	double buildMs = BestTime([&]()
+	{
+		flip = !flip;
+		batcher.Build(flip ? items : reversed, draws);
+	});
+	batcher.Build(items, draws);
+	UINT64 version = batcher.Version();
+	double unchangedMs = BestTime([&]() { batcher.Build(items, draws); });
+	bool kept = batcher.Version() == version;
+
+	// A level of detail change regroups.
+	draws[0].IndexCount = draws[0].IndexCount == 3000 ? 1500 : 3000;
+	bool lodRebuilds = batcher.Build(items, draws);
+	draws[0].IndexCount = draws[0].IndexCount == 3000 ? 1500 : 3000;
+	batcher.Build(items, draws);
+
+	// Every item is drawn exactly once, and the items of a batch share its draw.
+	std::vector<UINT> drawn(itemCount, 0);
+	for (UINT item : batcher.SingleItems())
+		++drawn[item];
+	bool sameDraws = true;
+	for (const InstanceBatch& batch : batcher.Batches())
+	{
+		const RenderItemDraw& first = draws[batch.Item];
+		for (UINT i = 0; i < batch.InstanceCount; ++i)
+		{
+			UINT item = batcher.Instances()[batch.FirstInstance + i];
+			++drawn[item];
+			sameDraws = sameDraws && draws[item].Geo == first.Geo &&
+				draws[item].StartIndexLocation == first.StartIndexLocation &&
+				draws[item].IndexCount == first.IndexCount;
+		}
+	}
+	bool valid = sameDraws && std::all_of(drawn.begin(), drawn.end(), [](UINT n) { return n == 1; });
+
+	// The demo scene: five rows of two cylinders and two spheres.
+	std::vector<RenderItemDraw> sceneDraws(20);
+	std::vector<UINT> sceneItems(20);
+	for (UINT i = 0; i < 20; ++i)
+	{
+		sceneDraws[i].Geo = &geos[0];
+		sceneDraws[i].IndexCount = i % 4 < 2 ? 1200 : 2400;
+		sceneDraws[i].StartIndexLocation = i % 4 < 2 ? 0 : 1200;
+		sceneItems[i] = i;
+	}
+	InstanceBatcher sceneBatcher;
+	sceneBatcher.Build(sceneItems, sceneDraws);
+
+	TestReport report("InstanceBatcher benchmark (" + std::to_string(itemCount) + " items, " +
+		std::to_string(meshCount) + " meshes, " + std::to_string(lodCount) + " LODs)");
+	report.Line("build: " + std::to_string(buildMs) + " ms, " + std::to_string(itemCount) + " draws become " +
+		std::to_string(batcher.DrawCount()));
+	report.Line("unchanged list: " + std::to_string(unchangedMs) + " ms");
+
+	// The batches upload an index per instance when they change; the instance
+	// data is written per item with the object constants, only when dirty.
+	size_t instanceCount = batcher.Instances().size();
+	report.Line("upload per change: " + std::to_string(instanceCount * sizeof(UINT) / 1024) +
+		" KB of indices, was " + std::to_string(instanceCount * sizeof(InstanceData) / 1024) +
+		" KB of instance data every frame");
+	report.Line("demo scene: " + std::to_string(sceneItems.size()) + " draws become " +
+		std::to_string(sceneBatcher.DrawCount()));
+	report.Check(valid, "items lost or mixed");
+	report.Check(kept, "unchanged list rebuilt");
+	report.Check(lodRebuilds, "LOD change not regrouped");
+
+	return report;
+}
+
+TestReport TestDrawPackets()
+{
+	const UINT packetCount = 100000;
+	const UINT layerCount = 4;
+	const UINT psoCount = 8;
+	const UINT geoCount = 64;
+	const UINT materialCount = 256;
+
+	// Random draws over a few layers, pipeline states, geometries and
+	// materials.
+	MeshGeometry geos[geoCount];
+	ID3D12PipelineState* psos[psoCount];
+	for (UINT i = 0; i < psoCount; ++i)
+		psos[i] = FakePso(i);
+
+	std::mt19937 rng(11);
+	std::uniform_int_distribution<UINT> pickLayer(0, layerCount - 1);
+	std::uniform_int_distribution<UINT> pickPso(0, psoCount - 1);
+	std::uniform_int_distribution<UINT> pickGeo(0, geoCount - 1);
+	std::uniform_int_distribution<UINT> pickMaterial(0, materialCount - 1);
+	std::uniform_real_distribution<float> pickDepth(0.0f, 1000.0f);
+
+	DrawPacketList unsorted;
+	for (UINT i = 0; i < packetCount; ++i)
+	{
+		unsorted.Add(MakeDrawKey(pickLayer(rng), pickPso(rng), pickGeo(rng), pickMaterial(rng),
+			DrawKeyDepth(pickDepth(rng), 1000.0f)), i);
+	}
+
+	// Refill the same list every run, as a renderer does every frame, and
+	// time only the sort.
+	DrawPacketList radix;
+	double radixMs = 0.0;
+	for (int run = 0; run < BenchmarkRuns; ++run)
+	{
+		radix.Clear();
+		for (const DrawPacket& packet : unsorted.Packets())
+			radix.Add(packet.Key, packet.Item);
+		double ms = TimeOnce([&]() { radix.Sort(); });
+		if (run == 0 || ms < radixMs)
+			radixMs = ms;
+	}
+
+	std::vector<DrawPacket> reference;
+	double stdMs = 0.0;
+	for (int run = 0; run < BenchmarkRuns; ++run)
+	{
+		reference = unsorted.Packets();
+		double ms = TimeOnce([&]()
+		{
+			std::stable_sort(reference.begin(), reference.end(),
+				[](const DrawPacket& a, const DrawPacket& b) { return a.Key < b.Key; });
+		});
+		if (run == 0 || ms < stdMs)
+			stdMs = ms;
+	}
+
+	auto samePackets = [](const std::vector<DrawPacket>& a, const std::vector<DrawPacket>& b)
+	{
+		return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+			[](const DrawPacket& x, const DrawPacket& y) { return x.Key == y.Key && x.Item == y.Item; });
+	};
+	bool same = samePackets(reference, radix.Packets());
+
+	// Keys that differ in every bit leave no room for the packet index, and
+	// keys with few values have long runs of equal keys.
+	bool sameEdgeCases = true;
+	std::uniform_int_distribution<UINT64> pickKey;
+	for (UINT64 keyMask : { ~0ull, 0x3ull << 40 })
+	{
+		DrawPacketList edge;
+		for (UINT i = 0; i < 5000; ++i)
+			edge.Add(pickKey(rng) & keyMask, i);
+		std::vector<DrawPacket> expected = edge.Packets();
+		std::stable_sort(expected.begin(), expected.end(),
+			[](const DrawPacket& a, const DrawPacket& b) { return a.Key < b.Key; });
+		edge.Sort();
+		sameEdgeCases = sameEdgeCases && samePackets(expected, edge.Packets());
+	}
+
+	// The state changes DrawPackets would make emitting each order.
+	auto emit = [&](const std::vector<DrawPacket>& packets)
+	{
+		DrawStateCache state;
+		for (const DrawPacket& packet : packets)
+		{
+			state.SetPso(psos[DrawKeyPso(packet.Key)]);
+			state.SetGeometry(&geos[DrawKeyGeometry(packet.Key)]);
+			state.SetTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			state.SetSkinnedCB(UINT(-1));
+			state.CountDraw();
+		}
+		return state.Stats();
+	};
+	DrawStateStats unsortedStats = emit(unsorted.Packets());
+	DrawStateStats sortedStats = emit(radix.Packets());
+
+	auto statsLine = [](const char* name, const DrawStateStats& stats)
+	{
+		return std::string(name) + ": " + std::to_string(stats.Changes()) + " state changes for " +
+			std::to_string(stats.Draws) + " draws (" + std::to_string(stats.PsoChanges) + " PSO, " +
+			std::to_string(stats.GeometryChanges) + " geometry)";
+	};
+
+	// Sorting a frame's packets should take well under a millisecond.  It is
+	// reported, not checked: Debug builds, busy machines and slow cores miss
+	// it, so the speedup over std::stable_sort is reported with it.
+	const double budgetMs = 1.0;
+
+	TestReport report("Draw packet benchmark (" + std::to_string(packetCount) + " packets, " +
+		std::to_string(psoCount) + " PSOs, " + std::to_string(geoCount) + " geometries)");
+	report.Line("radix sort: " + std::to_string(radixMs) + " ms of a " + std::to_string(budgetMs) + " ms budget, " +
+		(radixMs < budgetMs ? "met" : "missed"));
+	report.Line("std::stable_sort: " + std::to_string(stdMs) + " ms, " + std::to_string(stdMs / radixMs) +
+		"x the radix sort time");
+	report.Line(statsLine("unsorted", unsortedStats));
+	report.Line(statsLine("sorted", sortedStats));
+	report.Check(same, "radix sort differs from std::stable_sort");
+	report.Check(sameEdgeCases, "radix sort differs from std::stable_sort for wide or repeated keys");
+	report.Check(sortedStats.Changes() < unsortedStats.Changes(), "sorting saved no state changes");
+
+	return report;
+}
+
+TestReport TestCommandRecording(JobSystem& jobs)
+{
+	const UINT packetCount = 100000;
+	const UINT packetsPerList = 1024;
+	const UINT psoCount = 8;
+	const UINT geoCount = 64;
+
+	MeshGeometry geos[geoCount];
+	ID3D12PipelineState* psos[psoCount];
+	for (UINT i = 0; i < psoCount; ++i)
+		psos[i] = FakePso(i);
+
+	std::mt19937 rng(13);
+	std::uniform_int_distribution<UINT> pickPso(0, psoCount - 1);
+	std::uniform_int_distribution<UINT> pickGeo(0, geoCount - 1);
+	std::uniform_int_distribution<UINT> pickMaterial(0, 255);
+	std::uniform_real_distribution<float> pickDepth(0.0f, 1000.0f);
+
+	DrawPacketList packets;
+	for (UINT i = 0; i < packetCount; ++i)
+		packets.Add(MakeDrawKey(0, pickPso(rng), pickGeo(rng), pickMaterial(rng), DrawKeyDepth(pickDepth(rng), 1000.0f)), i);
+	packets.Sort();
+
+	// Each list "records" its packets into a command stream of its own: the
+	// state binds the draw cache lets through and one word per draw.
+	UINT listCount = (packetCount + packetsPerList - 1) / packetsPerList;
+	std::vector<std::vector<UINT64>> streams(listCount);
+
+	ParallelRecording recording;
+	for (UINT list = 0; list < listCount; ++list)
+	{
+		UINT begin = list * packetsPerList;
+		UINT end = MathHelper::Min(begin + packetsPerList, packetCount);
+		recording.Add([&, list, begin, end](ID3D12GraphicsCommandList*)
+		{
+			std::vector<UINT64>& stream = streams[list];
+			stream.clear();
+
+			DrawStateCache state;
+			for (UINT p = begin; p < end; ++p)
+			{
+				const DrawPacket& packet = packets.Packets()[p];
+				if (state.SetPso(psos[DrawKeyPso(packet.Key)]))
+					stream.push_back(DrawKeyPso(packet.Key));
+				if (state.SetGeometry(&geos[DrawKeyGeometry(packet.Key)]))
+					stream.push_back(DrawKeyGeometry(packet.Key));
+				stream.push_back(packet.Key);
+				stream.push_back(packet.Item);
+			}
+		});
+	}
+
+	// The submitted commands, in submission order.
+	auto submitted = [&]()
+	{
+		std::vector<UINT64> commands;
+		for (const std::vector<UINT64>& stream : streams)
+			commands.insert(commands.end(), stream.begin(), stream.end());
+		return commands;
+	};
+
+	bool valid = true;
+	double serialMs = BestTime([&]()
+	{
+		MockCommandRecorder recorder(listCount);
+		recording.Execute(recorder, nullptr);
+		valid = valid && recorder.Valid();
+	});
+	std::vector<UINT64> serialCommands = submitted();
+
+	double parallelMs = BestTime([&]()
+	{
+		MockCommandRecorder recorder(listCount);
+		recording.Execute(recorder, &jobs);
+		valid = valid && recorder.Valid();
+	});
+	bool sameCommands = submitted() == serialCommands;
+
+	TestReport report("Command recording benchmark (" + std::to_string(packetCount) + " draws in " +
+		std::to_string(listCount) + " lists, mock recorder)");
+	report.Line("serial: " + std::to_string(serialMs) + " ms");
+	report.Line("job system: " + std::to_string(parallelMs) + " ms on " + std::to_string(jobs.ThreadCount()) + " threads");
+	report.Check(sameCommands, "commands differ");
+	report.Check(valid, "lists not submitted once");
+
+	return report;
+}
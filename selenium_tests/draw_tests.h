@@ -0,0 +1,22 @@
+#pragma once
+#include "test_report.h"
+
+class JobSystem;
+
+// Groups 100k random draws of a few meshes and LODs with InstanceBatcher,
+// reports the draw count before and after, and checks that every item is
+// drawn once with its own draw, that an unchanged list keeps the batches and
+// that a LOD change regroups.
+TestReport TestInstanceBatcher();
+
+// Sorts 100k random draw packets with DrawPacketList against
+// std::stable_sort, counts the state changes of emitting them unsorted and
+// sorted, and reports the sort time against its 1 ms budget.  Checks that
+// both orders match, also for keys too wide to pack and repeated keys.
+TestReport TestDrawPackets();
+
+// Records 100k sorted draws into a hundred command lists through
+// ParallelRecording and a mock CommandRecorder, on the calling thread and
+// with the job system, and checks both submit the same commands in the same
+// order.
+TestReport TestCommandRecording(JobSystem& jobs);
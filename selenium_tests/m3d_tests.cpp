@@ -0,0 +1,318 @@
+#include "m3d_tests.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "index_buffer.h"
+#include "job_system.h"
+#include "m3d_binary.h"
+#include "test_fixtures.h"
+
+using namespace DirectX;
+
+TestReport TestM3dBinary()
+{
+	const UINT vertexCount = 50000;
+	const UINT boneCount = 60;
+	const UINT clipCount = 8;
+	const UINT keyCount = 60;
+	const std::string textFilename = "test.m3d";
+	const std::string binaryFilename = "test.m3db";
+	const std::string invalidFilename = "test_invalid.m3db";
+
+	TestReport report("M3D binary benchmark (" + std::to_string(vertexCount) + " vertices, " +
+		std::to_string(boneCount) + " bones, " + std::to_string(clipCount) + " clips of " + std::to_string(keyCount) +
+		" keys)");
+
+	UINT64 textBytes = WriteTestM3d(textFilename, vertexCount, boneCount, clipCount, keyCount);
+	if (!report.Check(textBytes != 0, "could not write " + textFilename))
+		return report;
+
+	std::vector<SkinnedVertex> vertices;
+	std::vector<UINT> indices;
+	std::vector<M3DLoader::Subset> subsets;
+	std::vector<M3DLoader::MaterialInfo> mats;
+	SkinnedData skinnedData;
+
+	// What the app does with each: the text loaders build everything, the
+	// binary file hands out views and copies only materials and clips.
+	auto timeText = [&](M3DLoader::ParseMode mode)
+	{
+		M3DLoader loader;
+		loader.Mode = mode;
+		return TimeOnce([&]() { loader.LoadM3d(textFilename, vertices, indices, subsets, mats, skinnedData); });
+	};
+	double streamMs = timeText(M3DLoader::ParseMode::Stream);
+	double bufferMs = timeText(M3DLoader::ParseMode::Buffer);
+
+	double convertMs = TimeOnce([&]() { M3DBinaryFile::Convert(textFilename, binaryFilename); });
+
+	UINT64 binaryBytes = 0;
+	double binaryMs = BestTime([&]()
+	{
+		M3DBinaryFile file;
+		if (file.Open(binaryFilename))
+		{
+			file.GetMaterials(mats);
+			file.GetSkinnedData(skinnedData);
+			binaryBytes = (UINT64)file.Vertices().Size * sizeof(SkinnedVertex);
+		}
+	});
+
+	report.Line("text, stream: " + std::to_string(streamMs) + " ms, " + std::to_string(textBytes / (1024 * 1024)) + " MB");
+	report.Line("text, buffer: " + std::to_string(bufferMs) + " ms");
+	report.Line("binary: " + std::to_string(binaryMs) + " ms to open with " + std::to_string(binaryBytes / 1024) +
+		" KB of vertices mapped, " + std::to_string(bufferMs / binaryMs) + "x the buffer parser; converting took " +
+		std::to_string(convertMs) + " ms");
+
+	// Validation: the converted file is current until its source changes,
+	// and files that are cut short or refer outside their sections are
+	// refused.
+	{
+		M3DBinaryFile file;
+		report.Check(file.Open(binaryFilename) && file.IsCurrent(textFilename), "converted file");
+	}
+
+	{
+		std::ofstream(textFilename, std::ios::app) << "\n";
+		M3DBinaryFile file;
+		report.Check(file.Open(binaryFilename) && !file.IsCurrent(textFilename), "stale source");
+	}
+
+	{
+		std::ifstream fin(binaryFilename, std::ios::binary);
+		std::vector<char> bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+		std::ofstream(invalidFilename, std::ios::binary).write(bytes.data(), bytes.size() - 64);
+		M3DBinaryFile file;
+		report.Check(!file.Open(invalidFilename), "truncated file");
+	}
+
+	// A small model to write broken copies of.
+	std::vector<XMFLOAT4X4> boneOffsets;
+	std::vector<int> boneHierarchy;
+	std::unordered_map<std::string, AnimationClip> clips;
+	WriteTestM3d(textFilename, 1000, 4, 1, 4);
+	M3DLoader loader;
+	loader.LoadM3d(textFilename, vertices, indices, subsets, mats, boneOffsets, boneHierarchy, clips);
+
+	auto refused = [&](const char* name, const std::vector<M3DLoader::Subset>& badSubsets, const std::vector<int>& badHierarchy)
+	{
+		M3DBinaryFile file;
+		report.Check(M3DBinaryFile::Write(invalidFilename, vertices, indices, badSubsets, std::vector<LodRange>(), mats,
+			boneOffsets, badHierarchy, clips) && !file.Open(invalidFilename), name);
+	};
+
+	std::vector<int> cyclicHierarchy = boneHierarchy;
+	cyclicHierarchy[1] = 3;
+	refused("bone parent after child", subsets, cyclicHierarchy);
+
+	std::vector<M3DLoader::Subset> bigSubsets = subsets;
+	bigSubsets.back().VertexCount += 1;
+	refused("subset past the vertices", bigSubsets, boneHierarchy);
+
+	std::remove(textFilename.c_str());
+	std::remove(binaryFilename.c_str());
+	std::remove(invalidFilename.c_str());
+
+	return report;
+}
+
+TestReport TestM3dParser(JobSystem& jobs)
+{
+	const UINT vertexCount = 50000;
+	const UINT boneCount = 60;
+	const UINT clipCount = 8;
+	const UINT keyCount = 60;
+	const std::string filename = "test.m3d";
+
+	TestReport report("M3D parser benchmark (" + std::to_string(vertexCount) + " vertices, " +
+		std::to_string(clipCount) + " clips)");
+
+	UINT64 fileBytes = WriteTestM3d(filename, vertexCount, boneCount, clipCount, keyCount);
+	if (!report.Check(fileBytes != 0, "could not write " + filename))
+		return report;
+
+	// Everything a parser produces.
+	struct Model
+	{
+		std::vector<SkinnedVertex> Vertices;
+		std::vector<UINT> Indices;
+		std::vector<M3DLoader::Subset> Subsets;
+		std::vector<M3DLoader::MaterialInfo> Mats;
+		std::vector<XMFLOAT4X4> BoneOffsets;
+		std::vector<int> BoneHierarchy;
+		std::unordered_map<std::string, AnimationClip> Clips;
+	};
+
+	auto load = [&](M3DLoader::ParseMode mode, JobSystem* loaderJobs, Model& model)
+	{
+		M3DLoader loader;
+		loader.Mode = mode;
+		loader.Jobs = loaderJobs;
+		return BestTime([&]()
+		{
+			model = Model();
+			loader.LoadM3d(filename, model.Vertices, model.Indices, model.Subsets, model.Mats,
+				model.BoneOffsets, model.BoneHierarchy, model.Clips);
+		});
+	};
+
+	auto sameBytes = [](const auto& a, const auto& b)
+	{
+		return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0);
+	};
+
+	auto same = [&](const Model& a, const Model& b)
+	{
+		bool equal = sameBytes(a.Vertices, b.Vertices) && sameBytes(a.Indices, b.Indices) &&
+			sameBytes(a.Subsets, b.Subsets) && sameBytes(a.BoneOffsets, b.BoneOffsets) &&
+			sameBytes(a.BoneHierarchy, b.BoneHierarchy) &&
+			a.Mats.size() == b.Mats.size() && a.Clips.size() == b.Clips.size();
+
+		for (size_t i = 0; equal && i < a.Mats.size(); ++i)
+		{
+			const M3DLoader::MaterialInfo& x = a.Mats[i];
+			const M3DLoader::MaterialInfo& y = b.Mats[i];
+			equal = x.Name == y.Name && x.MaterialTypeName == y.MaterialTypeName &&
+				x.DiffuseMapName == y.DiffuseMapName && x.NormalMapName == y.NormalMapName &&
+				x.AlphaClip == y.AlphaClip && x.Roughness == y.Roughness &&
+				std::memcmp(&x.DiffuseAlbedo, &y.DiffuseAlbedo, sizeof(x.DiffuseAlbedo)) == 0 &&
+				std::memcmp(&x.FresnelR0, &y.FresnelR0, sizeof(x.FresnelR0)) == 0;
+		}
+
+		for (const auto& clip : a.Clips)
+		{
+			auto other = b.Clips.find(clip.first);
+			equal = equal && other != b.Clips.end() &&
+				clip.second.BoneAnimations.size() == other->second.BoneAnimations.size();
+			for (size_t i = 0; equal && i < clip.second.BoneAnimations.size(); ++i)
+				equal = sameBytes(clip.second.BoneAnimations[i].Keyframes, other->second.BoneAnimations[i].Keyframes);
+		}
+
+		return equal;
+	};
+
+	Model stream;
+	Model buffer;
+	Model serialSections;
+	Model parallel;
+	double streamMs = load(M3DLoader::ParseMode::Stream, nullptr, stream);
+	double bufferMs = load(M3DLoader::ParseMode::Buffer, nullptr, buffer);
+	double serialSectionsMs = load(M3DLoader::ParseMode::Parallel, nullptr, serialSections);
+	double parallelMs = load(M3DLoader::ParseMode::Parallel, &jobs, parallel);
+
+	std::remove(filename.c_str());
+
+	double megabytes = fileBytes / (1024.0 * 1024.0);
+	report.Line("stream: " + std::to_string(streamMs) + " ms, " + std::to_string(megabytes * 1000.0 / streamMs) +
+		" MB/s of " + std::to_string(megabytes) + " MB");
+	report.Line("buffer: " + std::to_string(bufferMs) + " ms, " + std::to_string(megabytes * 1000.0 / bufferMs) +
+		" MB/s, " + std::to_string(streamMs / bufferMs) + "x");
+	report.Line("sections, no job system: " + std::to_string(serialSectionsMs) + " ms");
+	report.Line("sections as jobs: " + std::to_string(parallelMs) + " ms on " + std::to_string(jobs.ThreadCount()) +
+		" threads, " + std::to_string(megabytes * 1000.0 / parallelMs) + " MB/s, " + std::to_string(bufferMs / parallelMs) +
+		"x the buffer parser");
+	report.Check(same(stream, buffer) && stream.Vertices.size() == vertexCount, "buffer parser differs from stream");
+	report.Check(same(buffer, serialSections) && same(buffer, parallel), "section jobs differ from buffer parser");
+
+	return report;
+}
+
+TestReport TestIndexPacking()
+{
+	const UINT vertexCount = 120000;
+	const std::string textFilename = "test.m3d";
+	const std::string binaryFilename = "test.m3db";
+
+	TestReport report("Index packing benchmark (" + std::to_string(vertexCount) + " vertices)");
+
+	// A model with two subsets of 60000 vertices each: the text loader must
+	// keep indices above 65535 and the converted file must still get 16-bit
+	// indices by rebasing each subset.
+	if (!report.Check(WriteTestM3d(textFilename, vertexCount, 4, 1, 4) != 0, "could not write " + textFilename))
+		return report;
+
+	std::vector<SkinnedVertex> vertices;
+	std::vector<UINT> indices;
+	std::vector<M3DLoader::Subset> subsets;
+	std::vector<M3DLoader::MaterialInfo> mats;
+	std::vector<XMFLOAT4X4> boneOffsets;
+	std::vector<int> boneHierarchy;
+	std::unordered_map<std::string, AnimationClip> clips;
+	M3DLoader loader;
+	loader.LoadM3d(textFilename, vertices, indices, subsets, mats, boneOffsets, boneHierarchy, clips);
+	std::remove(textFilename.c_str());
+
+	UINT maxIndex = 0;
+	for (UINT i : indices)
+		maxIndex = i > maxIndex ? i : maxIndex;
+	report.Check(maxIndex >= 65536, "32-bit text indices");
+
+	// Written as loaded, without the reordering and LODs Convert adds.
+	M3DBinaryFile file;
+	if (report.Check(M3DBinaryFile::Write(binaryFilename, vertices, indices, subsets, std::vector<LodRange>(), mats,
+		boneOffsets, boneHierarchy, clips) && file.Open(binaryFilename), "binary file"))
+	{
+		bool same = file.IndexFormat() == DXGI_FORMAT_R16_UINT && file.Indices16().Size == indices.size() &&
+			file.Subsets().Size == subsets.size();
+		for (UINT s = 0; s < subsets.size() && same; ++s)
+		{
+			const M3DLoader::Subset& subset = subsets[s];
+			for (UINT i = subset.FaceStart * 3; i < (subset.FaceStart + subset.FaceCount) * 3 && same; ++i)
+				same = file.Indices16()[i] + (UINT)file.SubsetBaseVertices()[s] == indices[i];
+		}
+		report.Check(same, "rebased binary indices");
+	}
+	file.Close();
+	std::remove(binaryFilename.c_str());
+
+	// The same indices as submeshes, packed directly.
+	std::vector<SubmeshGeometry> submeshes(subsets.size());
+	for (UINT s = 0; s < subsets.size(); ++s)
+	{
+		submeshes[s].StartIndexLocation = subsets[s].FaceStart * 3;
+		submeshes[s].IndexCount = subsets[s].FaceCount * 3;
+	}
+
+	PackedIndices packed;
+	std::vector<SubmeshGeometry> rebased;
+	double packMs = BestTime([&]()
+	{
+		rebased = submeshes;
+		PackIndices(indices.data(), (UINT)indices.size(), rebased.data(), (UINT)rebased.size(), packed);
+	});
+
+	bool same = packed.Format == DXGI_FORMAT_R16_UINT;
+	for (const SubmeshGeometry& submesh : rebased)
+	{
+		for (UINT i = submesh.StartIndexLocation; i < submesh.StartIndexLocation + submesh.IndexCount && same; ++i)
+			same = packed.Indices16[i] + (UINT)submesh.BaseVertexLocation == indices[i];
+	}
+	report.Check(same, "rebased submeshes");
+
+	// One submesh spanning every vertex cannot be rebased and keeps 32-bit
+	// indices and its base vertex.
+	std::vector<SubmeshGeometry> whole(1);
+	whole[0].IndexCount = (UINT)indices.size();
+	PackedIndices wide;
+	PackIndices(indices.data(), (UINT)indices.size(), whole.data(), 1, wide);
+	report.Check(wide.Format == DXGI_FORMAT_R32_UINT && wide.Indices32 == indices && whole[0].BaseVertexLocation == 0,
+		"32-bit fallback");
+
+	// Indices that already fit are not touched.
+	std::vector<std::uint32_t> small(indices.begin(), indices.begin() + subsets[0].FaceCount * 3);
+	std::vector<SubmeshGeometry> smallSubmesh(1);
+	smallSubmesh[0].IndexCount = (UINT)small.size();
+	PackedIndices narrow;
+	PackIndices(small.data(), (UINT)small.size(), smallSubmesh.data(), 1, narrow);
+	same = narrow.Format == DXGI_FORMAT_R16_UINT && smallSubmesh[0].BaseVertexLocation == 0;
+	for (UINT i = 0; i < small.size() && same; ++i)
+		same = narrow.Indices16[i] == small[i];
+	report.Check(same, "16-bit mesh");
+
+	report.Line(std::to_string(indices.size()) + " indices up to " + std::to_string(maxIndex) + " packed into " +
+		std::to_string(packed.ByteSize() / 1024) + " KB instead of " + std::to_string(indices.size() * 4 / 1024) +
+		" KB in " + std::to_string(packMs) + " ms");
+
+	return report;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "test_report.h"
+
+class JobSystem;
+
+// Writes a 50k vertex text .m3d with eight clips to the working directory,
+// loads it with both text parsers and through M3DBinaryFile, and checks that
+// stale, truncated and inconsistent binary files are detected.
+TestReport TestM3dBinary();
+
+// Parses a 50k vertex text .m3d with the stream and buffer parsers and with
+// its sections decoded as jobs (with and without the job system), reports
+// the throughput of each in MB/s and checks that all produce exactly the
+// same vertices, indices, subsets, materials, skeleton and keys.
+TestReport TestM3dParser(JobSystem& jobs);
+
+// Loads a 120k vertex .m3d with two subsets and checks that indices above
+// 65535 survive the text loader, that the written .m3db and PackIndices
+// rebase the subsets to 16-bit indices, and that a single submesh over all
+// the vertices falls back to 32-bit indices.
+TestReport TestIndexPacking();
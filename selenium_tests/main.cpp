@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include "animation_tests.h"
+#include "draw_tests.h"
+#include "job_system.h"
+#include "m3d_tests.h"
+#include "mesh_tests.h"
+#include "scene_tests.h"
+#include "test_report.h"
+
+namespace
+{
+	struct Test
+	{
+		const char* Name;
+		std::function<TestReport()> Run;
+	};
+}
+
+// Runs the tests named on the command line, or all of them, and prints their
+// reports.  Returns 1 if a check failed and 2 for an unknown test name.
+int main(int argc, char* argv[])
+{
+	JobSystem jobs;
+
+	const Test tests[] =
+	{
+		{ "alloc", []() { return TestPoseAllocations(); } },
+		{ "anim", [&]() { return TestAnimationBatch(jobs); } },
+		{ "posecache", [&]() { return TestPoseCache(jobs); } },
+		{ "compress", []() { return TestAnimationCompression(); } },
+		{ "lanes", []() { return TestSkeletonLanes(); } },
+		{ "m3db", []() { return TestM3dBinary(); } },
+		{ "m3dparse", [&]() { return TestM3dParser(jobs); } },
+		{ "indices", []() { return TestIndexPacking(); } },
+		{ "geo", [&]() { return TestGeometryGenerator(jobs); } },
+		{ "vcache", []() { return TestMeshOptimizer(); } },
+		{ "vertexpack", []() { return TestVertexPacking(); } },
+		{ "meshlets", []() { return TestMeshlets(); } },
+		{ "lod", []() { return TestMeshSimplifier(); } },
+		{ "terrain", [&]() { return TestTerrain(jobs); } },
+		{ "bvh", []() { return TestSceneBvh(); } },
+		{ "cull", [&]() { return TestFrustumCuller(jobs); } },
+		{ "camera", []() { return TestCamera(); } },
+		{ "store", []() { return TestRenderItemStore(); } },
+		{ "dirty", []() { return TestDirtyTracking(); } },
+		{ "instance", []() { return TestInstanceBatcher(); } },
+		{ "packets", []() { return TestDrawPackets(); } },
+		{ "record", [&]() { return TestCommandRecording(jobs); } },
+	};
+
+	for (int arg = 1; arg < argc; ++arg)
+	{
+		bool known = false;
+		for (const Test& test : tests)
+			known = known || std::strcmp(argv[arg], test.Name) == 0;
+		if (!known)
+		{
+			std::printf("unknown test %s; the tests are:", argv[arg]);
+			for (const Test& test : tests)
+				std::printf(" %s", test.Name);
+			std::printf("\n");
+			return 2;
+		}
+	}
+
+	UINT testCount = 0;
+	UINT failedTests = 0;
+	for (const Test& test : tests)
+	{
+		bool selected = argc == 1;
+		for (int arg = 1; arg < argc; ++arg)
+			selected = selected || std::strcmp(argv[arg], test.Name) == 0;
+		if (!selected)
+			continue;
+
+		TestReport report = test.Run();
+		std::printf("[%s] %s\n", test.Name, report.Text().c_str());
+		std::fflush(stdout);
+
+		++testCount;
+		failedTests += report.Failures() > 0 ? 1 : 0;
+	}
+
+	std::printf("%u of %u tests pass\n", testCount - failedTests, testCount);
+	return failedTests > 0 ? 1 : 0;
+}
@@ -0,0 +1,773 @@
+#include "mesh_tests.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <thread>
+#include "geometry_generator.h"
+#include "job_system.h"
+#include "m3d_loader.h"
+#include "math_helper.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet.h"
+#include "terrain.h"
+#include "test_fixtures.h"
+#include "vertex_packing.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Best time of BenchmarkRuns calls of create, and the mesh of the last
+	// call.
+	double TimeGenerator(GeometryGenerator& geoGen,
+		const std::function<GeometryGenerator::MeshData(GeometryGenerator&)>& create,
+		GeometryGenerator::MeshData& mesh)
+	{
+		return BestTime([&]() { mesh = create(geoGen); });
+	}
+
+	// Vertex and index counts of a mesh of vertexCount vertices, edgeCount
+	// edges and triangleCount triangles after subdivisionCount calls of
+	// Subdivide: each call adds a vertex per edge, splits every edge in two
+	// with three new edges inside each triangle, and makes four triangles of
+	// one.
+	void SubdividedCounts(size_t vertexCount, size_t edgeCount, size_t triangleCount, UINT subdivisionCount,
+		size_t& outVertexCount, size_t& outIndexCount)
+	{
+		for (UINT i = 0; i < subdivisionCount; ++i)
+		{
+			vertexCount += edgeCount;
+			edgeCount = 2 * edgeCount + 3 * triangleCount;
+			triangleCount *= 4;
+		}
+		outVertexCount = vertexCount;
+		outIndexCount = triangleCount * 3;
+	}
+
+	// Whether a and b have the same vertices, bit for bit, and indices.
+	bool SameMesh(const GeometryGenerator::MeshData& a, const GeometryGenerator::MeshData& b)
+	{
+		if (a.Vertices.size() != b.Vertices.size() || a.Indices32 != b.Indices32)
+			return false;
+		for (size_t i = 0; i < a.Vertices.size(); ++i)
+		{
+			if (std::memcmp(&a.Vertices[i], &b.Vertices[i], sizeof(Vertex)) != 0)
+				return false;
+		}
+		return true;
+	}
+}
+
+TestReport TestGeometryGenerator(JobSystem& jobs)
+{
+	struct Shape
+	{
+		const char* Name;
+		std::function<GeometryGenerator::MeshData(GeometryGenerator&)> Create;
+		size_t VertexCount;
+		size_t IndexCount;
+	};
+
+	// The counts each shape must come out with, worked out from its
+	// tessellation.  A cylinder's caps each add a ring and a center vertex.
+	const UINT gridSize = 2048;
+	const UINT slices = 1024;
+	const UINT stacks = 1024;
+	const UINT subdivisions = GeometryGenerator::MaxSubdivisions;
+
+	size_t geosphereVertices, geosphereIndices;
+	SubdividedCounts(12, 30, 20, subdivisions, geosphereVertices, geosphereIndices);
+	size_t boxVertices, boxIndices;
+	SubdividedCounts(24, 30, 12, subdivisions, boxVertices, boxIndices);
+
+	const Shape shapes[] =
+	{
+		{ "grid 2048x2048", [=](GeometryGenerator& g) { return g.CreateGrid(100.0f, 100.0f, gridSize, gridSize); },
+			(size_t)gridSize * gridSize, (size_t)(gridSize - 1) * (gridSize - 1) * 6 },
+		{ "sphere 1024x1024", [=](GeometryGenerator& g) { return g.CreateSphere(1.0f, slices, stacks); },
+			2 + (size_t)(stacks - 1) * (slices + 1), (size_t)6 * slices * (stacks - 1) },
+		{ "cylinder 1024x1024", [=](GeometryGenerator& g) { return g.CreateCylinder(1.0f, 0.5f, 3.0f, slices, stacks); },
+			(size_t)(stacks + 1) * (slices + 1) + 2 * (slices + 2), (size_t)6 * slices * stacks + 6 * slices },
+		{ "geosphere 6", [=](GeometryGenerator& g) { return g.CreateGeosphere(1.0f, subdivisions); },
+			geosphereVertices, geosphereIndices },
+		{ "box 6", [=](GeometryGenerator& g) { return g.CreateBox(1.0f, 1.0f, 1.0f, subdivisions); },
+			boxVertices, boxIndices },
+	};
+
+	GeometryGenerator serialGen;
+	GeometryGenerator parallelGen;
+	parallelGen.Jobs = &jobs;
+
+	UINT cores = std::thread::hardware_concurrency();
+	TestReport report("GeometryGenerator benchmark (" + std::to_string(jobs.ThreadCount()) + " threads on " +
+		std::to_string(cores) + " hardware threads)");
+
+	double serialTotal = 0.0;
+	double parallelTotal = 0.0;
+	for (const Shape& shape : shapes)
+	{
+		GeometryGenerator::MeshData serialMesh;
+		GeometryGenerator::MeshData parallelMesh;
+		double serialMs = TimeGenerator(serialGen, shape.Create, serialMesh);
+		double parallelMs = TimeGenerator(parallelGen, shape.Create, parallelMesh);
+		serialTotal += serialMs;
+		parallelTotal += parallelMs;
+
+		size_t triangleCount = parallelMesh.Indices32.size() / 3;
+		report.Line(std::string(shape.Name) + ": " + std::to_string(triangleCount) + " triangles, " +
+			std::to_string(serialMs) + " ms serial, " + std::to_string(parallelMs) + " ms parallel, " +
+			std::to_string(serialMs / parallelMs) + "x, " + std::to_string(triangleCount / 1000.0 / parallelMs) +
+			" M triangles/s");
+
+		// The arrays are sized from the counts up front, so they must match
+		// the formulas exactly, and the jobs must not change a single vertex.
+		report.Check(serialMesh.Vertices.size() == shape.VertexCount &&
+			serialMesh.Indices32.size() == shape.IndexCount, std::string(shape.Name) + " counts differ from the formula");
+		report.Check(SameMesh(serialMesh, parallelMesh),
+			std::string(shape.Name) + " differs with jobs");
+	}
+
+	// Shared midpoints: every geosphere vertex has its own position.
+	GeometryGenerator::MeshData geosphere = parallelGen.CreateGeosphere(1.0f, GeometryGenerator::MaxSubdivisions);
+	std::vector<std::array<float, 3>> positions(geosphere.Vertices.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+		positions[i] = { geosphere.Vertices[i].Pos.x, geosphere.Vertices[i].Pos.y, geosphere.Vertices[i].Pos.z };
+	std::sort(positions.begin(), positions.end());
+	size_t duplicates = positions.size() - (std::unique(positions.begin(), positions.end()) - positions.begin());
+	report.Line("geosphere 6: " + std::to_string(geosphere.Vertices.size()) + " vertices, " +
+		std::to_string(duplicates) + " duplicates");
+	report.Check(duplicates == 0, "duplicated geosphere midpoints");
+
+	// The jobs can only pay off with more than one hardware thread.  Wall
+	// clock times vary with the build and the load of the machine, so the
+	// speedup is reported, not checked.
+	double speedup = serialTotal / parallelTotal;
+	if (cores < 2 || jobs.ThreadCount() < 2)
+	{
+		report.Line("parallel speedup not measurable on " + std::to_string(cores) + " hardware thread(s), " +
+			std::to_string(speedup) + "x overall");
+	}
+	else
+	{
+		report.Line("parallel speedup: " + std::to_string(speedup) + "x overall");
+	}
+
+	return report;
+}
+
+TestReport TestMeshOptimizer()
+{
+	// Triangles by corner positions, sorted, to check a reordering kept them.
+	typedef std::array<float, 9> Triangle;
+	auto triangles = [](const UINT* indices, size_t indexCount, const XMFLOAT3* positions, UINT stride)
+	{
+		std::vector<Triangle> result(indexCount / 3);
+		for (size_t t = 0; t < result.size(); ++t)
+		{
+			for (UINT k = 0; k < 3; ++k)
+			{
+				const XMFLOAT3& p = *(const XMFLOAT3*)((const BYTE*)positions + (size_t)indices[t * 3 + k] * stride);
+				result[t][k * 3 + 0] = p.x;
+				result[t][k * 3 + 1] = p.y;
+				result[t][k * 3 + 2] = p.z;
+			}
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	};
+
+	MeshOptimizer optimizer;
+	TestReport report("Mesh optimizer benchmark (FIFO cache of " + std::to_string(optimizer.SimulatedCacheSize) +
+		" vertices)");
+
+	auto addResult = [&](const std::string& name, const VertexCacheStats& before, const VertexCacheStats& after,
+		double ms, bool sameTriangles)
+	{
+		report.Line(name + ": " + std::to_string(after.Triangles) + " triangles, ACMR " + std::to_string(before.ACMR()) +
+			" -> " + std::to_string(after.ACMR()) + ", ATVR " + std::to_string(before.ATVR()) + " -> " +
+			std::to_string(after.ATVR()) + " in " + std::to_string(ms) + " ms");
+		report.Check(after.ACMR() <= before.ACMR(), name + " ACMR got worse");
+		report.Check(sameTriangles, name + " triangles changed");
+	};
+
+	GeometryGenerator geoGen;
+	auto runMesh = [&](const std::string& name, const GeometryGenerator::MeshData& source)
+	{
+		GeometryGenerator::MeshData mesh = source;
+		VertexCacheStats before;
+		VertexCacheStats after;
+		double ms = TimeOnce([&]() { optimizer.OptimizeMesh(mesh, &before, &after); });
+		bool same = triangles(source.Indices32.data(), source.Indices32.size(), &source.Vertices[0].Pos,
+			sizeof(source.Vertices[0])) == triangles(mesh.Indices32.data(), mesh.Indices32.size(),
+			&mesh.Vertices[0].Pos, sizeof(mesh.Vertices[0]));
+		addResult(name, before, after, ms, same);
+	};
+
+	runMesh("sphere 20x20", geoGen.CreateSphere(0.5f, 20, 20));
+	runMesh("cylinder 20x20", geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20));
+	runMesh("grid 300x300", geoGen.CreateGrid(20.0f, 30.0f, 300, 300));
+
+	// The worst case for a FIFO cache: triangles in random order.
+	GeometryGenerator::MeshData shuffled = geoGen.CreateGrid(20.0f, 30.0f, 100, 100);
+	std::vector<std::uint32_t> order(shuffled.Indices32.size() / 3);
+	for (UINT t = 0; t < order.size(); ++t)
+		order[t] = t;
+	std::shuffle(order.begin(), order.end(), std::mt19937(1));
+	std::vector<std::uint32_t> gridIndices = shuffled.Indices32;
+	for (UINT t = 0; t < order.size(); ++t)
+	{
+		for (UINT k = 0; k < 3; ++k)
+			shuffled.Indices32[t * 3 + k] = gridIndices[order[t] * 3 + k];
+	}
+	runMesh("shuffled grid 100x100", shuffled);
+
+	// A model loaded per subset, as the app does before converting it.
+	const std::string textFilename = "test.m3d";
+	if (!report.Check(WriteTestM3d(textFilename, 20000, 4, 1, 4) != 0, "could not write " + textFilename))
+		return report;
+
+	std::vector<SkinnedVertex> vertices;
+	std::vector<UINT> indices;
+	std::vector<M3DLoader::Subset> subsets;
+	std::vector<M3DLoader::MaterialInfo> mats;
+	SkinnedData skinnedData;
+	M3DLoader loader;
+	loader.LoadM3d(textFilename, vertices, indices, subsets, mats, skinnedData);
+	std::remove(textFilename.c_str());
+
+	std::vector<SkinnedVertex> sourceVertices = vertices;
+	std::vector<UINT> sourceIndices = indices;
+	VertexCacheStats before;
+	VertexCacheStats after;
+	double ms = TimeOnce([&]() { optimizer.OptimizeSubsets(vertices, indices, subsets, &before, &after); });
+
+	// Each subset must keep its own triangles.
+	bool same = true;
+	for (const M3DLoader::Subset& subset : subsets)
+	{
+		size_t first = (size_t)subset.FaceStart * 3;
+		size_t count = (size_t)subset.FaceCount * 3;
+		same = same && triangles(&sourceIndices[first], count, &sourceVertices[0].Pos, sizeof(SkinnedVertex)) ==
+			triangles(&indices[first], count, &vertices[0].Pos, sizeof(SkinnedVertex));
+	}
+	addResult("random .m3d, " + std::to_string(subsets.size()) + " subsets", before, after, ms, same);
+
+	return report;
+}
+
+TestReport TestVertexPacking()
+{
+	const UINT vertexCount = 200000;
+
+	std::mt19937 rng(3);
+	std::normal_distribution<float> direction;
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	auto randomDirection = [&]()
+	{
+		XMFLOAT3 v(direction(rng), direction(rng), direction(rng));
+		XMStoreFloat3(&v, XMVector3Normalize(XMLoadFloat3(&v)));
+		return v;
+	};
+
+	std::vector<SkinnedVertex> skinned(vertexCount);
+	std::vector<Vertex> vertices(vertexCount);
+	for (UINT i = 0; i < vertexCount; ++i)
+	{
+		SkinnedVertex& v = skinned[i];
+		v.Pos = XMFLOAT3(unit(rng) * 14.0f - 5.0f, unit(rng) * 4.0f - 2.0f, unit(rng) * 14.0f - 7.0f);
+		v.Normal = randomDirection();
+		v.TangentU = randomDirection();
+		v.TexC = XMFLOAT2(unit(rng) * 4.0f - 2.0f, unit(rng));
+		float a = unit(rng);
+		float b = unit(rng) * (1.0f - a);
+		v.BoneWeights = XMFLOAT3(a, b, unit(rng) * (1.0f - a - b));
+		for (UINT k = 0; k < 4; ++k)
+			v.BoneIndices[k] = (BYTE)(i + k);
+
+		vertices[i].Pos = v.Pos;
+		vertices[i].Normal = v.Normal;
+		vertices[i].TexC = v.TexC;
+		vertices[i].TangentU = v.TangentU;
+	}
+
+	std::vector<PackedVertex> packed(vertexCount);
+	std::vector<PackedSkinnedVertex> packedSkinned(vertexCount);
+	std::vector<QuantizedVertex> quantized(vertexCount);
+	PositionQuantization quantization = PositionQuantization::Fit(&vertices[0].Pos, vertexCount, sizeof(Vertex));
+	double packMs = BestTime([&]() { PackVertices(vertices.data(), vertexCount, packed.data()); });
+	double packSkinnedMs = BestTime([&]() { PackVertices(skinned.data(), vertexCount, packedSkinned.data()); });
+	double quantizeMs = BestTime([&]() { PackVertices(vertices.data(), vertexCount, quantization, quantized.data()); });
+
+	// Bounds: octahedral SNORM16 is good to a few hundredths of a degree,
+	// half floats round to 11 significant bits, UNORM8 weights to 1/255 and
+	// UNORM16 positions to one step of the quantization grid.
+	const float maxAngleDegrees = 0.05f;
+	const float maxWeightError = 1.0f / 255.0f;
+	const float maxPositionError = quantization.Scale / 65535.0f;
+
+	float angleError = 0.0f;
+	float texCError = 0.0f;
+	float weightError = 0.0f;
+	float positionError = 0.0f;
+	bool texCWithinHalf = true;
+	bool weightsAtMostOne = true;
+	bool sameBoneIndices = true;
+	auto angle = [](const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		float c = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&a), XMLoadFloat3(&b)));
+		return XMConvertToDegrees(std::acos(MathHelper::Min(c, 1.0f)));
+	};
+	auto checkTexC = [&](float unpacked, float source)
+	{
+		float error = std::fabs(unpacked - source);
+		texCError = MathHelper::Max(texCError, error);
+		texCWithinHalf = texCWithinHalf && error <= MathHelper::Max(std::fabs(source), 1.0f) / 2048.0f;
+	};
+
+	for (UINT i = 0; i < vertexCount; ++i)
+	{
+		const SkinnedVertex& v = skinned[i];
+		SkinnedVertex u = UnpackVertex(packedSkinned[i]);
+		angleError = MathHelper::Max(angleError, MathHelper::Max(angle(u.Normal, v.Normal), angle(u.TangentU, v.TangentU)));
+		checkTexC(u.TexC.x, v.TexC.x);
+		checkTexC(u.TexC.y, v.TexC.y);
+
+		weightError = MathHelper::Max(weightError, std::fabs(u.BoneWeights.x - v.BoneWeights.x));
+		weightError = MathHelper::Max(weightError, std::fabs(u.BoneWeights.y - v.BoneWeights.y));
+		weightError = MathHelper::Max(weightError, std::fabs(u.BoneWeights.z - v.BoneWeights.z));
+		weightsAtMostOne = weightsAtMostOne && u.BoneWeights.x + u.BoneWeights.y + u.BoneWeights.z <= 1.0001f;
+		sameBoneIndices = sameBoneIndices && std::memcmp(u.BoneIndices, v.BoneIndices, sizeof(v.BoneIndices)) == 0;
+
+		Vertex q = UnpackVertex(quantized[i], quantization);
+		positionError = MathHelper::Max(positionError, std::fabs(q.Pos.x - v.Pos.x));
+		positionError = MathHelper::Max(positionError, std::fabs(q.Pos.y - v.Pos.y));
+		positionError = MathHelper::Max(positionError, std::fabs(q.Pos.z - v.Pos.z));
+	}
+
+	TestReport report("Vertex packing benchmark (" + std::to_string(vertexCount) + " random vertices)");
+	report.Line("Vertex " + std::to_string(sizeof(Vertex)) + " -> " + std::to_string(sizeof(PackedVertex)) +
+		" bytes, packed in " + std::to_string(packMs) + " ms");
+	report.Line("SkinnedVertex " + std::to_string(sizeof(SkinnedVertex)) + " -> " + std::to_string(sizeof(PackedSkinnedVertex)) +
+		" bytes, packed in " + std::to_string(packSkinnedMs) + " ms");
+	report.Line("quantized Vertex " + std::to_string(sizeof(Vertex)) + " -> " + std::to_string(sizeof(QuantizedVertex)) +
+		" bytes, packed in " + std::to_string(quantizeMs) + " ms");
+	report.Line("largest errors: normal/tangent " + std::to_string(angleError) + " degrees (bound " +
+		std::to_string(maxAngleDegrees) + "), texture coordinate " + std::to_string(texCError) + ", weight " +
+		std::to_string(weightError) + " (bound " + std::to_string(maxWeightError) + "), position " +
+		std::to_string(positionError) + " (bound " + std::to_string(maxPositionError) + ")");
+	report.Check(angleError <= maxAngleDegrees, "octahedral direction");
+	report.Check(texCWithinHalf, "half texture coordinate");
+	report.Check(weightError <= maxWeightError, "UNORM8 weight");
+	report.Check(weightsAtMostOne, "weights above one");
+	report.Check(sameBoneIndices, "bone indices");
+	report.Check(positionError <= maxPositionError, "UNORM16 position");
+
+	return report;
+}
+
+TestReport TestMeshlets()
+{
+	GeometryGenerator geoGen;
+	MeshOptimizer optimizer;
+	struct Mesh
+	{
+		std::string Name;
+		GeometryGenerator::MeshData Data;
+	};
+	Mesh meshes[] =
+	{
+		{ "box", geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3) },
+		{ "grid", geoGen.CreateGrid(20.0f, 30.0f, 60, 40) },
+		{ "sphere", geoGen.CreateSphere(0.5f, 20, 20) },
+		{ "cylinder", geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20) },
+		{ "geosphere", geoGen.CreateGeosphere(1.0f, 4) },
+	};
+
+	// Camera poses: in front, below, straight above and looking away.
+	const XMFLOAT3 eyes[] = { { 0.0f, 2.0f, -15.0f }, { 0.0f, -20.0f, -30.0f }, { 0.0f, 30.0f, 0.01f }, { 0.0f, 2.0f, 15.0f } };
+	const XMFLOAT3 targets[] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 2.0f, 30.0f } };
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f * MathHelper::Pi, 4.0f / 3.0f, 1.0f, 1000.0f);
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, proj);
+	XMMATRIX world = XMMatrixScaling(2.0f, 1.0f, 2.0f);
+
+	TestReport report("Meshlet benchmark (at most " + std::to_string(MaxMeshletVertices) + " vertices and " +
+		std::to_string(MaxMeshletTriangles) + " triangles per meshlet, 4 camera poses)");
+	for (Mesh& mesh : meshes)
+	{
+		GeometryGenerator::MeshData& data = mesh.Data;
+		optimizer.OptimizeMesh(data);
+		const XMFLOAT3* positions = &data.Vertices[0].Pos;
+		const UINT stride = sizeof(data.Vertices[0]);
+		auto position = [&](UINT index) { return XMLoadFloat3((const XMFLOAT3*)((const BYTE*)positions + index * stride)); };
+
+		std::vector<Meshlet> meshlets;
+		double buildMs = TimeOnce([&]()
+		{
+			BuildMeshlets(data.Indices32.data(), (UINT)data.Indices32.size(), positions, stride, meshlets);
+		});
+
+		// Meshlets must tile the index buffer within the limits, contain
+		// their vertices and have every triangle normal inside their cone.
+		UINT maxVertices = 0;
+		UINT maxTriangles = 0;
+		UINT nextIndex = 0;
+		bool contiguous = true;
+		bool bounded = true;
+		bool coned = true;
+		for (const Meshlet& meshlet : meshlets)
+		{
+			maxVertices = MathHelper::Max(maxVertices, meshlet.VertexCount);
+			maxTriangles = MathHelper::Max(maxTriangles, meshlet.IndexCount / 3);
+			contiguous = contiguous && meshlet.StartIndex == nextIndex;
+			nextIndex = meshlet.StartIndex + meshlet.IndexCount;
+
+			XMVECTOR center = XMLoadFloat3(&meshlet.Bounds.Center);
+			XMVECTOR axis = XMLoadFloat3(&meshlet.ConeAxis);
+			float minCos = std::sqrt(MathHelper::Max(0.0f, 1.0f - meshlet.ConeCutoff * meshlet.ConeCutoff));
+			for (UINT i = meshlet.StartIndex; i < nextIndex; i += 3)
+			{
+				XMVECTOR a = position(data.Indices32[i]);
+				XMVECTOR b = position(data.Indices32[i + 1]);
+				XMVECTOR c = position(data.Indices32[i + 2]);
+				for (XMVECTOR p : { a, b, c })
+					bounded = bounded && XMVectorGetX(XMVector3Length(XMVectorSubtract(p, center))) <= meshlet.Bounds.Radius * 1.0001f + 1e-5f;
+
+				XMVECTOR normal = XMVector3Cross(XMVectorSubtract(b, a), XMVectorSubtract(c, a));
+				if (meshlet.ConeCutoff < 1.0f && XMVectorGetX(XMVector3Length(normal)) > 1e-12f)
+					coned = coned && XMVectorGetX(XMVector3Dot(XMVector3Normalize(normal), axis)) >= minCos - 1e-3f;
+			}
+		}
+		report.Line(mesh.Name + ": " + std::to_string(data.Indices32.size() / 3) + " triangles in " +
+			std::to_string(meshlets.size()) + " meshlets of up to " + std::to_string(maxVertices) + " vertices and " +
+			std::to_string(maxTriangles) + " triangles, built in " + std::to_string(buildMs) + " ms");
+		report.Check(contiguous && nextIndex == data.Indices32.size(), mesh.Name + " indices not covered");
+		report.Check(maxVertices <= MaxMeshletVertices && maxTriangles <= MaxMeshletTriangles, mesh.Name + " over the limits");
+		report.Check(bounded, mesh.Name + " vertex outside bounds");
+		report.Check(coned, mesh.Name + " normal outside cone");
+
+		for (UINT pose = 0; pose < _countof(eyes); ++pose)
+		{
+			XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&eyes[pose]), XMLoadFloat3(&targets[pose]),
+				XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+			MeshletCuller culler;
+			culler.SetCamera(frustum, view, eyes[pose]);
+			std::vector<MeshletDrawRange> ranges;
+			MeshletCullStats stats;
+			culler.Cull(meshlets, 0, world, ranges, &stats);
+
+			// Culling must be conservative: no triangle that is left out may
+			// face the eye with a corner inside the view volume.
+			std::vector<char> drawn(data.Indices32.size(), 0);
+			for (const MeshletDrawRange& range : ranges)
+				std::fill(drawn.begin() + range.StartIndexLocation, drawn.begin() + range.StartIndexLocation + range.IndexCount, 1);
+
+			XMMATRIX worldViewProj = world * view * proj;
+			XMVECTOR eye = XMLoadFloat3(&eyes[pose]);
+			UINT wronglyCulled = 0;
+			for (UINT i = 0; i < data.Indices32.size(); i += 3)
+			{
+				if (drawn[i])
+					continue;
+
+				XMVECTOR a = XMVector3TransformCoord(position(data.Indices32[i]), world);
+				XMVECTOR b = XMVector3TransformCoord(position(data.Indices32[i + 1]), world);
+				XMVECTOR c = XMVector3TransformCoord(position(data.Indices32[i + 2]), world);
+				XMVECTOR normal = XMVector3Cross(XMVectorSubtract(b, a), XMVectorSubtract(c, a));
+				bool frontFacing = XMVectorGetX(XMVector3Dot(normal, XMVectorSubtract(eye, a))) > 0.0f;
+
+				bool inside = false;
+				for (UINT k = 0; k < 3; ++k)
+				{
+					XMFLOAT4 clip;
+					XMStoreFloat4(&clip, XMVector3Transform(position(data.Indices32[i + k]), worldViewProj));
+					inside = inside || (std::fabs(clip.x) < clip.w && std::fabs(clip.y) < clip.w && clip.z > 0.0f && clip.z < clip.w);
+				}
+				if (frontFacing && inside)
+					++wronglyCulled;
+			}
+
+			report.Line("  pose " + std::to_string(pose) + ": " + std::to_string(stats.Visible()) + " of " +
+				std::to_string(stats.Tested) + " visible, " + std::to_string(stats.FrustumCulled) + " outside the frustum, " +
+				std::to_string(stats.BackfaceCulled) + " facing away, " + std::to_string(ranges.size()) + " draws");
+			report.Check(wronglyCulled == 0, mesh.Name + " pose " + std::to_string(pose) + " culled " +
+				std::to_string(wronglyCulled) + " visible triangles");
+		}
+	}
+
+	return report;
+}
+
+TestReport TestMeshSimplifier()
+{
+	// Distance from p to the triangle abc.
+	auto triangleDistance = [](FXMVECTOR p, FXMVECTOR a, FXMVECTOR b, GXMVECTOR c)
+	{
+		auto segmentDistance = [&](FXMVECTOR s0, FXMVECTOR s1)
+		{
+			XMVECTOR d = XMVectorSubtract(s1, s0);
+			float t = XMVectorGetX(XMVector3Dot(XMVectorSubtract(p, s0), d)) / MathHelper::Max(XMVectorGetX(XMVector3LengthSq(d)), 1e-20f);
+			XMVECTOR closest = XMVectorAdd(s0, XMVectorScale(d, MathHelper::Clamp(t, 0.0f, 1.0f)));
+			return XMVectorGetX(XMVector3Length(XMVectorSubtract(p, closest)));
+		};
+
+		XMVECTOR normal = XMVector3Cross(XMVectorSubtract(b, a), XMVectorSubtract(c, a));
+		if (XMVectorGetX(XMVector3LengthSq(normal)) > 1e-20f)
+		{
+			normal = XMVector3Normalize(normal);
+			float height = XMVectorGetX(XMVector3Dot(XMVectorSubtract(p, a), normal));
+			XMVECTOR q = XMVectorSubtract(p, XMVectorScale(normal, height));
+			auto side = [&](FXMVECTOR e0, FXMVECTOR e1)
+			{
+				return XMVectorGetX(XMVector3Dot(XMVector3Cross(XMVectorSubtract(e1, e0), XMVectorSubtract(q, e0)), normal));
+			};
+			if (side(a, b) >= 0.0f && side(b, c) >= 0.0f && side(c, a) >= 0.0f)
+				return std::fabs(height);
+		}
+		return MathHelper::Min(segmentDistance(a, b), MathHelper::Min(segmentDistance(b, c), segmentDistance(c, a)));
+	};
+
+	GeometryGenerator geoGen;
+	MeshOptimizer optimizer;
+	MeshSimplifier simplifier;
+	struct Mesh
+	{
+		std::string Name;
+		GeometryGenerator::MeshData Data;
+	};
+	Mesh meshes[] =
+	{
+		{ "grid", geoGen.CreateGrid(20.0f, 30.0f, 60, 40) },
+		{ "sphere 20x20", geoGen.CreateSphere(0.5f, 20, 20) },
+		{ "sphere 60x60", geoGen.CreateSphere(0.5f, 60, 60) },
+		{ "cylinder", geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20) },
+		{ "geosphere", geoGen.CreateGeosphere(1.0f, 4) },
+	};
+
+	TestReport report("Mesh simplifier benchmark (up to " + std::to_string(simplifier.MaxLodLevels) +
+		" levels of " + std::to_string(simplifier.LodTriangleRatio) + "x the triangles, error at most " +
+		std::to_string(simplifier.MaxRelativeError) + " of the bounding radius)");
+	for (Mesh& mesh : meshes)
+	{
+		GeometryGenerator::MeshData& data = mesh.Data;
+		optimizer.OptimizeMesh(data);
+
+		std::vector<UINT> lodIndices;
+		std::vector<LodRange> lods;
+		double buildMs = TimeOnce([&]() { simplifier.BuildMeshLods(data, lodIndices, lods); });
+
+		BoundingSphere bounds;
+		BoundingSphere::CreateFromPoints(bounds, data.Vertices.size(), &data.Vertices[0].Pos, sizeof(data.Vertices[0]));
+		float maxError = simplifier.MaxRelativeError * bounds.Radius;
+
+		report.Line(mesh.Name + ": " + std::to_string(data.Indices32.size() / 3) + " triangles, " +
+			std::to_string(lods.size()) + " levels in " + std::to_string(buildMs) + " ms");
+
+		UINT previousTriangles = (UINT)data.Indices32.size() / 3;
+		float previousError = 0.0f;
+		for (const LodRange& lod : lods)
+		{
+			// The measured error is the largest distance from a full detail
+			// vertex to the level's surface; the estimate must not be below it.
+			float measured = 0.0f;
+			for (const Vertex& v : data.Vertices)
+			{
+				XMVECTOR p = XMLoadFloat3(&v.Pos);
+				float nearest = FLT_MAX;
+				for (UINT i = lod.StartIndexLocation; i < lod.StartIndexLocation + lod.IndexCount; i += 3)
+				{
+					nearest = MathHelper::Min(nearest, triangleDistance(p,
+						XMLoadFloat3(&data.Vertices[lodIndices[i]].Pos),
+						XMLoadFloat3(&data.Vertices[lodIndices[i + 1]].Pos),
+						XMLoadFloat3(&data.Vertices[lodIndices[i + 2]].Pos)));
+				}
+				measured = MathHelper::Max(measured, nearest);
+			}
+
+			UINT triangles = lod.IndexCount / 3;
+			std::string level = mesh.Name + " level of " + std::to_string(triangles) + " triangles";
+			report.Line("  " + std::to_string(triangles) + " triangles, error " + std::to_string(lod.Error) +
+				", measured " + std::to_string(measured));
+			report.Check(triangles < previousTriangles, level + " not fewer triangles");
+			report.Check(lod.Error >= previousError && lod.Error <= maxError, level + " error out of range");
+			report.Check(measured <= lod.Error * 1.001f + 1e-6f, level + " error underestimated");
+
+			previousTriangles = triangles;
+			previousError = lod.Error;
+		}
+	}
+
+	return report;
+}
+
+TestReport TestTerrain(JobSystem& jobs)
+{
+	const UINT width = 1025;
+	const UINT depth = 769;
+	const std::string filename = "test.r16";
+
+	// Rolling hills with fine noise, so the coarse levels have real error.
+	std::mt19937 rng(17);
+	std::uniform_real_distribution<float> noise(-0.005f, 0.005f);
+	std::vector<unsigned char> bytes((size_t)width * depth * 2);
+	for (UINT r = 0; r < depth; ++r)
+	{
+		for (UINT c = 0; c < width; ++c)
+		{
+			float h = 0.5f + 0.25f * std::sin(c * 0.02f) * std::cos(r * 0.03f) + 0.02f * std::sin(c * 0.31f + r * 0.2f) + noise(rng);
+			std::uint16_t sample = (std::uint16_t)(MathHelper::Clamp(h, 0.0f, 1.0f) * 65535.0f);
+			bytes[((size_t)r * width + c) * 2 + 0] = (unsigned char)(sample & 0xff);
+			bytes[((size_t)r * width + c) * 2 + 1] = (unsigned char)(sample >> 8);
+		}
+	}
+	std::ofstream(filename, std::ios::binary).write((const char*)bytes.data(), bytes.size());
+
+	TestReport report("Terrain benchmark (" + std::to_string(width) + "x" + std::to_string(depth) + " r16 heightmap)");
+	Terrain terrain;
+	terrain.HeightScale = 40.0f;
+	report.Check(!terrain.LoadHeightmap(filename), "non-square heightmap taken as square");
+	bool loaded = report.Check(terrain.LoadHeightmap(filename, width, depth), "heightmap not loaded");
+	report.Check(!terrain.LoadHeightmap(filename, width, depth + 1), "wrong size accepted");
+	std::remove(filename.c_str());
+	if (!loaded)
+		return report;
+
+	double serialMs = BestTime([&]() { terrain.Build(); });
+	std::vector<Vertex> serialVertices = terrain.Vertices();
+	terrain.Jobs = &jobs;
+	double parallelMs = BestTime([&]() { terrain.Build(); });
+	const std::vector<Vertex>& vertices = terrain.Vertices();
+	report.Check(serialVertices.size() == vertices.size() &&
+		std::memcmp(serialVertices.data(), vertices.data(), vertices.size() * sizeof(Vertex)) == 0, "parallel build differs");
+
+	const std::vector<TerrainChunk>& chunks = terrain.Chunks();
+	const UINT cells = terrain.BuiltChunkCells();
+	const UINT n = cells + 1;
+	const UINT chunkCols = (width - 1) / cells;
+	const UINT levels = (UINT)chunks[0].LodErrors.size();
+
+	// Errors start at 0 and never decrease.
+	bool ordered = true;
+	for (const TerrainChunk& chunk : chunks)
+	{
+		ordered = ordered && chunk.LodErrors[0] == 0.0f;
+		for (UINT level = 1; level < levels; ++level)
+			ordered = ordered && chunk.LodErrors[level] >= chunk.LodErrors[level - 1];
+	}
+	report.Check(ordered, "level errors out of order");
+
+	// Cracks: wherever two neighbours meet at any pair of levels, the skirt
+	// of the higher edge must reach down to the lower one.
+	auto height = [&](UINT chunk, UINT i, UINT j) { return vertices[chunks[chunk].BaseVertexLocation + i * n + j].Pos.y; };
+	auto skirtDepth = [&](UINT chunk) { return height(chunk, cells, 0) - vertices[chunks[chunk].BaseVertexLocation + n * n].Pos.y; };
+	auto edgeHeight = [&](const std::vector<float>& edge, UINT step, UINT k)
+	{
+		UINT k0 = k / step * step;
+		UINT k1 = MathHelper::Min(k0 + step, cells);
+		float t = k1 > k0 ? (float)(k - k0) / (k1 - k0) : 0.0f;
+		return edge[k0] + (edge[k1] - edge[k0]) * t;
+	};
+
+	float worstGap = 0.0f;
+	UINT cracks = 0;
+	for (UINT a = 0; a < chunks.size(); ++a)
+	{
+		// The neighbour at +x shares a's last column, the one at -z its last row.
+		UINT neighbours[2] = { (a % chunkCols) + 1 < chunkCols ? a + 1 : UINT_MAX, a + chunkCols < chunks.size() ? a + chunkCols : UINT_MAX };
+		for (UINT side = 0; side < 2; ++side)
+		{
+			UINT b = neighbours[side];
+			if (b == UINT_MAX)
+				continue;
+
+			std::vector<float> edgeA(n);
+			std::vector<float> edgeB(n);
+			for (UINT k = 0; k < n; ++k)
+			{
+				edgeA[k] = side == 0 ? height(a, k, cells) : height(a, cells, k);
+				edgeB[k] = side == 0 ? height(b, k, 0) : height(b, 0, k);
+			}
+
+			for (UINT levelA = 0; levelA < levels; ++levelA)
+			{
+				for (UINT levelB = 0; levelB < levels; ++levelB)
+				{
+					for (UINT k = 0; k < n; ++k)
+					{
+						float gap = edgeHeight(edgeA, 1u << levelA, k) - edgeHeight(edgeB, 1u << levelB, k);
+						worstGap = MathHelper::Max(worstGap, std::fabs(gap));
+						if ((gap > 0.0f && gap > skirtDepth(a)) || (gap < 0.0f && -gap > skirtDepth(b)))
+							++cracks;
+					}
+				}
+			}
+		}
+	}
+	report.Check(cracks == 0, "cracks between neighbours");
+
+	// Levels from a camera low over the terrain and from one far above it.
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f * MathHelper::Pi, 16.0f / 9.0f, 1.0f, 5000.0f);
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, proj);
+	const float pixelsPerUnit = 0.5f * 1080.0f / std::tan(0.125f * MathHelper::Pi);
+	const float maxPixelError = 2.0f;
+
+	report.Line(std::to_string(chunks.size()) + " chunks of " + std::to_string(cells) + " cells, " +
+		std::to_string(levels) + " levels");
+	report.Line("build: " + std::to_string(serialMs) + " ms serial, " + std::to_string(parallelMs) + " ms on " +
+		std::to_string(jobs.ThreadCount()) + " threads");
+	report.Line("coarsest level errors up to " + std::to_string(std::max_element(chunks.begin(), chunks.end(),
+		[](const TerrainChunk& a, const TerrainChunk& b) { return a.LodErrors.back() < b.LodErrors.back(); })->LodErrors.back()) +
+		", widest gap between neighbours " + std::to_string(worstGap) + ", " + std::to_string(cracks) + " cracks");
+
+	const XMFLOAT3 eyes[] = { { 0.0f, 45.0f, -300.0f }, { 0.0f, 1500.0f, -1500.0f } };
+	const char* names[] = { "low", "high" };
+	UINT triangles[2] = {};
+	for (UINT e = 0; e < 2; ++e)
+	{
+		XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&eyes[e]), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		terrain.Update(frustum, view, eyes[e], pixelsPerUnit, maxPixelError);
+		const TerrainStats& stats = terrain.Stats();
+		for (const TerrainDraw& draw : terrain.AllDraws())
+			triangles[e] += draw.IndexCount / 3;
+
+		// The chunk culler may keep chunks just outside, never drop one inside.
+		BoundingFrustum worldFrustum;
+		XMVECTOR det = XMMatrixDeterminant(view);
+		frustum.Transform(worldFrustum, XMMatrixInverse(&det, view));
+		bool noneMissed = std::all_of(chunks.begin(), chunks.end(), [&](const TerrainChunk& chunk)
+		{
+			return chunk.Visible || worldFrustum.Contains(chunk.Bounds) == DISJOINT;
+		});
+
+		// The picked level's error must project to at most maxPixelError.
+		UINT levelCounts[8] = {};
+		bool withinError = true;
+		for (const TerrainChunk& chunk : chunks)
+		{
+			++levelCounts[MathHelper::Min(chunk.LodIndex, 7u)];
+			float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&chunk.Bounds.Extents)));
+			float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&chunk.Bounds.Center), XMLoadFloat3(&eyes[e])))) - radius;
+			withinError = withinError && (chunk.LodIndex == 0 || chunk.LodErrors[chunk.LodIndex] * pixelsPerUnit <= maxPixelError * distance);
+		}
+
+		std::string line = std::string(names[e]) + " camera: " + std::to_string(stats.VisibleChunks) + " visible chunks, " +
+			std::to_string(stats.Triangles) + " of " + std::to_string(stats.FullDetailTriangles) + " triangles drawn, " +
+			std::to_string(triangles[e]) + " in all chunks, chunks per level";
+		for (UINT level = 0; level < levels; ++level)
+			line += " " + std::to_string(levelCounts[level]);
+		report.Line(line);
+		report.Check(withinError, std::string(names[e]) + " camera level too coarse");
+		report.Check(noneMissed, std::string(names[e]) + " camera culled a chunk inside the frustum");
+	}
+	report.Check(triangles[1] * 2 <= triangles[0] && triangles[0] != 0, "far camera not coarser");
+
+	return report;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "test_report.h"
+
+class JobSystem;
+
+// Times GeometryGenerator on high-tessellation shapes, once on the calling
+// thread and once with the job system, and reports the parallel speedup.
+// Checks the vertex and index counts of each shape against its formula, that
+// both runs make the same mesh and that geosphere midpoints are shared.
+TestReport TestGeometryGenerator(JobSystem& jobs);
+
+// Runs the mesh optimizer on generated meshes, a grid with its triangles
+// shuffled and a random .m3d per subset, and reports the ACMR and ATVR of
+// a simulated FIFO vertex cache before and after.  Checks that no ACMR got
+// worse and no triangles changed.
+TestReport TestMeshOptimizer();
+
+// Packs 200k random vertices into PackedVertex, PackedSkinnedVertex and
+// QuantizedVertex, reports the sizes and packing times, and checks that the
+// unpacked normals, tangents, texture coordinates, weights and positions
+// are within the error bounds of their formats.
+TestReport TestVertexPacking();
+
+// Builds meshlets for generated meshes and culls them from four camera
+// poses.  Reports the meshlet counts and how many are culled by the frustum
+// and by their normal cones, and checks the limits, bounds, cones and that
+// no visible triangle is culled.
+TestReport TestMeshlets();
+
+// Builds LOD chains for generated meshes and reports the triangle count,
+// estimated error and measured error (largest distance of a full detail
+// vertex to the level) of each level.  Checks that levels get coarser, that
+// their error is in range and not below the measured one.
+TestReport TestMeshSimplifier();
+
+// Loads a 1025x769 r16 heightmap and builds the terrain on one thread and on
+// the job system.  Checks that malformed sizes are refused, that both builds
+// match, that no pair of levels of neighbouring chunks leaves a crack the
+// skirts do not cover, and that the levels picked from a low and a high
+// camera stay within the pixel error.
+TestReport TestTerrain(JobSystem& jobs);
@@ -0,0 +1,602 @@
+#include "scene_tests.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include "camera.h"
+#include "cpu_features.h"
+#include "dirty_tracker.h"
+#include "frustum_culler.h"
+#include "job_system.h"
+#include "math_helper.h"
+#include "render_item_store.h"
+#include "scene_bvh.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// count boxes of 1 to 6 units scattered over a 2000 x 200 x 2000 area.
+	std::vector<BoundingBox> RandomBoxes(UINT count)
+	{
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> xz(-1000.0f, 1000.0f);
+		std::uniform_real_distribution<float> y(0.0f, 200.0f);
+		std::uniform_real_distribution<float> extent(0.5f, 3.0f);
+
+		std::vector<BoundingBox> boxes(count);
+		for (BoundingBox& box : boxes)
+		{
+			box.Center = XMFLOAT3(xz(rng), y(rng), xz(rng));
+			box.Extents = XMFLOAT3(extent(rng), extent(rng), extent(rng));
+		}
+		return boxes;
+	}
+}
+
+TestReport TestSceneBvh()
+{
+	const UINT itemCount = 100000;
+	std::vector<BoundingBox> boxes = RandomBoxes(itemCount);
+
+	// A camera at the origin looking down +z, so view space is world space.
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, XMMatrixPerspectiveFovLH(0.25f*XM_PI, 16.0f / 9.0f, 1.0f, 1000.0f));
+
+	SceneBvh bvh;
+	double buildMs = BestTime([&]() { bvh.Build(boxes.data(), itemCount); });
+
+	std::vector<UINT> visible;
+	visible.reserve(itemCount);
+	SceneBvhStats stats;
+	double queryMs = BestTime([&]()
+	{
+		visible.clear();
+		stats = SceneBvhStats();
+		bvh.Query(frustum, visible, &stats);
+	});
+
+	std::vector<UINT> bruteVisible;
+	bruteVisible.reserve(itemCount);
+	double bruteMs = BestTime([&]()
+	{
+		bruteVisible.clear();
+		for (UINT i = 0; i < itemCount; ++i)
+		{
+			if (frustum.Contains(boxes[i]) != DISJOINT)
+				bruteVisible.push_back(i);
+		}
+	});
+
+	// The query must find exactly the items the per-box test keeps.
+	auto sameItems = [&]()
+	{
+		std::vector<UINT> found;
+		bvh.Query(frustum, found);
+		std::sort(found.begin(), found.end());
+
+		std::vector<UINT> expected;
+		for (UINT i = 0; i < itemCount; ++i)
+		{
+			if (frustum.Contains(boxes[i]) != DISJOINT)
+				expected.push_back(i);
+		}
+		return found == expected;
+	};
+
+	TestReport report("SceneBvh benchmark (" + std::to_string(itemCount) + " items, " +
+		std::to_string(bvh.NodeCount()) + " nodes)");
+	report.Check(stats.Visible == bruteVisible.size(), "query and every box count differ");
+	report.Check(sameItems(), "query differs from every box after Build");
+
+	// Move every 100th item a little and refit.
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> step(-2.0f, 2.0f);
+	double refitMs = BestTime([&]()
+	{
+		for (UINT i = 0; i < itemCount; i += 100)
+		{
+			BoundingBox box = bvh.ItemBounds(i);
+			box.Center.x += step(rng);
+			box.Center.z += step(rng);
+			bvh.SetItemBounds(i, box);
+			boxes[i] = box;
+		}
+		bvh.Refit();
+	});
+	report.Check(sameItems(), "query differs from every box after small moves");
+
+	// Move some items across the scene, into and out of the frustum, so
+	// leaves grow far beyond their old boxes.
+	std::uniform_real_distribution<float> xz(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> y(0.0f, 200.0f);
+	for (UINT i = 0; i < itemCount; i += 37)
+	{
+		boxes[i].Center = XMFLOAT3(xz(rng), y(rng), xz(rng));
+		bvh.SetItemBounds(i, boxes[i]);
+	}
+	bvh.Refit();
+	report.Check(sameItems(), "query differs from every box after large moves");
+
+	report.Line("build: " + std::to_string(buildMs) + " ms");
+	report.Line("query: " + std::to_string(queryMs) + " ms, " + std::to_string(stats.Visible) + " visible, " +
+		std::to_string(stats.NodesTested) + " nodes and " + std::to_string(stats.ItemsTested) + " items tested");
+	report.Line("every box: " + std::to_string(bruteMs) + " ms, " + std::to_string(bruteVisible.size()) + " visible");
+	report.Line("refit after moving " + std::to_string(itemCount / 100) + " items: " + std::to_string(refitMs) + " ms");
+
+	return report;
+}
+
+TestReport TestFrustumCuller(JobSystem& jobs)
+{
+	// The SceneBvh boxes, ten times as many.
+	const UINT itemCount = 1000000;
+	std::vector<BoundingBox> boxes = RandomBoxes(itemCount);
+
+	Camera camera;
+	camera.SetLens(0.25f*XM_PI, 16.0f / 9.0f, 1.0f, 1000.0f);
+	camera.SetPosition(0.0f, 100.0f, 0.0f);
+	camera.UpdateViewMatrix();
+
+	XMFLOAT4 planes[6];
+	camera.GetFrustumPlanes(planes);
+
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, camera.GetProj());
+	XMMATRIX view = camera.GetView();
+	XMVECTOR det = XMMatrixDeterminant(view);
+	frustum.Transform(frustum, XMMatrixInverse(&det, view));
+
+	size_t intersectsVisible = 0;
+	double intersectsMs = BestTime([&]()
+	{
+		intersectsVisible = 0;
+		for (const BoundingBox& box : boxes)
+			intersectsVisible += frustum.Intersects(box) ? 1 : 0;
+	});
+
+	FrustumCuller culler;
+	culler.SetBounds(boxes.data(), itemCount);
+
+	double serialMs = BestTime([&]() { culler.Cull(planes); });
+	std::vector<UINT> serialVisible(culler.VisibleItems(), culler.VisibleItems() + culler.VisibleCount());
+
+	culler.Jobs = &jobs;
+	double parallelMs = BestTime([&]() { culler.Cull(planes); });
+	std::vector<UINT> parallelVisible(culler.VisibleItems(), culler.VisibleItems() + culler.VisibleCount());
+
+	// The same test one box at a time, to check the SIMD output: every box
+	// it keeps must be found, and the culler may only add boxes that would
+	// be kept grown by a unit on every axis.  The grid rounds by at most ten
+	// grid steps, well under a unit for this scene.
+	auto keeps = [&](const XMFLOAT3& center, const XMFLOAT3& extents)
+	{
+		bool inside = true;
+		for (const XMFLOAT4& plane : planes)
+		{
+			float d = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w +
+				std::fabs(plane.x) * extents.x + std::fabs(plane.y) * extents.y + std::fabs(plane.z) * extents.z;
+			inside = inside && d >= 0.0f;
+		}
+		return inside;
+	};
+	auto matchesScalar = [&](const std::vector<UINT>& visible, size_t& exactCount)
+	{
+		std::vector<UINT> expected;
+		for (UINT i = 0; i < itemCount; ++i)
+		{
+			if (keeps(boxes[i].Center, boxes[i].Extents))
+				expected.push_back(i);
+		}
+		exactCount = expected.size();
+
+		bool onlyNear = std::all_of(visible.begin(), visible.end(), [&](UINT i)
+		{
+			const XMFLOAT3& e = boxes[i].Extents;
+			return i < itemCount && keeps(boxes[i].Center, XMFLOAT3(e.x + 1.0f, e.y + 1.0f, e.z + 1.0f));
+		});
+		return std::is_sorted(visible.begin(), visible.end()) && onlyNear &&
+			std::includes(visible.begin(), visible.end(), expected.begin(), expected.end());
+	};
+	size_t exactVisible = 0;
+	bool serialMatches = matchesScalar(serialVisible, exactVisible);
+
+	// A box leaving the grid makes the next Cull quantize them all again.
+	boxes[0].Center = XMFLOAT3(0.0f, 100.0f, 50.0f);
+	boxes[1].Center = XMFLOAT3(1500.0f, 100.0f, 0.0f);
+	culler.SetBounds(0, boxes[0]);
+	culler.SetBounds(1, boxes[1]);
+	culler.Cull(planes);
+	std::vector<UINT> movedVisible(culler.VisibleItems(), culler.VisibleItems() + culler.VisibleCount());
+	size_t movedExactVisible = 0;
+	bool movedMatches = matchesScalar(movedVisible, movedExactVisible) && !movedVisible.empty() && movedVisible[0] == 0;
+
+	// The target is a million items in about a millisecond on one core.  It
+	// is reported, not checked: Debug builds and busy machines miss it.
+	const double targetMs = 1.0 * itemCount / 1000000;
+	double gigabytesPerSecond = (double)FrustumCuller::BoundsBytesPerItem * itemCount / (serialMs * 1e6);
+
+	TestReport report("FrustumCuller benchmark (" + std::to_string(itemCount) + " items, " +
+		(CpuHasAvx2() ? "AVX2, " : "SSE2, ") + std::to_string(jobs.ThreadCount()) + " threads)");
+	report.Line("BoundingFrustum::Intersects: " + std::to_string(intersectsMs) + " ms, " +
+		std::to_string(intersectsVisible) + " visible");
+	report.Line("quantized SoA planes: " + std::to_string(serialMs) + " ms serial, " + std::to_string(parallelMs) +
+		" ms parallel, " + std::to_string(serialVisible.size()) + " visible, " + std::to_string(exactVisible) +
+		" by the exact box test");
+	report.Line("one core: " + std::to_string(serialMs * 1e6 / itemCount) + " ns per item, " +
+		std::to_string(gigabytesPerSecond) + " GB/s of bounds read, target " + std::to_string(targetMs) + " ms " +
+		(serialMs <= targetMs ? "met" : "missed"));
+	report.Check(serialVisible == parallelVisible, "serial and parallel differ");
+	report.Check(serialMatches, "differs from the scalar test");
+	report.Check(movedMatches, "differs from the scalar test after a box left the grid");
+
+	return report;
+}
+
+TestReport TestCamera()
+{
+	auto clip = [](const Camera& camera, const XMFLOAT3& p, bool jittered)
+	{
+		XMMATRIX viewProj = XMMatrixMultiply(camera.GetView(), jittered ? camera.GetProj() : camera.GetUnjitteredProj());
+		XMFLOAT4 h;
+		XMStoreFloat4(&h, XMVector4Transform(XMVectorSet(p.x, p.y, p.z, 1.0f), viewProj));
+		return h;
+	};
+
+	TestReport report("Camera benchmark");
+
+	Camera camera;
+	camera.SetLens(0.25f * MathHelper::Pi, 1.5f, 1.0f, 1000.0f);
+	camera.SetPosition(10.0f, 100.0f, -20.0f);
+	camera.Pitch(0.3f);
+	camera.RotateY(0.7f);
+	camera.UpdateViewMatrix();
+
+	// The world space planes keep exactly the points the projection maps
+	// into the clip volume.
+	XMFLOAT4 planes[6];
+	camera.GetFrustumPlanes(planes);
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> coordinate(-1200.0f, 1200.0f);
+	UINT mismatches = 0;
+	UINT insideCount = 0;
+	for (UINT i = 0; i < 100000; ++i)
+	{
+		XMFLOAT3 p(coordinate(rng), coordinate(rng), coordinate(rng));
+		XMFLOAT4 h = clip(camera, p, false);
+		bool inside = h.w > 0.0f && h.z >= 0.0f && h.z <= h.w && std::fabs(h.x) <= h.w && std::fabs(h.y) <= h.w;
+		bool planesInside = true;
+		for (const XMFLOAT4& plane : planes)
+			planesInside = planesInside && plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w >= 0.0f;
+
+		// Points within a hair of a plane may go either way.
+		float margin = 1e-4f * MathHelper::Max(h.w, 1.0f);
+		bool nearEdge = std::fabs(std::fabs(h.x) - h.w) < margin || std::fabs(std::fabs(h.y) - h.w) < margin ||
+			std::fabs(h.z) < margin || std::fabs(h.z - h.w) < margin;
+		if (inside != planesInside && !nearEdge)
+			++mismatches;
+		insideCount += inside ? 1 : 0;
+	}
+	report.Line("planes against clip space: 100000 random points, " + std::to_string(insideCount) + " inside, " +
+		std::to_string(mismatches) + " disagree");
+	report.Check(mismatches == 0, "planes and clip space disagree");
+
+	// Reverse-Z: depth 1 at the near plane, near / z beyond it, 0 at infinity,
+	// with the culling planes unchanged.
+	UINT64 version = camera.GetVersion();
+	camera.SetInfiniteReverseZ(true);
+	report.Check(camera.GetVersion() != version, "reverse-Z kept the version");
+
+	XMFLOAT3 eye = camera.GetPosition3f();
+	XMFLOAT3 look;
+	XMStoreFloat3(&look, XMMatrixTranspose(camera.GetView()).r[2]);
+	auto along = [&](float distance) { return XMFLOAT3(eye.x + look.x * distance, eye.y + look.y * distance, eye.z + look.z * distance); };
+	float worstDepthError = 0.0f;
+	for (float distance : { 1.0f, 2.0f, 10.0f, 500.0f, 1000.0f, 1e6f })
+	{
+		XMFLOAT4 h = clip(camera, along(distance), false);
+		worstDepthError = MathHelper::Max(worstDepthError, std::fabs(h.z / h.w - 1.0f / distance));
+	}
+	report.Line("reverse-Z depth: largest error from near / z " + std::to_string(worstDepthError));
+	report.Check(worstDepthError <= 1e-5f, "reverse-Z depth");
+
+	XMFLOAT4 reversePlanes[6];
+	camera.GetFrustumPlanes(reversePlanes);
+	report.Check(std::memcmp(planes, reversePlanes, sizeof(planes)) == 0, "reverse-Z moved the planes");
+
+	// Jitter moves the image by the requested pixels and nothing else.
+	const UINT width = 800;
+	const UINT height = 600;
+	version = camera.GetVersion();
+	camera.SetJitter(0.25f, -0.5f, width, height);
+	report.Check(camera.GetVersion() != version, "jitter kept the version");
+
+	XMFLOAT4 jittered = clip(camera, along(300.0f), true);
+	XMFLOAT4 unjittered = clip(camera, along(300.0f), false);
+	float shiftX = (jittered.x / jittered.w - unjittered.x / unjittered.w) * 0.5f * width;
+	float shiftY = -(jittered.y / jittered.w - unjittered.y / unjittered.w) * 0.5f * height;
+	report.Line("jitter: shifted by " + std::to_string(shiftX) + ", " + std::to_string(shiftY) + " pixels for 0.25, -0.5");
+	report.Check(std::fabs(shiftX - 0.25f) <= 1e-3f && std::fabs(shiftY + 0.5f) <= 1e-3f, "jitter shift");
+
+	camera.GetFrustumPlanes(reversePlanes);
+	report.Check(std::memcmp(planes, reversePlanes, sizeof(planes)) == 0, "jitter moved the planes");
+
+	// Halton offsets are in [-0.5, 0.5), repeat every sampleCount frames and
+	// average out.
+	const UINT sampleCount = 8;
+	XMFLOAT2 mean(0.0f, 0.0f);
+	bool haltonInRange = true;
+	for (UINT frame = 0; frame < sampleCount; ++frame)
+	{
+		XMFLOAT2 offset = Camera::HaltonJitter(frame, sampleCount);
+		XMFLOAT2 repeated = Camera::HaltonJitter(frame + sampleCount, sampleCount);
+		haltonInRange = haltonInRange && offset.x >= -0.5f && offset.x < 0.5f && offset.y >= -0.5f && offset.y < 0.5f &&
+			offset.x == repeated.x && offset.y == repeated.y;
+		mean.x += offset.x / sampleCount;
+		mean.y += offset.y / sampleCount;
+	}
+	report.Check(haltonInRange && std::fabs(mean.x) <= 0.1f && std::fabs(mean.y) <= 0.1f, "Halton sequence");
+
+	// The version only changes when the matrices do.
+	version = camera.GetVersion();
+	camera.UpdateViewMatrix();
+	camera.GetFrustum();
+	camera.GetFrustumPlanes(reversePlanes);
+	report.Check(camera.GetVersion() == version, "clean update changed the version");
+	camera.Walk(1.0f);
+	camera.UpdateViewMatrix();
+	report.Check(camera.GetVersion() != version, "move kept the version");
+	version = camera.GetVersion();
+	camera.SetLens(0.3f * MathHelper::Pi, 1.5f, 1.0f, 1000.0f);
+	report.Check(camera.GetVersion() != version, "new lens kept the version");
+
+	// Cost of a frame's update with the camera still and moving.
+	const UINT updates = 100000;
+	double cleanMs = BestTime([&]()
+	{
+		for (UINT i = 0; i < updates; ++i)
+			camera.UpdateViewMatrix();
+	});
+	double dirtyMs = BestTime([&]()
+	{
+		for (UINT i = 0; i < updates; ++i)
+		{
+			camera.Walk(0.001f);
+			camera.UpdateViewMatrix();
+		}
+	});
+	report.Line("UpdateViewMatrix: " + std::to_string(cleanMs * 1e6 / updates) + " ns unchanged, " +
+		std::to_string(dirtyMs * 1e6 / updates) + " ns after a move, frustum and planes included");
+
+	return report;
+}
+
+TestReport TestRenderItemStore()
+{
+	const UINT stepCount = 200000;
+	const int frameResourceCount = 3;
+
+	TestReport report("Render item store benchmark");
+	RenderItemStore store;
+	store.SetFrameResourceCount(frameResourceCount);
+
+	// Random adds and removes; twice as many adds.  Every item carries its
+	// id in World._41 and IndexCount to check it is still itself.
+	std::mt19937 rng(5);
+	std::vector<UINT> operations(stepCount);
+	for (UINT& op : operations)
+		op = rng();
+
+	std::vector<RenderItemHandle> liveHandles;
+	std::vector<UINT> liveIds;
+	std::vector<RenderItemHandle> removed;
+	liveHandles.reserve(stepCount);
+	liveIds.reserve(stepCount);
+	removed.reserve(stepCount);
+	UINT nextId = 0;
+	bool versionChanges = true;
+	RenderItem item;
+	item.Layer = RenderLayer::Opaque;
+	double churnMs = TimeOnce([&]()
+	{
+		for (UINT op : operations)
+		{
+			UINT64 version = store.LayoutVersion();
+			if (liveHandles.empty() || op % 3 != 0)
+			{
+				item.World._41 = (float)nextId;
+				item.IndexCount = nextId;
+				liveHandles.push_back(store.Add(item));
+				liveIds.push_back(nextId++);
+			}
+			else
+			{
+				UINT pick = (op / 3) % (UINT)liveHandles.size();
+				store.Remove(liveHandles[pick]);
+				removed.push_back(liveHandles[pick]);
+				liveHandles[pick] = liveHandles.back();
+				liveIds[pick] = liveIds.back();
+				liveHandles.pop_back();
+				liveIds.pop_back();
+			}
+			versionChanges = versionChanges && store.LayoutVersion() != version;
+		}
+	});
+	report.Line(std::to_string(stepCount) + " adds and removes in " + std::to_string(churnMs) + " ms, " +
+		std::to_string(churnMs * 1e6 / stepCount) + " ns each, " + std::to_string(store.Count()) + " items left");
+
+	report.Check(store.Count() == liveHandles.size(), "count");
+	report.Check(versionChanges, "layout version");
+
+	bool intact = true;
+	for (UINT i = 0; i < liveHandles.size() && intact; ++i)
+	{
+		RenderItemHandle handle = liveHandles[i];
+		UINT index = store.IndexOf(handle);
+		RenderItemHandle back = store.HandleAt(index);
+		intact = store.IsValid(handle) && store.World()[index]._41 == (float)liveIds[i] &&
+			store.Draw()[index].IndexCount == liveIds[i] && back.Slot == handle.Slot && back.Generation == handle.Generation;
+	}
+	report.Check(intact, "live items");
+
+	UINT staleValid = 0;
+	for (RenderItemHandle handle : removed)
+		staleValid += store.IsValid(handle) ? 1 : 0;
+	report.Check(staleValid == 0, "removed handles still valid");
+
+	// The last item moves into the hole of a removed one and gets a new
+	// constant buffer slot, so every frame resource must write it again.
+	for (int frame = 0; frame < frameResourceCount; ++frame)
+		store.TakeDirty(frame);
+	RenderItemHandle moved = store.HandleAt(store.Count() - 1);
+	store.Remove(store.HandleAt(0));
+	bool movedDirty = store.IndexOf(moved) == 0;
+	for (int frame = 0; frame < frameResourceCount; ++frame)
+	{
+		const std::vector<UINT>& dirty = store.TakeDirty(frame);
+		movedDirty = movedDirty && std::find(dirty.begin(), dirty.end(), 0u) != dirty.end() &&
+			std::all_of(dirty.begin(), dirty.end(), [&](UINT i) { return i < store.Count(); });
+	}
+	report.Check(movedDirty, "dirty list after a move");
+
+	// Writing the world matrices of every item, through the store and
+	// through separately allocated items.
+	const UINT itemCount = 100000;
+	RenderItemStore streamStore;
+	std::vector<std::unique_ptr<RenderItem>> items;
+	std::vector<std::unique_ptr<char[]>> fragments;
+	for (UINT i = 0; i < itemCount; ++i)
+	{
+		item.World._41 = (float)i;
+		streamStore.Add(item);
+		items.push_back(std::make_unique<RenderItem>(item));
+		fragments.push_back(std::make_unique<char[]>(64 + (i * 97) % 512));
+	}
+	std::shuffle(items.begin(), items.end(), rng);
+	fragments.clear();
+
+	std::vector<XMFLOAT4X4> constants(itemCount);
+	double storeMs = BestTime([&]()
+	{
+		const std::vector<XMFLOAT4X4>& world = streamStore.World();
+		for (UINT i = 0; i < itemCount; ++i)
+			XMStoreFloat4x4(&constants[i], XMMatrixTranspose(XMLoadFloat4x4(&world[i])));
+	});
+	double pointerMs = BestTime([&]()
+	{
+		for (UINT i = 0; i < itemCount; ++i)
+			XMStoreFloat4x4(&constants[i], XMMatrixTranspose(XMLoadFloat4x4(&items[i]->World)));
+	});
+	report.Line("world matrices of " + std::to_string(itemCount) + " items: " + std::to_string(storeMs) + " ms from the store, " +
+		std::to_string(pointerMs) + " ms through one allocation per item");
+
+	return report;
+}
+
+TestReport TestDirtyTracking()
+{
+	const UINT itemCount = 100000;
+	const int frameResourceCount = 3;
+	const int frameCount = 120;
+
+	// Stands in for ObjectConstants in a mapped upload buffer.
+	struct Constants
+	{
+		XMFLOAT4X4 World;
+		XMFLOAT4X4 TexTransform;
+		UINT MaterialIndex;
+	};
+
+	std::vector<XMFLOAT4X4> worlds(itemCount, MathHelper::Identity4x4());
+	std::vector<std::vector<Constants>> scanBuffers(frameResourceCount, std::vector<Constants>(itemCount));
+	std::vector<std::vector<Constants>> listBuffers(frameResourceCount, std::vector<Constants>(itemCount));
+
+	auto writeConstants = [&](std::vector<Constants>& buffer, UINT i)
+	{
+		Constants c;
+		XMStoreFloat4x4(&c.World, XMMatrixTranspose(XMLoadFloat4x4(&worlds[i])));
+		XMStoreFloat4x4(&c.TexTransform, XMMatrixIdentity());
+		c.MaterialIndex = i;
+		buffer[i] = c;
+	};
+
+	TestReport report("Dirty tracking benchmark (" + std::to_string(itemCount) + " items, " +
+		std::to_string(frameResourceCount) + " frame resources, update time per frame over " +
+		std::to_string(frameCount) + " frames)");
+
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<UINT> pick(0, itemCount - 1);
+	for (UINT changesPerFrame : { 0u, 30u, 300u, 3000u })
+	{
+		// The items changed in each frame, the same for both cases.
+		std::vector<UINT> changes(frameCount * changesPerFrame);
+		for (UINT& item : changes)
+			item = pick(rng);
+
+		// A count of dirty frame resources per item, checked for every item.
+		std::vector<int> numFramesDirty(itemCount, 0);
+		size_t scanWrites = 0;
+		double scanMs = 0.0;
+		for (int frame = 0; frame < frameCount; ++frame)
+		{
+			for (UINT c = 0; c < changesPerFrame; ++c)
+			{
+				UINT i = changes[frame * changesPerFrame + c];
+				worlds[i]._41 = (float)frame;
+				numFramesDirty[i] = frameResourceCount;
+			}
+
+			scanMs += TimeOnce([&]()
+			{
+				std::vector<Constants>& buffer = scanBuffers[frame % frameResourceCount];
+				for (UINT i = 0; i < itemCount; ++i)
+				{
+					if (numFramesDirty[i] > 0)
+					{
+						writeConstants(buffer, i);
+						numFramesDirty[i]--;
+						++scanWrites;
+					}
+				}
+			});
+		}
+
+		// DirtyTracker lists per frame resource.
+		DirtyTracker tracker;
+		tracker.SetFrameResourceCount(frameResourceCount);
+		tracker.Resize(itemCount);
+		size_t listWrites = 0;
+		double listMs = 0.0;
+		for (int frame = 0; frame < frameCount; ++frame)
+		{
+			for (UINT c = 0; c < changesPerFrame; ++c)
+			{
+				UINT i = changes[frame * changesPerFrame + c];
+				worlds[i]._41 = (float)frame;
+				tracker.MarkDirty(i);
+			}
+
+			listMs += TimeOnce([&]()
+			{
+				std::vector<Constants>& buffer = listBuffers[frame % frameResourceCount];
+				for (UINT i : tracker.TakeDirty(frame % frameResourceCount))
+				{
+					writeConstants(buffer, i);
+					++listWrites;
+				}
+			});
+		}
+
+		bool match = listWrites == scanWrites;
+		for (int f = 0; f < frameResourceCount && match; ++f)
+			match = std::memcmp(scanBuffers[f].data(), listBuffers[f].data(), itemCount * sizeof(Constants)) == 0;
+
+		report.Line(std::to_string(changesPerFrame) + " changes per frame, " + std::to_string(listWrites / frameCount) +
+			" writes: scan " + std::to_string(scanMs / frameCount) + " ms, dirty lists " +
+			std::to_string(listMs / frameCount) + " ms");
+		report.Check(match, "dirty lists differ from the scan at " + std::to_string(changesPerFrame) + " changes per frame");
+	}
+
+	return report;
+}
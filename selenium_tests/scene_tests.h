@@ -0,0 +1,34 @@
+#pragma once
+#include "test_report.h"
+
+class JobSystem;
+
+// Builds a SceneBvh over 100k random boxes and times frustum queries against
+// testing every box, and refits after moving 1% of them.  Checks that the
+// query finds the items the per-box test keeps after Build, after the small
+// moves and after moving every 37th item across the scene.
+TestReport TestSceneBvh();
+
+// Culls 1M random boxes with FrustumCuller, on the calling thread and with
+// the job system, against BoundingFrustum::Intersects per box, and checks
+// that the visible items hold every box a scalar test keeps and only boxes
+// near the frustum besides.  Reports whether one core meets the 1 ms target.
+TestReport TestFrustumCuller(JobSystem& jobs);
+
+// Checks Camera on the CPU: the cached world space planes against clip space
+// for random points, reverse-Z depth and planes, the jitter shift, the Halton
+// sequence and when the version changes.  Times UpdateViewMatrix with the
+// camera still and moving.
+TestReport TestCamera();
+
+// Adds and removes 200k items in random order and checks that live handles
+// still find their own components, removed handles are invalid, the layout
+// version changes and an item moved into a hole is queued for every frame
+// resource.  Times the churn and a world matrix pass over the store against
+// separately allocated items.
+TestReport TestRenderItemStore();
+
+// Writes the constants of the items changed per frame out of 100k, for a
+// few change rates, scanning a dirty count per item against DirtyTracker
+// lists, and checks both write the same constants.
+TestReport TestDirtyTracking();
@@ -0,0 +1,86 @@
+#include "test_fixtures.h"
+#include <fstream>
+#include <iomanip>
+#include <random>
+
+UINT64 WriteTestM3d(const std::string& filename, UINT vertexCount, UINT boneCount,
+	UINT clipCount, UINT keyCount)
+{
+	std::ofstream fout(filename);
+	if (!fout)
+		return 0;
+
+	std::mt19937 rng(31);
+	std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+	std::uniform_int_distribution<UINT> pickBone(0, boneCount - 1);
+	std::uniform_int_distribution<UINT> pickVertex(0, vertexCount / 2 - 1);
+	auto v = [&]() { return value(rng); };
+
+	UINT triangleCount = vertexCount;
+	fout << std::fixed << std::setprecision(6);
+	fout << "***************m3d-File-Header***************\n#Materials 2\n#Vertices " << vertexCount <<
+		"\n#Triangles " << triangleCount << "\n#Bones " << boneCount << "\n#AnimationClips " << clipCount << "\n\n";
+
+	fout << "***************Materials*********************\n";
+	for (UINT i = 0; i < 2; ++i)
+	{
+		fout << "Name: mat" << i << "\nDiffuse: 1 0.5 0.25\nFresnel0: 0.05 0.05 0.05\nRoughness: 0.5\nAlphaClip: " << i <<
+			"\nMaterialTypeName: Skinned\nDiffuseMap: diffuse" << i << ".dds\nNormalMap: normal" << i << ".dds\n\n";
+	}
+
+	fout << "***************SubsetTable*******************\n";
+	for (UINT i = 0; i < 2; ++i)
+	{
+		fout << "SubsetID: " << i << " VertexStart: " << i * vertexCount / 2 << " VertexCount: " << vertexCount / 2 <<
+			" FaceStart: " << i * triangleCount / 2 << " FaceCount: " << triangleCount / 2 << "\n";
+	}
+
+	fout << "\n***************Vertices**********************\n";
+	for (UINT i = 0; i < vertexCount; ++i)
+	{
+		fout << "Position: " << v() << " " << v() << " " << v() << "\nTangent: " << v() << " " << v() << " " << v() <<
+			" 1\nNormal: " << v() << " " << v() << " " << v() << "\nTex-Coords: " << v() << " " << v() <<
+			"\nBlendWeights: 0.5 0.3 0.2 0\nBlendIndices: " << pickBone(rng) << " " << pickBone(rng) << " " <<
+			pickBone(rng) << " 0\n\n";
+	}
+
+	// Each half of the triangles uses the vertices of its subset.
+	fout << "***************Triangles*********************\n";
+	for (UINT i = 0; i < triangleCount; ++i)
+	{
+		UINT base = i < triangleCount / 2 ? 0 : vertexCount / 2;
+		fout << base + pickVertex(rng) << " " << base + pickVertex(rng) << " " << base + pickVertex(rng) << "\n";
+	}
+
+	fout << "\n***************BoneOffsets*******************\n";
+	for (UINT i = 0; i < boneCount; ++i)
+		fout << "BoneOffset" << i << " 1 0 0 0 0 1 0 0 0 0 1 0 " << v() << " " << v() << " " << v() << " 1\n";
+
+	fout << "\n***************BoneHierarchy*****************\n";
+	for (UINT i = 0; i < boneCount; ++i)
+		fout << "ParentIndexOfBone" << i << ": " << (i == 0 ? -1 : (int)(i - 1) / 2) << "\n";
+
+	fout << "\n***************AnimationClips****************\n";
+	for (UINT c = 0; c < clipCount; ++c)
+	{
+		fout << "AnimationClip Take" << c + 1 << "\n{\n";
+		for (UINT i = 0; i < boneCount; ++i)
+		{
+			fout << "\tBone" << i << " #Keyframes: " << keyCount << "\n\t{\n";
+			for (UINT k = 0; k < keyCount; ++k)
+			{
+				fout << "\t\tTime: " << k / 30.0f << " Pos: " << v() << " " << v() << " " << v() <<
+					" Scale: 1 1 1 Quat: 0 0 0 1\n";
+			}
+			fout << "\t}\n\n";
+		}
+		fout << "}\n";
+	}
+
+	fout.close();
+	if (!fout)
+		return 0;
+
+	std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+	return (UINT64)fin.tellg();
+}
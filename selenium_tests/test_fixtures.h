@@ -0,0 +1,9 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+
+// Writes a text .m3d of two materials and subsets, vertexCount random
+// vertices, as many triangles, and clipCount clips of keyCount keys per
+// bone.  Returns the file size in bytes, or 0 on failure.
+UINT64 WriteTestM3d(const std::string& filename, UINT vertexCount, UINT boneCount,
+	UINT clipCount, UINT keyCount);
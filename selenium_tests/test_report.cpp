@@ -0,0 +1,52 @@
+#include "test_report.h"
+#include <chrono>
+
+double TimeOnce(const std::function<void()>& func)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	func();
+	auto stop = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+double BestTime(const std::function<void()>& func)
+{
+	double best = 0.0;
+	for (int run = 0; run < BenchmarkRuns; ++run)
+	{
+		double ms = TimeOnce(func);
+		if (run == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+TestReport::TestReport(const std::string& title) :
+	mTitle(title)
+{
+}
+
+void TestReport::Line(const std::string& text)
+{
+	mLines.push_back(text);
+}
+
+bool TestReport::Check(bool passed, const std::string& name)
+{
+	++mChecks;
+	if (!passed)
+		mFailed.push_back(name);
+	return passed;
+}
+
+std::string TestReport::Text()const
+{
+	std::string text = mTitle + "\n";
+	for (const std::string& line : mLines)
+		text += line + "\n";
+
+	text += "checks: " + std::to_string(mChecks - Failures()) + " of " + std::to_string(mChecks) + " pass\n";
+	for (const std::string& name : mFailed)
+		text += "FAILED " + name + "\n";
+	return text;
+}
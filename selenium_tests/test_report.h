@@ -0,0 +1,40 @@
+#pragma once
+#include <Windows.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Best of a few runs so page faults of the first allocation do not count.
+const int BenchmarkRuns = 3;
+
+// Time of one call of func, in milliseconds.
+double TimeOnce(const std::function<void()>& func);
+
+// Best time of BenchmarkRuns calls of func, in milliseconds.
+double BestTime(const std::function<void()>& func);
+
+// What one test measured and the checks it made.  A failed check is listed
+// by name and fails the run.
+class TestReport
+{
+public:
+	explicit TestReport(const std::string& title);
+
+	// Appends a line of measurements.
+	void Line(const std::string& text);
+
+	// Records a check and returns passed.
+	bool Check(bool passed, const std::string& name);
+
+	UINT Checks()const { return mChecks; }
+	UINT Failures()const { return (UINT)mFailed.size(); }
+
+	// The title, the lines, how many checks pass and a line per failed one.
+	std::string Text()const;
+
+private:
+	std::string mTitle;
+	std::vector<std::string> mLines;
+	std::vector<std::string> mFailed;
+	UINT mChecks = 0;
+};